@@ -0,0 +1,479 @@
+#include "baseline_db.h"
+#include "crc32.h"
+#include "file_repo.h"
+#include "hash_engine.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <libgen.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#define BASELINE_MAGIC   "CRC32DB"
+#define BASELINE_VERSION 3
+// crc32 only baselines
+#define BASELINE_VERSION_2 2
+#define BASELINE_VERSION_1 1
+
+struct baseline_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t hash_algo;
+    uint32_t attr_size;
+    uint64_t record_count;
+    uint64_t names_size;
+    uint64_t manifests_size;
+    uint32_t body_crc32;
+    uint32_t header_crc32; // crc32 of the previous fields
+    uint8_t  reserved[8];
+};
+
+struct baseline_record {
+    uint64_t name_offset;
+    uint64_t fingerprint_digest;
+};
+
+// followed by block_count digests
+struct baseline_manifest {
+    uint64_t record;
+    uint64_t block_size;
+    uint32_t block_count;
+    uint32_t reserved;
+};
+
+struct baseline_header_v2 {
+    char     magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t record_count;
+    uint64_t names_size;
+    uint32_t body_crc32;
+    uint32_t header_crc32;
+    uint8_t  reserved[24];
+};
+
+struct baseline_record_v2 {
+    uint64_t name_offset;
+    uint32_t name_len;
+    uint32_t file_attr;
+    uint64_t fingerprint_digest;
+};
+
+// version 1 record: file name in the observed directory, crc32 and metadata
+struct baseline_record_v1 {
+    uint64_t name_offset;
+    uint32_t name_len;
+    uint32_t file_attr;
+    uint64_t size;
+    int64_t  mtime_ns;
+    int64_t  ctime_ns;
+    uint64_t inode;
+    uint64_t device;
+    uint32_t has_fingerprint;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(baseline_header) == 64, "baseline header must be 64 bytes");
+static_assert(sizeof(baseline_record) == 16, "baseline record must be 16 bytes");
+static_assert(sizeof(baseline_manifest) == 24, "baseline manifest must be 24 bytes");
+static_assert(sizeof(baseline_header_v2) == 64, "baseline v2 header must be 64 bytes");
+static_assert(sizeof(baseline_record_v2) == 24, "baseline v2 record must be 24 bytes");
+static_assert(sizeof(baseline_record_v1) == 64, "baseline v1 record must be 64 bytes");
+
+static uint32_t header_crc32(const baseline_header &header) {
+    return crc32_update(0, &header, offsetof(baseline_header, header_crc32));
+}
+
+// baseline's visitors (see read_baseline)
+struct baseline_reader {
+    HashAlgo             algo;
+    baseline_file_fn     on_file;
+    baseline_manifest_fn on_manifest;
+    void                *ctx;
+    const char          *v1_dir; // directory of version 1 file's names (NULL - other versions are loaded)
+};
+
+static BaselineStatus load_records(const char *data, size_t size, const baseline_reader &reader) {
+    baseline_header header;
+    memcpy(&header, data, sizeof(header));
+    if (header.record_size != sizeof(baseline_record) ||
+        header.header_crc32 != header_crc32(header))
+        return BASELINE_CORRUPTED;
+    if (header.hash_algo != static_cast<uint32_t>(reader.algo))
+        return BASELINE_OTHER_HASH;
+    if (header.attr_size != hash_digest_size(reader.algo))
+        return BASELINE_CORRUPTED;
+    size_t body_size = size - sizeof(header);
+    size_t item_size = sizeof(baseline_record) + header.attr_size;
+    if (header.record_count > body_size / item_size ||
+        header.names_size > body_size - header.record_count * item_size ||
+        header.manifests_size != body_size - header.record_count * item_size - header.names_size)
+        return BASELINE_CORRUPTED;
+    const char *body = data + sizeof(header);
+    if (crc32_update(0, body, body_size) != header.body_crc32)
+        return BASELINE_CORRUPTED;
+    const char *attrs = body + header.record_count * sizeof(baseline_record);
+    const char *names = attrs + header.record_count * header.attr_size;
+    const char *manifests = names + header.names_size;
+    // the last name's NUL terminates all names
+    if (header.record_count && (header.names_size == 0 || names[header.names_size - 1] != '\0'))
+        return BASELINE_CORRUPTED;
+    // check all records and manifests before passing them
+    for (uint64_t i = 0; i < header.record_count; ++i) {
+        baseline_record record;
+        memcpy(&record, body + i * sizeof(record), sizeof(record));
+        if (record.name_offset >= header.names_size)
+            return BASELINE_CORRUPTED;
+    }
+    for (uint64_t offset = 0; offset < header.manifests_size; ) {
+        baseline_manifest manifest;
+        if (header.manifests_size - offset < sizeof(manifest))
+            return BASELINE_CORRUPTED;
+        memcpy(&manifest, manifests + offset, sizeof(manifest));
+        offset += sizeof(manifest);
+        if (manifest.record >= header.record_count || manifest.block_size == 0 || manifest.block_count == 0 ||
+            manifest.block_count > (header.manifests_size - offset) / header.attr_size)
+            return BASELINE_CORRUPTED;
+        offset += static_cast<uint64_t>(manifest.block_count) * header.attr_size;
+    }
+    FileAttr attr;
+    attr.size = header.attr_size;
+    for (uint64_t i = 0; i < header.record_count; ++i) {
+        baseline_record record;
+        memcpy(&record, body + i * sizeof(record), sizeof(record));
+        memcpy(attr.bytes, attrs + i * header.attr_size, header.attr_size);
+        if (reader.on_file(names + record.name_offset, &attr, record.fingerprint_digest, reader.ctx))
+            return BASELINE_ERROR;
+    }
+    for (uint64_t offset = 0; reader.on_manifest && offset < header.manifests_size; ) {
+        baseline_manifest manifest;
+        memcpy(&manifest, manifests + offset, sizeof(manifest));
+        offset += sizeof(manifest);
+        baseline_record record;
+        memcpy(&record, body + manifest.record * sizeof(record), sizeof(record));
+        FileManifest file_manifest = {manifest.block_size, manifest.block_count,
+                                      reinterpret_cast<const uint8_t *>(manifests + offset)};
+        if (reader.on_manifest(names + record.name_offset, &file_manifest, reader.ctx))
+            return BASELINE_ERROR;
+        offset += static_cast<uint64_t>(manifest.block_count) * header.attr_size;
+    }
+    return BASELINE_OK;
+}
+
+// version 2 file: records with crc32 attribute
+static BaselineStatus load_records_v2(const char *data, size_t size, const baseline_reader &reader) {
+    baseline_header_v2 header;
+    memcpy(&header, data, sizeof(header));
+    if (header.record_size != sizeof(baseline_record_v2) ||
+        header.header_crc32 != crc32_update(0, &header, offsetof(baseline_header_v2, header_crc32)))
+        return BASELINE_CORRUPTED;
+    if (reader.algo != HASH_CRC32)
+        return BASELINE_OTHER_HASH;
+    size_t body_size = size - sizeof(header);
+    if (header.record_count > body_size / sizeof(baseline_record_v2) ||
+        header.record_count * sizeof(baseline_record_v2) + header.names_size != body_size)
+        return BASELINE_CORRUPTED;
+    const char *body = data + sizeof(header);
+    if (crc32_update(0, body, body_size) != header.body_crc32)
+        return BASELINE_CORRUPTED;
+    const char *names = body + header.record_count * sizeof(baseline_record_v2);
+    for (uint64_t i = 0; i < header.record_count; ++i) {
+        baseline_record_v2 record;
+        memcpy(&record, body + i * sizeof(record), sizeof(record));
+        if (record.name_offset >= header.names_size ||
+            record.name_len >= header.names_size - record.name_offset ||
+            names[record.name_offset + record.name_len] != '\0')
+            return BASELINE_CORRUPTED;
+    }
+    // crc32 digests are big-endian
+    FileAttr attr;
+    attr.size = 4;
+    for (uint64_t i = 0; i < header.record_count; ++i) {
+        baseline_record_v2 record;
+        memcpy(&record, body + i * sizeof(record), sizeof(record));
+        for (int k = 0; k < 4; ++k)
+            attr.bytes[k] = static_cast<uint8_t>(record.file_attr >> (24 - 8 * k));
+        if (reader.on_file(names + record.name_offset, &attr, record.fingerprint_digest, reader.ctx))
+            return BASELINE_ERROR;
+    }
+    return BASELINE_OK;
+}
+
+// version 1 file: one directory's names, crc32 attribute and metadata
+static BaselineStatus load_records_v1(const char *data, size_t size, const baseline_reader &reader) {
+    baseline_header_v2 header;
+    memcpy(&header, data, sizeof(header));
+    if (header.record_size != sizeof(baseline_record_v1) ||
+        header.header_crc32 != crc32_update(0, &header, offsetof(baseline_header_v2, header_crc32)))
+        return BASELINE_CORRUPTED;
+    if (!reader.v1_dir)
+        return BASELINE_OLD_VERSION;
+    if (reader.algo != HASH_CRC32)
+        return BASELINE_OTHER_HASH;
+    size_t body_size = size - sizeof(header);
+    if (header.record_count > body_size / sizeof(baseline_record_v1) ||
+        header.record_count * sizeof(baseline_record_v1) + header.names_size != body_size)
+        return BASELINE_CORRUPTED;
+    const char *body = data + sizeof(header);
+    if (crc32_update(0, body, body_size) != header.body_crc32)
+        return BASELINE_CORRUPTED;
+    const char *names = body + header.record_count * sizeof(baseline_record_v1);
+    for (uint64_t i = 0; i < header.record_count; ++i) {
+        baseline_record_v1 record;
+        memcpy(&record, body + i * sizeof(record), sizeof(record));
+        if (record.name_offset >= header.names_size ||
+            record.name_len >= header.names_size - record.name_offset ||
+            names[record.name_offset + record.name_len] != '\0' ||
+            memchr(names + record.name_offset, '/', record.name_len))
+            return BASELINE_CORRUPTED;
+    }
+    std::string path(reader.v1_dir);
+    if (path.empty() || path.back() != '/')
+        path.push_back('/');
+    size_t dir_len = path.size();
+    FileAttr attr;
+    attr.size = 4;
+    for (uint64_t i = 0; i < header.record_count; ++i) {
+        baseline_record_v1 record;
+        memcpy(&record, body + i * sizeof(record), sizeof(record));
+        for (int k = 0; k < 4; ++k)
+            attr.bytes[k] = static_cast<uint8_t>(record.file_attr >> (24 - 8 * k));
+        FileFingerprint fingerprint = {record.size, record.mtime_ns, record.ctime_ns, record.inode, record.device};
+        path.replace(dir_len, std::string::npos, names + record.name_offset, record.name_len);
+        if (reader.on_file(path.c_str(), &attr, record.has_fingerprint ? get_fingerprint_digest(&fingerprint) : 0,
+                           reader.ctx))
+            return BASELINE_ERROR;
+    }
+    return BASELINE_OK;
+}
+
+static BaselineStatus load_file(const char *data, size_t size, const baseline_reader &reader) {
+    baseline_header header;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, BASELINE_MAGIC, sizeof(BASELINE_MAGIC)) != 0)
+        return BASELINE_CORRUPTED;
+    // migration loads version 1 only
+    if (reader.v1_dir && header.version != BASELINE_VERSION_1)
+        return BASELINE_CORRUPTED;
+    if (header.version == BASELINE_VERSION)
+        return load_records(data, size, reader);
+    if (header.version == BASELINE_VERSION_2)
+        return load_records_v2(data, size, reader);
+    if (header.version == BASELINE_VERSION_1)
+        return load_records_v1(data, size, reader);
+    return BASELINE_CORRUPTED;
+}
+
+static BaselineStatus read_file(const char *path, const baseline_reader &reader) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return errno == ENOENT ? BASELINE_NOT_FOUND : BASELINE_ERROR;
+    struct stat sb;
+    if (fstat(fd, &sb) != 0) {
+        close(fd);
+        return BASELINE_ERROR;
+    }
+    size_t size = static_cast<size_t>(sb.st_size);
+    if (size < sizeof(baseline_header)) {
+        close(fd);
+        return BASELINE_CORRUPTED;
+    }
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return BASELINE_ERROR;
+    madvise(map, size, MADV_SEQUENTIAL);
+    BaselineStatus status;
+    try {
+        status = load_file(static_cast<const char *>(map), size, reader);
+    }  catch (...) {
+        status = BASELINE_ERROR;
+    }
+    munmap(map, size);
+    return status;
+}
+
+BaselineStatus read_baseline(const char *path, HashAlgo algo, baseline_file_fn on_file,
+                             baseline_manifest_fn on_manifest, void *ctx) {
+    return read_file(path, {algo, on_file, on_manifest, ctx, NULL});
+}
+
+BaselineStatus get_baseline_algo(const char *path, HashAlgo *algo) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return errno == ENOENT ? BASELINE_NOT_FOUND : BASELINE_ERROR;
+    baseline_header header;
+    ssize_t n = pread(fd, &header, sizeof(header), 0);
+    close(fd);
+    if (n < 0)
+        return BASELINE_ERROR;
+    if (n != static_cast<ssize_t>(sizeof(header)) || memcmp(header.magic, BASELINE_MAGIC, sizeof(BASELINE_MAGIC)) != 0)
+        return BASELINE_CORRUPTED;
+    if (header.version == BASELINE_VERSION_2 || header.version == BASELINE_VERSION_1) {
+        *algo = HASH_CRC32;
+        return BASELINE_OK;
+    }
+    if (header.version != BASELINE_VERSION || header.header_crc32 != header_crc32(header) ||
+        header.hash_algo >= HASH_ALGO_COUNT)
+        return BASELINE_CORRUPTED;
+    *algo = static_cast<HashAlgo>(header.hash_algo);
+    return BASELINE_OK;
+}
+
+static int push_baseline_file(const char *file_name, const FileAttr *file_attr,
+                              uint64_t fingerprint_digest, void *) {
+    return push_file_digest(file_name, file_attr, fingerprint_digest);
+}
+
+static int push_baseline_manifest(const char *file_name, const FileManifest *manifest, void *) {
+    return set_file_manifest(file_name, manifest);
+}
+
+BaselineStatus load_baseline(const char *path) {
+    if (get_file_attr_size() != hash_digest_size(hash_get_algo()))
+        return BASELINE_ERROR;
+    return read_baseline(path, hash_get_algo(), push_baseline_file, push_baseline_manifest, NULL);
+}
+
+BaselineStatus migrate_baseline(const char *path, const char *dir) {
+    if (get_file_attr_size() != hash_digest_size(hash_get_algo()))
+        return BASELINE_ERROR;
+    return read_file(path, {hash_get_algo(), push_baseline_file, NULL, NULL, dir});
+}
+
+struct baseline_entry {
+    std::string name;
+    FileAttr    file_attr;
+    uint64_t    fingerprint_digest;
+};
+
+static void collect_file(const char *file_name, const FileAttr *file_attr,
+                         uint64_t fingerprint_digest, void *ctx) {
+    std::vector<baseline_entry> *entries = static_cast<std::vector<baseline_entry> *>(ctx);
+    entries->push_back({file_name, *file_attr, fingerprint_digest});
+}
+
+struct baseline_file_manifest {
+    std::string          name;
+    uint64_t             block_size;
+    uint32_t             block_count;
+    std::vector<uint8_t> digests;
+};
+
+static void collect_manifest(const char *file_name, const FileManifest *manifest, void *ctx) {
+    std::vector<baseline_file_manifest> *manifests = static_cast<std::vector<baseline_file_manifest> *>(ctx);
+    size_t size = static_cast<size_t>(manifest->block_count) * get_file_attr_size();
+    manifests->push_back({file_name, manifest->block_size, manifest->block_count,
+                          std::vector<uint8_t>(manifest->digests, manifest->digests + size)});
+}
+
+static bool write_all(int fd, const void *buf, size_t len) {
+    const char *p = static_cast<const char *>(buf);
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// sync directory to keep rename after crash
+static void sync_parent_dir(const char *path) {
+    std::string dir_path(path);
+    int fd = open(dirname(&dir_path[0]), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+BaselineStatus save_baseline(const char *path) {
+    return save_baseline_in(path, NULL, 0);
+}
+
+BaselineStatus save_baseline_in(const char *path, char *const *dirs, int count) {
+    std::string tmp_path;
+    std::vector<baseline_record> records;
+    std::string attrs;
+    std::string names;
+    std::string manifests;
+    uint32_t attr_size = get_file_attr_size();
+    try {
+        std::vector<baseline_entry> entries;
+        for_each_file_in(dirs, count, collect_file, &entries);
+        std::sort(entries.begin(), entries.end(),
+                  [](const baseline_entry &a, const baseline_entry &b) { return a.name < b.name; });
+        records.reserve(entries.size());
+        attrs.reserve(entries.size() * attr_size);
+        for (auto &it: entries) {
+            baseline_record record;
+            record.name_offset = names.size();
+            record.fingerprint_digest = it.fingerprint_digest;
+            records.push_back(record);
+            attrs.append(reinterpret_cast<const char *>(it.file_attr.bytes), attr_size);
+            names.append(it.name);
+            names.push_back('\0');
+        }
+        // manifests refer to records by index
+        std::vector<baseline_file_manifest> file_manifests;
+        for_each_manifest_in(dirs, count, collect_manifest, &file_manifests);
+        for (auto &it: file_manifests) {
+            auto entry = std::lower_bound(entries.begin(), entries.end(), it.name,
+                                          [](const baseline_entry &a, const std::string &name) { return a.name < name; });
+            baseline_manifest manifest;
+            memset(&manifest, 0, sizeof(manifest));
+            manifest.record = static_cast<uint64_t>(entry - entries.begin());
+            manifest.block_size = it.block_size;
+            manifest.block_count = it.block_count;
+            manifests.append(reinterpret_cast<const char *>(&manifest), sizeof(manifest));
+            manifests.append(reinterpret_cast<const char *>(it.digests.data()), it.digests.size());
+        }
+        tmp_path = std::string(path) + ".tmp";
+    }  catch (...) {
+        return BASELINE_ERROR;
+    }
+    baseline_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BASELINE_MAGIC, sizeof(BASELINE_MAGIC));
+    header.version = BASELINE_VERSION;
+    header.record_size = sizeof(baseline_record);
+    header.hash_algo = static_cast<uint32_t>(hash_get_algo());
+    header.attr_size = attr_size;
+    header.record_count = records.size();
+    header.names_size = names.size();
+    header.manifests_size = manifests.size();
+    uint32_t body_crc32 = crc32_update(0, records.data(), records.size() * sizeof(baseline_record));
+    body_crc32 = crc32_update(body_crc32, attrs.data(), attrs.size());
+    body_crc32 = crc32_update(body_crc32, names.data(), names.size());
+    header.body_crc32 = crc32_update(body_crc32, manifests.data(), manifests.size());
+    header.header_crc32 = header_crc32(header);
+
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return BASELINE_ERROR;
+    bool ok = write_all(fd, &header, sizeof(header)) &&
+              write_all(fd, records.data(), records.size() * sizeof(baseline_record)) &&
+              write_all(fd, attrs.data(), attrs.size()) &&
+              write_all(fd, names.data(), names.size()) &&
+              write_all(fd, manifests.data(), manifests.size()) &&
+              fsync(fd) == 0;
+    if (close(fd) != 0)
+        ok = false;
+    if (!ok || rename(tmp_path.c_str(), path) != 0) {
+        unlink(tmp_path.c_str());
+        return BASELINE_ERROR;
+    }
+    sync_parent_dir(path);
+    return BASELINE_OK;
+}
@@ -0,0 +1,94 @@
+#ifndef BASELINE_DB_HEADER
+#define BASELINE_DB_HEADER
+
+#include <stdint.h>
+#include "file_repo.h"
+#include "hash_engine.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// baseline file: header, records sorted by file name, attributes, names, manifests
+//
+// header (64 bytes):
+//   magic "CRC32DB", version, record size, hash algorithm (see HashAlgo),
+//   attribute size, records count, names size, manifests size, crc32 of
+//   records, attributes, names and manifests, crc32 of the header's previous fields
+// record (16 bytes):
+//   name offset in names, file's fingerprint digest
+// attributes:
+//   files' digests of attribute size bytes in records' order
+// names:
+//   NUL terminated file paths
+// manifests (see FileManifest):
+//   record's index, block size, blocks count, blocks' digests of attribute size bytes
+//
+// numbers are in host byte order (a foreign file fails the version check).
+// Version 2 files (24-byte records with crc32 attribute) are loaded for crc32.
+// Version 1 files (64-byte records of one directory's file names) are loaded
+// by migrate_baseline only.
+
+// load baseline file into file repository
+// param[in] path - path to baseline file
+// return operation's status (see BaselineStatus)
+BaselineStatus load_baseline(const char *path);
+
+// get hash algorithm of baseline's digests from its header, the records aren't read
+// param[in] path - path to baseline file
+// param[out] algo - digests' algorithm, crc32 for version 1 and 2 files
+// return operation's status (see BaselineStatus)
+BaselineStatus get_baseline_algo(const char *path, HashAlgo *algo);
+
+// load version 1 baseline file into file repository. Its names are relative
+// to the only observed directory of the version which wrote it.
+// param[in] path - path to baseline file
+// param[in] dir - path to the directory the file was written for
+// return operation's status (see BaselineStatus), BASELINE_CORRUPTED for other versions
+BaselineStatus migrate_baseline(const char *path, const char *dir);
+
+// baseline's file handler
+// param[in] file_name - file's path
+// param[in] file_attr - file's digest
+// param[in] fingerprint_digest - file's metadata digest (0 - unknown)
+// param[in] ctx - user context from read_baseline
+// return 0 - continue, other - stop reading
+typedef int (*baseline_file_fn)(const char *file_name, const FileAttr *file_attr,
+                                uint64_t fingerprint_digest, void *ctx);
+
+// baseline's manifest handler, the file was passed to baseline_file_fn before
+// param[in] file_name - file's path
+// param[in] manifest - file's blocks digests (valid during the call)
+// param[in] ctx - user context from read_baseline
+// return 0 - continue, other - stop reading
+typedef int (*baseline_manifest_fn)(const char *file_name, const FileManifest *manifest, void *ctx);
+
+// read baseline file without file repository. The whole file is checked before
+// handlers are called, files come in name order.
+// param[in] path - path to baseline file
+// param[in] algo - expected hash algorithm of digests
+// param[in] on_file - file's handler
+// param[in] on_manifest - manifest's handler (NULL - manifests are skipped)
+// param[in] ctx - user context for handlers
+// return operation's status (see BaselineStatus), BASELINE_ERROR if a handler stopped reading
+BaselineStatus read_baseline(const char *path, HashAlgo algo, baseline_file_fn on_file,
+                             baseline_manifest_fn on_manifest, void *ctx);
+
+// save file repository into baseline file. The file is replaced atomically:
+// data is written into temporary file, synced and renamed.
+// param[in] path - path to baseline file
+// return operation's status (see BaselineStatus)
+BaselineStatus save_baseline(const char *path);
+
+// save files under directories into baseline file (see save_baseline)
+// param[in] path - path to baseline file
+// param[in] dirs - directories' paths (NULL - all files)
+// param[in] count - number of directories
+// return operation's status (see BaselineStatus)
+BaselineStatus save_baseline_in(const char *path, char *const *dirs, int count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BASELINE_DB_HEADER
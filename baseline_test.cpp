@@ -0,0 +1,248 @@
+#include "baseline_db.h"
+#include "crc32.h"
+#include "file_repo.h"
+#include "hash_engine.h"
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static int fails = 0;
+
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        printf("failed: %s\n", what);
+        fails++;
+    }
+}
+
+static bool corrupt_byte(const std::string &path, long offset) {
+    FILE *f = fopen(path.c_str(), "r+b");
+    if (!f)
+        return false;
+    fseek(f, offset, SEEK_SET);
+    int c = fgetc(f);
+    fseek(f, offset, SEEK_SET);
+    fputc(c ^ 0x5A, f);
+    fclose(f);
+    return true;
+}
+
+// attribute of size bytes made of number
+static FileAttr make_attr(uint32_t value, uint32_t size) {
+    FileAttr attr;
+    attr.size = size;
+    for (uint32_t i = 0; i < size; ++i)
+        attr.bytes[i] = static_cast<uint8_t>(value >> (i % 4 * 8)) + static_cast<uint8_t>(i / 4);
+    return attr;
+}
+
+static bool same_attr(const char *file, const FileAttr &expected) {
+    FileAttr attr;
+    return get_file_attr(file, &attr) == 0 && attr.size == expected.size &&
+           memcmp(attr.bytes, expected.bytes, attr.size) == 0;
+}
+
+// relative, absolute and nested file paths
+static std::string file_path(int i) {
+    std::string name = "file" + std::to_string(i);
+    switch (i % 3) {
+    case 0:
+        return name;
+    case 1:
+        return "/" + name;
+    default:
+        return "/data/dir" + std::to_string(i % 7) + "/sub/" + name;
+    }
+}
+
+// write version 1 baseline: names in one directory with crc32 attribute i * 7919,
+// files of odd numbers have fingerprint
+static bool write_baseline_v1(const std::string &path, int count, const FileFingerprint &fingerprint) {
+    std::string records, names;
+    for (int i = 0; i < count; ++i) {
+        std::string name = "file" + std::to_string(i);
+        uint64_t record[8] = {names.size(), name.size() | static_cast<uint64_t>(i * 7919) << 32};
+        if (i % 2)
+            memcpy(&record[2], &fingerprint, sizeof(fingerprint));
+        record[7] = i % 2;
+        records.append(reinterpret_cast<const char *>(record), sizeof(record));
+        names.append(name);
+        names.push_back('\0');
+    }
+    char header[64] = "CRC32DB";
+    uint32_t fields[2] = {1, 64};
+    uint64_t sizes[2] = {static_cast<uint64_t>(count), names.size()};
+    memcpy(header + 8, fields, sizeof(fields));
+    memcpy(header + 16, sizes, sizeof(sizes));
+    uint32_t crcs[2] = {crc32_update(crc32_update(0, records.data(), records.size()), names.data(), names.size())};
+    memcpy(header + 32, crcs, 4);
+    crcs[1] = crc32_update(0, header, 36);
+    memcpy(header + 32, crcs, sizeof(crcs));
+    FILE *f = fopen(path.c_str(), "wb");
+    if (!f)
+        return false;
+    bool ok = fwrite(header, 1, sizeof(header), f) == sizeof(header) &&
+              fwrite(records.data(), 1, records.size(), f) == records.size() &&
+              fwrite(names.data(), 1, names.size(), f) == names.size();
+    return fclose(f) == 0 && ok;
+}
+
+int main() {
+    char dir[] = "/tmp/baseline_test_XXXXXX";
+    if (!mkdtemp(dir)) {
+        printf("failed: can't create directory\n");
+        return 1;
+    }
+    std::string path = std::string(dir) + "/baseline";
+
+    printf("TEST 1: no baseline file... ");
+    check(load_baseline(path.c_str()) == BASELINE_NOT_FOUND, "missing file");
+    printf("Ok\n");
+
+    printf("TEST 2: save and load baseline... ");
+    FileFingerprint fingerprint = {100, 200, 300, 400, 500};
+    for (int i = 0; i < 3000; ++i) {
+        FileAttr attr = make_attr(static_cast<uint32_t>(i * 7919), 4);
+        push_file(file_path(i).c_str(), &attr, i % 2 ? &fingerprint : NULL);
+    }
+    check(save_baseline(path.c_str()) == BASELINE_OK, "save");
+    // change repository, loading must restore saved values
+    FileAttr changed = make_attr(1, 4);
+    push_file(file_path(1).c_str(), &changed, NULL);
+    push_file(file_path(2).c_str(), &changed, NULL);
+    check(load_baseline(path.c_str()) == BASELINE_OK, "load");
+    for (int i = 0; i < 3000; ++i) {
+        if (!same_attr(file_path(i).c_str(), make_attr(static_cast<uint32_t>(i * 7919), 4))) {
+            check(false, "file attr");
+            break;
+        }
+    }
+    check(!is_file_observed("/data/dir1/file1"), "unknown file");
+    check(check_file_fingerprint(file_path(1).c_str(), &fingerprint) == VALID_ATTR, "file1 fingerprint");
+    check(check_file_fingerprint(file_path(2).c_str(), &fingerprint) == ATTR_CHANGED, "file2 without fingerprint");
+    // all files except the checked one are unchecked
+    begin_files_check();
+    FileAttr attr5 = make_attr(5 * 7919, 4);
+    check_file_attr(file_path(5).c_str(), &attr5, NULL);
+    int unchecked = 0;
+    bool found_checked = false;
+    const char *name;
+    while ((name = get_next_unchecked_file()) != NULL) {
+        unchecked++;
+        found_checked |= file_path(5) == name;
+    }
+    check(unchecked == 2999 && !found_checked, "unchecked files");
+    printf("Ok\n");
+
+    printf("TEST 3: corrupted baseline... ");
+    check(corrupt_byte(path, 64 + 30), "corrupt record");
+    check(load_baseline(path.c_str()) == BASELINE_CORRUPTED, "corrupted record");
+    check(save_baseline(path.c_str()) == BASELINE_OK, "save");
+    check(corrupt_byte(path, 12), "corrupt header");
+    check(load_baseline(path.c_str()) == BASELINE_CORRUPTED, "corrupted header");
+    check(truncate(path.c_str(), 100) == 0, "truncate");
+    check(load_baseline(path.c_str()) == BASELINE_CORRUPTED, "truncated file");
+    printf("Ok\n");
+
+    printf("TEST 4: baseline of other hash algorithm... ");
+    check(save_baseline(path.c_str()) == BASELINE_OK, "save crc32");
+    HashAlgo algo = HASH_BLAKE3;
+    check(get_baseline_algo(path.c_str(), &algo) == BASELINE_OK && algo == HASH_CRC32, "crc32 baseline's algorithm");
+    check(get_baseline_algo((path + ".missing").c_str(), &algo) == BASELINE_NOT_FOUND, "no baseline's algorithm");
+    hash_set_algo(HASH_BLAKE3);
+    check(set_file_attr_size(hash_digest_size(HASH_BLAKE3)) == 0 && !is_file_observed(file_path(0).c_str()), "blake3 digest size");
+    check(load_baseline(path.c_str()) == BASELINE_OTHER_HASH, "crc32 baseline for blake3");
+    for (int i = 0; i < 100; ++i) {
+        FileAttr attr = make_attr(static_cast<uint32_t>(i), BLAKE3_OUT_LEN);
+        push_file(file_path(i).c_str(), &attr, &fingerprint);
+    }
+    FileAttr short_attr = make_attr(1, 4);
+    check(push_file("short", &short_attr, NULL) != 0, "wrong digest size");
+    check(save_baseline(path.c_str()) == BASELINE_OK, "save blake3");
+    clear_files();
+    check(load_baseline(path.c_str()) == BASELINE_OK && !is_file_observed(file_path(100).c_str()), "load blake3");
+    check(get_baseline_algo(path.c_str(), &algo) == BASELINE_OK && algo == HASH_BLAKE3, "blake3 baseline's algorithm");
+    for (int i = 0; i < 100; ++i) {
+        if (!same_attr(file_path(i).c_str(), make_attr(static_cast<uint32_t>(i), BLAKE3_OUT_LEN))) {
+            check(false, "blake3 digest");
+            break;
+        }
+    }
+    hash_set_algo(HASH_CRC32);
+    check(set_file_attr_size(4) == 0, "crc32 digest size");
+    check(load_baseline(path.c_str()) == BASELINE_OTHER_HASH && !is_file_observed(file_path(0).c_str()),
+          "blake3 baseline for crc32");
+    printf("Ok\n");
+
+    printf("TEST 5: large files' manifests... ");
+    for (int i = 0; i < 100; ++i) {
+        FileAttr attr = make_attr(static_cast<uint32_t>(i), 4);
+        push_file(file_path(i).c_str(), &attr, NULL);
+    }
+    std::vector<uint8_t> digests(4 * 10);
+    for (size_t i = 0; i < digests.size(); ++i)
+        digests[i] = static_cast<uint8_t>(i * 13);
+    FileManifest manifest = {1 << 20, 10, digests.data()};
+    check(set_file_manifest(file_path(7).c_str(), &manifest) == 0, "set manifest");
+    manifest.block_count = 3;
+    check(set_file_manifest(file_path(50).c_str(), &manifest) == 0, "set short manifest");
+    check(set_file_manifest("unknown", &manifest) != 0, "manifest of unknown file");
+    check(save_baseline(path.c_str()) == BASELINE_OK, "save manifests");
+    // a new attribute removes manifest, loading restores it
+    FileAttr attr7 = make_attr(7, 4);
+    push_file(file_path(7).c_str(), &attr7, NULL);
+    check(get_file_manifest(file_path(7).c_str(), &manifest) != 0, "manifest removed");
+    check(load_baseline(path.c_str()) == BASELINE_OK, "load manifests");
+    check(get_file_manifest(file_path(7).c_str(), &manifest) == 0 && manifest.block_size == 1 << 20 &&
+          manifest.block_count == 10 && memcmp(manifest.digests, digests.data(), digests.size()) == 0,
+          "loaded manifest");
+    check(get_file_manifest(file_path(50).c_str(), &manifest) == 0 && manifest.block_count == 3 &&
+          memcmp(manifest.digests, digests.data(), 12) == 0, "loaded short manifest");
+    check(get_file_manifest(file_path(8).c_str(), &manifest) != 0, "file without manifest");
+    struct stat sb;
+    check(stat(path.c_str(), &sb) == 0 && corrupt_byte(path, sb.st_size - 5), "corrupt manifest");
+    check(load_baseline(path.c_str()) == BASELINE_CORRUPTED, "corrupted manifest");
+    printf("Ok\n");
+
+    printf("TEST 6: version 1 baseline... ");
+    clear_files();
+    check(write_baseline_v1(path, 50, fingerprint), "write version 1");
+    check(load_baseline(path.c_str()) == BASELINE_OLD_VERSION && !is_file_observed("file0"), "not loaded");
+    check(migrate_baseline(path.c_str(), "/srv/data") == BASELINE_OK, "migrate");
+    for (int i = 0; i < 50; ++i) {
+        // crc32 digests are big-endian
+        uint32_t value = static_cast<uint32_t>(i * 7919);
+        FileAttr attr;
+        attr.size = 4;
+        for (int k = 0; k < 4; ++k)
+            attr.bytes[k] = static_cast<uint8_t>(value >> (24 - 8 * k));
+        if (!same_attr(("/srv/data/file" + std::to_string(i)).c_str(), attr)) {
+            check(false, "migrated crc32");
+            break;
+        }
+    }
+    check(check_file_fingerprint("/srv/data/file1", &fingerprint) == VALID_ATTR, "migrated fingerprint");
+    check(check_file_fingerprint("/srv/data/file2", &fingerprint) == ATTR_CHANGED, "no fingerprint");
+    check(save_baseline(path.c_str()) == BASELINE_OK && migrate_baseline(path.c_str(), "/srv/data") == BASELINE_CORRUPTED,
+          "migrate current version");
+    check(write_baseline_v1(path, 50, fingerprint) && corrupt_byte(path, 64 + 70), "corrupt version 1");
+    check(migrate_baseline(path.c_str(), "/srv/data") == BASELINE_CORRUPTED, "corrupted version 1");
+    hash_set_algo(HASH_BLAKE3);
+    check(set_file_attr_size(hash_digest_size(HASH_BLAKE3)) == 0, "blake3 digest size");
+    check(write_baseline_v1(path, 50, fingerprint) && migrate_baseline(path.c_str(), "/srv/data") == BASELINE_OTHER_HASH,
+          "version 1 for blake3");
+    hash_set_algo(HASH_CRC32);
+    set_file_attr_size(4);
+    printf("Ok\n");
+
+    unlink(path.c_str());
+    rmdir(dir);
+    if (fails) {
+        printf("%d checks failed\n", fails);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,401 @@
+#include "blake3.h"
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define BLAKE3_HAVE_AVX2
+#include <immintrin.h>
+#endif
+
+#define BLAKE3_BLOCK_LEN 64
+// chunks hashed at once by the AVX2 kernel
+#define BLAKE3_LANES     8
+
+// domain flags
+#define CHUNK_START 1u
+#define CHUNK_END   2u
+#define PARENT      4u
+#define ROOT        8u
+
+namespace {
+
+const uint32_t iv[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+// message words of every round (the permutation applied round times)
+const uint8_t schedule[7][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+    {3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+    {10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+    {12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+    {9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+    {11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13},
+};
+
+inline uint32_t load32(const uint8_t *p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+inline void store32(uint8_t *p, uint32_t v) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    std::memcpy(p, &v, sizeof(v));
+}
+
+inline void load_block(const uint8_t *block, uint32_t words[16]) {
+    for (int i = 0; i < 16; ++i)
+        words[i] = load32(block + 4 * i);
+}
+
+inline uint32_t rotr32(uint32_t v, int r) {
+    return (v >> r) | (v << (32 - r));
+}
+
+inline void g(uint32_t *s, int a, int b, int c, int d, uint32_t x, uint32_t y) {
+    s[a] = s[a] + s[b] + x;
+    s[d] = rotr32(s[d] ^ s[a], 16);
+    s[c] = s[c] + s[d];
+    s[b] = rotr32(s[b] ^ s[c], 12);
+    s[a] = s[a] + s[b] + y;
+    s[d] = rotr32(s[d] ^ s[a], 8);
+    s[c] = s[c] + s[d];
+    s[b] = rotr32(s[b] ^ s[c], 7);
+}
+
+// compression function, out[0..7] is the new chaining value
+void compress(const uint32_t cv[8], const uint32_t m[16], uint64_t counter, uint32_t block_len,
+              uint32_t flags, uint32_t out[16]) {
+    uint32_t s[16] = {
+        cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+        iv[0], iv[1], iv[2], iv[3],
+        static_cast<uint32_t>(counter), static_cast<uint32_t>(counter >> 32), block_len, flags
+    };
+    for (int r = 0; r < 7; ++r) {
+        const uint8_t *w = schedule[r];
+        g(s, 0, 4, 8, 12, m[w[0]], m[w[1]]);
+        g(s, 1, 5, 9, 13, m[w[2]], m[w[3]]);
+        g(s, 2, 6, 10, 14, m[w[4]], m[w[5]]);
+        g(s, 3, 7, 11, 15, m[w[6]], m[w[7]]);
+        g(s, 0, 5, 10, 15, m[w[8]], m[w[9]]);
+        g(s, 1, 6, 11, 12, m[w[10]], m[w[11]]);
+        g(s, 2, 7, 8, 13, m[w[12]], m[w[13]]);
+        g(s, 3, 4, 9, 14, m[w[14]], m[w[15]]);
+    }
+    for (int i = 0; i < 8; ++i) {
+        out[i] = s[i] ^ s[i + 8];
+        out[i + 8] = s[i + 8] ^ cv[i];
+    }
+}
+
+void output_cv(const Blake3Output &output, uint32_t cv[8]) {
+    uint32_t out[16];
+    compress(output.input_cv, output.block, output.counter, output.block_len, output.flags, out);
+    std::memcpy(cv, out, 8 * sizeof(uint32_t));
+}
+
+void parent_output(const uint32_t left[8], const uint32_t right[8], Blake3Output *output) {
+    std::memcpy(output->input_cv, iv, sizeof(iv));
+    std::memcpy(output->block, left, 8 * sizeof(uint32_t));
+    std::memcpy(output->block + 8, right, 8 * sizeof(uint32_t));
+    output->counter = 0;
+    output->block_len = BLAKE3_BLOCK_LEN;
+    output->flags = PARENT;
+}
+
+void parent_cv(const uint32_t left[8], const uint32_t right[8], uint32_t cv[8]) {
+    Blake3Output output;
+    parent_output(left, right, &output);
+    output_cv(output, cv);
+}
+
+void root_hash(const Blake3Output &output, uint8_t out[BLAKE3_OUT_LEN]) {
+    uint32_t words[16];
+    compress(output.input_cv, output.block, 0, output.block_len, output.flags | ROOT, words);
+    for (int i = 0; i < 8; ++i)
+        store32(out + 4 * i, words[i]);
+}
+
+// add chaining value of finished subtree, subtrees of the same size are merged
+// param[in] subtrees - finished subtrees including this one
+void push_cv(uint32_t (*stack)[8], uint32_t &stack_len, uint32_t cv[8], uint64_t subtrees) {
+    while ((subtrees & 1) == 0) {
+        parent_cv(stack[--stack_len], cv, cv);
+        subtrees >>= 1;
+    }
+    std::memcpy(stack[stack_len++], cv, 8 * sizeof(uint32_t));
+}
+
+#ifdef BLAKE3_HAVE_AVX2
+__attribute__((target("avx2")))
+inline __m256i rot16(__m256i v) {
+    return _mm256_shuffle_epi8(v, _mm256_set_epi8(13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2,
+                                                  13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2));
+}
+
+__attribute__((target("avx2")))
+inline __m256i rot8(__m256i v) {
+    return _mm256_shuffle_epi8(v, _mm256_set_epi8(12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1,
+                                                  12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1));
+}
+
+__attribute__((target("avx2")))
+inline void g8(__m256i *s, int a, int b, int c, int d, __m256i x, __m256i y) {
+    s[a] = _mm256_add_epi32(_mm256_add_epi32(s[a], s[b]), x);
+    s[d] = rot16(_mm256_xor_si256(s[d], s[a]));
+    s[c] = _mm256_add_epi32(s[c], s[d]);
+    s[b] = _mm256_xor_si256(s[b], s[c]);
+    s[b] = _mm256_or_si256(_mm256_srli_epi32(s[b], 12), _mm256_slli_epi32(s[b], 20));
+    s[a] = _mm256_add_epi32(_mm256_add_epi32(s[a], s[b]), y);
+    s[d] = rot8(_mm256_xor_si256(s[d], s[a]));
+    s[c] = _mm256_add_epi32(s[c], s[d]);
+    s[b] = _mm256_xor_si256(s[b], s[c]);
+    s[b] = _mm256_or_si256(_mm256_srli_epi32(s[b], 7), _mm256_slli_epi32(s[b], 25));
+}
+
+// 8 x 8 words: v[i]'s word j becomes v[j]'s word i
+__attribute__((target("avx2")))
+void transpose8(__m256i *v) {
+    __m256i ab_0145 = _mm256_unpacklo_epi32(v[0], v[1]);
+    __m256i ab_2367 = _mm256_unpackhi_epi32(v[0], v[1]);
+    __m256i cd_0145 = _mm256_unpacklo_epi32(v[2], v[3]);
+    __m256i cd_2367 = _mm256_unpackhi_epi32(v[2], v[3]);
+    __m256i ef_0145 = _mm256_unpacklo_epi32(v[4], v[5]);
+    __m256i ef_2367 = _mm256_unpackhi_epi32(v[4], v[5]);
+    __m256i gh_0145 = _mm256_unpacklo_epi32(v[6], v[7]);
+    __m256i gh_2367 = _mm256_unpackhi_epi32(v[6], v[7]);
+    __m256i abcd_04 = _mm256_unpacklo_epi64(ab_0145, cd_0145);
+    __m256i abcd_15 = _mm256_unpackhi_epi64(ab_0145, cd_0145);
+    __m256i abcd_26 = _mm256_unpacklo_epi64(ab_2367, cd_2367);
+    __m256i abcd_37 = _mm256_unpackhi_epi64(ab_2367, cd_2367);
+    __m256i efgh_04 = _mm256_unpacklo_epi64(ef_0145, gh_0145);
+    __m256i efgh_15 = _mm256_unpackhi_epi64(ef_0145, gh_0145);
+    __m256i efgh_26 = _mm256_unpacklo_epi64(ef_2367, gh_2367);
+    __m256i efgh_37 = _mm256_unpackhi_epi64(ef_2367, gh_2367);
+    v[0] = _mm256_permute2x128_si256(abcd_04, efgh_04, 0x20);
+    v[1] = _mm256_permute2x128_si256(abcd_15, efgh_15, 0x20);
+    v[2] = _mm256_permute2x128_si256(abcd_26, efgh_26, 0x20);
+    v[3] = _mm256_permute2x128_si256(abcd_37, efgh_37, 0x20);
+    v[4] = _mm256_permute2x128_si256(abcd_04, efgh_04, 0x31);
+    v[5] = _mm256_permute2x128_si256(abcd_15, efgh_15, 0x31);
+    v[6] = _mm256_permute2x128_si256(abcd_26, efgh_26, 0x31);
+    v[7] = _mm256_permute2x128_si256(abcd_37, efgh_37, 0x31);
+}
+
+// hash 8 consecutive whole chunks at once
+// param[in] counter - index of the first chunk
+// param[out] cvs - chunks' chaining values
+__attribute__((target("avx2")))
+void hash8_chunks(const uint8_t *input, uint64_t counter, uint32_t cvs[BLAKE3_LANES][8]) {
+    __m256i h[8];
+    for (int i = 0; i < 8; ++i)
+        h[i] = _mm256_set1_epi32(static_cast<int>(iv[i]));
+    alignas(32) uint32_t counter_low[BLAKE3_LANES];
+    alignas(32) uint32_t counter_high[BLAKE3_LANES];
+    for (int i = 0; i < BLAKE3_LANES; ++i) {
+        counter_low[i] = static_cast<uint32_t>(counter + i);
+        counter_high[i] = static_cast<uint32_t>((counter + i) >> 32);
+    }
+    for (int block = 0; block < BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN; ++block) {
+        __m256i m[16];
+        for (int i = 0; i < BLAKE3_LANES; ++i) {
+            const uint8_t *p = input + i * BLAKE3_CHUNK_LEN + block * BLAKE3_BLOCK_LEN;
+            m[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+            m[i + 8] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 32));
+        }
+        transpose8(m);
+        transpose8(m + 8);
+        uint32_t flags = (block == 0 ? CHUNK_START : 0) |
+                         (block == BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN - 1 ? CHUNK_END : 0);
+        __m256i s[16] = {
+            h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7],
+            _mm256_set1_epi32(static_cast<int>(iv[0])), _mm256_set1_epi32(static_cast<int>(iv[1])),
+            _mm256_set1_epi32(static_cast<int>(iv[2])), _mm256_set1_epi32(static_cast<int>(iv[3])),
+            _mm256_load_si256(reinterpret_cast<const __m256i *>(counter_low)),
+            _mm256_load_si256(reinterpret_cast<const __m256i *>(counter_high)),
+            _mm256_set1_epi32(BLAKE3_BLOCK_LEN), _mm256_set1_epi32(static_cast<int>(flags))
+        };
+        for (int r = 0; r < 7; ++r) {
+            const uint8_t *w = schedule[r];
+            g8(s, 0, 4, 8, 12, m[w[0]], m[w[1]]);
+            g8(s, 1, 5, 9, 13, m[w[2]], m[w[3]]);
+            g8(s, 2, 6, 10, 14, m[w[4]], m[w[5]]);
+            g8(s, 3, 7, 11, 15, m[w[6]], m[w[7]]);
+            g8(s, 0, 5, 10, 15, m[w[8]], m[w[9]]);
+            g8(s, 1, 6, 11, 12, m[w[10]], m[w[11]]);
+            g8(s, 2, 7, 8, 13, m[w[12]], m[w[13]]);
+            g8(s, 3, 4, 9, 14, m[w[14]], m[w[15]]);
+        }
+        for (int i = 0; i < 8; ++i)
+            h[i] = _mm256_xor_si256(s[i], s[i + 8]);
+    }
+    transpose8(h);
+    for (int i = 0; i < BLAKE3_LANES; ++i)
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(cvs[i]), h[i]);
+}
+
+const bool have_avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+uint32_t chunk_len(const Blake3State *state) {
+    return state->blocks_compressed * BLAKE3_BLOCK_LEN + state->block_len;
+}
+
+void start_chunk(Blake3State *state, uint64_t counter) {
+    std::memcpy(state->cv, iv, sizeof(iv));
+    state->chunk_counter = counter;
+    state->block_len = 0;
+    state->blocks_compressed = 0;
+}
+
+uint32_t start_flag(const Blake3State *state) {
+    return state->blocks_compressed == 0 ? CHUNK_START : 0;
+}
+
+void compress_block(Blake3State *state, const uint8_t *block) {
+    uint32_t words[16];
+    uint32_t out[16];
+    load_block(block, words);
+    compress(state->cv, words, state->chunk_counter, BLAKE3_BLOCK_LEN, start_flag(state), out);
+    std::memcpy(state->cv, out, sizeof(state->cv));
+    state->blocks_compressed++;
+}
+
+// the last block isn't compressed until more data comes: it gets CHUNK_END
+void chunk_update(Blake3State *state, const uint8_t *input, size_t len) {
+    while (len > 0) {
+        if (state->block_len == BLAKE3_BLOCK_LEN) {
+            compress_block(state, state->block);
+            state->block_len = 0;
+        }
+        while (state->block_len == 0 && len > BLAKE3_BLOCK_LEN) {
+            compress_block(state, input);
+            input += BLAKE3_BLOCK_LEN;
+            len -= BLAKE3_BLOCK_LEN;
+        }
+        size_t take = BLAKE3_BLOCK_LEN - state->block_len;
+        if (take > len)
+            take = len;
+        std::memcpy(state->block + state->block_len, input, take);
+        state->block_len += static_cast<uint32_t>(take);
+        input += take;
+        len -= take;
+    }
+}
+
+void chunk_output(const Blake3State *state, Blake3Output *output) {
+    uint8_t block[BLAKE3_BLOCK_LEN] = {};
+    std::memcpy(block, state->block, state->block_len);
+    std::memcpy(output->input_cv, state->cv, sizeof(state->cv));
+    load_block(block, output->block);
+    output->counter = state->chunk_counter;
+    output->block_len = state->block_len;
+    output->flags = start_flag(state) | CHUNK_END;
+}
+
+// finish the current chunk, the next one starts
+void push_chunk(Blake3State *state) {
+    Blake3Output output;
+    uint32_t cv[8];
+    chunk_output(state, &output);
+    output_cv(output, cv);
+    push_cv(state->stack, state->stack_len, cv, ++state->chunks);
+    start_chunk(state, state->chunk_counter + 1);
+}
+
+} // namespace
+
+void blake3_reset(Blake3State *state, uint64_t first_chunk) {
+    start_chunk(state, first_chunk);
+    state->chunks = 0;
+    state->stack_len = 0;
+}
+
+void blake3_update(Blake3State *state, const void *buf, size_t len) {
+    const uint8_t *input = static_cast<const uint8_t *>(buf);
+    while (len > 0) {
+        // the last chunk isn't finished until more data comes: it may be the root
+        if (chunk_len(state) == BLAKE3_CHUNK_LEN)
+            push_chunk(state);
+#ifdef BLAKE3_HAVE_AVX2
+        if (have_avx2 && chunk_len(state) == 0) {
+            while (len > BLAKE3_LANES * BLAKE3_CHUNK_LEN) {
+                uint32_t cvs[BLAKE3_LANES][8];
+                hash8_chunks(input, state->chunk_counter, cvs);
+                for (int i = 0; i < BLAKE3_LANES; ++i)
+                    push_cv(state->stack, state->stack_len, cvs[i], ++state->chunks);
+                state->chunk_counter += BLAKE3_LANES;
+                input += BLAKE3_LANES * BLAKE3_CHUNK_LEN;
+                len -= BLAKE3_LANES * BLAKE3_CHUNK_LEN;
+            }
+        }
+#endif
+        size_t take = BLAKE3_CHUNK_LEN - chunk_len(state);
+        if (take > len)
+            take = len;
+        chunk_update(state, input, take);
+        input += take;
+        len -= take;
+    }
+}
+
+void blake3_subtree(const Blake3State *state, Blake3Output *output) {
+    chunk_output(state, output);
+    for (uint32_t i = state->stack_len; i > 0; --i) {
+        uint32_t cv[8];
+        output_cv(*output, cv);
+        parent_output(state->stack[i - 1], cv, output);
+    }
+}
+
+void blake3_final(const Blake3State *state, uint8_t out[BLAKE3_OUT_LEN]) {
+    Blake3Output output;
+    blake3_subtree(state, &output);
+    root_hash(output, out);
+}
+
+void blake3_combine(const Blake3Output *parts, size_t count, uint8_t out[BLAKE3_OUT_LEN]) {
+    // parts are subtrees of the same size, they are merged like chunks
+    uint32_t stack[BLAKE3_MAX_DEPTH][8];
+    uint32_t stack_len = 0;
+    for (size_t i = 0; i + 1 < count; ++i) {
+        uint32_t cv[8];
+        output_cv(parts[i], cv);
+        push_cv(stack, stack_len, cv, i + 1);
+    }
+    Blake3Output output = parts[count - 1];
+    for (uint32_t i = stack_len; i > 0; --i) {
+        uint32_t cv[8];
+        output_cv(output, cv);
+        parent_output(stack[i - 1], cv, &output);
+    }
+    root_hash(output, out);
+}
+
+void blake3_subtree_cv(const Blake3Output *output, uint8_t out[BLAKE3_OUT_LEN]) {
+    uint32_t cv[8];
+    output_cv(*output, cv);
+    for (int i = 0; i < 8; ++i)
+        store32(out + 4 * i, cv[i]);
+}
+
+const char *blake3_kernel_name() {
+#ifdef BLAKE3_HAVE_AVX2
+    if (have_avx2)
+        return "avx2";
+#endif
+    return "portable";
+}
+
+void blake3(const void *buf, size_t len, uint8_t out[BLAKE3_OUT_LEN]) {
+    Blake3State state;
+    blake3_reset(&state, 0);
+    blake3_update(&state, buf, len);
+    blake3_final(&state, out);
+}
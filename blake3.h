@@ -0,0 +1,71 @@
+#ifndef BLAKE3_HEADER
+#define BLAKE3_HEADER
+
+#include <stddef.h>
+#include <stdint.h>
+#include "crc32check_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// BLAKE3 hash (unkeyed, 32-byte output). Input is split into 1 KiB chunks
+// which are the leaves of a binary tree, so parts of input can be hashed
+// separately (by several threads) and combined into the same hash.
+
+#define BLAKE3_OUT_LEN     32
+#define BLAKE3_CHUNK_LEN   1024
+
+// tree node whose chaining value or root hash isn't calculated yet
+typedef struct {
+    uint32_t input_cv[8];
+    uint32_t block[16];
+    uint64_t counter;
+    uint32_t block_len;
+    uint32_t flags;
+} Blake3Output;
+
+// streaming state: Blake3State (see crc32check_types.h)
+
+// start new hash
+// param[in] first_chunk - index of the first chunk: 0 - the whole input, offset / BLAKE3_CHUNK_LEN
+//                         for part of input (see blake3_combine)
+void blake3_reset(Blake3State *state, uint64_t first_chunk);
+
+// continue hash with data
+// param[in] buf - data
+// param[in] len - data size in bytes
+void blake3_update(Blake3State *state, const void *buf, size_t len);
+
+// get hash of data passed to blake3_update (state isn't changed)
+// param[out] out - hash
+void blake3_final(const Blake3State *state, uint8_t out[BLAKE3_OUT_LEN]);
+
+// get root of the subtree of data passed to blake3_update (state isn't changed)
+// param[out] output - subtree's root
+void blake3_subtree(const Blake3State *state, Blake3Output *output);
+
+// combine parts of input into its hash. All parts but the last one have the same
+// size: 2^n chunks, a part's first chunk is its offset / BLAKE3_CHUNK_LEN.
+// param[in] parts - roots of parts' subtrees (see blake3_subtree) in input order
+// param[in] count - number of parts (> 0)
+// param[out] out - hash
+void blake3_combine(const Blake3Output *parts, size_t count, uint8_t out[BLAKE3_OUT_LEN]);
+
+// get chaining value of subtree's root: the part's digest inside the tree
+// param[in] output - subtree's root (see blake3_subtree)
+// param[out] out - chaining value
+void blake3_subtree_cv(const Blake3Output *output, uint8_t out[BLAKE3_OUT_LEN]);
+
+// return implementation's name for logs (avx2, portable)
+const char *blake3_kernel_name();
+
+// get hash of buffer
+// param[out] out - hash
+void blake3(const void *buf, size_t len, uint8_t out[BLAKE3_OUT_LEN]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BLAKE3_HEADER
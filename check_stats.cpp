@@ -0,0 +1,360 @@
+#include "check_stats.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+#include <atomic>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// shards of counters, threads take them in turn
+#define STAT_SHARDS  32
+// histogram's buckets (+Inf bucket isn't stored)
+#define STAT_BUCKETS 10
+
+// buckets' upper bounds in ns
+static const uint64_t bucket_bounds[STAT_BUCKETS] = {
+    10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL,
+    1000000000ULL, 10000000000ULL, 60000000000ULL, 300000000000ULL, 3600000000000ULL
+};
+
+struct stat_histogram {
+    std::atomic<uint64_t> buckets[STAT_BUCKETS + 1]; // the last one is +Inf
+    std::atomic<uint64_t> sum_ns;
+};
+
+// one thread's counters, cache line aligned to avoid false sharing
+struct alignas(64) stat_shard {
+    std::atomic<uint64_t> counters[STAT_COUNTER_COUNT];
+    stat_histogram        histograms[STAT_HIST_COUNT];
+};
+
+static stat_shard shards[STAT_SHARDS];
+static std::atomic<uint64_t> gauges[STAT_GAUGE_COUNT];
+static std::atomic<unsigned> next_shard(0);
+
+struct metric_info {
+    const char *name;
+    const char *labels;
+    const char *help;
+};
+
+static const metric_info counter_info[STAT_COUNTER_COUNT] = {
+    {"crc32_check_passes_total", "{type=\"initial\"}", "Finished directory passes."},
+    {"crc32_check_passes_total", "{type=\"full\"}", NULL},
+    {"crc32_check_passes_total", "{type=\"dirty\"}", NULL},
+    {"crc32_check_passes_total", "{type=\"file\"}", NULL},
+    {"crc32_check_passes_total", "{type=\"slice\"}", NULL},
+    {"crc32_check_pass_overruns_total", "", "Checks longer than the deamon's timeout."},
+    {"crc32_check_requests_total", "", "Check requests received by the deamon."},
+    {"crc32_check_requests_merged_total", "", "Check requests merged into pending ones."},
+    {"crc32_check_files_hashed_total", "", "Files read and hashed."},
+    {"crc32_check_files_skipped_total", "", "Files with unchanged metadata skipped in fast mode."},
+    {"crc32_check_trees_skipped_total", "", "Trees of unchanged directories skipped in fast mode."},
+    {"crc32_check_files_failed_total", "", "New, changed and deleted files."},
+    {"crc32_check_hash_errors_total", "", "Files which couldn't be read."},
+    {"crc32_check_bytes_hashed_total", "", "Bytes read and hashed."},
+    {"crc32_check_throttle_wait_seconds_total", "", "Time readers slept in the rate limiter."},
+    {"crc32_check_throttle_backoffs_total", "", "Rate limit reductions on system pressure."},
+    {"crc32_check_report_events_total", "", "Events and messages queued to the report writer."},
+    {"crc32_check_report_overflows_total", "", "Events and messages logged to syslog directly while the report queue was full."},
+    {"crc32_check_torn_reads_total", "", "Files changed while they were read, each retry is counted."},
+    {"crc32_check_deferred_checks_total", "{reason=\"unstable\"}", "File checks deferred to the next pass."},
+    {"crc32_check_deferred_checks_total", "{reason=\"writer\"}", NULL},
+    {"crc32_check_snapshots_total", "", "Files hashed from FICLONE copies."},
+    {"crc32_check_hash_allocations_total", "", "Heap allocations of the hashing path, flat while checks run."},
+};
+
+static const metric_info gauge_info[STAT_GAUGE_COUNT] = {
+    {"crc32_check_timeout_seconds", "", "Deamon's timeout between checks."},
+    {"crc32_check_last_pass_duration_seconds", "", "Duration of the last initial scan or full check."},
+    {"crc32_check_last_pass_timestamp_seconds", "", "End of the last initial scan or full check."},
+    {"crc32_check_queue_depth", "{backend=\"pool\"}", "Files queued for hashing."},
+    {"crc32_check_queue_depth", "{backend=\"uring\"}", NULL},
+    {"crc32_check_last_pass_files", "", "Files observed by the last initial scan or full check."},
+    {"crc32_check_rate_limit", "{unit=\"bytes\"}", "Current read rate limit per second with back-off (0 - no limit)."},
+    {"crc32_check_rate_limit", "{unit=\"files\"}", NULL},
+};
+
+static const metric_info set_counter_info[STAT_SET_COUNTER_COUNT] = {
+    {"crc32_check_set_checks_total", "", "Finished check cycles of watch set."},
+    {"crc32_check_set_files_total", "", "Files observed by watch set's check cycles."},
+    {"crc32_check_set_files_failed_total", "", "New, changed and deleted files of watch set."},
+    {"crc32_check_set_bytes_hashed_total", "", "Bytes read and hashed by watch set's checks."},
+    {"crc32_check_set_busy_seconds_total", "", "Time the scheduler spent on watch set's checks."},
+};
+
+static const metric_info set_gauge_info[STAT_SET_GAUGE_COUNT] = {
+    {"crc32_check_set_latency_seconds", "", "Watch set's last check time from its request to its end."},
+    {"crc32_check_set_throughput_bytes", "", "Watch set's last check cycle's bytes/sec while it was checked."},
+};
+
+// watch set's values, they are updated by the checking thread only
+struct watch_set_stats {
+    std::string           name;
+    std::atomic<uint64_t> counters[STAT_SET_COUNTER_COUNT];
+    std::atomic<uint64_t> gauges[STAT_SET_GAUGE_COUNT];
+};
+
+static std::vector<std::unique_ptr<watch_set_stats>> watch_sets;
+
+static const metric_info histogram_info[STAT_HIST_COUNT] = {
+    {"crc32_check_pass_duration_seconds", "", "Duration of initial scans and full checks."},
+    {"crc32_check_file_hash_duration_seconds", "", "Hashing time of a file."},
+};
+
+static stat_shard &thread_shard() {
+    static thread_local stat_shard *shard =
+        &shards[next_shard.fetch_add(1, std::memory_order_relaxed) % STAT_SHARDS];
+    return *shard;
+}
+
+void stats_add(StatCounter counter, uint64_t value) {
+    thread_shard().counters[counter].fetch_add(value, std::memory_order_relaxed);
+}
+
+uint64_t stats_get(StatCounter counter) {
+    uint64_t value = 0;
+    for (auto &it: shards)
+        value += it.counters[counter].load(std::memory_order_relaxed);
+    return value;
+}
+
+void stats_set(StatGauge gauge, uint64_t value) {
+    gauges[gauge].store(value, std::memory_order_relaxed);
+}
+
+void stats_observe(StatHistogram histogram, uint64_t ns) {
+    stat_histogram &hist = thread_shard().histograms[histogram];
+    int bucket = 0;
+    while (bucket < STAT_BUCKETS && ns > bucket_bounds[bucket])
+        bucket++;
+    hist.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    hist.sum_ns.fetch_add(ns, std::memory_order_relaxed);
+}
+
+void stats_file_hashed(uint64_t bytes, uint64_t ns, int failed) {
+    stat_shard &shard = thread_shard();
+    shard.counters[failed ? STAT_HASH_ERRORS : STAT_FILES_HASHED].fetch_add(1, std::memory_order_relaxed);
+    shard.counters[STAT_BYTES_HASHED].fetch_add(bytes, std::memory_order_relaxed);
+    stats_observe(STAT_HIST_FILE_HASH, ns);
+}
+
+int stats_watch_sets(const char *const *names, int count) {
+    try {
+        std::vector<std::unique_ptr<watch_set_stats>> sets;
+        for (int i = 0; i < count; ++i) {
+            sets.emplace_back(new watch_set_stats());
+            sets.back()->name = names[i];
+            for (auto &it: sets.back()->counters)
+                it.store(0, std::memory_order_relaxed);
+            for (auto &it: sets.back()->gauges)
+                it.store(0, std::memory_order_relaxed);
+        }
+        watch_sets.swap(sets);
+    }  catch (...) {
+        return 1;
+    }
+    return 0;
+}
+
+void stats_watch_add(int set, StatSetCounter counter, uint64_t value) {
+    if (set >= 0 && static_cast<size_t>(set) < watch_sets.size())
+        watch_sets[set]->counters[counter].fetch_add(value, std::memory_order_relaxed);
+}
+
+void stats_watch_set(int set, StatSetGauge gauge, uint64_t value) {
+    if (set >= 0 && static_cast<size_t>(set) < watch_sets.size())
+        watch_sets[set]->gauges[gauge].store(value, std::memory_order_relaxed);
+}
+
+static void append(std::string &out, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+static void append(std::string &out, const char *format, ...) {
+    char line[256];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (len > 0)
+        out.append(line, static_cast<size_t>(len) < sizeof(line) ? static_cast<size_t>(len) : sizeof(line) - 1);
+}
+
+static void append_header(std::string &out, const metric_info &info, const char *type) {
+    if (!info.help)
+        return; // the same metric with other labels
+    append(out, "# HELP %s %s\n# TYPE %s %s\n", info.name, info.help, info.name, type);
+}
+
+// metrics in text exposition format
+static std::string format_stats() {
+    std::string out;
+    for (int i = 0; i < STAT_COUNTER_COUNT; ++i) {
+        append_header(out, counter_info[i], "counter");
+        uint64_t value = stats_get(static_cast<StatCounter>(i));
+        if (i == STAT_THROTTLE_WAIT_NS)
+            append(out, "%s%s %.9f\n", counter_info[i].name, counter_info[i].labels, value / 1e9);
+        else
+            append(out, "%s%s %llu\n", counter_info[i].name, counter_info[i].labels,
+                   static_cast<unsigned long long>(value));
+    }
+    for (int i = 0; i < STAT_GAUGE_COUNT; ++i) {
+        append_header(out, gauge_info[i], "gauge");
+        uint64_t value = gauges[i].load(std::memory_order_relaxed);
+        if (i == STAT_GAUGE_LAST_PASS_NS)
+            append(out, "%s%s %.9f\n", gauge_info[i].name, gauge_info[i].labels, value / 1e9);
+        else
+            append(out, "%s%s %llu\n", gauge_info[i].name, gauge_info[i].labels,
+                   static_cast<unsigned long long>(value));
+    }
+    for (int i = 0; i < STAT_HIST_COUNT; ++i) {
+        append_header(out, histogram_info[i], "histogram");
+        uint64_t count = 0;
+        uint64_t sum_ns = 0;
+        for (int b = 0; b <= STAT_BUCKETS; ++b) {
+            for (auto &it: shards)
+                count += it.histograms[i].buckets[b].load(std::memory_order_relaxed);
+            if (b < STAT_BUCKETS)
+                append(out, "%s_bucket{le=\"%g\"} %llu\n", histogram_info[i].name,
+                       bucket_bounds[b] / 1e9, static_cast<unsigned long long>(count));
+            else
+                append(out, "%s_bucket{le=\"+Inf\"} %llu\n", histogram_info[i].name,
+                       static_cast<unsigned long long>(count));
+        }
+        for (auto &it: shards)
+            sum_ns += it.histograms[i].sum_ns.load(std::memory_order_relaxed);
+        append(out, "%s_sum %.9f\n%s_count %llu\n", histogram_info[i].name, sum_ns / 1e9,
+               histogram_info[i].name, static_cast<unsigned long long>(count));
+    }
+    for (int i = 0; i < STAT_SET_COUNTER_COUNT && !watch_sets.empty(); ++i) {
+        append_header(out, set_counter_info[i], "counter");
+        for (auto &it: watch_sets) {
+            uint64_t value = it->counters[i].load(std::memory_order_relaxed);
+            if (i == STAT_SET_BUSY_NS)
+                append(out, "%s{set=\"%s\"} %.9f\n", set_counter_info[i].name, it->name.c_str(), value / 1e9);
+            else
+                append(out, "%s{set=\"%s\"} %llu\n", set_counter_info[i].name, it->name.c_str(),
+                       static_cast<unsigned long long>(value));
+        }
+    }
+    for (int i = 0; i < STAT_SET_GAUGE_COUNT && !watch_sets.empty(); ++i) {
+        append_header(out, set_gauge_info[i], "gauge");
+        for (auto &it: watch_sets) {
+            uint64_t value = it->gauges[i].load(std::memory_order_relaxed);
+            if (i == STAT_SET_GAUGE_LATENCY_NS)
+                append(out, "%s{set=\"%s\"} %.9f\n", set_gauge_info[i].name, it->name.c_str(), value / 1e9);
+            else
+                append(out, "%s{set=\"%s\"} %llu\n", set_gauge_info[i].name, it->name.c_str(),
+                       static_cast<unsigned long long>(value));
+        }
+    }
+    return out;
+}
+
+// return operation result: true - all data was sent
+static bool send_all(int fd, const std::string &data, int flags) {
+    const char *p = data.data();
+    size_t len = data.size();
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, flags);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+char *stats_text(size_t *size) {
+    try {
+        std::string text = format_stats();
+        char *out = static_cast<char*>(malloc(text.size() + 1));
+        if (!out)
+            return NULL;
+        memcpy(out, text.c_str(), text.size() + 1);
+        *size = text.size();
+        return out;
+    }  catch (...) {
+        return NULL;
+    }
+}
+
+static int server_fd = -1;
+static std::string server_path;
+static std::thread server;
+
+static void serve_loop(int listen_fd) {
+    while (1) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            return; // socket was shut down
+        }
+        // slow client can't stop the server
+        struct timeval timeout = {1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        try {
+            send_all(fd, format_stats(), MSG_NOSIGNAL);
+        }  catch (...) {}
+        close(fd);
+    }
+}
+
+int stats_server_start(const char *socket_path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (server_fd >= 0 || strlen(socket_path) >= sizeof(addr.sun_path))
+        return 1;
+    strcpy(addr.sun_path, socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return 1;
+    unlink(socket_path);
+    if (bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+        close(fd);
+        return 1;
+    }
+    // signals are handled by the daemon's thread only
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    bool failed = false;
+    try {
+        server_path = socket_path;
+        server = std::thread(serve_loop, fd);
+    }  catch (...) {
+        failed = true;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (failed) {
+        close(fd);
+        unlink(socket_path);
+        return 1;
+    }
+    server_fd = fd;
+    return 0;
+}
+
+void stats_server_stop() {
+    if (server_fd < 0)
+        return;
+    // wakes accept in the server thread
+    shutdown(server_fd, SHUT_RDWR);
+    server.join();
+    close(server_fd);
+    server_fd = -1;
+    unlink(server_path.c_str());
+}
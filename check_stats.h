@@ -0,0 +1,126 @@
+#ifndef CHECK_STATS_HEADER
+#define CHECK_STATS_HEADER
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// daemon's metrics. Counters and histograms are sharded per thread: hot path
+// updates are relaxed atomic additions without locks, readers sum the shards.
+
+typedef enum {
+    STAT_PASSES_INITIAL,    // initial scans
+    STAT_PASSES_FULL,       // checks of all files
+    STAT_PASSES_DIRTY,      // checks of files reported by the directory watcher
+    STAT_PASSES_FILE,       // single file checks requested via control socket
+    STAT_PASSES_SLICE,      // budgeted slices of check cycles
+    STAT_PASS_OVERRUNS,     // checks longer than the deamon's timeout
+    STAT_REQUESTS,          // check requests received by the deamon
+    STAT_REQUESTS_MERGED,   // check requests merged into pending ones
+    STAT_FILES_HASHED,      // files read and hashed
+    STAT_FILES_SKIPPED,     // files with unchanged metadata in fast mode
+    STAT_TREES_SKIPPED,     // trees of unchanged directories skipped in fast mode
+    STAT_FILES_FAILED,      // new, changed and deleted files
+    STAT_HASH_ERRORS,       // files which couldn't be read
+    STAT_BYTES_HASHED,      // bytes read and hashed
+    STAT_THROTTLE_WAIT_NS,  // time readers slept in rate limiter
+    STAT_THROTTLE_BACKOFFS, // rate limit reductions on system pressure
+    STAT_REPORT_EVENTS,     // events and messages queued to the report writer
+    STAT_REPORT_OVERFLOWS,  // events and messages logged directly while the report queue was full
+    STAT_TORN_READS,        // files changed while they were read (each retry)
+    STAT_DEFERRED_UNSTABLE, // checks deferred because files kept changing
+    STAT_DEFERRED_WRITERS,  // checks deferred because files were open for write
+    STAT_SNAPSHOTS,         // files hashed from FICLONE copies
+    STAT_HASH_ALLOCATIONS,  // heap allocations of the hashing path: I/O buffers, job slots, chunk lists
+    STAT_COUNTER_COUNT
+} StatCounter;
+
+typedef enum {
+    STAT_GAUGE_TIMEOUT,         // deamon's timeout in sec
+    STAT_GAUGE_LAST_PASS_NS,    // duration of the last initial scan or full check
+    STAT_GAUGE_LAST_PASS_TIME,  // its end (unix time)
+    STAT_GAUGE_POOL_QUEUE,      // files queued to hash workers
+    STAT_GAUGE_URING_QUEUE,     // files queued to io_uring scanner
+    STAT_GAUGE_LAST_PASS_FILES, // files observed by it
+    STAT_GAUGE_READ_RATE_LIMIT, // current read rate limit in bytes/sec with back-off (0 - no limit)
+    STAT_GAUGE_FILE_RATE_LIMIT, // current file open rate limit in files/sec with back-off (0 - no limit)
+    STAT_GAUGE_COUNT
+} StatGauge;
+
+typedef enum {
+    STAT_HIST_PASS,      // duration of initial scans and full checks
+    STAT_HIST_FILE_HASH, // hashing time of a file
+    STAT_HIST_COUNT
+} StatHistogram;
+
+// watch set's metrics, they are labeled with the set's name
+typedef enum {
+    STAT_SET_CHECKS,       // finished check cycles
+    STAT_SET_FILES,        // files observed by them
+    STAT_SET_FILES_FAILED, // new, changed and deleted files found by them
+    STAT_SET_BYTES_HASHED, // bytes read and hashed by the set's checks
+    STAT_SET_BUSY_NS,      // time the scheduler spent on the set's checks
+    STAT_SET_COUNTER_COUNT
+} StatSetCounter;
+
+typedef enum {
+    STAT_SET_GAUGE_LATENCY_NS,  // the last check's time from its request to the end of its cycle
+    STAT_SET_GAUGE_THROUGHPUT,  // the last check cycle's bytes/sec while the set was checked
+    STAT_SET_GAUGE_COUNT
+} StatSetGauge;
+
+// add value to counter
+void stats_add(StatCounter counter, uint64_t value);
+
+// return counter's value since start
+uint64_t stats_get(StatCounter counter);
+
+// set gauge's value
+void stats_set(StatGauge gauge, uint64_t value);
+
+// add observation to histogram
+// param[in] ns - observed duration
+void stats_observe(StatHistogram histogram, uint64_t ns);
+
+// count hashed file
+// param[in] bytes - bytes read
+// param[in] ns - hashing time
+// param[in] failed - 1 - file couldn't be read
+void stats_file_hashed(uint64_t bytes, uint64_t ns, int failed);
+
+// set watch sets of the metrics, their values are reset. Call before stats_server_start.
+// param[in] names - sets' names, they are label values (no '"', '\\' or new lines)
+// param[in] count - number of sets
+// return operation result: 0 - ok, 1 - error
+int stats_watch_sets(const char *const *names, int count);
+
+// add value to watch set's counter
+// param[in] set - set's index in stats_watch_sets
+void stats_watch_add(int set, StatSetCounter counter, uint64_t value);
+
+// set watch set's gauge
+// param[in] set - set's index in stats_watch_sets
+void stats_watch_set(int set, StatSetGauge gauge, uint64_t value);
+
+// format all metrics in Prometheus text exposition format
+// param[out] size - text's length
+// return allocated text (caller frees it) or NULL on error
+char *stats_text(size_t *size);
+
+// serve metrics on Unix stream socket: every connection gets stats_text's
+// output and is closed
+// param[in] socket_path - path to socket, an existing socket file is replaced
+// return operation result: 0 - server started, 1 - error
+int stats_server_start(const char *socket_path);
+
+// stop serving metrics and remove the socket
+void stats_server_stop();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHECK_STATS_HEADER
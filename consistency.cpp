@@ -0,0 +1,326 @@
+#include "consistency.h"
+#include "check_stats.h"
+#include "hash_engine.h"
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <linux/fs.h>
+#include <linux/limits.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+// files open for write are rescanned at most so often
+#define WRITERS_SCAN_INTERVAL_NS 1000000000ULL
+
+// deferred files are forgotten if so many of them are tracked (e.g. deleted ones)
+#define MAX_TRACKED_DEFERRALS 65536
+
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+
+struct file_id {
+    uint64_t device;
+    uint64_t inode;
+    bool operator==(const file_id &other) const {
+        return device == other.device && inode == other.inode;
+    }
+};
+
+struct file_id_hash {
+    size_t operator()(const file_id &id) const {
+        return std::hash<uint64_t>()(id.inode * 0x9E3779B97F4A7C15ULL ^ id.device);
+    }
+};
+
+static ConsistencyConfig settings;
+// devices where copies can't be made: no reflinks, read-only, ...
+static std::mutex devices_mutex;
+static std::unordered_set<uint64_t> no_reflink_devices;
+// files open for write by other processes
+static std::mutex writers_mutex;
+static std::unordered_set<file_id, file_id_hash> writers;
+static uint64_t writers_scan_ns;
+// deferrals in a row of files' checks
+static std::mutex deferrals_mutex;
+static std::unordered_map<std::string, int> deferrals;
+static std::atomic<size_t> deferrals_count;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+static void fill_fingerprint(const struct stat &sb, FileFingerprint *fingerprint) {
+    fingerprint->size = static_cast<uint64_t>(sb.st_size);
+    fingerprint->mtime_ns = static_cast<int64_t>(sb.st_mtim.tv_sec) * 1000000000 + sb.st_mtim.tv_nsec;
+    fingerprint->ctime_ns = static_cast<int64_t>(sb.st_ctim.tv_sec) * 1000000000 + sb.st_ctim.tv_nsec;
+    fingerprint->inode = static_cast<uint64_t>(sb.st_ino);
+    fingerprint->device = static_cast<uint64_t>(sb.st_dev);
+}
+
+void consistency_setup(const ConsistencyConfig *config) {
+    settings = *config;
+    if (settings.retries < 0)
+        settings.retries = 0;
+    if (settings.backoff_ms < 0)
+        settings.backoff_ms = 0;
+    if (settings.max_deferrals < 1)
+        settings.max_deferrals = 1;
+    std::lock_guard<std::mutex> lock(deferrals_mutex);
+    deferrals.clear();
+    deferrals_count = 0;
+}
+
+int consistency_enabled() {
+    return settings.retries > 0 || settings.reflink;
+}
+
+int get_path_fingerprint(const char *path, FileFingerprint *fingerprint) {
+    struct stat sb;
+    if (fstatat(AT_FDCWD, path, &sb, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(sb.st_mode))
+        return 1;
+    fill_fingerprint(sb, fingerprint);
+    return 0;
+}
+
+int same_fingerprint(const FileFingerprint *a, const FileFingerprint *b) {
+    return a->size == b->size && a->mtime_ns == b->mtime_ns && a->ctime_ns == b->ctime_ns &&
+           a->inode == b->inode && a->device == b->device;
+}
+
+static void sleep_ms(uint64_t ms) {
+    struct timespec ts = {static_cast<time_t>(ms / 1000), static_cast<long>(ms % 1000) * 1000000};
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {}
+}
+
+ReadConsistency hash_path_consistent(const char *path, FileAttr *digest, FileFingerprint *fingerprint) {
+    if (!consistency_enabled())
+        return hash_path(path, digest) ? READ_ERROR : READ_STABLE;
+    FileFingerprint before;
+    for (int attempt = 0; attempt <= settings.retries; ++attempt) {
+        if (attempt) {
+            stats_add(STAT_TORN_READS, 1);
+            sleep_ms(static_cast<uint64_t>(settings.backoff_ms) << (attempt - 1 < 16 ? attempt - 1 : 16));
+        }
+        // the file could be changed after it was found, that isn't a torn read
+        if (get_path_fingerprint(path, &before))
+            return hash_path(path, digest) ? READ_ERROR : READ_STABLE;
+        // the copy is made from the content with this metadata
+        FileSnapshot snapshot;
+        if (open_file_snapshot(path, &before, &snapshot) == 0) {
+            int failed = hash_path(snapshot.path, digest);
+            close_file_snapshot(&snapshot);
+            if (failed)
+                return READ_ERROR;
+            if (fingerprint)
+                *fingerprint = before;
+            return READ_STABLE;
+        }
+        if (hash_path(path, digest))
+            return READ_ERROR;
+        FileFingerprint after;
+        // without retries the snapshot was the only check
+        if (settings.retries == 0 ||
+            (get_path_fingerprint(path, &after) == 0 && same_fingerprint(&before, &after))) {
+            if (fingerprint && settings.retries)
+                *fingerprint = before;
+            return READ_STABLE;
+        }
+    }
+    stats_add(STAT_TORN_READS, 1);
+    return READ_UNSTABLE;
+}
+
+// return 1 if errno is a passing shortage: the copy can work for the next file.
+// Other errors (no reflinks or O_TMPFILE, read-only filesystem, no access to
+// the directory, ...) stay, the device isn't tried again.
+static int is_transient_error(int error) {
+    return error == ENOMEM || error == EINTR || error == EAGAIN || error == EBUSY ||
+           error == EMFILE || error == ENFILE;
+}
+
+static int is_reflink_device(uint64_t device) {
+    std::lock_guard<std::mutex> lock(devices_mutex);
+    return no_reflink_devices.count(device) == 0;
+}
+
+static void set_no_reflink_device(uint64_t device) {
+    try {
+        std::lock_guard<std::mutex> lock(devices_mutex);
+        no_reflink_devices.insert(device);
+    }  catch (...) {}
+}
+
+int open_file_snapshot(const char *path, const FileFingerprint *fingerprint, FileSnapshot *snapshot) {
+    snapshot->fd = -1;
+    if (!settings.reflink || (fingerprint && !is_reflink_device(fingerprint->device)))
+        return 1;
+    int src = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (src < 0)
+        return 1;
+    struct stat sb;
+    FileFingerprint current;
+    if (fstat(src, &sb) != 0 || !S_ISREG(sb.st_mode)) {
+        close(src);
+        return 1;
+    }
+    fill_fingerprint(sb, &current);
+    if (fingerprint && !same_fingerprint(fingerprint, &current)) {
+        close(src);
+        return 1;
+    }
+    // the copy is an unnamed file of the same filesystem
+    const char *slash = strrchr(path, '/');
+    std::string dir = slash ? std::string(path, slash == path ? 1 : static_cast<size_t>(slash - path)) : ".";
+    int dst = open(dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (dst < 0 || ioctl(dst, FICLONE, src) != 0) {
+        if (!is_transient_error(errno))
+            set_no_reflink_device(current.device);
+        if (dst >= 0)
+            close(dst);
+        close(src);
+        return 1;
+    }
+    // a write could come before the copy
+    FileFingerprint after;
+    int changed = fstat(src, &sb) != 0;
+    if (!changed) {
+        fill_fingerprint(sb, &after);
+        changed = !same_fingerprint(&current, &after);
+    }
+    close(src);
+    if (changed) {
+        close(dst);
+        return 1;
+    }
+    snapshot->fd = dst;
+    snprintf(snapshot->path, sizeof(snapshot->path), "/proc/self/fd/%d", dst);
+    stats_add(STAT_SNAPSHOTS, 1);
+    return 0;
+}
+
+void close_file_snapshot(FileSnapshot *snapshot) {
+    if (snapshot->fd >= 0)
+        close(snapshot->fd);
+    snapshot->fd = -1;
+}
+
+// return 1 if fdinfo's flags have write access
+static int is_written_fd(int fdinfo_dir, const char *fd_name) {
+    int fd = openat(fdinfo_dir, fd_name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return 0;
+    char text[256];
+    ssize_t len = read(fd, text, sizeof(text) - 1);
+    close(fd);
+    if (len <= 0)
+        return 0;
+    text[len] = '\0';
+    const char *flags = strstr(text, "flags:");
+    if (!flags)
+        return 0;
+    unsigned long value = strtoul(flags + 6, NULL, 8);
+    return (value & O_ACCMODE) != O_RDONLY;
+}
+
+// add regular files open for write by process
+static void scan_process(int proc_dir, const char *pid, std::unordered_set<file_id, file_id_hash> &found) {
+    char path[NAME_MAX + sizeof("/fdinfo")];
+    snprintf(path, sizeof(path), "%s/fd", pid);
+    int fd_dir = openat(proc_dir, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd_dir < 0)
+        return;
+    snprintf(path, sizeof(path), "%s/fdinfo", pid);
+    int fdinfo_dir = openat(proc_dir, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *d = fdinfo_dir >= 0 ? fdopendir(fd_dir) : NULL;
+    if (!d) {
+        if (fdinfo_dir >= 0)
+            close(fdinfo_dir);
+        close(fd_dir);
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] == '.')
+            continue;
+        struct stat sb;
+        // the link is followed to the open file
+        if (fstatat(dirfd(d), entry->d_name, &sb, 0) != 0 || !S_ISREG(sb.st_mode))
+            continue;
+        if (is_written_fd(fdinfo_dir, entry->d_name))
+            found.insert({static_cast<uint64_t>(sb.st_dev), static_cast<uint64_t>(sb.st_ino)});
+    }
+    closedir(d);
+    close(fdinfo_dir);
+}
+
+void consistency_begin_pass() {
+    if (!settings.defer_writers)
+        return;
+    uint64_t now = now_ns();
+    if (writers_scan_ns && now - writers_scan_ns < WRITERS_SCAN_INTERVAL_NS)
+        return;
+    writers_scan_ns = now;
+    try {
+        std::unordered_set<file_id, file_id_hash> found;
+        DIR *proc = opendir("/proc");
+        if (!proc)
+            return;
+        char self[32];
+        snprintf(self, sizeof(self), "%d", static_cast<int>(getpid()));
+        struct dirent *entry;
+        while ((entry = readdir(proc)) != NULL) {
+            if (entry->d_name[0] < '1' || entry->d_name[0] > '9' || strcmp(entry->d_name, self) == 0)
+                continue;
+            scan_process(dirfd(proc), entry->d_name, found);
+        }
+        closedir(proc);
+        std::lock_guard<std::mutex> lock(writers_mutex);
+        writers.swap(found);
+    }  catch (...) {}
+}
+
+int is_file_being_written(const FileFingerprint *fingerprint) {
+    if (!settings.defer_writers)
+        return 0;
+    std::lock_guard<std::mutex> lock(writers_mutex);
+    return writers.count({fingerprint->device, fingerprint->inode}) ? 1 : 0;
+}
+
+int defer_file_check(const char *path) {
+    try {
+        std::lock_guard<std::mutex> lock(deferrals_mutex);
+        if (deferrals.size() >= MAX_TRACKED_DEFERRALS)
+            deferrals.clear();
+        int &count = deferrals[path];
+        deferrals_count = deferrals.size();
+        if (count >= settings.max_deferrals)
+            return 0;
+        ++count;
+        return 1;
+    }  catch (...) {
+        return 0;
+    }
+}
+
+void end_file_deferral(const char *path) {
+    if (deferrals_count == 0)
+        return;
+    try {
+        std::lock_guard<std::mutex> lock(deferrals_mutex);
+        deferrals.erase(path);
+        deferrals_count = deferrals.size();
+    }  catch (...) {}
+}
@@ -0,0 +1,97 @@
+#ifndef CONSISTENCY_HEADER
+#define CONSISTENCY_HEADER
+
+#include <stdint.h>
+#include "file_repo.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// consistent reads of files written during a pass: a file's digest is trusted
+// only if its metadata didn't change while it was read (torn read), otherwise
+// it's read again after a delay. Files which keep changing and files open for
+// write by other processes are deferred to the next pass instead of being
+// reported, at most max_deferrals passes in a row: then the file is hashed and
+// reported as changed if it's still torn. On filesystems with reflinks (btrfs,
+// XFS) a file can be hashed from its FICLONE copy, the copy can't change while
+// it's read.
+
+// consistency's settings
+typedef struct {
+    int retries;       // torn reads are retried so many times (0 - no metadata checks)
+    int backoff_ms;    // delay before the first retry, doubled for each next one
+    int defer_writers; // 1 - files open for write by other processes are checked by the next pass
+    int reflink;       // 1 - files are hashed from FICLONE copies where the filesystem supports them
+    int max_deferrals; // a file's check is deferred at most so many passes in a row (<= 0 - 1 pass)
+} ConsistencyConfig;
+
+// hashing result
+typedef enum {
+    READ_STABLE,   // digest matches the file's content with the fingerprint
+    READ_ERROR,    // file couldn't be read, digest is zero (see hash_failed)
+    READ_UNSTABLE  // file kept changing, digest isn't reliable
+} ReadConsistency;
+
+// copy of file's content (see open_file_snapshot)
+typedef struct {
+    int  fd;
+    char path[32]; // path for read_file
+} FileSnapshot;
+
+// set consistency's settings (everything is off by default)
+void consistency_setup(const ConsistencyConfig *config);
+
+// return 1 if digests are checked against metadata (retries or reflinks are on)
+int consistency_enabled();
+
+// get regular file's metadata
+// param[in] path - path to file, symbolic link isn't followed
+// param[out] fingerprint - file's metadata
+// return operation result: 0 - ok, 1 - error or not a regular file
+int get_path_fingerprint(const char *path, FileFingerprint *fingerprint);
+
+// return 1 if fingerprints are the same
+int same_fingerprint(const FileFingerprint *a, const FileFingerprint *b);
+
+// hash file, torn reads are retried with back-off
+// param[in] path - path to file
+// param[out] digest - file's digest
+// param[in,out] fingerprint - metadata before hashing (NULL - unknown), it's replaced
+//                             by metadata of the hashed content
+// return hashing result (see ReadConsistency)
+ReadConsistency hash_path_consistent(const char *path, FileAttr *digest, FileFingerprint *fingerprint);
+
+// make FICLONE copy of file, it's readable by snapshot->path until close_file_snapshot
+// param[in] path - path to file
+// param[in] fingerprint - file's metadata, the copy is made only if it's unchanged
+// param[out] snapshot - file's copy
+// return operation result: 0 - copy was made, 1 - reflinks are off or unsupported, file changed
+//        or copy failed; copies of the device's files aren't tried after a lasting failure
+int open_file_snapshot(const char *path, const FileFingerprint *fingerprint, FileSnapshot *snapshot);
+
+// remove file's copy
+void close_file_snapshot(FileSnapshot *snapshot);
+
+// rescan files open for write by other processes (/proc/<pid>/fdinfo), it's done
+// at most once per second. Call at the start of pass.
+void consistency_begin_pass();
+
+// return 1 if file is open for write by another process (see consistency_begin_pass)
+// param[in] fingerprint - file's metadata
+int is_file_being_written(const FileFingerprint *fingerprint);
+
+// count deferral of file's check to the next pass
+// param[in] path - path to file
+// return 1 - the check is deferred, 0 - it was deferred max_deferrals passes in a row, check the file now
+int defer_file_check(const char *path);
+
+// forget file's deferrals, its check was done
+// param[in] path - path to file
+void end_file_deferral(const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CONSISTENCY_HEADER
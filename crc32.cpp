@@ -1,26 +1,452 @@
 #include "crc32.h"
-#include <fstream>
+#include "check_stats.h"
+#include "file_reader.h"
+#include <linux/limits.h>
+#include <time.h>
+#include <cstdio>
+#include <cstring>
 #include <boost/crc.hpp>
 
-#define BUFFER_SIZE 1024
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define CRC32_HAVE_PCLMUL
+#define CRC32_HAVE_SSE42
+#include <immintrin.h>
+#endif
 
-uint32_t calc_file_crc32(const char *dir, const char *file) {
-    /// TODO check args
-    try {
-        std::string full_name = std::string(dir) + "/" + std::string(file);
-        std::ifstream ifs(full_name.c_str(), std::ios_base::binary);
-        if (ifs) {
-            boost::crc_32_type result;
-            do {
-                char buffer[BUFFER_SIZE];
-                ifs.read(buffer, BUFFER_SIZE);
-                result.process_bytes(buffer, static_cast<std::size_t>(ifs.gcount()));
-            } while (ifs);
-            return result.checksum();
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define CRC32_HAVE_SLICING
+#endif
+
+// reflected IEEE polynomial
+#define CRC32_POLY 0xEDB88320u
+// reflected Castagnoli polynomial (crc32c)
+#define CRC32C_POLY 0x82F63B78u
+
+// the kernels work with the raw (not inverted) crc register
+typedef uint32_t (*crc32_kernel_fn)(uint32_t reg, const uint8_t *buf, size_t len);
+
+namespace {
+
+template <uint32_t Poly>
+struct crc32_tables {
+    uint32_t t[16][256];
+    crc32_tables() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? (c >> 1) ^ Poly : c >> 1;
+            t[0][i] = c;
         }
-        // bad file
-        return 0;
-    } catch (...) {}
-    // return when exception
+        for (int n = 1; n < 16; ++n)
+            for (int i = 0; i < 256; ++i)
+                t[n][i] = (t[n - 1][i] >> 8) ^ t[0][t[n - 1][i] & 0xFF];
+    }
+};
+
+const crc32_tables<CRC32_POLY> &tables() {
+    static const crc32_tables<CRC32_POLY> tbl;
+    return tbl;
+}
+
+const crc32_tables<CRC32C_POLY> &crc32c_tables() {
+    static const crc32_tables<CRC32C_POLY> tbl;
+    return tbl;
+}
+
+inline uint32_t load32(const uint8_t *p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint32_t crc32_bytes(uint32_t reg, const uint8_t *buf, size_t len) {
+    const uint32_t (&t0)[256] = tables().t[0];
+    while (len--)
+        reg = (reg >> 8) ^ t0[(reg ^ *buf++) & 0xFF];
+    return reg;
+}
+
+inline uint32_t reflect32(uint32_t v) {
+    uint32_t r = 0;
+    for (int i = 0; i < 32; ++i, v >>= 1)
+        r = (r << 1) | (v & 1);
+    return r;
+}
+
+uint32_t crc32_boost(uint32_t reg, const uint8_t *buf, size_t len) {
+    // boost expects the unreflected interim remainder
+    boost::crc_32_type result(reflect32(reg));
+    result.process_bytes(buf, len);
+    return result.checksum() ^ 0xFFFFFFFFu;
+}
+
+#ifdef CRC32_HAVE_SLICING
+uint32_t crc32_slice8(uint32_t reg, const uint8_t *buf, size_t len) {
+    const uint32_t (*t)[256] = tables().t;
+    while (len >= 8) {
+        uint32_t one = load32(buf) ^ reg;
+        uint32_t two = load32(buf + 4);
+        reg = t[7][one & 0xFF] ^ t[6][(one >> 8) & 0xFF] ^
+              t[5][(one >> 16) & 0xFF] ^ t[4][one >> 24] ^
+              t[3][two & 0xFF] ^ t[2][(two >> 8) & 0xFF] ^
+              t[1][(two >> 16) & 0xFF] ^ t[0][two >> 24];
+        buf += 8;
+        len -= 8;
+    }
+    return crc32_bytes(reg, buf, len);
+}
+
+uint32_t crc32_slice16(uint32_t reg, const uint8_t *buf, size_t len) {
+    const uint32_t (*t)[256] = tables().t;
+    while (len >= 16) {
+        uint32_t one = load32(buf) ^ reg;
+        uint32_t two = load32(buf + 4);
+        uint32_t three = load32(buf + 8);
+        uint32_t four = load32(buf + 12);
+        reg = t[15][one & 0xFF] ^ t[14][(one >> 8) & 0xFF] ^
+              t[13][(one >> 16) & 0xFF] ^ t[12][one >> 24] ^
+              t[11][two & 0xFF] ^ t[10][(two >> 8) & 0xFF] ^
+              t[9][(two >> 16) & 0xFF] ^ t[8][two >> 24] ^
+              t[7][three & 0xFF] ^ t[6][(three >> 8) & 0xFF] ^
+              t[5][(three >> 16) & 0xFF] ^ t[4][three >> 24] ^
+              t[3][four & 0xFF] ^ t[2][(four >> 8) & 0xFF] ^
+              t[1][(four >> 16) & 0xFF] ^ t[0][four >> 24];
+        buf += 16;
+        len -= 16;
+    }
+    return crc32_bytes(reg, buf, len);
+}
+#endif
+
+#ifdef CRC32_HAVE_PCLMUL
+// folding with carry-less multiplication (Intel, "Fast CRC Computation for
+// Generic Polynomials Using PCLMULQDQ Instruction"), len >= 64 and len % 16 == 0
+__attribute__((target("pclmul,sse4.1")))
+uint32_t crc32_fold(uint32_t reg, const uint8_t *buf, size_t len) {
+    alignas(16) static const uint64_t k1k2[] = {0x0154442bd4, 0x01c6e41596};
+    alignas(16) static const uint64_t k3k4[] = {0x01751997d0, 0x00ccaa009e};
+    alignas(16) static const uint64_t k5k0[] = {0x0163cd6124, 0x0000000000};
+    alignas(16) static const uint64_t poly[] = {0x01db710641, 0x01f7011641};
+
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    x1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x00));
+    x2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x10));
+    x3 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x20));
+    x4 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(reg)));
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i *>(k1k2));
+    buf += 64;
+    len -= 64;
+    // fold by 4 x 128 bits
+    while (len >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+        y5 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x00));
+        y6 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x10));
+        y7 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x20));
+        y8 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x30));
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+        buf += 64;
+        len -= 64;
+    }
+    // fold 4 x 128 bits into 128 bits
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i *>(k3k4));
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+    // fold the rest by 128 bits
+    while (len >= 16) {
+        x2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf));
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+        buf += 16;
+        len -= 16;
+    }
+    // fold 128 bits into 64 bits
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+    x0 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(k5k0));
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    // Barrett reduction into 32 bits
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i *>(poly));
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    return static_cast<uint32_t>(_mm_extract_epi32(x1, 1));
+}
+
+uint32_t crc32_pclmul(uint32_t reg, const uint8_t *buf, size_t len) {
+    if (len >= 64) {
+        size_t fold_len = len & ~static_cast<size_t>(15);
+        reg = crc32_fold(reg, buf, fold_len);
+        buf += fold_len;
+        len -= fold_len;
+    }
+#ifdef CRC32_HAVE_SLICING
+    return crc32_slice8(reg, buf, len);
+#else
+    return crc32_bytes(reg, buf, len);
+#endif
+}
+#endif
+
+uint32_t crc32c_slice8(uint32_t reg, const uint8_t *buf, size_t len) {
+    const uint32_t (*t)[256] = crc32c_tables().t;
+#ifdef CRC32_HAVE_SLICING
+    while (len >= 8) {
+        uint32_t one = load32(buf) ^ reg;
+        uint32_t two = load32(buf + 4);
+        reg = t[7][one & 0xFF] ^ t[6][(one >> 8) & 0xFF] ^
+              t[5][(one >> 16) & 0xFF] ^ t[4][one >> 24] ^
+              t[3][two & 0xFF] ^ t[2][(two >> 8) & 0xFF] ^
+              t[1][(two >> 16) & 0xFF] ^ t[0][two >> 24];
+        buf += 8;
+        len -= 8;
+    }
+#endif
+    while (len--)
+        reg = (reg >> 8) ^ t[0][(reg ^ *buf++) & 0xFF];
+    return reg;
+}
+
+#ifdef CRC32_HAVE_SSE42
+// crc32 instruction of SSE4.2 calculates crc32c
+__attribute__((target("sse4.2")))
+uint32_t crc32c_sse42(uint32_t reg, const uint8_t *buf, size_t len) {
+#ifdef __x86_64__
+    uint64_t reg64 = reg;
+    while (len >= 8) {
+        uint64_t v;
+        std::memcpy(&v, buf, sizeof(v));
+        reg64 = _mm_crc32_u64(reg64, v);
+        buf += 8;
+        len -= 8;
+    }
+    reg = static_cast<uint32_t>(reg64);
+#endif
+    while (len >= 4) {
+        reg = _mm_crc32_u32(reg, load32(buf));
+        buf += 4;
+        len -= 4;
+    }
+    while (len--)
+        reg = _mm_crc32_u8(reg, *buf++);
+    return reg;
+}
+#endif
+
+bool crc32c_hardware() {
+#ifdef CRC32_HAVE_SSE42
+    return __builtin_cpu_supports("sse4.2");
+#else
+    return false;
+#endif
+}
+
+const crc32_kernel_fn crc32c_fn =
+#ifdef CRC32_HAVE_SSE42
+    crc32c_hardware() ? crc32c_sse42 :
+#endif
+    crc32c_slice8;
+
+const crc32_kernel_fn kernels[CRC32_KERNEL_COUNT] = {
+    crc32_boost,
+#ifdef CRC32_HAVE_SLICING
+    crc32_slice8,
+    crc32_slice16,
+#else
+    nullptr,
+    nullptr,
+#endif
+#ifdef CRC32_HAVE_PCLMUL
+    crc32_pclmul,
+#else
+    nullptr,
+#endif
+};
+
+bool kernel_supported(Crc32Kernel kernel) {
+    if (kernel < 0 || kernel >= CRC32_KERNEL_COUNT || !kernels[kernel])
+        return false;
+#ifdef CRC32_HAVE_PCLMUL
+    if (kernel == CRC32_KERNEL_PCLMUL)
+        return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+#endif
+    return true;
+}
+
+// kernels from the fastest to the slowest
+Crc32Kernel select_fastest_kernel() {
+    static const Crc32Kernel order[] = {
+        CRC32_KERNEL_PCLMUL,
+        CRC32_KERNEL_SLICE16,
+        CRC32_KERNEL_SLICE8
+    };
+    for (Crc32Kernel kernel: order) {
+        if (kernel_supported(kernel))
+            return kernel;
+    }
+    return CRC32_KERNEL_BOOST;
+}
+
+Crc32Kernel active_kernel = select_fastest_kernel();
+crc32_kernel_fn active_fn = kernels[active_kernel];
+
+} // namespace
+
+uint32_t crc32_update(uint32_t crc, const void *buf, size_t len) {
+    return ~active_fn(~crc, static_cast<const uint8_t *>(buf), len);
+}
+
+// a * b modulo polynomial (reflected bit order, x^0 is the high bit)
+static uint32_t multmodp(uint32_t a, uint32_t b, uint32_t poly) {
+    uint32_t m = 1u << 31;
+    uint32_t p = 0;
+    while (1) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0)
+                break;
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ poly : b >> 1;
+    }
+    return p;
+}
+
+// x^(2^k) modulo polynomial
+template <uint32_t Poly>
+struct x2n_table {
+    uint32_t values[32];
+    x2n_table() {
+        uint32_t p = 1u << 30; // x^1
+        values[0] = p;
+        for (int n = 1; n < 32; ++n)
+            values[n] = p = multmodp(p, p, Poly);
+    }
+};
+
+// x^(n * 2^k) modulo polynomial
+template <uint32_t Poly>
+static uint32_t x2nmodp(uint64_t n, unsigned k) {
+    static const x2n_table<Poly> table;
+    uint32_t p = 1u << 31; // x^0
+    while (n) {
+        if (n & 1)
+            p = multmodp(table.values[k & 31], p, Poly);
+        n >>= 1;
+        k++;
+    }
+    return p;
+}
+
+uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t len2) {
+    // shift crc1 by len2 zero bytes, the register's pre and post inversions cancel out
+    return multmodp(x2nmodp<CRC32_POLY>(len2, 3), crc1, CRC32_POLY) ^ crc2;
+}
+
+uint32_t crc32c_update(uint32_t crc, const void *buf, size_t len) {
+    return ~crc32c_fn(~crc, static_cast<const uint8_t *>(buf), len);
+}
+
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t len2) {
+    return multmodp(x2nmodp<CRC32C_POLY>(len2, 3), crc1, CRC32C_POLY) ^ crc2;
+}
+
+const char *crc32c_kernel_name() {
+    return crc32c_hardware() ? "sse4.2" : "slice-by-8";
+}
+
+uint32_t crc32_update_kernel(Crc32Kernel kernel, uint32_t crc, const void *buf, size_t len) {
+    return ~kernels[kernel](~crc, static_cast<const uint8_t *>(buf), len);
+}
+
+int crc32_kernel_supported(Crc32Kernel kernel) {
+    return kernel_supported(kernel) ? 1 : 0;
+}
+
+const char *crc32_kernel_name(Crc32Kernel kernel) {
+    switch (kernel) {
+    case CRC32_KERNEL_BOOST:
+        return "boost";
+    case CRC32_KERNEL_SLICE8:
+        return "slice-by-8";
+    case CRC32_KERNEL_SLICE16:
+        return "slice-by-16";
+    case CRC32_KERNEL_PCLMUL:
+        return "pclmul";
+    default:
+        return "unknown";
+    }
+}
+
+Crc32Kernel crc32_get_kernel() {
+    return active_kernel;
+}
+
+int crc32_set_kernel(Crc32Kernel kernel) {
+    if (!kernel_supported(kernel))
+        return 1;
+    active_kernel = kernel;
+    active_fn = kernels[kernel];
     return 0;
 }
+
+struct file_crc32 {
+    uint32_t crc;
+    uint64_t bytes;
+};
+
+static void crc32_file_data(const void *buf, size_t len, void *ctx) {
+    file_crc32 *file = static_cast<file_crc32 *>(ctx);
+    file->crc = crc32_update(file->crc, buf, len);
+    file->bytes += len;
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+uint32_t calc_file_crc32(const char *dir, const char *file) {
+    // path is built on the stack, hashing a file doesn't allocate
+    char full_name[PATH_MAX];
+    int len = snprintf(full_name, sizeof(full_name), "%s/%s", dir, file);
+    if (len < 0 || len >= static_cast<int>(sizeof(full_name)))
+        return 0;
+    return calc_path_crc32(full_name);
+}
+
+uint32_t calc_path_crc32(const char *path) {
+    file_crc32 file = {0, 0};
+    uint64_t start_ns = now_ns();
+    int failed = read_file(path, get_file_reader(), crc32_file_data, &file);
+    stats_file_hashed(file.bytes, now_ns() - start_ns, failed);
+    // 0 for bad file
+    return failed ? 0 : file.crc;
+}
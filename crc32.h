@@ -1,17 +1,76 @@
 #ifndef CRC32_CALC_HEADER
 #define CRC32_CALC_HEADER
 
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// crc32 calculation kernels (the same IEEE crc32 for every kernel)
+typedef enum {
+    CRC32_KERNEL_BOOST,   // boost::crc_32_type, reference implementation
+    CRC32_KERNEL_SLICE8,  // table driven, 8 bytes per step
+    CRC32_KERNEL_SLICE16, // table driven, 16 bytes per step
+    CRC32_KERNEL_PCLMUL,  // x86 carry-less multiplication folding
+    CRC32_KERNEL_COUNT
+} Crc32Kernel;
+
 // param[in] dir - path to directory
 // param[in] file - file name in directory
 // return crc32 sum for file (0 - file not found or system error)
 uint32_t calc_file_crc32(const char *dir, const char *file);
 
+// param[in] path - path to file
+// return crc32 sum for file (0 - file not found or system error)
+uint32_t calc_path_crc32(const char *path);
+
+// continue crc32 calculation with the active kernel
+// param[in] crc - crc32 of the previous data (0 for the first block)
+// param[in] buf - data
+// param[in] len - data size in bytes
+// return crc32 of the previous data followed by buf
+uint32_t crc32_update(uint32_t crc, const void *buf, size_t len);
+
+// combine crc32 of two consecutive blocks (like zlib's crc32_combine)
+// param[in] crc1 - crc32 of the first block
+// param[in] crc2 - crc32 of the second block
+// param[in] len2 - size of the second block in bytes
+// return crc32 of the first block followed by the second one
+uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t len2);
+
+// continue crc32c (Castagnoli polynomial) calculation, SSE4.2 crc32
+// instruction is used if cpu supports it
+// param[in] crc - crc32c of the previous data (0 for the first block)
+// param[in] buf - data
+// param[in] len - data size in bytes
+// return crc32c of the previous data followed by buf
+uint32_t crc32c_update(uint32_t crc, const void *buf, size_t len);
+
+// combine crc32c of two consecutive blocks, see crc32_combine
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t len2);
+
+// return crc32c implementation's name for logs (sse4.2, slice-by-8)
+const char *crc32c_kernel_name();
+
+// the same as crc32_update but with the given kernel
+// (kernel must be supported, see crc32_kernel_supported)
+uint32_t crc32_update_kernel(Crc32Kernel kernel, uint32_t crc, const void *buf, size_t len);
+
+// return 1 if kernel can run on this cpu, 0 - otherwise
+int crc32_kernel_supported(Crc32Kernel kernel);
+
+// return kernel's name for logs
+const char *crc32_kernel_name(Crc32Kernel kernel);
+
+// return active kernel (the fastest supported one is selected at startup)
+Crc32Kernel crc32_get_kernel();
+
+// change active kernel
+// return operation result: 0 - kernel was selected, 1 - kernel isn't supported
+int crc32_set_kernel(Crc32Kernel kernel);
+
 #ifdef __cplusplus
 }
 #endif
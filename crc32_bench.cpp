@@ -0,0 +1,284 @@
+#include <benchmark/benchmark.h>
+#include "crc32.h"
+#include "dir_check.h"
+#include "file_reader.h"
+#include "file_repo.h"
+#include "hash_engine.h"
+#include "hash_pool.h"
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+// micro-benchmarks of crc32 kernels, hash algorithms, file readers, file repository and
+// directory checks. Machine-readable results:
+//   crc32_bench --benchmark_out=crc32_bench.json --benchmark_out_format=json
+// (or "make crc32_bench_json")
+
+// files per directory in benchmark's tree
+#define BENCH_DIR_FILES 1000
+// max different names looked up by a benchmark
+#define BENCH_SAMPLE    (1 << 20)
+
+static const FileFingerprint bench_fingerprint = {4096, 1, 2, 3, 4};
+
+// file's attribute: its number (4 bytes)
+static FileAttr bench_attr(uint32_t i) {
+    FileAttr attr = {4, {}};
+    memcpy(attr.bytes, &i, sizeof(i));
+    return attr;
+}
+
+static std::string bench_path(uint32_t i) {
+    return "/srv/data/dir" + std::to_string(i / BENCH_DIR_FILES) + "/file_" + std::to_string(i) + ".dat";
+}
+
+// fill repository with count files (benchmarks are rerun with the same count)
+static void fill_repo(uint32_t count) {
+    static uint32_t filled = 0;
+    static uint64_t version = 0;
+    // other benchmarks change repository too
+    if (filled == count && version == get_files_version())
+        return;
+    clear_files();
+    for (uint32_t i = 0; i < count; ++i) {
+        FileAttr attr = bench_attr(i);
+        push_file(bench_path(i).c_str(), &attr, &bench_fingerprint);
+    }
+    filled = count;
+    version = get_files_version();
+}
+
+// random paths: observed files (attribute is file's number) or unknown ones
+static std::vector<std::pair<std::string, FileAttr>> sample_paths(uint32_t count, bool observed) {
+    std::mt19937 random(count);
+    std::vector<std::pair<std::string, FileAttr>> paths;
+    uint32_t size = count < BENCH_SAMPLE ? count : BENCH_SAMPLE;
+    for (uint32_t i = 0; i < size; ++i) {
+        uint32_t n = random() % count;
+        paths.emplace_back(observed ? bench_path(n) : bench_path(n) + ".new", bench_attr(n));
+    }
+    return paths;
+}
+
+// temporary directory removed at exit
+static const std::string &bench_dir() {
+    static std::string dir;
+    if (dir.empty()) {
+        char path[] = "/tmp/crc32_bench_XXXXXX";
+        if (!mkdtemp(path)) {
+            perror("mkdtemp");
+            exit(1);
+        }
+        dir = path;
+        atexit([] {
+            std::string cmd = "rm -rf '" + dir + "'";
+            if (system(cmd.c_str()) != 0)
+                fprintf(stderr, "can't remove %s\n", dir.c_str());
+        });
+    }
+    return dir;
+}
+
+// create file of size bytes with random content (existing file is kept)
+static void make_file(const std::string &path, uint64_t size) {
+    struct stat sb;
+    if (stat(path.c_str(), &sb) == 0 && static_cast<uint64_t>(sb.st_size) == size)
+        return;
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(path.c_str());
+        exit(1);
+    }
+    std::mt19937_64 random(size);
+    std::vector<uint64_t> buf(1 << 16);
+    while (size > 0) {
+        for (auto &it: buf)
+            it = random();
+        size_t part = size < buf.size() * sizeof(uint64_t) ? size : buf.size() * sizeof(uint64_t);
+        if (write(fd, buf.data(), part) != static_cast<ssize_t>(part)) {
+            perror(path.c_str());
+            exit(1);
+        }
+        size -= part;
+    }
+    close(fd);
+}
+
+// crc32 kernel on buffer in cache
+// param range(0) - kernel, range(1) - buffer size
+static void BM_crc32_kernel(benchmark::State &state) {
+    Crc32Kernel kernel = static_cast<Crc32Kernel>(state.range(0));
+    if (!crc32_kernel_supported(kernel)) {
+        state.SkipWithError("kernel isn't supported");
+        return;
+    }
+    state.SetLabel(crc32_kernel_name(kernel));
+    std::vector<char> buf(static_cast<size_t>(state.range(1)), 'x');
+    uint32_t crc = 0;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(crc = crc32_update_kernel(kernel, crc, buf.data(), buf.size()));
+    state.SetBytesProcessed(state.iterations() * state.range(1));
+}
+
+// hash algorithm on buffer in cache
+// param range(0) - algorithm, range(1) - buffer size
+static void BM_hash_algo(benchmark::State &state) {
+    HashAlgo algo = static_cast<HashAlgo>(state.range(0));
+    HashAlgo saved = hash_get_algo();
+    hash_set_algo(algo);
+    state.SetLabel(std::string(hash_algo_name(algo)) + " " + hash_algo_kernel(algo));
+    std::vector<char> buf(static_cast<size_t>(state.range(1)), 'x');
+    HashState hash;
+    FileAttr digest;
+    for (auto _ : state) {
+        hash_begin(&hash);
+        hash_update(&hash, buf.data(), buf.size());
+        hash_end(&hash, &digest);
+        benchmark::DoNotOptimize(digest);
+    }
+    hash_set_algo(saved);
+    state.SetBytesProcessed(state.iterations() * state.range(1));
+}
+
+// calc_path_crc32 (calc_file_crc32 without directory) by reader and file size
+// param range(0) - file reader, range(1) - file size
+static void BM_file_crc32(benchmark::State &state) {
+    FileReaderKind reader = static_cast<FileReaderKind>(state.range(0));
+    std::string path = bench_dir() + "/file_" + std::to_string(state.range(1));
+    make_file(path, static_cast<uint64_t>(state.range(1)));
+    state.SetLabel(file_reader_name(reader));
+    FileReaderKind saved = get_file_reader();
+    set_file_reader(reader);
+    for (auto _ : state)
+        benchmark::DoNotOptimize(calc_path_crc32(path.c_str()));
+    set_file_reader(saved);
+    state.SetBytesProcessed(state.iterations() * state.range(1));
+}
+
+static void file_crc32_args(benchmark::internal::Benchmark *bench) {
+    for (int reader = FILE_READER_AUTO; reader < FILE_READER_COUNT; ++reader)
+        for (int64_t size: {4096, 256 * 1024, 16 * 1024 * 1024, 256 * 1024 * 1024})
+            bench->Args({reader, size});
+}
+
+static void BM_push_file(benchmark::State &state) {
+    uint32_t count = static_cast<uint32_t>(state.range(0));
+    for (auto _ : state) {
+        state.PauseTiming();
+        clear_files();
+        state.ResumeTiming();
+        for (uint32_t i = 0; i < count; ++i) {
+            FileAttr attr = bench_attr(i);
+            push_file(bench_path(i).c_str(), &attr, &bench_fingerprint);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+}
+
+static void BM_check_file_attr(benchmark::State &state) {
+    uint32_t count = static_cast<uint32_t>(state.range(0));
+    fill_repo(count);
+    auto paths = sample_paths(count, true);
+    size_t i = 0;
+    for (auto _ : state) {
+        const auto &it = paths[i];
+        benchmark::DoNotOptimize(check_file_attr(it.first.c_str(), &it.second, &bench_fingerprint));
+        if (++i == paths.size())
+            i = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_unknown_file(benchmark::State &state) {
+    uint32_t count = static_cast<uint32_t>(state.range(0));
+    fill_repo(count);
+    auto paths = sample_paths(count, false);
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(is_file_observed(paths[i].first.c_str()));
+        if (++i == paths.size())
+            i = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// begin check and sweep all files, none of them was checked
+static void BM_unchecked_sweep(benchmark::State &state) {
+    uint32_t count = static_cast<uint32_t>(state.range(0));
+    fill_repo(count);
+    for (auto _ : state) {
+        begin_files_check();
+        while (get_next_unchecked_file() != NULL) {}
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+}
+
+// generated tree: files of size bytes, 100 files per directory
+static std::string make_tree(int64_t files, int64_t size) {
+    std::string root = bench_dir() + "/tree_" + std::to_string(files) + "_" + std::to_string(size);
+    mkdir(root.c_str(), 0755);
+    for (int64_t i = 0; i < files; ++i) {
+        std::string dir = root + "/dir" + std::to_string(i / 100);
+        if (i % 100 == 0)
+            mkdir(dir.c_str(), 0755);
+        make_file(dir + "/file" + std::to_string(i), static_cast<uint64_t>(size));
+    }
+    return root;
+}
+
+// check_files_in_directory on generated tree by hash workers
+// param range(0) - number of files, range(1) - file size, range(2) - fast check
+static void BM_check_directory(benchmark::State &state) {
+    std::string root = make_tree(state.range(0), state.range(1));
+    char *paths[] = {&root[0]};
+    DaemonConfig config = {};
+    config.paths_to_dirs = paths;
+    config.dirs_count = 1;
+    config.workers = 2;
+    config.fast_check = static_cast<int>(state.range(2));
+    config.reader = FILE_READER_AUTO;
+    config.large_file_size = 64 * 1024 * 1024;
+    config.chunk_size = 16 * 1024 * 1024;
+    if (hash_pool_start(config.workers)) {
+        state.SkipWithError("start hash workers failed");
+        return;
+    }
+    dir_check_setup(&config, 0);
+    clear_files();
+    init_directory_info();
+    for (auto _ : state) {
+        if (check_files_in_directory() != 0) {
+            state.SkipWithError("integrity check failed");
+            break;
+        }
+    }
+    hash_pool_stop();
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetBytesProcessed(state.iterations() * state.range(0) * state.range(1));
+}
+
+BENCHMARK(BM_crc32_kernel)
+    ->ArgsProduct({{CRC32_KERNEL_BOOST, CRC32_KERNEL_SLICE8, CRC32_KERNEL_SLICE16, CRC32_KERNEL_PCLMUL},
+                   {64, 4096, 64 * 1024, 1024 * 1024}});
+BENCHMARK(BM_hash_algo)
+    ->ArgsProduct({{HASH_CRC32, HASH_CRC32C, HASH_XXH3_64, HASH_XXH3_128, HASH_BLAKE3},
+                   {64, 4096, 1024 * 1024}});
+BENCHMARK(BM_file_crc32)->Apply(file_crc32_args)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_push_file)->Arg(10000)->Arg(1000000)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_check_file_attr)->Arg(10000)->Arg(1000000)->Arg(10000000);
+BENCHMARK(BM_unknown_file)->Arg(10000)->Arg(1000000)->Arg(10000000);
+BENCHMARK(BM_unchecked_sweep)->Arg(10000)->Arg(1000000)->Arg(10000000)->Unit(benchmark::kMillisecond);
+// many small files vs few large ones, full and fast checks
+BENCHMARK(BM_check_directory)
+    ->ArgsProduct({{10000}, {4096}, {0, 1}})
+    ->Args({8, 128 * 1024 * 1024, 0})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+BENCHMARK_MAIN();
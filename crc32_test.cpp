@@ -0,0 +1,500 @@
+#include "check_stats.h"
+#include "crc32.h"
+#include "file_reader.h"
+#include "hash_engine.h"
+#include "hash_pool.h"
+#include "throttle.h"
+#include <unistd.h>
+#include <time.h>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+#include <boost/crc.hpp>
+
+// heap allocations of the whole process (operator new is replaced)
+static std::atomic<uint64_t> allocations(0);
+
+void *operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void *p = malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+static uint32_t boost_crc32(const uint8_t *buf, size_t len) {
+    boost::crc_32_type result;
+    result.process_bytes(buf, len);
+    return result.checksum();
+}
+
+static int fails = 0;
+
+// hash pool's result: file's crc32 is compared with the expected one (ctx)
+static std::atomic<int> pool_matches(0);
+
+static void pool_result(const char *file, const FileAttr *digest, const FileFingerprint *fingerprint,
+                        const FileManifest *manifest, void *ctx) {
+    (void)file;
+    (void)fingerprint;
+    (void)manifest;
+    uint32_t crc = 0;
+    for (uint32_t i = 0; i < digest->size; ++i)
+        crc = crc << 8 | digest->bytes[i];
+    if (crc == *static_cast<const uint32_t *>(ctx))
+        pool_matches++;
+}
+
+// system pressure seen by the rate limiter's back-off
+static std::atomic<int> under_pressure(0);
+
+static int pressure_probe() {
+    return under_pressure.load();
+}
+
+// sleep past the rate limiter's pressure sample and take a token
+static void sample_pressure(int pressure) {
+    under_pressure = pressure;
+    usleep(1050000);
+    throttle_bytes(1);
+}
+
+static double elapsed_sec(const struct timespec &start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static void crc32_data(const void *buf, size_t len, void *ctx) {
+    uint32_t *crc = static_cast<uint32_t *>(ctx);
+    *crc = crc32_update(*crc, buf, len);
+}
+
+// crc32 of file read by parts and combined
+static uint32_t chunked_file_crc32(const std::string &path, FileReaderKind reader, size_t size, uint64_t chunk) {
+    uint32_t crc = 0;
+    for (uint64_t offset = 0; offset == 0 || offset < size; offset += chunk) {
+        uint32_t part = 0;
+        if (read_file_range(path.c_str(), reader, offset, chunk, crc32_data, &part) != 0)
+            return 0;
+        crc = offset ? crc32_combine(crc, part, size - offset < chunk ? size - offset : chunk) : part;
+    }
+    return crc;
+}
+
+static void check(bool ok, const char *kernel, const char *what, size_t len) {
+    if (!ok) {
+        printf("failed: %s %s (len %zu)\n", kernel, what, len);
+        fails++;
+    }
+}
+
+static std::string digest_hex(const FileAttr &digest) {
+    std::string hex;
+    char byte[3];
+    for (uint32_t i = 0; i < digest.size; ++i) {
+        snprintf(byte, sizeof(byte), "%02x", digest.bytes[i]);
+        hex += byte;
+    }
+    return hex;
+}
+
+// digest of buffer in hex
+static std::string hex_digest(HashAlgo algo, const void *buf, size_t len) {
+    hash_set_algo(algo);
+    HashState state;
+    FileAttr digest;
+    hash_begin(&state);
+    hash_update(&state, buf, len);
+    hash_end(&state, &digest);
+    return digest_hex(digest);
+}
+
+// digest of buffer hashed by updates of piece bytes
+static std::string hex_pieces_digest(HashAlgo algo, const uint8_t *buf, size_t len, size_t piece) {
+    hash_set_algo(algo);
+    HashState state;
+    FileAttr digest;
+    hash_begin(&state);
+    for (size_t offset = 0; offset < len; offset += piece)
+        hash_update(&state, buf + offset, len - offset < piece ? len - offset : piece);
+    hash_end(&state, &digest);
+    return digest_hex(digest);
+}
+
+// input of xxHash's sanity tests
+static std::vector<uint8_t> xxh_sanity_buffer(size_t len) {
+    std::vector<uint8_t> buf(len);
+    uint64_t gen = 2654435761U;
+    for (size_t i = 0; i < len; ++i) {
+        buf[i] = static_cast<uint8_t>(gen >> 56);
+        gen *= 11400714785074694797ULL;
+    }
+    return buf;
+}
+
+// input of BLAKE3's test vectors
+static std::vector<uint8_t> blake3_vector_input(size_t len) {
+    std::vector<uint8_t> buf(len);
+    for (size_t i = 0; i < len; ++i)
+        buf[i] = static_cast<uint8_t>(i % 251);
+    return buf;
+}
+
+// official digests around XXH3's 16, 128 and 240 bytes' paths, 64-byte stripes and 1024-byte blocks
+static const struct {
+    size_t      len;
+    const char *xxh3_64;
+    const char *xxh3_128;
+} xxh3_vectors[] = {
+    {0, "2d06800538d394c2", "99aa06d3014798d86001c324468d497f"},
+    {1, "c44bdff4074eecdb", "a6cd5e9392000f6ac44bdff4074eecdb"},
+    {3, "54247382a8d6b94d", "20efc49ff02422ea54247382a8d6b94d"},
+    {4, "e5dc74bc51848a51", "970d585ac632bf8e2e7d8d6876a39fe9"},
+    {8, "24ccc9acaa9f65e4", "47a7f080d82bb45664c69cab4bb21dc5"},
+    {9, "14d5001c15dd3f2b", "564ef6078950d457ed7ccbc501eb7501"},
+    {16, "981b17d36c7498c9", "c68c368ecf8a9c05562980258a998629"},
+    {17, "796f5acd3a60f862", "955fa78643ed3669abbc12d11973d7db"},
+    {128, "fcff24126754d861", "39992220e045260aebb15e34a7fb5ab1"},
+    {129, "98f1b0a679a2ca29", "03815fc91f1b30b686c9e3bc8f0a3b5c"},
+    {240, "81c3c2b67f568ccf", "aa4202daa2769dc85c9aae94c8ebe5a0"},
+    {241, "c5a639ecd2030e5e", "99a80ecf0ecfc647c5a639ecd2030e5e"},
+    {1024, "dd85c9b5c1109c5c", "0d30d24071c64c57dd85c9b5c1109c5c"},
+    {1025, "d870c0fa13211c6a", "fd3ee4fe7f2954c6d870c0fa13211c6a"},
+    {2048, "dd59e2c3a5f038e0", "f736557fd47073a5dd59e2c3a5f038e0"},
+    {2240, "6e73a90539cf2948", "ccb134fbfa7ce49d6e73a90539cf2948"},
+    {2367, "cb37aeb9e5d361ed", "e89c0f6ff369b427cb37aeb9e5d361ed"},
+};
+
+// official digests around BLAKE3's 1024-byte chunks and their tree
+static const struct {
+    size_t      len;
+    const char *blake3;
+} blake3_vectors[] = {
+    {0, "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262"},
+    {1, "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213"},
+    {1023, "10108970eeda3eb932baac1428c7a2163b0e924c9a9e25b35bba72b28f70bd11"},
+    {1024, "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7"},
+    {1025, "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444"},
+    {2048, "e776b6028c7cd22a4d0ba182a8bf62205d2ef576467e838ed6f2529b85fba24a"},
+    {2049, "5f4d72f40d7a5f82b15ca2b2e44b1de3c2ef86c426c95c1af0b6879522563030"},
+    {3072, "b98cb0ff3623be03326b373de6b9095218513e64f1ee2edd2525c7ad1e5cffd2"},
+    {3073, "7124b49501012f81cc7f11ca069ec9226cecb8a2c850cfe644e327d22d3e1cd3"},
+    {4096, "015094013f57a5277b59d8475c0501042c0b642e531b0a1c8f58d2163229e969"},
+    {4097, "9b4052b38f1c5fc8b1f9ff7ac7b27cd242487b3d890d15c96a1c25b8aa0fb995"},
+    {5120, "9cadc15fed8b5d854562b26a9536d9707cadeda9b143978f319ab34230535833"},
+    {5121, "628bd2cb2004694adaab7bbd778a25df25c47b9d4155a55f8fbd79f2fe154cff"},
+    {8192, "aae792484c8efe4f19e2ca7d371d8c467ffb10748d8a5a1ae579948f718a2a63"},
+    {8193, "bab6c09cb8ce8cf459261398d2e7aef35700bf488116ceb94a36d0f5f1b7bc3b"},
+    {16384, "f875d6646de28985646f34ee13be9a576fd515f76b5b0a26bb324735041ddde4"},
+    {31744, "62b6960e1a44bcc1eb1a611a8d6235b6b4b78f32e7abc4fb4c6cdcce94895c47"},
+    {102400, "bc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085"},
+};
+
+// digest of buffer hashed by parts and combined
+static std::string hex_parts_digest(HashAlgo algo, const uint8_t *buf, size_t len, size_t part_size) {
+    hash_set_algo(algo);
+    std::vector<HashPart> parts;
+    for (size_t offset = 0; offset == 0 || offset < len; offset += part_size) {
+        HashState state;
+        HashPart part;
+        hash_begin_part(&state, offset);
+        hash_update(&state, buf + offset, len - offset < part_size ? len - offset : part_size);
+        hash_end_part(&state, &part);
+        parts.push_back(part);
+    }
+    FileAttr digest;
+    hash_combine_parts(parts.data(), parts.size(), &digest);
+    return digest_hex(digest);
+}
+
+int main() {
+    std::mt19937 rnd(12345);
+    std::vector<uint8_t> data(1 << 20);
+    for (auto &b: data)
+        b = static_cast<uint8_t>(rnd());
+
+    printf("TEST 1: known value... ");
+    const char *check_str = "123456789";
+    for (int k = 0; k < CRC32_KERNEL_COUNT; ++k) {
+        Crc32Kernel kernel = static_cast<Crc32Kernel>(k);
+        if (!crc32_kernel_supported(kernel))
+            continue;
+        check(crc32_update_kernel(kernel, 0, check_str, strlen(check_str)) == 0xCBF43926,
+              crc32_kernel_name(kernel), "check value", strlen(check_str));
+    }
+    printf("Ok\n");
+
+    printf("TEST 2: kernels against boost on random buffers... ");
+    for (int i = 0; i < 2000; ++i) {
+        size_t len = i < 300 ? static_cast<size_t>(i) : rnd() % data.size();
+        size_t offset = rnd() % (data.size() - len + 1);
+        uint32_t expected = boost_crc32(data.data() + offset, len);
+        for (int k = 0; k < CRC32_KERNEL_COUNT; ++k) {
+            Crc32Kernel kernel = static_cast<Crc32Kernel>(k);
+            if (!crc32_kernel_supported(kernel))
+                continue;
+            check(crc32_update_kernel(kernel, 0, data.data() + offset, len) == expected,
+                  crc32_kernel_name(kernel), "whole buffer", len);
+        }
+    }
+    printf("Ok\n");
+
+    printf("TEST 3: kernels against boost with split buffers... ");
+    for (int i = 0; i < 500; ++i) {
+        size_t len = rnd() % 100000;
+        size_t split = len ? rnd() % len : 0;
+        uint32_t expected = boost_crc32(data.data(), len);
+        for (int k = 0; k < CRC32_KERNEL_COUNT; ++k) {
+            Crc32Kernel kernel = static_cast<Crc32Kernel>(k);
+            if (!crc32_kernel_supported(kernel))
+                continue;
+            uint32_t crc = crc32_update_kernel(kernel, 0, data.data(), split);
+            crc = crc32_update_kernel(kernel, crc, data.data() + split, len - split);
+            check(crc == expected, crc32_kernel_name(kernel), "split buffer", len);
+        }
+    }
+    printf("Ok\n");
+
+    printf("TEST 4: active kernel %s... ", crc32_kernel_name(crc32_get_kernel()));
+    check(crc32_update(0, data.data(), data.size()) == boost_crc32(data.data(), data.size()),
+          crc32_kernel_name(crc32_get_kernel()), "active kernel", data.size());
+    printf("Ok\n");
+
+    printf("TEST 5: crc32 combine... ");
+    for (int i = 0; i < 500; ++i) {
+        size_t len = i < 50 ? static_cast<size_t>(i) : rnd() % data.size();
+        size_t split = len ? rnd() % (len + 1) : 0;
+        uint32_t crc1 = crc32_update(0, data.data(), split);
+        uint32_t crc2 = crc32_update(0, data.data() + split, len - split);
+        check(crc32_combine(crc1, crc2, len - split) == boost_crc32(data.data(), len),
+              "combine", "two blocks", len);
+    }
+    {
+        // zero blocks doubled by combine up to 4 GiB, checked directly while they are small
+        std::vector<uint8_t> zeros(8 << 20);
+        uint32_t crc = crc32_update(0, zeros.data(), 1 << 20);
+        uint64_t len = 1 << 20;
+        for (; len < (1ULL << 32); len *= 2) {
+            if (len <= zeros.size())
+                check(crc == crc32_update(0, zeros.data(), static_cast<size_t>(len)), "combine", "zeros", len);
+            crc = crc32_combine(crc, crc, len);
+        }
+        // a zero byte before or after long zero block gives the same crc32
+        uint32_t zero = crc32_update(0, zeros.data(), 1);
+        check(crc32_combine(crc, zero, 1) == crc32_combine(zero, crc, len), "combine", "long block", 0);
+    }
+    printf("Ok\n");
+
+    printf("TEST 6: file crc32 with every reader, whole and by parts... ");
+    char dir[] = "/tmp/crc32_test_XXXXXX";
+    if (!mkdtemp(dir)) {
+        printf("failed: can't create directory\n");
+        return 1;
+    }
+    const size_t file_sizes[] = {0, 1, 4097, 300 * 1024 + 7, data.size()};
+    for (size_t size: file_sizes) {
+        std::string path = std::string(dir) + "/data";
+        FILE *f = fopen(path.c_str(), "wb");
+        if (!f || fwrite(data.data(), 1, size, f) != size) {
+            printf("failed: can't write file\n");
+            return 1;
+        }
+        fclose(f);
+        for (int r = 0; r < FILE_READER_COUNT; ++r) {
+            FileReaderKind reader = static_cast<FileReaderKind>(r);
+            set_file_reader(reader);
+            uint64_t hashed = stats_get(STAT_FILES_HASHED);
+            uint64_t bytes = stats_get(STAT_BYTES_HASHED);
+            check(calc_file_crc32(dir, "data") == boost_crc32(data.data(), size),
+                  file_reader_name(reader), "file crc32", size);
+            check(stats_get(STAT_FILES_HASHED) == hashed + 1 && stats_get(STAT_BYTES_HASHED) == bytes + size,
+                  file_reader_name(reader), "file metrics", size);
+            // aligned (O_DIRECT) and unaligned parts
+            check(chunked_file_crc32(path, reader, size, 8192) == boost_crc32(data.data(), size),
+                  file_reader_name(reader), "aligned parts", size);
+            check(chunked_file_crc32(path, reader, size, 100003) == boost_crc32(data.data(), size),
+                  file_reader_name(reader), "unaligned parts", size);
+        }
+        unlink(path.c_str());
+    }
+    set_file_reader(FILE_READER_AUTO);
+    printf("Ok\n");
+
+    printf("TEST 7: throttled reading... ");
+    std::string path = std::string(dir) + "/data";
+    FILE *f = fopen(path.c_str(), "wb");
+    const size_t size = 1024 * 1024;
+    std::vector<uint8_t> zeros(size);
+    if (!f || fwrite(zeros.data(), 1, size, f) != size) {
+        printf("failed: can't write file\n");
+        return 1;
+    }
+    fclose(f);
+    ThrottleConfig throttle = {4 * 1024 * 1024, 0, 0, 0, 0};
+    throttle_setup(&throttle);
+    set_file_reader(FILE_READER_PREAD);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < 3; ++i)
+        check(calc_file_crc32(dir, "data") == boost_crc32(zeros.data(), size), "pread", "throttled crc32", size);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    // 3 MiB at 4 MiB/sec, the bucket's burst is 0.1 sec
+    double sec = end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1e9;
+    check(sec >= 0.5 && stats_get(STAT_THROTTLE_WAIT_NS) > 0, "pread", "read rate limit", size);
+    throttle = ThrottleConfig();
+    throttle_setup(&throttle);
+    set_file_reader(FILE_READER_AUTO);
+    unlink(path.c_str());
+    rmdir(dir);
+    printf("Ok\n");
+
+    printf("TEST 8: hash algorithms' known values, split buffers and parts... ");
+    check(hex_digest(HASH_CRC32, check_str, strlen(check_str)) == "cbf43926", "crc32", "check value", 9);
+    check(hex_digest(HASH_CRC32C, check_str, strlen(check_str)) == "e3069283", "crc32c", "check value", 9);
+    check(hex_digest(HASH_XXH3_64, "abc", 3) == "78af5f94892f3950", "xxh3-64", "known value", 3);
+    check(hex_digest(HASH_XXH3_128, "abc", 3) == "06b05ab6733a618578af5f94892f3950", "xxh3-128", "known value", 3);
+    check(hex_digest(HASH_BLAKE3, "", 0) == "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262",
+          "blake3", "known value", 0);
+    // official vectors whole and by odd pieces, which cross stripes, blocks and chunks
+    for (const auto &vector: xxh3_vectors) {
+        std::vector<uint8_t> input = xxh_sanity_buffer(vector.len);
+        for (size_t piece: {vector.len ? vector.len : 1, static_cast<size_t>(1), static_cast<size_t>(63)}) {
+            check(hex_pieces_digest(HASH_XXH3_64, input.data(), vector.len, piece) == vector.xxh3_64,
+                  "xxh3-64", "sanity vector", vector.len);
+            check(hex_pieces_digest(HASH_XXH3_128, input.data(), vector.len, piece) == vector.xxh3_128,
+                  "xxh3-128", "sanity vector", vector.len);
+        }
+    }
+    for (const auto &vector: blake3_vectors) {
+        std::vector<uint8_t> input = blake3_vector_input(vector.len);
+        for (size_t piece: {vector.len ? vector.len : 1, static_cast<size_t>(63), static_cast<size_t>(1000)}) {
+            check(hex_pieces_digest(HASH_BLAKE3, input.data(), vector.len, piece) == vector.blake3,
+                  "blake3", "test vector", vector.len);
+        }
+        if (hash_can_split(1024) && vector.len)
+            check(hex_parts_digest(HASH_BLAKE3, input.data(), vector.len, 1024) == vector.blake3,
+                  "blake3", "test vector by parts", vector.len);
+    }
+    for (int a = 0; a < HASH_ALGO_COUNT; ++a) {
+        HashAlgo algo = static_cast<HashAlgo>(a);
+        for (int i = 0; i < 50; ++i) {
+            size_t len = i < 10 ? static_cast<size_t>(i) * 111 : rnd() % data.size();
+            size_t split = len ? rnd() % (len + 1) : 0;
+            std::string expected = hex_digest(algo, data.data(), len);
+            HashState state;
+            FileAttr digest;
+            hash_begin(&state);
+            hash_update(&state, data.data(), split);
+            hash_update(&state, data.data() + split, len - split);
+            hash_end(&state, &digest);
+            check(digest.size == hash_digest_size(algo) && digest_hex(digest) == expected,
+                  hash_algo_name(algo), "split buffer", len);
+            if (hash_can_split(65536))
+                check(hex_parts_digest(algo, data.data(), len, 65536) == expected,
+                      hash_algo_name(algo), "parts", len);
+        }
+    }
+    hash_set_algo(HASH_CRC32);
+    printf("Ok\n");
+
+    printf("TEST 9: no heap allocations per file in steady state... ");
+    strcpy(dir, "/tmp/crc32_test_XXXXXX");
+    if (!mkdtemp(dir)) {
+        printf("failed: can't create directory\n");
+        return 1;
+    }
+    // long names don't fit into std::string's inline buffer
+    std::vector<std::string> paths;
+    std::vector<uint32_t> crcs;
+    for (int i = 0; i < 64; ++i) {
+        size_t len = i % 4 == 3 ? 300 * 1024 + static_cast<size_t>(i) : static_cast<size_t>(i) * 1000;
+        paths.push_back(std::string(dir) + "/file_with_a_long_name_" + std::to_string(i));
+        crcs.push_back(boost_crc32(data.data(), len));
+        FILE *file = fopen(paths.back().c_str(), "wb");
+        if (!file || fwrite(data.data(), 1, len, file) != len) {
+            printf("failed: can't write file\n");
+            return 1;
+        }
+        fclose(file);
+    }
+    check(hash_pool_start(4) == 0, "pool", "start", 0);
+    uint64_t pool_allocations = 0, hash_allocations = 0;
+    for (int round = 0; round < 3; ++round) {
+        // the first rounds allocate workers' buffers
+        if (round == 2) {
+            pool_allocations = allocations.load();
+            hash_allocations = stats_get(STAT_HASH_ALLOCATIONS);
+        }
+        pool_matches = 0;
+        for (size_t i = 0; i < paths.size(); ++i)
+            hash_pool_submit(paths[i].c_str(), NULL, pool_result, &crcs[i]);
+        hash_pool_flush();
+        check(pool_matches == static_cast<int>(paths.size()), "pool", "file crc32", paths.size());
+    }
+    check(allocations.load() == pool_allocations, "pool", "heap allocations", allocations.load() - pool_allocations);
+    check(stats_get(STAT_HASH_ALLOCATIONS) == hash_allocations, "pool", "hash allocations counter", 0);
+    hash_pool_stop();
+    for (const std::string &file: paths)
+        unlink(file.c_str());
+    rmdir(dir);
+    printf("Ok\n");
+
+    printf("TEST 10: rate limiter's back-off and recovery... ");
+    ThrottleStats throttle_stats;
+    // unlimited reading backs off from the floor when the achieved rate is low
+    throttle = ThrottleConfig();
+    throttle.load_limit = 1;
+    throttle_set_pressure_probe(pressure_probe);
+    throttle_setup(&throttle);
+    throttle_get_stats(&throttle_stats);
+    uint64_t backoffs = throttle_stats.backoffs;
+    const uint64_t min_base = 4 << 20;
+    sample_pressure(1);
+    throttle_get_stats(&throttle_stats);
+    check(throttle_stats.bytes_per_sec == min_base / 2 && throttle_stats.backoffs == backoffs + 1,
+          "throttle", "first back-off", throttle_stats.bytes_per_sec);
+    sample_pressure(1);
+    throttle_get_stats(&throttle_stats);
+    check(throttle_stats.bytes_per_sec == min_base / 4 && throttle_stats.backoffs == backoffs + 2,
+          "throttle", "second back-off", throttle_stats.bytes_per_sec);
+    sample_pressure(0);
+    throttle_get_stats(&throttle_stats);
+    check(throttle_stats.bytes_per_sec == min_base / 2 && throttle_stats.backoffs == backoffs + 2,
+          "throttle", "first recovery", throttle_stats.bytes_per_sec);
+    sample_pressure(0);
+    throttle_get_stats(&throttle_stats);
+    check(throttle_stats.bytes_per_sec == 0, "throttle", "full recovery", throttle_stats.bytes_per_sec);
+    // pieces cost more than the longest sleep below 64 KiB/s, the rate is kept anyway
+    throttle = ThrottleConfig();
+    throttle.bytes_per_sec = 32 * 1024;
+    throttle_setup(&throttle);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    throttle_bytes(96 * 1024);
+    double low_rate_sec = elapsed_sec(start);
+    // 3 sec for the bytes without the burst allowance of 0.1 sec
+    check(low_rate_sec > 2.8 && low_rate_sec < 4, "throttle", "low rate", 96 * 1024);
+    throttle = ThrottleConfig();
+    throttle_setup(&throttle);
+    throttle_set_pressure_probe(NULL);
+    printf("Ok\n");
+
+    if (fails) {
+        printf("%d checks failed\n", fails);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,240 @@
+#include "crc32check.h"
+#include "baseline_db.h"
+#include "file_reader.h"
+#include "hash_engine.h"
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <cerrno>
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct Crc32Check {
+    HashAlgo       algo;
+    FileReaderKind reader;
+    unsigned       threads;
+    std::mutex     lock; // guards references
+    std::unordered_map<std::string, FileAttr> references;
+};
+
+struct tree_diff {
+    std::string    file;
+    Crc32CheckDiff diff;
+    FileAttr       digest;
+    FileAttr       reference;
+};
+
+static void hash_file_data(const void *buf, size_t len, void *ctx) {
+    hash_update(static_cast<HashState *>(ctx), buf, len);
+}
+
+static int hash_one_file(const Crc32Check *check, const char *file, FileAttr *digest) {
+    HashState state;
+    hash_begin_algo(&state, check->algo);
+    if (read_file(file, check->reader, hash_file_data, &state)) {
+        digest->size = hash_digest_size(check->algo);
+        memset(digest->bytes, 0, digest->size);
+        return 1;
+    }
+    hash_end(&state, digest);
+    return 0;
+}
+
+// collect regular files of directory tree, symlinks aren't followed
+// param[out] unreadable_dirs - subdirectories which couldn't be listed
+// return operation result: 0 - ok, 1 - the directory couldn't be listed
+static int collect_files(const std::string &dir, std::vector<std::string> &files,
+                         std::vector<std::string> &unreadable_dirs) {
+    DIR *d = opendir(dir.c_str());
+    if (!d)
+        return 1;
+    std::vector<std::string> subdirs;
+    struct dirent *entry;
+    errno = 0;
+    while ((entry = readdir(d)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        unsigned char type = entry->d_type;
+        if (type == DT_UNKNOWN) {
+            struct stat sb;
+            if (fstatat(dirfd(d), entry->d_name, &sb, AT_SYMLINK_NOFOLLOW) != 0)
+                continue;
+            type = S_ISDIR(sb.st_mode) ? DT_DIR : S_ISREG(sb.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+        std::string path = dir == "/" ? "/" + std::string(entry->d_name) : dir + "/" + entry->d_name;
+        if (type == DT_DIR)
+            subdirs.push_back(path);
+        else if (type == DT_REG)
+            files.push_back(path);
+        errno = 0;
+    }
+    int result = errno ? 1 : 0;
+    closedir(d);
+    for (auto &it: subdirs) {
+        if (collect_files(it, files, unreadable_dirs))
+            unreadable_dirs.push_back(it);
+    }
+    return result;
+}
+
+Crc32Check *crc32check_create(HashAlgo algo, FileReaderKind reader, int threads) {
+    if (algo < 0 || algo >= HASH_ALGO_COUNT || reader < 0 || reader >= FILE_READER_COUNT)
+        return NULL;
+    Crc32Check *check = new (std::nothrow) Crc32Check();
+    if (!check)
+        return NULL;
+    check->algo = algo;
+    check->reader = reader;
+    check->threads = threads > 0 ? static_cast<unsigned>(threads) : std::max(1u, std::thread::hardware_concurrency());
+    return check;
+}
+
+void crc32check_destroy(Crc32Check *check) {
+    delete check;
+}
+
+void crc32check_begin(const Crc32Check *check, HashState *state) {
+    hash_begin_algo(state, check->algo);
+}
+
+void crc32check_update(HashState *state, const void *buf, size_t len) {
+    hash_update(state, buf, len);
+}
+
+void crc32check_end(const HashState *state, FileAttr *digest) {
+    hash_end(state, digest);
+}
+
+// hash files by up to check->threads threads
+// param[out] failures - 1 for unreadable files (NULL - not needed)
+static int hash_batch(const Crc32Check *check, const char *const *files, size_t count,
+                      FileAttr *digests, char *failures) {
+    std::atomic<size_t> next(0);
+    std::atomic<int> failed(0);
+    auto worker = [&]() {
+        size_t i;
+        while ((i = next.fetch_add(1)) < count) {
+            int result = hash_one_file(check, files[i], &digests[i]);
+            if (failures)
+                failures[i] = static_cast<char>(result);
+            if (result)
+                failed.fetch_add(1);
+        }
+    };
+    size_t threads = std::min<size_t>(check->threads, count);
+    try {
+        std::vector<std::thread> workers;
+        // the calling thread is a worker too
+        for (size_t i = 1; i < threads; ++i)
+            workers.emplace_back(worker);
+        worker();
+        for (auto &it: workers)
+            it.join();
+    }  catch (...) {
+        return -1;
+    }
+    return failed.load();
+}
+
+int crc32check_hash_files(Crc32Check *check, const char *const *files, size_t count, FileAttr *digests) {
+    return hash_batch(check, files, count, digests, NULL);
+}
+
+int crc32check_set_reference(Crc32Check *check, const char *file, const FileAttr *digest) {
+    if (digest->size != hash_digest_size(check->algo))
+        return 1;
+    try {
+        std::lock_guard<std::mutex> guard(check->lock);
+        check->references[file] = *digest;
+    }  catch (...) {
+        return 1;
+    }
+    return 0;
+}
+
+static int add_reference(const char *file_name, const FileAttr *file_attr, uint64_t, void *ctx) {
+    Crc32Check *check = static_cast<Crc32Check *>(ctx);
+    try {
+        check->references[file_name] = *file_attr;
+    }  catch (...) {
+        return 1;
+    }
+    return 0;
+}
+
+BaselineStatus crc32check_load_baseline(Crc32Check *check, const char *path) {
+    std::lock_guard<std::mutex> guard(check->lock);
+    return read_baseline(path, check->algo, add_reference, NULL, check);
+}
+
+size_t crc32check_reference_count(Crc32Check *check) {
+    std::lock_guard<std::mutex> guard(check->lock);
+    return check->references.size();
+}
+
+int crc32check_verify_tree(Crc32Check *check, const char *dir, crc32check_diff_fn on_diff, void *ctx) {
+    std::vector<tree_diff> diffs;
+    try {
+        std::string root(dir);
+        while (root.size() > 1 && root.back() == '/')
+            root.pop_back();
+        std::vector<std::string> files, unreadable_dirs;
+        if (collect_files(root, files, unreadable_dirs))
+            return -1;
+        std::sort(files.begin(), files.end());
+        std::vector<const char *> paths;
+        paths.reserve(files.size());
+        for (auto &it: files)
+            paths.push_back(it.c_str());
+        std::vector<FileAttr> digests(files.size());
+        std::vector<char> failures(files.size());
+        if (hash_batch(check, paths.data(), paths.size(), digests.data(), failures.data()) < 0)
+            return -1;
+        std::string prefix = root == "/" ? root : root + "/";
+        std::lock_guard<std::mutex> guard(check->lock);
+        for (size_t i = 0; i < files.size(); ++i) {
+            auto ref = check->references.find(files[i]);
+            bool found = ref != check->references.end();
+            if (failures[i]) {
+                diffs.push_back({files[i], CRC32CHECK_UNREADABLE_FILE, FileAttr(), found ? ref->second : FileAttr()});
+            } else if (!found) {
+                diffs.push_back({files[i], CRC32CHECK_NEW_FILE, digests[i], FileAttr()});
+            } else if (memcmp(digests[i].bytes, ref->second.bytes, digests[i].size) != 0) {
+                diffs.push_back({files[i], CRC32CHECK_CHANGED_FILE, digests[i], ref->second});
+            }
+        }
+        for (auto &it: unreadable_dirs)
+            diffs.push_back({it, CRC32CHECK_UNREADABLE_DIR, FileAttr(), FileAttr()});
+        // reference files of unreadable directories aren't known to be deleted
+        auto in_unreadable_dir = [&unreadable_dirs](const std::string &file) {
+            for (auto &it: unreadable_dirs) {
+                if (file.size() > it.size() && file[it.size()] == '/' && file.compare(0, it.size(), it) == 0)
+                    return true;
+            }
+            return false;
+        };
+        for (auto &it: check->references) {
+            if (it.first.compare(0, prefix.size(), prefix) == 0 &&
+                !std::binary_search(files.begin(), files.end(), it.first) && !in_unreadable_dir(it.first))
+                diffs.push_back({it.first, CRC32CHECK_DELETED_FILE, FileAttr(), it.second});
+        }
+    }  catch (...) {
+        return -1;
+    }
+    std::sort(diffs.begin(), diffs.end(), [](const tree_diff &a, const tree_diff &b) { return a.file < b.file; });
+    if (on_diff) {
+        for (auto &it: diffs) {
+            bool has_digest = it.diff == CRC32CHECK_NEW_FILE || it.diff == CRC32CHECK_CHANGED_FILE;
+            on_diff(it.file.c_str(), it.diff, has_digest ? &it.digest : NULL,
+                    it.reference.size ? &it.reference : NULL, ctx);
+        }
+    }
+    return static_cast<int>(diffs.size());
+}
@@ -0,0 +1,94 @@
+#ifndef CRC32CHECK_HEADER
+#define CRC32CHECK_HEADER
+
+#include <stddef.h>
+#include <stdint.h>
+#include "crc32check_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// embeddable checker (libcrc32check): a context keeps its own reference digests
+// instead of the deamon's file repository, so contexts are independent and
+// one context can be used by several threads.
+
+typedef struct Crc32Check Crc32Check;
+
+// difference between a tree and the reference digests
+typedef enum {
+    CRC32CHECK_NEW_FILE,        // file has no reference digest
+    CRC32CHECK_CHANGED_FILE,    // file's digest differs from the reference one
+    CRC32CHECK_DELETED_FILE,    // reference file wasn't found
+    CRC32CHECK_UNREADABLE_FILE, // file couldn't be read
+    CRC32CHECK_UNREADABLE_DIR   // subdirectory couldn't be listed, its reference files aren't compared
+} Crc32CheckDiff;
+
+// difference handler, it may call the context's functions
+// param[in] file - file's or unreadable directory's path
+// param[in] diff - difference's type
+// param[in] digest - file's digest (NULL for deleted and unreadable files, directories)
+// param[in] reference - reference digest (NULL for new and unreadable new files, directories)
+// param[in] ctx - user context from crc32check_verify_tree
+typedef void (*crc32check_diff_fn)(const char *file, Crc32CheckDiff diff, const FileAttr *digest,
+                                   const FileAttr *reference, void *ctx);
+
+// create context
+// param[in] algo - hash algorithm of digests
+// param[in] reader - file reading backend
+// param[in] threads - max threads hashing files of one call (<= 0 - number of CPUs)
+// return context, NULL - error
+Crc32Check *crc32check_create(HashAlgo algo, FileReaderKind reader, int threads);
+
+// free context
+void crc32check_destroy(Crc32Check *check);
+
+// start hashing data in memory with the context's algorithm
+// param[out] state - hashing state, it belongs to the caller
+void crc32check_begin(const Crc32Check *check, HashState *state);
+
+// continue hashing
+// param[in] buf - data
+// param[in] len - data size in bytes
+void crc32check_update(HashState *state, const void *buf, size_t len);
+
+// get digest of hashed data
+// param[out] digest - digest
+void crc32check_end(const HashState *state, FileAttr *digest);
+
+// hash files in parallel
+// param[in] files - paths to files
+// param[in] count - number of files
+// param[out] digests - files' digests in files' order, zero for unreadable files
+// return number of unreadable files, -1 - error
+int crc32check_hash_files(Crc32Check *check, const char *const *files, size_t count, FileAttr *digests);
+
+// set file's reference digest
+// param[in] file - file's path
+// param[in] digest - digest of the context's algorithm
+// return operation result: 0 - ok, 1 - error
+int crc32check_set_reference(Crc32Check *check, const char *file, const FileAttr *digest);
+
+// add reference digests of baseline file saved by the deamon
+// param[in] path - path to baseline file
+// return operation's status (see BaselineStatus)
+BaselineStatus crc32check_load_baseline(Crc32Check *check, const char *path);
+
+// return number of reference digests
+size_t crc32check_reference_count(Crc32Check *check);
+
+// hash all regular files of directory tree and compare them with reference
+// digests. Reference files under the directory which weren't found are deleted.
+// Differences are passed in path order after the tree is hashed.
+// Subdirectories which can't be listed are differences too.
+// param[in] dir - directory, paths are dir/relative path (as in the baseline)
+// param[in] on_diff - difference handler (NULL - only count)
+// param[in] ctx - user context for on_diff
+// return number of differences, -1 - error (dir can't be listed)
+int crc32check_verify_tree(Crc32Check *check, const char *dir, crc32check_diff_fn on_diff, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CRC32CHECK_HEADER
@@ -0,0 +1,169 @@
+#include "crc32check.h"
+#include "baseline_db.h"
+#include "file_repo.h"
+#include "hash_engine.h"
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static int fails = 0;
+
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        printf("failed: %s\n", what);
+        fails++;
+    }
+}
+
+static void write_file(const std::string &path, const std::string &data) {
+    FILE *f = fopen(path.c_str(), "wb");
+    if (f) {
+        fwrite(data.data(), 1, data.size(), f);
+        fclose(f);
+    }
+}
+
+static bool same_digest(const FileAttr &a, const FileAttr &b) {
+    return a.size == b.size && memcmp(a.bytes, b.bytes, a.size) == 0;
+}
+
+struct diff_log {
+    std::vector<std::string> files;
+    std::vector<Crc32CheckDiff> diffs;
+    bool pointers_ok = true;
+};
+
+static void log_diff(const char *file, Crc32CheckDiff diff, const FileAttr *digest,
+                     const FileAttr *reference, void *ctx) {
+    diff_log *log = static_cast<diff_log *>(ctx);
+    log->files.push_back(file);
+    log->diffs.push_back(diff);
+    switch (diff) {
+    case CRC32CHECK_NEW_FILE:
+        log->pointers_ok &= digest && !reference;
+        break;
+    case CRC32CHECK_CHANGED_FILE:
+        log->pointers_ok &= digest && reference;
+        break;
+    case CRC32CHECK_UNREADABLE_DIR:
+        log->pointers_ok &= !digest && !reference;
+        break;
+    default:
+        log->pointers_ok &= !digest;
+        break;
+    }
+}
+
+int main() {
+    char dir_template[] = "/tmp/crc32check_test.XXXXXX";
+    const char *dir = mkdtemp(dir_template);
+    if (!dir) {
+        printf("failed: temporary directory\n");
+        return 1;
+    }
+    std::string root(dir);
+    mkdir((root + "/sub").c_str(), 0755);
+    std::vector<std::string> files = {root + "/a.txt", root + "/b.txt", root + "/sub/c.txt"};
+    std::string big(3 * 1024 * 1024 + 17, 'x');
+    for (size_t i = 0; i < big.size(); i += 4093)
+        big[i] = static_cast<char>(i);
+    write_file(files[0], "123456789");
+    write_file(files[1], big);
+    write_file(files[2], "");
+
+    for (int algo = HASH_CRC32; algo < HASH_ALGO_COUNT; ++algo) {
+        Crc32Check *ctx = crc32check_create(static_cast<HashAlgo>(algo), FILE_READER_AUTO, 2);
+        check(ctx != NULL, "create");
+        if (!ctx)
+            continue;
+        // streaming digest of data in memory equals file's digest
+        std::vector<const char *> paths = {files[0].c_str(), files[1].c_str(), files[2].c_str()};
+        FileAttr digests[3];
+        check(crc32check_hash_files(ctx, paths.data(), paths.size(), digests) == 0, "hash files");
+        HashState state;
+        crc32check_begin(ctx, &state);
+        for (size_t i = 0; i < big.size(); i += 1000)
+            crc32check_update(&state, big.data() + i, std::min<size_t>(1000, big.size() - i));
+        FileAttr streamed;
+        crc32check_end(&state, &streamed);
+        check(same_digest(streamed, digests[1]), "streaming digest");
+        check(streamed.size == hash_digest_size(static_cast<HashAlgo>(algo)), "digest size");
+        if (algo == HASH_CRC32)
+            check(digests[0].size == 4 && digests[0].bytes[0] == 0xCB && digests[0].bytes[3] == 0x26, "crc32 check value");
+
+        // the first verification reports all files as new
+        diff_log log;
+        check(crc32check_verify_tree(ctx, dir, log_diff, &log) == 3, "new files");
+        check(log.files == files && log.diffs[0] == CRC32CHECK_NEW_FILE && log.pointers_ok, "new files' order");
+        for (size_t i = 0; i < files.size(); ++i)
+            check(crc32check_set_reference(ctx, files[i].c_str(), &digests[i]) == 0, "set reference");
+        check(crc32check_verify_tree(ctx, (root + "/").c_str(), NULL, NULL) == 0, "unchanged tree");
+        check(crc32check_reference_count(ctx) == 3, "reference count");
+        FileAttr wrong_size = digests[0];
+        wrong_size.size = 3;
+        check(crc32check_set_reference(ctx, files[0].c_str(), &wrong_size) != 0, "wrong digest size");
+
+        // change, delete and add files
+        write_file(files[0], "123456780");
+        unlink(files[2].c_str());
+        write_file(root + "/sub/d.txt", "new");
+        log = diff_log();
+        check(crc32check_verify_tree(ctx, dir, log_diff, &log) == 3, "changed tree");
+        check(log.files.size() == 3 && log.files[0] == files[0] && log.diffs[0] == CRC32CHECK_CHANGED_FILE &&
+              log.diffs[1] == CRC32CHECK_DELETED_FILE && log.diffs[2] == CRC32CHECK_NEW_FILE && log.pointers_ok,
+              "changed tree's diffs");
+        // references outside of the directory aren't deleted files
+        log = diff_log();
+        check(crc32check_verify_tree(ctx, (root + "/sub").c_str(), log_diff, &log) == 2, "subtree");
+        check(crc32check_verify_tree(ctx, (root + "/missing").c_str(), NULL, NULL) == -1, "missing tree");
+        // files of unreadable directories aren't deleted, root reads directories regardless of their mode
+        chmod((root + "/sub").c_str(), 0);
+        if (access((root + "/sub").c_str(), R_OK) != 0) {
+            log = diff_log();
+            check(crc32check_verify_tree(ctx, dir, log_diff, &log) == 2, "unreadable directory");
+            check(log.files.size() == 2 && log.diffs[0] == CRC32CHECK_CHANGED_FILE && log.files[1] == root + "/sub" &&
+                  log.diffs[1] == CRC32CHECK_UNREADABLE_DIR && log.pointers_ok, "unreadable directory's diffs");
+        }
+        chmod((root + "/sub").c_str(), 0755);
+        crc32check_destroy(ctx);
+        write_file(files[0], "123456789");
+        write_file(files[2], "");
+        unlink((root + "/sub/d.txt").c_str());
+    }
+
+    // baseline saved by the deamon is verified without its file repository
+    hash_set_algo(HASH_XXH3_64);
+    check(set_file_attr_size(hash_digest_size(HASH_XXH3_64)) == 0, "xxh3 digest size");
+    Crc32Check *ctx = crc32check_create(HASH_XXH3_64, FILE_READER_PREAD, 0);
+    std::vector<const char *> paths = {files[0].c_str(), files[1].c_str(), files[2].c_str()};
+    FileAttr digests[3];
+    check(crc32check_hash_files(ctx, paths.data(), paths.size(), digests) == 0, "hash files for baseline");
+    for (size_t i = 0; i < files.size(); ++i)
+        check(push_file_digest(files[i].c_str(), &digests[i], 0) == 0, "push file");
+    std::string baseline = root + "/baseline.db";
+    check(save_baseline(baseline.c_str()) == BASELINE_OK, "save baseline");
+    clear_files();
+    check(crc32check_load_baseline(ctx, baseline.c_str()) == BASELINE_OK && crc32check_reference_count(ctx) == 3,
+          "load baseline");
+    unlink(baseline.c_str());
+    check(crc32check_verify_tree(ctx, dir, NULL, NULL) == 0, "verify baseline");
+    Crc32Check *other = crc32check_create(HASH_BLAKE3, FILE_READER_AUTO, 1);
+    check(crc32check_load_baseline(other, baseline.c_str()) == BASELINE_NOT_FOUND, "missing baseline");
+    crc32check_destroy(other);
+    crc32check_destroy(ctx);
+
+    for (auto &it: files)
+        unlink(it.c_str());
+    rmdir((root + "/sub").c_str());
+    rmdir(dir);
+    printf("Ok\n");
+    if (fails) {
+        printf("%d checks failed\n", fails);
+        return 1;
+    }
+    return 0;
+}
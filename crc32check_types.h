@@ -0,0 +1,91 @@
+#ifndef CRC32CHECK_TYPES_HEADER
+#define CRC32CHECK_TYPES_HEADER
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// types of libcrc32check's API (see crc32check.h), the library's internal
+// headers share them
+
+// max size of file's attribute in bytes
+#define FILE_ATTR_MAX_SIZE 32
+
+// file's attribute: digest of its content, size bytes are used
+typedef struct {
+    uint32_t size;
+    uint8_t  bytes[FILE_ATTR_MAX_SIZE];
+} FileAttr;
+
+// file reading backends
+typedef enum {
+    FILE_READER_AUTO,   // backend is chosen by file size
+    FILE_READER_PREAD,  // large buffer pread, read pages are dropped from page cache
+    FILE_READER_MMAP,   // mmap with MADV_SEQUENTIAL
+    FILE_READER_DIRECT, // O_DIRECT with aligned buffer (bypasses page cache)
+    FILE_READER_COUNT
+} FileReaderKind;
+
+// baseline file's status (see baseline_db.h)
+typedef enum {
+    BASELINE_OK,
+    BASELINE_NOT_FOUND,  // no baseline file
+    BASELINE_CORRUPTED,  // wrong format, version or checksum
+    BASELINE_OTHER_HASH, // file has digests of another hash algorithm
+    BASELINE_ERROR,      // system error
+    BASELINE_OLD_VERSION // version 1 file, its names are relative to a directory (see migrate_baseline)
+} BaselineStatus;
+
+// hash algorithms, digests are stored as big-endian numbers (crc32, crc32c,
+// xxh3) or as bytes (blake3)
+typedef enum {
+    HASH_CRC32,    // IEEE crc32, 4 bytes (see crc32_update)
+    HASH_CRC32C,   // Castagnoli crc32, 4 bytes, SSE4.2 instruction
+    HASH_XXH3_64,  // XXH3 64-bit, 8 bytes
+    HASH_XXH3_128, // XXH3 128-bit, 16 bytes
+    HASH_BLAKE3,   // BLAKE3, 32 bytes, large files' chunks are hashed by several workers
+    HASH_ALGO_COUNT
+} HashAlgo;
+
+// XXH3 streaming state
+typedef struct {
+    uint64_t acc[8];
+    uint8_t  buffer[256];
+    uint64_t total_len;
+    uint32_t buffered; // bytes in buffer
+    uint32_t stripes;  // stripes accumulated in the current block
+} Xxh3State;
+
+// max height of BLAKE3 chaining values' stack (2^54 chunks)
+#define BLAKE3_MAX_DEPTH   54
+
+// BLAKE3 streaming state
+typedef struct {
+    uint32_t cv[8];                        // current chunk's chaining value
+    uint64_t chunk_counter;                // current chunk's index in the whole input
+    uint8_t  block[64];
+    uint32_t block_len;                    // bytes in block
+    uint32_t blocks_compressed;            // current chunk's compressed blocks
+    uint64_t chunks;                       // finished chunks of this state
+    uint32_t stack_len;
+    uint32_t stack[BLAKE3_MAX_DEPTH][8];   // chaining values of finished subtrees
+} Blake3State;
+
+// hashing state
+typedef struct {
+    HashAlgo algo;
+    uint64_t len; // bytes hashed
+    union {
+        uint32_t    crc;
+        Xxh3State   xxh3;
+        Blake3State blake3;
+    } u;
+} HashState;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CRC32CHECK_TYPES_HEADER
@@ -1,275 +1,945 @@
+#define _GNU_SOURCE // accept4
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <sys/msg.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <signal.h>
 #include <syslog.h>
-#include <dirent.h>
-#include <signal.h>
+#include <stdatomic.h>
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
 #include <time.h>
 #include <linux/limits.h>
 
-#include "crc32.h"
+#include "baseline_db.h"
+#include "check_stats.h"
+#include "daemon.h"
+#include "dir_check.h"
+#include "dir_watch.h"
 #include "file_repo.h"
+#include "hash_pool.h"
+#include "report.h"
+#include "set_round.h"
+#include "throttle.h"
+#include "uring_scan.h"
 
 // deamon's log
 #define DAEMON_LOG_FILE  "crc32_check_daemon"
 
-// check request type for queue
-#define MSG_TYPE 1
+// control socket's clients served at once
+#define CONTROL_CLIENTS  16
+
+// time a control socket's client has to send its command and to read the reply
+#define CONTROL_CLIENT_TIMEOUT_MS 5000
+
+// bytes a watch set of weight 1 reads in its turn while several sets are checked
+#define SCHEDULER_QUANTUM (64ULL << 20)
 
-// data type for request
+// a check turn pauses after this time or size of files, so signals, timers and
+// commands are served during the check
+#define LOOP_PAUSE_NS     (100 * 1000000ULL)
+#define LOOP_PAUSE_BYTES  (16ULL << 20)
+
+// epoll events' sources, clients are CONTROL_CLIENT + index
+typedef enum {
+    EVENT_SIGNAL,
+    EVENT_TIMER,
+    EVENT_WATCH,
+    EVENT_POOL,
+    EVENT_CONTROL,
+    EVENT_CLIENT
+} EventSource;
+
+// epoll source of watch set's timer: set's index is in the high half
+#define SET_TIMER_EVENT(set) ((uint64_t)(set) << 32 | EVENT_TIMER)
+
+// pending check type
 typedef enum {
     CHECK_REQUEST,
-    STOP_DAEMON
-} RequestData;
+    CHECK_SLICE_REQUEST,
+    CHECK_DIRTY_REQUEST,
+    REQUEST_COUNT
+} RequestType;
+
+// control socket client's state
+typedef enum {
+    CLIENT_READING,  // command line is read
+    CLIENT_CHECKING, // command waits for single file's check, the client isn't polled
+    CLIENT_WRITING   // reply is sent
+} ClientState;
 
-// request type for queue
+// control socket's client: command line is read and reply is sent without
+// blocking the loop
 typedef struct {
-   long type;
-   char data;
-} CheckRequest;
+    int         fd;           // -1 - free slot
+    ClientState state;
+    int64_t     deadline_ms;  // end of reading or writing (CLOCK_MONOTONIC), the client is closed then
+    size_t      len;
+    char        line[PATH_MAX + 16];
+    char       *reply;        // reply's buffer
+    size_t      reply_len;
+    size_t      reply_sent;
+    size_t      reply_size;   // buffer's capacity
+    int         reply_failed; // out of memory, the reply is lost
+} ControlClient;
 
-// queue id for check directory request
-static int queue_id;
+static int epoll_fd = -1;
+static int signal_fd = -1;
+// directory watcher's wake up
+static int watch_fd = -1;
+// hash workers' wake up: single file's check is finished
+static int pool_fd = -1;
+static int control_fd = -1;
+static const char *control_path;
+static ControlClient clients[CONTROL_CLIENTS];
 
-// path to directory
-static char path_to_check_directory[PATH_MAX];
+// pending checks: at most one of each type, newer requests are merged into it
+static atomic_int pending_requests[REQUEST_COUNT];
 
-// timer for periodical check
-static timer_t timerid;
+// requests merged into pending ones since the check started
+static atomic_ulong merged_requests[REQUEST_COUNT];
 
-static void request_for_check();
-static void sig_on();
+// the directory watcher lost events, changes of verified trees could be missed
+static atomic_int events_lost;
 
-static void sig_handler(int signo) {
-    if (signo == SIGUSR1) { //request from user
-        request_for_check(CHECK_REQUEST);
-    } else if (signo == SIGRTMIN) { // request from timer
-        request_for_check(CHECK_REQUEST);
-    } else if (signo == SIGTERM) {
-        request_for_check(STOP_DAEMON);
+// SIGTERM was received
+static int stop_requested;
+
+// min time between full checks of a watch set (see DaemonConfig)
+static int min_interval_s;
+
+// timer requests budgeted slices of the check cycle instead of full checks
+static int sliced_checks;
+
+// slice's budget (see DaemonConfig)
+static uint64_t slice_bytes;
+static uint64_t slice_ns;
+
+// watch set's place in the check scheduler. Requests of the set are pending
+// until the set joins the round (see set_round.h).
+typedef struct {
+    int             timer_fd;
+    RequestType     request;          // pending check (REQUEST_COUNT - none)
+    unsigned long   merged;           // requests merged into the pending check
+    struct timespec requested;        // pending check's first request (CLOCK_MONOTONIC)
+    int             sliced;           // running check is timer's slice
+    struct timespec started;          // running check's request
+    uint64_t        slice_bytes;      // running slice's remaining budget
+    uint64_t        slice_ns;
+    struct timespec last_check_end;   // end of the set's last check or initial scan
+    int             postponed_logged; // pending check's postponing was logged
+    uint64_t        baseline_version; // set's reference info in its baseline (see get_watch_set_version)
+    CheckTurn       turn;             // running turn, it's continued while it's paused
+    char            cursor_path[PATH_MAX]; // check cycle's cursor next to set's baseline ("" - isn't saved)
+} SetSchedule;
+
+static SetSchedule *schedules;
+static int sets_count;
+
+// round of running checks
+static SetRound check_round;
+
+// set of the paused turn (-1 - none)
+static int paused_set = -1;
+
+// request for dir's checking. A request is merged into the same pending one,
+// so slow checks can't be buried by timer's ticks.
+// Called from the deamon's loop and the directory watcher's thread.
+static void request_for_check(RequestType request) {
+    if (atomic_exchange(&pending_requests[request], 1))
+        atomic_fetch_add(&merged_requests[request], 1);
+}
+
+// directory watcher's handler, wakes up the deamon's loop
+static void on_dir_change(int full_check) {
+    if (full_check)
+        atomic_store(&events_lost, 1);
+    request_for_check(full_check ? CHECK_REQUEST : CHECK_DIRTY_REQUEST);
+    uint64_t one = 1;
+    if (write(watch_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        syslog(LOG_ERR, "[ERROR] wake up deamon failed %d\n", errno);
+}
+
+// signals are received via signalfd, the others are ignored like before
+static void block_signals() {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGTERM);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) != 0)
+        syslog(LOG_ERR, "[ERROR] block signals failed\n");
+    const int ignored[] = {SIGQUIT, SIGINT, SIGHUP, SIGCONT, SIGPIPE};
+    for (size_t i = 0; i < sizeof(ignored) / sizeof(ignored[0]); ++i) {
+        if (signal(ignored[i], SIG_IGN) == SIG_ERR)
+            syslog(LOG_ERR, "[ERROR] ignore signal %d failed\n", ignored[i]);
     }
-    sig_on();
 }
 
-// general signal init
-static void (*mysignal(int signo, void (*hndlr)(int)))(int) {
-    struct sigaction act, oact;
-    sigemptyset(&act.sa_mask);
-    act.sa_flags = 0;
-    if (signo == SIGUSR1 || signo == SIGRTMIN || signo == SIGTERM) {
-        act.sa_handler = hndlr;
-        act.sa_flags |= SA_RESTART;
-    } else {
-        act.sa_handler = SIG_IGN;
+// return check's name for log: "Check" and set's name if the deamon has several watch sets
+static const char *get_check_name(char *buf, size_t size, int set) {
+    if (sets_count < 2)
+        return "Check";
+    snprintf(buf, size, "Check of %s", get_watch_set(set)->name);
+    return buf;
+}
+
+// save watch set's files into its baseline file. The only set keeps all files
+// of file repository.
+static void save_set_baseline(int set) {
+    const WatchSet *watch_set = get_watch_set(set);
+    const char *baseline_path = watch_set->baseline_path;
+    uint64_t version = get_watch_set_version(set);
+    BaselineStatus status = sets_count > 1 ?
+        save_baseline_in(baseline_path, watch_set->paths_to_dirs, watch_set->dirs_count) :
+        save_baseline(baseline_path);
+    if (status == BASELINE_OK)
+        schedules[set].baseline_version = version;
+    else
+        syslog(LOG_ERR, "[ERROR] save baseline %s failed\n", baseline_path);
+}
+
+// save watch set's files into its baseline file if they were changed
+static void update_baseline(int set) {
+    if (get_watch_set(set)->baseline_path && get_watch_set_version(set) != schedules[set].baseline_version)
+        save_set_baseline(set);
+}
+
+static void update_baselines() {
+    for (int i = 0; i < sets_count; ++i)
+        update_baseline(i);
+}
+
+// load watch set's reference information from its baseline file or from its directories
+// return 1 - baseline was loaded, 0 - directories were scanned, -1 - baseline can't be used
+static int load_set_info(int set) {
+    const WatchSet *watch_set = get_watch_set(set);
+    const char *baseline_path = watch_set->baseline_path;
+    const char *cursor_path = schedules[set].cursor_path;
+    if (baseline_path) {
+        switch (load_baseline(baseline_path)) {
+        case BASELINE_OK:
+            schedules[set].baseline_version = get_watch_set_version(set);
+            syslog(LOG_NOTICE, "Baseline %s loaded\n", baseline_path);
+            // continue the check cycle of the previous run
+            if (cursor_path[0])
+                load_check_cursor(set, cursor_path);
+            return 1;
+        case BASELINE_NOT_FOUND:
+            break;
+        case BASELINE_OLD_VERSION:
+            // rebuilding would accept changes made before the upgrade as reference
+            if (watch_set->dirs_count != 1 ||
+                migrate_baseline(baseline_path, watch_set->paths_to_dirs[0]) != BASELINE_OK) {
+                syslog(LOG_ERR, "[ERROR] baseline %s has an old format and can't be migrated, "
+                       "remove it to rebuild it from the directories\n", baseline_path);
+                return -1;
+            }
+            syslog(LOG_NOTICE, "Baseline %s of an old format migrated\n", baseline_path);
+            save_set_baseline(set);
+            return 1;
+        case BASELINE_CORRUPTED:
+            syslog(LOG_ERR, "[ERROR] baseline %s is corrupted, it will be rebuilt\n", baseline_path);
+            break;
+        case BASELINE_OTHER_HASH:
+            // rebuilding would accept all changes made since the baseline was written
+            syslog(LOG_ERR, "[ERROR] baseline %s has digests of another hash algorithm than %s, "
+                   "select its algorithm or remove it to rebuild it\n", baseline_path,
+                   hash_algo_name(hash_get_algo()));
+            return -1;
+        case BASELINE_ERROR:
+        default:
+            syslog(LOG_ERR, "[ERROR] load baseline %s failed, it will be rebuilt\n", baseline_path);
+            break;
+        }
     }
-    if (sigaction(signo, &act, &oact) < 0) {
-        return (SIG_ERR);
+    init_set_info(set);
+    update_baseline(set);
+    // no active cycle: the previous run's cursor is removed
+    if (cursor_path[0] && save_check_cursor(set, cursor_path))
+        syslog(LOG_ERR, "[ERROR] remove check cursor %s failed\n", cursor_path);
+    return 0;
+}
+
+// take pending request: requests received after it will be pending again
+static int take_request(RequestType request) {
+    if (!atomic_exchange(&pending_requests[request], 0))
+        return 0;
+    unsigned long merged = atomic_exchange(&merged_requests[request], 0);
+    if (merged) {
+        stats_add(STAT_REQUESTS_MERGED, merged);
+        if (request != CHECK_DIRTY_REQUEST)
+            syslog(LOG_INFO, "%lu check requests were merged into the check\n", merged);
     }
-    return (oact.sa_handler);
+    return 1;
 }
 
-// deamon's signal init
-static void sig_on() {
-    if (mysignal(SIGUSR1, sig_handler) == SIG_ERR) {
-        syslog(LOG_ERR, "[ERROR] SIGUSR1 handling\n");
+// return time till the end of min interval after watch set's previous check (ms, 0 - check can start)
+static int min_interval_wait_ms(int set) {
+    if (min_interval_s == 0)
+        return 0;
+    SetSchedule *schedule = &schedules[set];
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t wait_ms = (int64_t)min_interval_s * 1000 -
+                      (int64_t)(now.tv_sec - schedule->last_check_end.tv_sec) * 1000 -
+                      (now.tv_nsec - schedule->last_check_end.tv_nsec) / 1000000;
+    if (wait_ms <= 0)
+        return 0;
+    if (!schedule->postponed_logged) {
+        char name[128];
+        syslog(LOG_INFO, "%s was postponed for %.3f sec (min interval %d sec)\n",
+               get_check_name(name, sizeof(name), set), wait_ms / 1e3, min_interval_s);
+        schedule->postponed_logged = 1;
     }
-    if (mysignal(SIGQUIT, sig_handler) == SIG_ERR) {
-        syslog(LOG_ERR, "[ERROR] SIGQUIT handling\n");
+    return (int)wait_ms;
+}
+
+// request for watch set's check, it's merged into the set's pending check.
+// A full check supersedes a slice.
+// param[in] request - CHECK_REQUEST or CHECK_SLICE_REQUEST
+// param[in] count - number of requests
+static void request_set_check(int set, RequestType request, unsigned long count) {
+    SetSchedule *schedule = &schedules[set];
+    if (schedule->request == REQUEST_COUNT) {
+        schedule->request = request;
+        clock_gettime(CLOCK_MONOTONIC, &schedule->requested);
+        count--;
+    } else if (request == CHECK_REQUEST) {
+        schedule->request = CHECK_REQUEST;
     }
-    if (mysignal(SIGINT, sig_handler) == SIG_ERR) {
-        syslog(LOG_ERR, "[ERROR] SIGINT handling\n");
+    schedule->merged += count;
+}
+
+// return index of watch set by its name (-1 - unknown set)
+static int find_watch_set(const char *name) {
+    for (int i = 0; i < sets_count; ++i) {
+        if (strcmp(get_watch_set(i)->name, name) == 0)
+            return i;
     }
-    if (mysignal(SIGHUP, sig_handler) == SIG_ERR) {
-        syslog(LOG_ERR, "[ERROR] SIGHUP handling\n");
+    return -1;
+}
+
+static int add_event(int fd, uint64_t source) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = source;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+// create listening control socket, an existing socket file is replaced
+// return operation's result: 0 - ok, -1 - error
+static int open_control_socket(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+    strcpy(addr.sun_path, path);
+    control_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (control_fd < 0)
+        return -1;
+    unlink(path);
+    // the deamon's umask is 0: only the deamon's user can connect
+    mode_t mask = umask(0177);
+    int bound = bind(control_fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(mask);
+    if (bound != 0 || listen(control_fd, CONTROL_CLIENTS) != 0)
+        return -1;
+    control_path = path;
+    return add_event(control_fd, EVENT_CONTROL);
+}
+
+// return CLOCK_MONOTONIC time in ms
+static int64_t monotonic_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static void close_client(ControlClient *client) {
+    close(client->fd);
+    client->fd = -1;
+    client->state = CLIENT_READING;
+    free(client->reply);
+    client->reply = NULL;
+    client->reply_len = client->reply_sent = client->reply_size = 0;
+    client->reply_failed = 0;
+}
+
+// send reply to a client which isn't served, a client which doesn't read it loses the rest
+static void send_reply(int fd, const char *reply) {
+    size_t len = strlen(reply);
+    while (len > 0) {
+        ssize_t n = send(fd, reply, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        reply += n;
+        len -= (size_t)n;
     }
-    if (mysignal(SIGCONT, sig_handler) == SIG_ERR) {
-        syslog(LOG_ERR, "[ERROR] SIGCONT handling\n");
+}
+
+// add text to client's reply
+// param[in] len - text's length
+static void append_reply(ControlClient *client, const char *text, size_t len) {
+    if (client->reply_failed)
+        return;
+    if (client->reply_len + len > client->reply_size) {
+        size_t size = client->reply_size ? client->reply_size : 256;
+        while (size < client->reply_len + len)
+            size *= 2;
+        char *reply = realloc(client->reply, size);
+        if (!reply) {
+            client->reply_failed = 1;
+            return;
+        }
+        client->reply = reply;
+        client->reply_size = size;
     }
-    if (mysignal(SIGRTMIN, sig_handler) == SIG_ERR) {
-        syslog(LOG_ERR, "[ERROR] SIGRTMIN handling\n");
+    memcpy(client->reply + client->reply_len, text, len);
+    client->reply_len += len;
+}
+
+static void add_reply(ControlClient *client, const char *text) {
+    append_reply(client, text, strlen(text));
+}
+
+// send client's reply till the socket is full, the client is closed when the
+// reply is sent or on error
+static void write_client(ControlClient *client) {
+    while (client->reply_sent < client->reply_len) {
+        ssize_t n = send(client->fd, client->reply + client->reply_sent,
+                         client->reply_len - client->reply_sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN)
+                close_client(client);
+            return; // EAGAIN - EPOLLOUT resumes it
+        }
+        client->reply_sent += (size_t)n;
     }
-    if (mysignal(SIGTERM, sig_handler) == SIG_ERR) {
-        syslog(LOG_ERR, "[ERROR] SIGTERM handling\n");
+    close_client(client);
+}
+
+// start sending client's reply, the rest is sent when the socket is writable
+static void start_reply(ControlClient *client) {
+    if (client->reply_failed) {
+        syslog(LOG_ERR, "[ERROR] control reply failed: out of memory\n");
+        close_client(client);
+        return;
     }
+    // a checking client was removed from epoll
+    int op = client->state == CLIENT_CHECKING ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+    client->state = CLIENT_WRITING;
+    client->deadline_ms = monotonic_ms() + CONTROL_CLIENT_TIMEOUT_MS;
+    write_client(client);
+    if (client->fd < 0)
+        return;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLOUT;
+    ev.data.u64 = EVENT_CLIENT + (uint64_t)(client - clients);
+    if (epoll_ctl(epoll_fd, op, client->fd, &ev) != 0)
+        close_client(client);
 }
 
-// save start information
-static void init_directory_info(const char *path_to_dir) {
-    DIR *d;
-    struct dirent *dir;
-    d = opendir(path_to_dir);
-    if (d) {
-        while ((dir = readdir(d)) != NULL) {
-            if (dir->d_type != DT_REG)
-                continue;
-            uint32_t crc32_sum = calc_file_crc32(path_to_dir, dir->d_name);
-            push_file(dir->d_name, crc32_sum);
+// close clients which didn't send their commands or read their replies in time
+// return time till the next client's deadline (ms, -1 - none)
+static int expire_clients() {
+    int64_t now = monotonic_ms();
+    int64_t wait_ms = -1;
+    for (int i = 0; i < CONTROL_CLIENTS; ++i) {
+        ControlClient *client = &clients[i];
+        if (client->fd < 0 || client->state == CLIENT_CHECKING)
+            continue;
+        if (client->deadline_ms <= now) {
+            close_client(client);
+        } else if (wait_ms < 0 || client->deadline_ms - now < wait_ms) {
+            wait_ms = client->deadline_ms - now;
         }
-        closedir(d);
     }
+    return (int)wait_ms;
 }
 
-// check present information
-static void check_files_in_directory(const char *path_to_dir) {
-    int fails = 0;
-    DIR *d;
-    struct dirent *dir;
-    d = opendir(path_to_dir);
-    if (!d) { // no directory. will print all files as deleted
+// add Merkle digest of directory's tree to reply: "<digest> <path>"
+static void add_digest(ControlClient *client, const char *path) {
+    FileAttr digest;
+    char text[80], reply[PATH_MAX + 96];
+    if (get_tree_digest(path, &digest)) {
+        snprintf(reply, sizeof(reply), "ERROR unknown directory %s\n", path);
     } else {
-        while ((dir = readdir(d)) != NULL) {
-            if (dir->d_type != DT_REG)
-                continue;
-            uint32_t crc32_sum = calc_file_crc32(path_to_dir, dir->d_name);
-            switch (check_file_attr(dir->d_name, crc32_sum)) {
-            case FILE_NOT_FOUND:
-                fails++;
-                syslog(LOG_NOTICE,
-                       "Integrity check: FAIL (%s - new file)\n",
-                       dir->d_name);
-                break;
-            case ATTR_CHANGED:
-                fails++;
-                syslog(LOG_NOTICE,
-                       "Integrity check: FAIL (%s - new crc 0x%X, old crc 0x%X)\n",
-                       dir->d_name,
-                       crc32_sum,
-                       get_file_attr(dir->d_name));
-                break;
-            case VALID_ATTR:
-                break;
-            case CHECK_ERROR:
-            default:
-                syslog(LOG_ERR, "[ERROR] check directory\n");
-                break;
-            }
-        }
-        closedir(d);
+        hash_digest_text(&digest, text, sizeof(text));
+        snprintf(reply, sizeof(reply), "%s %s\n", text, path);
     }
-    const char *name = NULL;
-    while ((name = get_next_unchecked_file()) != NULL) {
-        syslog(LOG_NOTICE,
-               "Integrity check: FAIL (%s - file was deleted)\n",
-               name);
-        fails++;
+    add_reply(client, reply);
+}
+
+// reply single file's check result, the client is closed after the reply
+static void on_file_checked(FileCheckResult result, void *ctx) {
+    ControlClient *client = (ControlClient *)ctx;
+    // the client was closed when the deamon stopped
+    if (client->fd < 0 || client->state != CLIENT_CHECKING)
+        return;
+    switch (result) {
+    case FILE_CHECK_OK:
+        add_reply(client, "OK\n");
+        break;
+    case FILE_CHECK_FAIL:
+        add_reply(client, "FAIL\n");
+        break;
+    case FILE_CHECK_IGNORED:
+    default:
+        add_reply(client, "IGNORED\n");
+        break;
     }
-    if (fails == 0)
-        syslog(LOG_NOTICE, "Integrity check: OK\n");
+    start_reply(client);
 }
 
-// request for dir's checking
-static void request_for_check(int request) {
-    CheckRequest msg;
-    msg.type = MSG_TYPE;
-    msg.data = request;
+// run client's command:
+//   check - request full check of all watch sets
+//   check <absolute path> - check one file by hash workers, the reply waits for it
+//   check <set> - request full check of watch set
+//   digest - Merkle digests of observing directories' trees
+//   digest <absolute path> - Merkle digest of directory's tree. Directories are
+//     hashed with files' algorithm, so with crc32 and crc32c the root is 32 bits
+//     only: equal digests of large trees don't prove they are the same.
+//   stats - metrics in Prometheus text format
+static void run_command(ControlClient *client, const char *command) {
+    if (strcmp(command, "check") == 0) {
+        request_for_check(CHECK_REQUEST);
+        add_reply(client, "QUEUED\n");
+    } else if (strncmp(command, "check /", 7) == 0) {
+        // the client waits without events, the result can come at once
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+        client->state = CLIENT_CHECKING;
+        if (check_single_file(command + 6, on_file_checked, client)) {
+            add_reply(client, "ERROR out of memory\n");
+            start_reply(client);
+        }
+    } else if (strncmp(command, "check ", 6) == 0) {
+        int set = find_watch_set(command + 6);
+        if (set < 0) {
+            add_reply(client, "ERROR unknown watch set\n");
+        } else {
+            request_set_check(set, CHECK_REQUEST, 1);
+            add_reply(client, "QUEUED\n");
+        }
+    } else if (strcmp(command, "digest") == 0) {
+        for (int i = 0; i < sets_count; ++i) {
+            const WatchSet *set = get_watch_set(i);
+            for (int j = 0; j < set->dirs_count; ++j)
+                add_digest(client, set->paths_to_dirs[j]);
+        }
+    } else if (strncmp(command, "digest /", 8) == 0) {
+        add_digest(client, command + 7);
+    } else if (strcmp(command, "stats") == 0) {
+        size_t size;
+        char *text = stats_text(&size);
+        if (text)
+            append_reply(client, text, size);
+        else
+            client->reply_failed = 1;
+        free(text);
+    } else {
+        add_reply(client, "ERROR unknown command\n");
+    }
+}
+
+static void accept_client() {
     while (1) {
-        if (msgsnd(queue_id, &msg, sizeof(msg.data), 0) == -1) {
-            switch (errno) {
-            case EINTR:
+        int fd = accept4(control_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
                 continue;
-            default:
-                syslog(LOG_ERR, "[ERROR] request for check failed %d\n", errno);
-                return;
-            }
-        } else {
-            return; // ok
+            return; // EAGAIN - no more clients
+        }
+        // commands are taken from root and the deamon's user only
+        struct ucred cred;
+        socklen_t cred_len = sizeof(cred);
+        if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) != 0 ||
+            (cred.uid != 0 && cred.uid != geteuid())) {
+            send_reply(fd, "ERROR permission denied\n");
+            close(fd);
+            continue;
         }
+        ControlClient *client = NULL;
+        for (int i = 0; i < CONTROL_CLIENTS && !client; ++i) {
+            if (clients[i].fd < 0)
+                client = &clients[i];
+        }
+        if (!client || add_event(fd, EVENT_CLIENT + (uint64_t)(client - clients)) != 0) {
+            send_reply(fd, "ERROR busy\n");
+            close(fd);
+            continue;
+        }
+        client->fd = fd;
+        client->state = CLIENT_READING;
+        client->deadline_ms = monotonic_ms() + CONTROL_CLIENT_TIMEOUT_MS;
+        client->len = 0;
+    }
+}
+
+// read client's command line, run it and start its reply (a file's check replies later)
+static void read_client(ControlClient *client) {
+    ssize_t n;
+    while ((n = read(client->fd, client->line + client->len, sizeof(client->line) - 1 - client->len)) < 0) {
+        if (errno == EINTR)
+            continue;
+        if (errno != EAGAIN)
+            close_client(client);
+        return;
     }
+    client->len += (size_t)n;
+    client->line[client->len] = '\0';
+    char *eol = strchr(client->line, '\n');
+    if (!eol && n > 0 && client->len + 1 < sizeof(client->line))
+        return; // wait for the rest
+    if (eol)
+        *eol = '\0';
+    else if (n > 0)
+        client->line[0] = '\0'; // too long line
+    size_t len = strlen(client->line);
+    if (len > 0 && client->line[len - 1] == '\r')
+        client->line[len - 1] = '\0';
+    stats_add(STAT_REQUESTS, 1);
+    run_command(client, client->line);
+    if (client->fd >= 0 && client->state == CLIENT_READING)
+        start_reply(client);
 }
 
-static int init_daemon(char *path_to_dir, int timeout_s) {
-    // save path
-    int cpy_n = snprintf(path_to_check_directory, PATH_MAX, "%s", path_to_dir);
-    if (cpy_n < 0 || cpy_n > PATH_MAX) {
-        syslog(LOG_ERR, "[ERROR] save path to directory failed\n");
+static void handle_signals() {
+    struct signalfd_siginfo info;
+    while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+        stats_add(STAT_REQUESTS, 1);
+        if (info.ssi_signo == SIGUSR1) // request from user
+            request_for_check(CHECK_REQUEST);
+        else if (info.ssi_signo == SIGTERM)
+            stop_requested = 1;
+    }
+}
+
+// watch set's timer's ticks missed during a check are merged into the pending one
+static void handle_timer(int set) {
+    uint64_t ticks;
+    if (read(schedules[set].timer_fd, &ticks, sizeof(ticks)) != sizeof(ticks) || ticks == 0)
+        return;
+    stats_add(STAT_REQUESTS, ticks);
+    request_set_check(set, sliced_checks ? CHECK_SLICE_REQUEST : CHECK_REQUEST, ticks);
+}
+
+static int init_daemon() {
+    for (int i = 0; i < CONTROL_CLIENTS; ++i)
+        clients[i].fd = -1;
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        syslog(LOG_ERR, "[ERROR] create epoll failed %d\n", errno);
         return EXIT_FAILURE;
     }
-    // create queue
-    key_t key;
-    if ((key = ftok(".", 'm')) == -1) {
-        syslog(LOG_ERR, "[ERROR] get key failed\n");
+    // signals were blocked at start
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGTERM);
+    signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd < 0 || add_event(signal_fd, EVENT_SIGNAL) != 0) {
+        syslog(LOG_ERR, "[ERROR] signal handling failed %d\n", errno);
         return EXIT_FAILURE;
     }
-    if ((queue_id = msgget(key, IPC_CREAT | 0666)) == -1) {
-        syslog(LOG_ERR, "[ERROR] create queue failed\n");
+    watch_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    pool_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (watch_fd < 0 || add_event(watch_fd, EVENT_WATCH) != 0 ||
+        pool_fd < 0 || add_event(pool_fd, EVENT_POOL) != 0) {
+        syslog(LOG_ERR, "[ERROR] create event failed %d\n", errno);
         return EXIT_FAILURE;
     }
-    // create timer
-    struct sigevent sev;
-    sev.sigev_notify = SIGEV_SIGNAL;
-    sev.sigev_signo = SIGRTMIN;
-    sev.sigev_value.sival_ptr = &timerid;
-    while (1) {
-        if (timer_create(CLOCK_REALTIME, &sev, &timerid) == -1) {
-            switch (errno) {
-            case EAGAIN:
-                continue;
-            default:
-                syslog(LOG_ERR, "[ERROR] create timer failed %d\n", errno);
-                return EXIT_FAILURE;
-            }
-        } else {
-            break;
+    hash_pool_set_wakeup(pool_fd);
+    // create and start watch sets' timers
+    for (int i = 0; i < sets_count; ++i) {
+        int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        schedules[i].timer_fd = timer_fd;
+        if (timer_fd < 0 || add_event(timer_fd, SET_TIMER_EVENT(i)) != 0) {
+            syslog(LOG_ERR, "[ERROR] create timer failed %d\n", errno);
+            return EXIT_FAILURE;
+        }
+        struct itimerspec its;
+        its.it_value.tv_sec = get_watch_set(i)->interval_s;
+        its.it_value.tv_nsec = 0;
+        its.it_interval.tv_sec = its.it_value.tv_sec;
+        its.it_interval.tv_nsec = its.it_value.tv_nsec;
+        if (timerfd_settime(timer_fd, 0, &its, NULL) == -1) {
+            syslog(LOG_ERR, "[ERROR] start timer failed\n");
+            return EXIT_FAILURE;
         }
-    }
-    // start timer
-    struct itimerspec its;
-    its.it_value.tv_sec = timeout_s;
-    its.it_value.tv_nsec = 0;
-    its.it_interval.tv_sec = its.it_value.tv_sec;
-    its.it_interval.tv_nsec = its.it_value.tv_nsec;
-    if (timer_settime(timerid, 0, &its, NULL) == -1) {
-        syslog(LOG_ERR, "[ERROR] start timer failed\n");
-        return EXIT_FAILURE;
     }
     return EXIT_SUCCESS;
 }
 
 static void deinit_daemon() {
-    struct msqid_ds msg_ctl;
-    if (msgctl(queue_id, IPC_RMID, &msg_ctl) == -1)
-        syslog(LOG_ERR, "[ERROR] delete queue failed\n");
+    for (int i = 0; i < CONTROL_CLIENTS; ++i) {
+        if (clients[i].fd >= 0)
+            close_client(&clients[i]);
+    }
+    for (int i = 0; i < sets_count; ++i) {
+        if (schedules[i].timer_fd >= 0)
+            close(schedules[i].timer_fd);
+        schedules[i].timer_fd = -1;
+    }
+    hash_pool_set_wakeup(-1);
+    int *fds[] = {&control_fd, &watch_fd, &pool_fd, &signal_fd, &epoll_fd};
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); ++i) {
+        if (*fds[i] >= 0)
+            close(*fds[i]);
+        *fds[i] = -1;
+    }
+    if (control_path)
+        unlink(control_path);
+}
+
+// watch set joins the round with its pending check
+static void start_set_check(int set) {
+    SetSchedule *schedule = &schedules[set];
+    join_round(&check_round, set);
+    schedule->sliced = schedule->request == CHECK_SLICE_REQUEST;
+    schedule->started = schedule->requested;
+    schedule->request = REQUEST_COUNT;
+    schedule->slice_bytes = slice_bytes;
+    schedule->slice_ns = slice_ns;
+    schedule->postponed_logged = 0;
+    if (schedule->merged) {
+        stats_add(STAT_REQUESTS_MERGED, schedule->merged);
+        syslog(LOG_INFO, "%lu check requests were merged into the check\n", schedule->merged);
+        schedule->merged = 0;
+    }
+}
+
+// spend running slice's budget by the turn
+// return 1 - slice's budget is spent
+static int spend_slice(SetSchedule *schedule, const CheckTurn *turn) {
+    int spent = 0;
+    if (slice_bytes) {
+        if (turn->bytes >= schedule->slice_bytes)
+            spent = 1;
+        else
+            schedule->slice_bytes -= turn->bytes;
+    }
+    if (slice_ns) {
+        if (turn->ns >= schedule->slice_ns)
+            spent = 1;
+        else
+            schedule->slice_ns -= turn->ns;
+    }
+    return spent;
+}
+
+// return size of files a turn reads before it pauses: the rate limit's share of
+// the pause time if it's lower
+static uint64_t loop_pause_bytes() {
+    ThrottleStats stats;
+    throttle_get_stats(&stats);
+    uint64_t bytes = stats.bytes_per_sec * (LOOP_PAUSE_NS / 1000000) / 1000;
+    return stats.bytes_per_sec && bytes < LOOP_PAUSE_BYTES ? bytes + 1 : LOOP_PAUSE_BYTES;
+}
+
+// save watch set's reference info and check cycle's position, the next run
+// resumes after them
+static void save_set_progress(int set) {
+    update_baseline(set);
+    const char *cursor_path = schedules[set].cursor_path;
+    if (cursor_path[0] && save_check_cursor(set, cursor_path))
+        syslog(LOG_ERR, "[ERROR] save check cursor %s failed\n", cursor_path);
+}
+
+// run watch set's turn: the only set's turn is its whole check or slice, a turn
+// of several sets reads set's deficit. The turn pauses to return to the loop,
+// the next call goes on with it.
+static void run_turn(int set) {
+    SetSchedule *schedule = &schedules[set];
+    CheckTurn *turn = &schedule->turn;
+    if (!turn->paused) {
+        memset(turn, 0, sizeof(*turn));
+        turn->sliced = schedule->sliced;
+        turn->budget_bytes = round_turn_budget(&check_round, set);
+        if (schedule->sliced) {
+            if (schedule->slice_bytes && (!turn->budget_bytes || schedule->slice_bytes < turn->budget_bytes))
+                turn->budget_bytes = schedule->slice_bytes;
+            turn->budget_ns = schedule->slice_ns;
+        }
+    }
+    turn->pause_bytes = loop_pause_bytes();
+    turn->pause_ns = LOOP_PAUSE_NS;
+    check_set_turn(set, turn);
+    paused_set = turn->paused ? set : -1;
+    if (turn->paused)
+        return;
+    spend_round_turn(&check_round, set, turn->bytes);
+    if (turn->finished || (schedule->sliced && spend_slice(schedule, turn))) {
+        leave_round(&check_round, set);
+        clock_gettime(CLOCK_MONOTONIC, &schedule->last_check_end);
+        uint64_t latency_ns = (uint64_t)(schedule->last_check_end.tv_sec - schedule->started.tv_sec) * 1000000000 +
+                              schedule->last_check_end.tv_nsec - schedule->started.tv_nsec;
+        stats_watch_set(set, STAT_SET_GAUGE_LATENCY_NS, latency_ns);
+        if (sets_count > 1) {
+            char name[128];
+            report_log(LOG_INFO, "%s: finished %.3f sec after its request\n",
+                       get_check_name(name, sizeof(name), set), latency_ns / 1e9);
+        }
+    }
+    // the baseline has the turn's results, the next run resumes after them
+    save_set_progress(set);
+}
+
+// run pending checks: dirty files, then one turn of the watch sets' round. Sets
+// with pending checks join the round after their min interval.
+// return time till the pending check (ms, 0 - the round goes on, -1 - no pending check)
+static int run_checks() {
+    // verified trees are forgotten, they are skipped again only when every
+    // directory has its watch and a walk verified them
+    if (atomic_exchange(&events_lost, 0))
+        set_changes_watched(dir_watch_complete());
+    if (take_request(CHECK_DIRTY_REQUEST)) {
+        check_dirty_files();
+        update_baselines();
+    }
+    if (take_request(CHECK_REQUEST)) {
+        for (int i = 0; i < sets_count; ++i)
+            request_set_check(i, CHECK_REQUEST, 1);
+    }
+    int wait_ms = -1;
+    for (int i = 0; i < sets_count; ++i) {
+        if (check_round.sets[i].running || schedules[i].request == REQUEST_COUNT)
+            continue;
+        int set_wait_ms = min_interval_wait_ms(i);
+        if (set_wait_ms == 0)
+            start_set_check(i);
+        else if (wait_ms < 0 || set_wait_ms < wait_ms)
+            wait_ms = set_wait_ms;
+    }
+    // a paused turn goes on before the round's next turn
+    int set = paused_set >= 0 ? paused_set : next_round_turn(&check_round);
+    if (set < 0)
+        return wait_ms;
+    run_turn(set);
+    // requests received during the turn are handled before the next turn
+    return 0;
 }
 
 static int deamon_task() {
+    int timeout_ms = 0;
     while (1) {
-        CheckRequest msg;
-        int result = msgrcv(queue_id, &msg, sizeof(msg) - sizeof(long), MSG_TYPE, 0);
-        if (result < 0) {
-            switch (errno) {
-            case EINTR:
+        // finished single file checks, the next one wakes the loop
+        hash_pool_poll();
+        struct epoll_event events[CONTROL_CLIENTS + EVENT_CLIENT];
+        int n = epoll_wait(epoll_fd, events, sizeof(events) / sizeof(events[0]), timeout_ms);
+        if (n < 0) {
+            if (errno == EINTR)
                 continue;
-            default:
-                syslog(LOG_ERR, "[ERROR] receive request failed\n");
-                return EXIT_FAILURE;
-            }
-        } else {
-            switch (msg.data) {
-            case CHECK_REQUEST:
-                check_files_in_directory(path_to_check_directory);
-                break;
-            case STOP_DAEMON:
-                deinit_daemon();
-                syslog(LOG_NOTICE, "The deamon was stopped\n");
-                return EXIT_SUCCESS;
-                break;
-            default:
-                deinit_daemon();
-                syslog(LOG_ERR, "[ERROR] stop deamon\n");
-                return EXIT_FAILURE;
-                break;
+            syslog(LOG_ERR, "[ERROR] wait for events failed %d\n", errno);
+            deinit_daemon();
+            return EXIT_FAILURE;
+        }
+        for (int i = 0; i < n; ++i) {
+            uint64_t source = events[i].data.u64;
+            if ((source & 0xFFFFFFFF) == EVENT_TIMER) {
+                handle_timer((int)(source >> 32));
+            } else if (source == EVENT_SIGNAL) {
+                handle_signals();
+            } else if (source == EVENT_WATCH) {
+                uint64_t count;
+                if (read(watch_fd, &count, sizeof(count)) == sizeof(count))
+                    stats_add(STAT_REQUESTS, count);
+            } else if (source == EVENT_POOL) {
+                uint64_t count;
+                if (read(pool_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+                    syslog(LOG_ERR, "[ERROR] read hash workers' event failed %d\n", errno);
+            } else if (source == EVENT_CONTROL) {
+                accept_client();
+            } else if (clients[source - EVENT_CLIENT].fd >= 0) {
+                ControlClient *client = &clients[source - EVENT_CLIENT];
+                if (client->state == CLIENT_READING)
+                    read_client(client);
+                else if (client->state == CLIENT_WRITING)
+                    write_client(client);
             }
         }
+        if (stop_requested) {
+            // the next run resumes the paused turn
+            if (paused_set >= 0)
+                save_set_progress(paused_set);
+            deinit_daemon();
+            syslog(LOG_NOTICE, "The deamon was stopped\n");
+            return EXIT_SUCCESS;
+        }
+        timeout_ms = run_checks();
+        int client_wait_ms = expire_clients();
+        if (client_wait_ms >= 0 && (timeout_ms < 0 || client_wait_ms < timeout_ms))
+            timeout_ms = client_wait_ms;
     }
 }
 
-int start_daemon(char *path_to_dir, int timeout_s) {
+// set up watch sets' schedules
+// return operation's result: 0 - ok, 1 - out of memory
+static int setup_schedules() {
+    sets_count = get_watch_sets_count();
+    schedules = calloc(sets_count ? (size_t)sets_count : 1, sizeof(SetSchedule));
+    check_round.sets = calloc(sets_count ? (size_t)sets_count : 1, sizeof(RoundSet));
+    if (!schedules || !check_round.sets)
+        return 1;
+    check_round.count = sets_count;
+    check_round.next = 0;
+    check_round.quantum = SCHEDULER_QUANTUM;
+    for (int i = 0; i < sets_count; ++i) {
+        check_round.sets[i].weight = get_watch_set(i)->weight;
+        SetSchedule *schedule = &schedules[i];
+        const char *baseline_path = get_watch_set(i)->baseline_path;
+        schedule->timer_fd = -1;
+        schedule->request = REQUEST_COUNT;
+        if (baseline_path && snprintf(schedule->cursor_path, sizeof(schedule->cursor_path), "%s.cursor",
+                                      baseline_path) >= (int)sizeof(schedule->cursor_path))
+            schedule->cursor_path[0] = '\0';
+    }
+    return 0;
+}
+
+// print baseline of another hash algorithm
+// return 0 - baseline can be used or built; 1 - it has another algorithm's digests
+static int check_baseline(const char *baseline_path, HashAlgo hash_algo) {
+    HashAlgo algo;
+    if (!baseline_path || get_baseline_algo(baseline_path, &algo) != BASELINE_OK || algo == hash_algo)
+        return 0;
+    printf("[ERROR] baseline %s has %s digests, not %s: select its algorithm or remove it to rebuild it\n",
+           baseline_path, hash_algo_name(algo), hash_algo_name(hash_algo));
+    return 1;
+}
+
+int check_baselines(const DaemonConfig *config) {
+    if (!config->watch_sets || config->watch_sets_count <= 0)
+        return check_baseline(config->baseline_path, config->hash_algo);
+    int result = 0;
+    for (int i = 0; i < config->watch_sets_count; ++i)
+        result |= check_baseline(config->watch_sets[i].baseline_path, config->hash_algo);
+    return result;
+}
+
+int start_daemon(const DaemonConfig *config) {
+    // after forking the mismatch would only be in syslog
+    if (check_baselines(config))
+        return EXIT_FAILURE;
+    min_interval_s = config->min_interval_s;
+    sliced_checks = config->slice_bytes || config->slice_ms;
+    slice_bytes = config->slice_bytes;
+    slice_ns = (uint64_t)config->slice_ms * 1000000;
     pid_t pid, sid;
     pid = fork();
     if (pid < 0)
@@ -287,8 +957,8 @@ int start_daemon(char *path_to_dir, int timeout_s) {
         syslog(LOG_ERR, "[ERROR] get new session failed\n");
         return EXIT_FAILURE;
     }
-    // start signal handling
-    sig_on();
+    // signals are handled by the deamon's loop, threads inherit the mask
+    block_signals();
     // create daemon in new process (to ensure that daemon can never re-acquire a terminal)
     pid = fork();
     if (pid < 0) {
@@ -305,11 +975,209 @@ int start_daemon(char *path_to_dir, int timeout_s) {
         syslog(LOG_ERR, "[ERROR] changing working directory failed\n");
         return EXIT_FAILURE;
     }
-    // load information about the directory
-    init_directory_info(path_to_dir);
+    hash_set_algo(config->hash_algo);
+    if (set_file_attr_size(hash_digest_size(config->hash_algo))) {
+        syslog(LOG_ERR, "[ERROR] set %s digest size failed\n", hash_algo_name(config->hash_algo));
+        return EXIT_FAILURE;
+    }
+    syslog(LOG_NOTICE, "hash: %s (%s), file reader: %s\n",
+           hash_algo_name(config->hash_algo), hash_algo_kernel(config->hash_algo),
+           file_reader_name(config->reader));
+    set_file_reader(config->reader);
+    // limits are shared by hash workers and io_uring scanner
+    throttle_setup(&config->throttle);
+    if (throttle_enabled() || config->throttle.idle_priority)
+        syslog(LOG_NOTICE, "throttle: %llu bytes/sec, %llu files/sec (0 - no limit), idle priority %s, "
+               "back off above io pressure %g%%, load %g (0 - never)\n",
+               (unsigned long long)config->throttle.bytes_per_sec,
+               (unsigned long long)config->throttle.files_per_sec,
+               config->throttle.idle_priority ? "on" : "off",
+               config->throttle.psi_limit, config->throttle.load_limit);
+    // integrity events are written by background thread
+    ReportConfig report = {config->events_path, config->syslog_events};
+    if (report_start(&report)) {
+        syslog(LOG_ERR, "[ERROR] start reporting to %s failed %d\n",
+               config->events_path ? config->events_path : "syslog", errno);
+        return EXIT_FAILURE;
+    }
+    // digests of files written during a pass are retried or deferred
+    consistency_setup(&config->consistency);
+    if (config->consistency.defer_writers || config->consistency.reflink)
+        syslog(LOG_NOTICE, "consistency: %d torn read retries, defer written files %s, reflink copies %s\n",
+               config->consistency.retries, config->consistency.defer_writers ? "on" : "off",
+               config->consistency.reflink ? "on" : "off");
+    // start hash workers
+    if (hash_pool_start(config->workers)) {
+        syslog(LOG_ERR, "[ERROR] start %d hash workers failed\n", config->workers);
+        report_stop();
+        return EXIT_FAILURE;
+    }
+    // io_uring scanner, hash workers are used if it isn't supported
+    int use_uring = 0;
+    if (config->use_uring) {
+        use_uring = uring_scan_start() == 0;
+        if (!use_uring)
+            syslog(LOG_ERR, "[ERROR] io_uring isn't supported, hash workers are used\n");
+    }
+    dir_check_setup(config, use_uring);
+    if (setup_schedules()) {
+        syslog(LOG_ERR, "[ERROR] out of memory, watch sets aren't scheduled\n");
+        uring_scan_stop();
+        hash_pool_stop();
+        report_stop();
+        return EXIT_FAILURE;
+    }
+    if (sets_count > 1)
+        syslog(LOG_NOTICE, "%d watch sets share %d hash workers\n", sets_count, config->workers);
+    // load information about the directories, changes made while the deamon
+    // wasn't running are reported by the first check
+    for (int i = 0; i < sets_count; ++i) {
+        int loaded = load_set_info(i);
+        if (loaded < 0) {
+            uring_scan_stop();
+            hash_pool_stop();
+            report_stop();
+            return EXIT_FAILURE;
+        }
+        if (loaded)
+            request_set_check(i, sliced_checks ? CHECK_SLICE_REQUEST : CHECK_REQUEST, 1);
+        else
+            clock_gettime(CLOCK_MONOTONIC, &schedules[i].last_check_end);
+    }
     // init daemon
-    if (init_daemon(path_to_dir, timeout_s) == EXIT_FAILURE)
+    if (init_daemon() == EXIT_FAILURE) {
+        deinit_daemon();
+        uring_scan_stop();
+        hash_pool_stop();
+        report_stop();
         return EXIT_FAILURE;
+    }
+    // per instance control socket
+    if (config->control_socket && open_control_socket(config->control_socket) != 0)
+        syslog(LOG_ERR, "[ERROR] open control socket %s failed %d\n", config->control_socket, errno);
+    // metrics for monitoring
+    if (config->stats_socket && stats_server_start(config->stats_socket))
+        syslog(LOG_ERR, "[ERROR] start stats server on %s failed\n", config->stats_socket);
+    // watch for changes between timer's checks
+    if (config->watch_changes && dir_watch_start(config->paths_to_dirs, config->dirs_count, on_dir_change))
+        syslog(LOG_ERR, "[ERROR] start watching directories failed, timer checks only\n");
+    else if (config->watch_changes)
+        set_changes_watched(1);
     // starting deamon
-    return deamon_task();
+    int result = deamon_task();
+    dir_watch_stop();
+    stats_server_stop();
+    uring_scan_stop();
+    hash_pool_stop();
+    report_stop();
+    return result;
+}
+
+// print difference between local files and manifest
+static void print_manifest_diff(ManifestDiff diff, const ManifestEntry *local,
+                                const ManifestEntry *reference, void *ctx) {
+    (void)ctx;
+    char local_text[80], reference_text[80];
+    switch (diff) {
+    case MANIFEST_ADDED:
+        printf("added %s\n", local->path);
+        break;
+    case MANIFEST_REMOVED:
+        printf("removed %s\n", reference->path);
+        break;
+    case MANIFEST_CHANGED:
+        hash_digest_text(&local->digest, local_text, sizeof(local_text));
+        hash_digest_text(&reference->digest, reference_text, sizeof(reference_text));
+        printf("changed %s: size %llu, %s; manifest size %llu, %s\n", local->path,
+               (unsigned long long)local->size, local_text,
+               (unsigned long long)reference->size, reference_text);
+        break;
+    case MANIFEST_UNREADABLE:
+        printf("unreadable %s\n", local->path);
+        break;
+    }
+}
+
+// print export's or compare's results
+static void print_manifest_totals(const char *command, const char *path, const ManifestTotals *totals,
+                                  const struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double sec = (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+    printf("[%s] %s: %llu files, ", command, path, (unsigned long long)totals->files);
+    if (strcmp(command, "compare") == 0)
+        printf("%llu added, %llu removed, %llu changed, ", (unsigned long long)totals->added,
+               (unsigned long long)totals->removed, (unsigned long long)totals->changed);
+    printf("%llu errors, %llu bytes, %.3f sec, %.0f bytes/sec\n", (unsigned long long)totals->errors,
+           (unsigned long long)totals->bytes, sec, sec > 0 ? totals->bytes / sec : 0.0);
+}
+
+int run_manifest_command(const DaemonConfig *config, const char *manifest_path, int write_manifest) {
+    HashAlgo algo = config->hash_algo;
+    ManifestReader *reader = NULL;
+    if (!write_manifest) {
+        switch (manifest_open(manifest_path, &algo, &reader)) {
+        case MANIFEST_OK:
+            break;
+        case MANIFEST_NOT_FOUND:
+            printf("[ERROR] no manifest %s\n", manifest_path);
+            return 2;
+        case MANIFEST_CORRUPTED:
+            printf("[ERROR] manifest %s is corrupted\n", manifest_path);
+            return 2;
+        default:
+            printf("[ERROR] open manifest %s failed\n", manifest_path);
+            return 2;
+        }
+    }
+    hash_set_algo(algo);
+    set_file_attr_size(hash_digest_size(algo));
+    set_file_reader(config->reader);
+    throttle_setup(&config->throttle);
+    consistency_setup(&config->consistency);
+    if (hash_pool_start(config->workers)) {
+        printf("[ERROR] start %d hash workers failed\n", config->workers);
+        manifest_close_reader(reader);
+        return 2;
+    }
+    // results of one queue come in walk order, io_uring scanner isn't started
+    dir_check_setup(config, 0);
+    ManifestTotals totals;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int result = 2;
+    if (write_manifest) {
+        ManifestWriter *writer = NULL;
+        ManifestStatus status = manifest_create(manifest_path, algo, &writer);
+        if (status == MANIFEST_OK) {
+            status = export_manifest(writer, &totals);
+            if (manifest_close_writer(writer, status == MANIFEST_OK) != MANIFEST_OK)
+                status = MANIFEST_ERROR;
+        }
+        if (status == MANIFEST_OK) {
+            print_manifest_totals("export", manifest_path, &totals, &start);
+            result = 0;
+        } else if (totals.errors) {
+            printf("[ERROR] export into manifest %s failed: %llu files couldn't be read\n", manifest_path,
+                   (unsigned long long)totals.errors);
+        } else {
+            printf("[ERROR] export into manifest %s failed\n", manifest_path);
+        }
+    } else {
+        printf("[compare] %s: %s digests\n", manifest_path, hash_algo_name(algo));
+        ManifestStatus status = compare_manifest(reader, print_manifest_diff, NULL, &totals);
+        if (status == MANIFEST_END) {
+            print_manifest_totals("compare", manifest_path, &totals, &start);
+            // files which couldn't be read aren't known to match
+            if (totals.errors)
+                printf("[ERROR] %llu files couldn't be read\n", (unsigned long long)totals.errors);
+            result = totals.errors ? 2 : totals.added || totals.removed || totals.changed ? 1 : 0;
+        } else {
+            printf("[ERROR] compare with manifest %s failed: %s\n", manifest_path,
+                   status == MANIFEST_CORRUPTED ? "manifest is corrupted" : "system error");
+        }
+        manifest_close_reader(reader);
+    }
+    hash_pool_stop();
+    return result;
 }
@@ -1,15 +1,82 @@
 #ifndef DAEMON_HEADER
 #define DAEMON_HEADER
 
+#include <stdint.h>
+#include "consistency.h"
+#include "file_reader.h"
+#include "hash_engine.h"
+#include "throttle.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-// start observing directory
-// param[in] path_to_dir - path to observing directory
-// param[in] timeous_s - deamon's timeout in sec
+// watch set: directories of one tenant checked by their own timer into their own
+// baseline. Sets share hash workers, their checks are interleaved by the scheduler.
+typedef struct {
+    char     *name;           // set's name in logs and metrics
+    char    **paths_to_dirs;  // absolute paths to set's directories (not nested with any observed one)
+    int       dirs_count;     // number of set's directories
+    int       interval_s;     // set's timer in sec
+    unsigned  weight;         // set's share of reading while several sets are checked (priority)
+    char     *baseline_path;  // path to set's baseline file (NULL - reference info is kept in memory only)
+} WatchSet;
+
+// deamon's settings
+typedef struct {
+    char         **paths_to_dirs;  // absolute paths to observing directories (not nested)
+    int            dirs_count;     // number of observing directories
+    int            timeout_s;      // deamon's timeout in sec
+    int            min_interval_s; // min time between the end of a full check and the start of the next one
+    int            workers;        // number of hash workers
+    int            fast_check;     // 1 - don't rehash files with unchanged size, mtime, ctime, inode, device
+    int            paranoid_every; // in fast mode every Nth check rehashes all files (0 - never)
+    uint64_t       slice_bytes;    // timer check reads about this many bytes and resumes on the next tick (0 - no limit)
+    int            slice_ms;       // timer check stops after this time and resumes on the next tick (0 - no limit)
+    int            cycle_window_s; // check cycle older than this is finished without budget (0 - never)
+    int            watch_changes;  // 1 - check changed files on inotify events, timer checks all files
+    FileReaderKind reader;         // file reading backend
+    HashAlgo       hash_algo;      // files' digest algorithm, baseline keeps digests of one algorithm
+    int            use_uring;      // 1 - hash files with io_uring scanner (if kernel supports it)
+    uint64_t       large_file_size; // files of this size (bytes) are hashed by chunks in parallel (0 - never)
+    uint64_t       chunk_size;     // large file's chunk size in bytes (0 - hash large files whole)
+    char          *baseline_path;  // path to baseline file (NULL - reference info is kept in memory only)
+    // globs without '/' match file or directory name, others - path relative to observing directory
+    char         **include_globs;  // observe only matching files, all files if there is no glob
+    int            include_count;  // number of include globs
+    char         **exclude_globs;  // ignore matching files and directories
+    int            exclude_count;  // number of exclude globs
+    char          *stats_socket;   // Unix socket for metrics in Prometheus text format (NULL - no metrics server)
+    char          *control_socket; // Unix socket for commands: check, check <path|set>, digest, stats (NULL - none)
+    ThrottleConfig throttle;       // rate limits, idle priority and back-off of the hashing path
+    char          *events_path;    // JSON lines file of integrity events (NULL - syslog only)
+    unsigned       syslog_events;  // max file events per pass in syslog, the rest are summarized (0 - no limit)
+    ConsistencyConfig consistency; // torn reads' retries, deferral of written files, reflink copies
+    // with watch sets paths_to_dirs are all sets' directories, baseline_path isn't used
+    WatchSet      *watch_sets;     // watch sets (NULL - one set of paths_to_dirs, timeout_s and baseline_path)
+    int            watch_sets_count; // number of watch sets
+} DaemonConfig;
+
+// check that watch sets' baselines have digests of the deamon's hash algorithm,
+// a mismatch is printed: such baseline is neither loaded nor rebuilt
+// param[in] config - deamon's settings
+// return 0 - baselines can be used or built; 1 - some baseline has another algorithm's digests
+int check_baselines(const DaemonConfig *config);
+
+// start observing directories
+// param[in] config - deamon's settings
 // return operation's result: 0 - deamon started without errors; 1 - error
-int start_daemon(char *path_to_dir, int timeout_s);
+int start_daemon(const DaemonConfig *config);
+
+// check the only observing directory once in the foreground: export its files
+// into tree manifest or compare them with one (see tree_manifest.h), differences
+// and results are printed. Compare uses manifest's hash algorithm.
+// param[in] config - deamon's settings (watch sets, baseline and sockets aren't used)
+// param[in] manifest_path - path to tree manifest
+// param[in] write_manifest - 1: export files into manifest, 0 - compare files with manifest
+// return operation's result: 0 - manifest was written or files are the same; 1 - files differ;
+//        2 - error, also some local file couldn't be read
+int run_manifest_command(const DaemonConfig *config, const char *manifest_path, int write_manifest);
 
 #ifdef __cplusplus
 }
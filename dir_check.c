@@ -0,0 +1,1319 @@
+#define _GNU_SOURCE // qsort_r
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <syslog.h>
+#include <dirent.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fnmatch.h>
+#include <libgen.h>
+#include <time.h>
+#include <linux/limits.h>
+
+#include "dir_check.h"
+#include "check_stats.h"
+#include "consistency.h"
+#include "dir_watch.h"
+#include "file_reader.h"
+#include "file_repo.h"
+#include "hash_engine.h"
+#include "hash_pool.h"
+#include "report.h"
+#include "throttle.h"
+#include "uring_scan.h"
+
+// max changed regions logged per file
+#define MAX_LOGGED_REGIONS 16
+
+// observing directories
+static char **paths_to_dirs;
+static int dirs_count;
+
+// file filters (see DaemonConfig)
+static char **include_globs;
+static int include_count;
+static char **exclude_globs;
+static int exclude_count;
+
+// skip files with unchanged metadata
+static int fast_check;
+
+// every Nth check rehashes all files in fast mode (0 - never)
+static int paranoid_every;
+
+// reading backends' statistic at the end of previous check
+static FileReaderStats last_reader_stats[FILE_READER_COUNT];
+
+// hash files with io_uring scanner instead of hash workers
+static int use_uring;
+
+// large files are hashed by hash workers (see DaemonConfig)
+static uint64_t large_file_size;
+
+// max check cycle's time of timer's slices (see DaemonConfig)
+static int cycle_window_s;
+
+// directory watcher reports changed files, fast checks skip verified trees
+static int changes_watched;
+
+// pass's results
+typedef struct {
+    unsigned long files;    // observed files
+    unsigned long skipped;  // files with unchanged metadata
+    unsigned long deferred; // files being written, they are checked by the next pass
+    unsigned long trees;    // skipped trees of unchanged directories
+    int           fails;    // new, changed and deleted files
+    uint64_t      hashed;   // files read and hashed
+    uint64_t      errors;   // files which couldn't be read
+    uint64_t      bytes;    // bytes read and hashed
+    uint64_t      wait_ns;  // time readers slept in rate limiter
+    uint64_t      backoffs; // rate limit reductions on system pressure
+    uint64_t      ns;       // pass's time
+} PassTotals;
+
+// check cycle: every file of watch set is checked once by one full check or by
+// several turns, the next turn resumes the walk after the cursor
+typedef struct {
+    int           active;            // files check was begun
+    int           skip_unchanged;    // fast mode of the cycle
+    uint32_t      gen;               // files check's generation (see begin_files_check)
+    PassTotals    totals;            // results of finished turns
+    PassTotals    turn_totals;       // results of the running turn's calls
+    int           turn_whole;        // the running turn began the cycle
+    int           turn_unbounded;    // the running turn's budget was dropped by the cycle's window
+    unsigned      slices;            // finished turns
+    int64_t       start;             // cycle's start (unix time)
+    char          cursor[PATH_MAX];  // the last file of the previous turn ("" - cycle's start)
+    char          resumed[PATH_MAX]; // cursor of previous deamon's run ("" - cycle wasn't resumed)
+} CheckCycle;
+
+// watch set's directories and check cycle
+typedef struct {
+    WatchSet      config;
+    char        **walk_roots;  // set's directories in walk order
+    unsigned long check_count; // number of set's check cycles
+    uint64_t      version;     // changes of set's reference info
+    CheckCycle    cycle;
+} SetState;
+
+static SetState *sets;
+static int sets_count;
+
+// the only watch set of the deamon without watch sets
+static WatchSet default_set;
+
+// check cursor file's first line
+#define CURSOR_MAGIC "CRC32CURSOR 1"
+
+static void set_fingerprint(const struct stat *sb, FileFingerprint *fingerprint) {
+    fingerprint->size = (uint64_t)sb->st_size;
+    fingerprint->mtime_ns = (int64_t)sb->st_mtim.tv_sec * 1000000000 + sb->st_mtim.tv_nsec;
+    fingerprint->ctime_ns = (int64_t)sb->st_ctim.tv_sec * 1000000000 + sb->st_ctim.tv_nsec;
+    fingerprint->inode = (uint64_t)sb->st_ino;
+    fingerprint->device = (uint64_t)sb->st_dev;
+}
+
+// get regular file's metadata
+// return operation result: 0 - ok, 1 - error or not a regular file
+static int get_file_fingerprint(int dir_fd, const char *file, FileFingerprint *fingerprint) {
+    struct stat sb;
+    if (fstatat(dir_fd, file, &sb, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(sb.st_mode))
+        return 1;
+    set_fingerprint(&sb, fingerprint);
+    return 0;
+}
+
+// queue file for hashing by io_uring scanner or hash workers, large files are
+// split into chunks by hash workers
+static int submit_file(const char *path, const FileFingerprint *fingerprint,
+                       hash_result_fn on_result, void *ctx) {
+    int large = large_file_size && fingerprint && fingerprint->size >= large_file_size;
+    if (use_uring && !large)
+        return uring_scan_submit(path, fingerprint, on_result, ctx);
+    return hash_pool_submit(path, fingerprint, on_result, ctx);
+}
+
+// skip check of observed file open for write by another process, a file
+// deferred too many passes in a row is checked
+// return 1 - the check is deferred to the next pass, 0 - check the file
+static int is_deferred_writer(const char *path, const FileFingerprint *fingerprint) {
+    if (!is_file_being_written(fingerprint) || !is_file_observed(path) ||
+        !defer_file_check(path) || skip_file_check(path) != VALID_ATTR)
+        return 0;
+    stats_add(STAT_DEFERRED_WRITERS, 1);
+    mark_path_changed(path);
+    return 1;
+}
+
+// return path relative to its observing directory (NULL - path is outside of them)
+static const char *get_relative_path(const char *path) {
+    for (int i = 0; i < dirs_count; ++i) {
+        size_t len = strlen(paths_to_dirs[i]);
+        if (len == 1 && paths_to_dirs[i][0] == '/')
+            return path[0] == '/' ? path + 1 : NULL;
+        if (strncmp(path, paths_to_dirs[i], len) == 0 && path[len] == '/')
+            return path + len + 1;
+    }
+    return NULL;
+}
+
+// return file's name for log: relative path for the only observing directory, full path otherwise
+static const char *get_log_name(const char *path) {
+    const char *relative = dirs_count == 1 ? get_relative_path(path) : NULL;
+    return relative ? relative : path;
+}
+
+// return 1 if one of globs matches path relative to observing directory
+static int match_globs(char **globs, int count, const char *relative) {
+    const char *name = strrchr(relative, '/');
+    name = name ? name + 1 : relative;
+    for (int i = 0; i < count; ++i) {
+        if (fnmatch(globs[i], strchr(globs[i], '/') ? relative : name, 0) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+// return 1 if file is observed
+// param[in] relative - path relative to observing directory
+// param[in] check_dirs - check file's directories too (the walk doesn't enter excluded ones)
+static int is_file_selected(const char *relative, int check_dirs) {
+    if (match_globs(exclude_globs, exclude_count, relative))
+        return 0;
+    if (check_dirs && exclude_count) {
+        char dir[PATH_MAX];
+        snprintf(dir, sizeof(dir), "%s", relative);
+        for (char *slash = strchr(dir, '/'); slash; slash = strchr(slash + 1, '/')) {
+            *slash = '\0';
+            int excluded = match_globs(exclude_globs, exclude_count, dir);
+            *slash = '/';
+            if (excluded)
+                return 0;
+        }
+    }
+    return include_count == 0 || match_globs(include_globs, include_count, relative);
+}
+
+// found file's handler
+// param[in] dir_fd - file's directory
+// param[in] path - path to file
+// param[in] name - file name in directory
+// param[in] ctx - user context from walk_directories
+// return 0 - continue walk, 1 - stop walk
+typedef int (*file_found_fn)(int dir_fd, const char *path, const char *name, void *ctx);
+
+// directory's handler, called before its entries and after all of them
+// param[in] dir_fd - opened directory
+// param[in] path - path to directory
+// param[in] complete - 0: directory's walk begins, 1: all its entries were walked
+// param[in] ctx - user context from walk_directories
+// return 1 - skip directory (on its begin), 0 - walk it
+typedef int (*dir_found_fn)(int dir_fd, const char *path, int complete, void *ctx);
+
+// walk's handler and position
+typedef struct {
+    file_found_fn on_file;
+    dir_found_fn  on_dir;       // NULL - no directory's handler
+    void         *ctx;
+    const char   *resume_after; // skip paths up to this one in walk order (NULL - walk all files)
+    int           stopped;      // on_file stopped the walk
+} DirWalk;
+
+// directory's entry for sorted walk
+typedef struct {
+    size_t        name; // offset in names
+    unsigned char type;
+} DirEntry;
+
+// return 1 if path is inside directory
+static int is_inside_dir(const char *dir, const char *path) {
+    size_t len = strlen(dir);
+    if (len == 1 && dir[0] == '/')
+        return path[0] == '/' && path[1] != '\0';
+    return strncmp(path, dir, len) == 0 && path[len] == '/';
+}
+
+// return index of watch set of path (-1 - path is outside of observing directories)
+static int get_path_set(const char *path) {
+    for (int i = 0; i < sets_count; ++i) {
+        for (int j = 0; j < sets[i].config.dirs_count; ++j) {
+            if (is_inside_dir(sets[i].config.paths_to_dirs[j], path))
+                return i;
+        }
+    }
+    return -1;
+}
+
+// return pass name for log: scan and set's name if the deamon has several watch sets
+// param[out] buf - buffer for the name
+static const char *get_pass_name(char *buf, size_t size, const char *scan, int set) {
+    if (sets_count < 2 || set < 0)
+        return scan;
+    snprintf(buf, size, "%s of %s", scan, sets[set].config.name);
+    return buf;
+}
+
+// return 1 if directory or file is before resume position and must be skipped
+static int skip_path(DirWalk *walk, const char *path, int is_dir) {
+    if (!walk->resume_after)
+        return 0;
+    int order = compare_tree_paths(path, walk->resume_after);
+    if (is_dir ? order < 0 && !is_inside_dir(path, walk->resume_after) : order <= 0)
+        return 1;
+    if (order >= 0)
+        walk->resume_after = NULL; // resume position is passed
+    return 0;
+}
+
+static int compare_entries(const void *a, const void *b, void *names) {
+    return strcmp((const char *)names + ((const DirEntry *)a)->name,
+                  (const char *)names + ((const DirEntry *)b)->name);
+}
+
+static void walk_directory(char *path, size_t path_len, size_t relative_offset, DirWalk *walk);
+
+// pass directory's entry to walk
+// param[in,out] path - buffer (PATH_MAX) with path to directory, restored on return
+// param[in] path_len - path's length
+// param[in] relative_offset - offset of path relative to observing directory
+static void walk_entry(int dir_fd, char *path, size_t path_len, size_t relative_offset,
+                       const char *name, unsigned char type, DirWalk *walk) {
+    if (type == DT_UNKNOWN) {
+        struct stat sb;
+        if (fstatat(dir_fd, name, &sb, AT_SYMLINK_NOFOLLOW) != 0)
+            return;
+        type = S_ISDIR(sb.st_mode) ? DT_DIR : S_ISREG(sb.st_mode) ? DT_REG : DT_UNKNOWN;
+    }
+    if (type != DT_REG && type != DT_DIR)
+        return;
+    // no extra '/' after root directory
+    size_t base = (path_len == 1 && path[0] == '/') ? 0 : path_len;
+    size_t name_len = strlen(name);
+    if (base + 1 + name_len >= PATH_MAX) {
+        syslog(LOG_ERR, "[ERROR] path is too long: %s/%s\n", path, name);
+        return;
+    }
+    path[base] = '/';
+    memcpy(path + base + 1, name, name_len + 1);
+    const char *relative = path + relative_offset;
+    if (skip_path(walk, path, type == DT_DIR)) {
+        // before resume position
+    } else if (type == DT_DIR) {
+        if (!match_globs(exclude_globs, exclude_count, relative))
+            walk_directory(path, base + 1 + name_len, relative_offset, walk);
+    } else if (is_file_selected(relative, 0)) {
+        walk->stopped = walk->on_file(dir_fd, path, name, walk->ctx);
+    }
+    path[path_len] = '\0';
+}
+
+// walk directory's entries in name order
+static void walk_sorted(DIR *d, char *path, size_t path_len, size_t relative_offset, DirWalk *walk) {
+    DirEntry *entries = NULL;
+    size_t count = 0, capacity = 0;
+    char *names = NULL;
+    size_t names_size = 0, names_capacity = 0;
+    struct dirent *dir;
+    while ((dir = readdir(d)) != NULL) {
+        const char *name = dir->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+            continue;
+        size_t len = strlen(name) + 1;
+        if (count == capacity || names_size + len > names_capacity) {
+            size_t new_capacity = capacity ? capacity * 2 : 64;
+            size_t new_names_capacity = names_capacity ? names_capacity * 2 + len : 4096;
+            DirEntry *new_entries = realloc(entries, new_capacity * sizeof(DirEntry));
+            if (new_entries)
+                entries = new_entries;
+            char *new_names = realloc(names, new_names_capacity);
+            if (new_names)
+                names = new_names;
+            if (!new_entries || !new_names) {
+                syslog(LOG_ERR, "[ERROR] out of memory, directory %s isn't walked\n", path);
+                count = 0;
+                break;
+            }
+            capacity = new_capacity;
+            names_capacity = new_names_capacity;
+        }
+        entries[count].name = names_size;
+        entries[count].type = dir->d_type;
+        count++;
+        memcpy(names + names_size, name, len);
+        names_size += len;
+    }
+    if (count)
+        qsort_r(entries, count, sizeof(DirEntry), compare_entries, names);
+    for (size_t i = 0; i < count && !walk->stopped; ++i)
+        walk_entry(dirfd(d), path, path_len, relative_offset, names + entries[i].name, entries[i].type, walk);
+    free(entries);
+    free(names);
+}
+
+// walk directory's tree in name order, so a walk can resume after a file;
+// symbolic links aren't followed
+// param[in,out] path - buffer (PATH_MAX) with path to directory, restored on return
+// param[in] path_len - path's length
+// param[in] relative_offset - offset of path relative to observing directory
+static void walk_directory(char *path, size_t path_len, size_t relative_offset, DirWalk *walk) {
+    DIR *d = opendir(path);
+    if (!d)
+        return;
+    if (walk->on_dir && walk->on_dir(dirfd(d), path, 0, walk->ctx)) {
+        closedir(d);
+        return;
+    }
+    // entries before resume position were walked by another pass
+    int resumed = walk->resume_after != NULL;
+    walk_sorted(d, path, path_len, relative_offset, walk);
+    if (walk->on_dir && !walk->stopped && !resumed)
+        walk->on_dir(dirfd(d), path, 1, walk->ctx);
+    closedir(d);
+}
+
+// pass watch set's files to on_file until it stops the walk
+// param[in] on_dir - directory's handler (NULL - walk all directories)
+// param[in] resume_after - start after this path in sorted walk's order (NULL - from start)
+// return 1 - walk was stopped by on_file, 0 - all files were passed
+static int walk_directories(const SetState *set, file_found_fn on_file, dir_found_fn on_dir, void *ctx,
+                            const char *resume_after) {
+    DirWalk walk = {on_file, on_dir, ctx, resume_after, 0};
+    char path[PATH_MAX];
+    for (int i = 0; i < set->config.dirs_count && !walk.stopped; ++i) {
+        const char *root = set->walk_roots[i];
+        size_t len = strlen(root);
+        if (len >= PATH_MAX || skip_path(&walk, root, 1))
+            continue;
+        memcpy(path, root, len + 1);
+        walk_directory(path, len, len == 1 && path[0] == '/' ? 1 : len + 1, &walk);
+    }
+    return walk.stopped;
+}
+
+// wait for all queued files
+static void flush_files() {
+    if (use_uring)
+        uring_scan_flush();
+    hash_pool_flush();
+}
+
+// directory pass: its start time and counters
+typedef struct {
+    struct timespec start;     // CLOCK_MONOTONIC
+    uint64_t        hashed;    // STAT_FILES_HASHED at start
+    uint64_t        errors;    // STAT_HASH_ERRORS at start
+    uint64_t        bytes;     // STAT_BYTES_HASHED at start
+    uint64_t        wait_ns;   // STAT_THROTTLE_WAIT_NS at start
+    uint64_t        backoffs;  // STAT_THROTTLE_BACKOFFS at start
+    unsigned long   files;     // observed files
+    unsigned long   skipped;   // files with unchanged metadata
+    int             fails;     // new, changed and deleted files
+    unsigned long   deferred;  // files being written, they are checked by the next pass
+    unsigned long   trees;     // skipped trees of unchanged directories
+    int             set;       // watch set of pass's files (-1 - files of any set)
+} DirPass;
+
+// param[in] set - watch set of pass's files (-1 - files of any set)
+static void begin_pass(DirPass *pass, int set) {
+    memset(pass, 0, sizeof(*pass));
+    pass->set = set;
+    clock_gettime(CLOCK_MONOTONIC, &pass->start);
+    pass->hashed = stats_get(STAT_FILES_HASHED);
+    pass->errors = stats_get(STAT_HASH_ERRORS);
+    pass->bytes = stats_get(STAT_BYTES_HASHED);
+    pass->wait_ns = stats_get(STAT_THROTTLE_WAIT_NS);
+    pass->backoffs = stats_get(STAT_THROTTLE_BACKOFFS);
+    consistency_begin_pass();
+}
+
+// get results of the pass
+static void measure_pass(const DirPass *pass, PassTotals *totals) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    totals->files = pass->files;
+    totals->skipped = pass->skipped;
+    totals->deferred = pass->deferred;
+    totals->trees = pass->trees;
+    totals->fails = pass->fails;
+    totals->hashed = stats_get(STAT_FILES_HASHED) - pass->hashed;
+    totals->errors = stats_get(STAT_HASH_ERRORS) - pass->errors;
+    totals->bytes = stats_get(STAT_BYTES_HASHED) - pass->bytes;
+    totals->wait_ns = stats_get(STAT_THROTTLE_WAIT_NS) - pass->wait_ns;
+    totals->backoffs = stats_get(STAT_THROTTLE_BACKOFFS) - pass->backoffs;
+    totals->ns = (uint64_t)(end.tv_sec - pass->start.tv_sec) * 1000000000 + end.tv_nsec - pass->start.tv_nsec;
+}
+
+static void add_totals(PassTotals *sum, const PassTotals *totals) {
+    sum->files += totals->files;
+    sum->skipped += totals->skipped;
+    sum->deferred += totals->deferred;
+    sum->trees += totals->trees;
+    sum->fails += totals->fails;
+    sum->hashed += totals->hashed;
+    sum->errors += totals->errors;
+    sum->bytes += totals->bytes;
+    sum->wait_ns += totals->wait_ns;
+    sum->backoffs += totals->backoffs;
+    sum->ns += totals->ns;
+}
+
+// log achieved throughput of the pass against the current limits
+// param[in] scan - pass name for log
+// param[in] totals - finished pass's results
+static void report_throttle(const char *scan, const PassTotals *totals) {
+    ThrottleStats stats;
+    throttle_get_stats(&stats);
+    double sec = totals->ns / 1e9;
+    uint64_t files = totals->hashed + totals->errors;
+    uint64_t bytes = totals->bytes;
+    uint64_t wait_ns = totals->wait_ns;
+    uint64_t backoffs = totals->backoffs;
+    report_log(LOG_INFO, "%s throttle: %.0f bytes/sec (limit %llu, now %llu), %.0f files/sec (limit %llu, now %llu), "
+           "readers waited %.3f sec, %llu back-offs\n",
+           scan, sec > 0 ? bytes / sec : 0.0, (unsigned long long)stats.bytes_limit,
+           (unsigned long long)stats.bytes_per_sec, sec > 0 ? files / sec : 0.0,
+           (unsigned long long)stats.files_limit, (unsigned long long)stats.files_per_sec,
+           wait_ns / 1e9, (unsigned long long)backoffs);
+}
+
+// update pass metrics and log one line summary of the finished pass
+// param[in] scan - pass name for log
+// param[in] passes - pass counter
+// param[in] totals - finished pass's results
+// param[in] timeout_s - longer full checks are reported (0 - never)
+static void log_pass(const char *scan, StatCounter passes, const PassTotals *totals, int timeout_s) {
+    uint64_t ns = totals->ns;
+    double sec = ns / 1e9;
+    uint64_t hashed = totals->hashed;
+    uint64_t errors = totals->errors;
+    uint64_t bytes = totals->bytes;
+    stats_add(passes, 1);
+    stats_add(STAT_FILES_SKIPPED, totals->skipped);
+    stats_add(STAT_TREES_SKIPPED, totals->trees);
+    stats_add(STAT_FILES_FAILED, (uint64_t)totals->fails);
+    // dirty and single file checks are short and frequent, they would hide slow full checks
+    if (passes == STAT_PASSES_INITIAL || passes == STAT_PASSES_FULL) {
+        stats_observe(STAT_HIST_PASS, ns);
+        stats_set(STAT_GAUGE_LAST_PASS_NS, ns);
+        stats_set(STAT_GAUGE_LAST_PASS_TIME, (uint64_t)time(NULL));
+        stats_set(STAT_GAUGE_LAST_PASS_FILES, totals->files);
+    }
+    report_pass_end();
+    report_log(LOG_INFO, "%s: %lu files, %llu hashed, %lu skipped, %d failed, %llu errors, "
+           "%llu bytes, %.3f sec, %.0f files/sec, %.0f bytes/sec\n",
+           scan, totals->files, (unsigned long long)hashed, totals->skipped, totals->fails,
+           (unsigned long long)errors, (unsigned long long)bytes, sec,
+           sec > 0 ? totals->files / sec : 0.0, sec > 0 ? bytes / sec : 0.0);
+    if (totals->deferred)
+        report_log(LOG_INFO, "%s: %lu files are being written, they are checked by the next pass\n",
+                   scan, totals->deferred);
+    if (totals->trees)
+        report_log(LOG_INFO, "%s: %lu trees of unchanged directories are skipped\n", scan, totals->trees);
+    if (throttle_enabled() && passes != STAT_PASSES_DIRTY && passes != STAT_PASSES_FILE)
+        report_throttle(scan, totals);
+    if (passes == STAT_PASSES_FULL && timeout_s > 0 && sec > timeout_s) {
+        stats_add(STAT_PASS_OVERRUNS, 1);
+        report_log(LOG_WARNING, "[WARNING] %s took %.3f sec, longer than timeout %d sec\n", scan, sec, timeout_s);
+    }
+}
+
+// update pass metrics and log its summary, full checks longer than its set's interval are reported
+static void end_pass(const char *scan, StatCounter passes, const DirPass *pass) {
+    PassTotals totals;
+    measure_pass(pass, &totals);
+    log_pass(scan, passes, &totals, pass->set >= 0 ? sets[pass->set].config.interval_s : 0);
+}
+
+// count change of file's reference info for its watch set's baseline
+// param[in] version - file repository's version before the change
+static void count_set_change(const DirPass *pass, const char *file, uint64_t version) {
+    if (get_files_version() == version)
+        return;
+    int set = pass->set >= 0 ? pass->set : get_path_set(file);
+    if (set >= 0)
+        sets[set].version++;
+}
+
+// log reading speed of each backend since previous check
+static void report_reader_stats() {
+    for (int k = FILE_READER_AUTO + 1; k < FILE_READER_COUNT; ++k) {
+        FileReaderStats stats;
+        get_file_reader_stats((FileReaderKind)k, &stats);
+        uint64_t files = stats.files - last_reader_stats[k].files;
+        uint64_t bytes = stats.bytes - last_reader_stats[k].bytes;
+        uint64_t ns = stats.ns - last_reader_stats[k].ns;
+        last_reader_stats[k] = stats;
+        if (files == 0)
+            continue;
+        report_log(LOG_INFO, "Reader %s: %llu files, %llu bytes, %llu bytes/sec\n",
+               file_reader_name((FileReaderKind)k),
+               (unsigned long long)files,
+               (unsigned long long)bytes,
+               (unsigned long long)(ns ? bytes * 1000000000.0 / ns : 0));
+    }
+}
+
+// save file's digest and manifest as reference
+static void save_file_info(const char *file, const FileAttr *digest,
+                           const FileFingerprint *fingerprint,
+                           const FileManifest *manifest, void *ctx) {
+    uint64_t version = get_files_version();
+    // file kept changing: its last content is saved without metadata, so fast checks rehash it
+    FileAttr last_digest;
+    if (digest->size == 0) {
+        hash_path(file, &last_digest);
+        digest = &last_digest;
+        fingerprint = NULL;
+    }
+    if (push_file(file, digest, fingerprint) || (manifest && set_file_manifest(file, manifest)))
+        syslog(LOG_ERR, "[ERROR] save file info %s\n", get_log_name(file));
+    count_set_change((const DirPass *)ctx, file, version);
+}
+
+// queue found file for saving
+static int save_found_file(int dir_fd, const char *path, const char *name, void *ctx) {
+    DirPass *pass = (DirPass *)ctx;
+    pass->files++;
+    FileFingerprint fingerprint;
+    int no_fingerprint = get_file_fingerprint(dir_fd, name, &fingerprint);
+    if (submit_file(path, no_fingerprint ? NULL : &fingerprint, save_file_info, pass))
+        syslog(LOG_ERR, "[ERROR] hash request for %s\n", get_log_name(path));
+    return 0;
+}
+
+void init_set_info(int set) {
+    DirPass pass;
+    char name[128];
+    begin_pass(&pass, set);
+    walk_directories(&sets[set], save_found_file, NULL, &pass, NULL);
+    flush_files();
+    end_pass(get_pass_name(name, sizeof(name), "Initial scan", set), STAT_PASSES_INITIAL, &pass);
+    report_reader_stats();
+}
+
+// save start information
+void init_directory_info() {
+    for (int i = 0; i < sets_count; ++i)
+        init_set_info(i);
+}
+
+// return 1 if manifests' block differs or one of them has no such block
+static int block_changed(const FileManifest *old, const FileManifest *manifest, uint32_t block) {
+    if (block >= old->block_count || block >= manifest->block_count)
+        return 1;
+    size_t size = get_file_attr_size();
+    return memcmp(old->digests + block * size, manifest->digests + block * size, size) != 0;
+}
+
+// log changed regions of large file: its blocks with other digests than in the reference manifest
+// param[in] manifest - file's manifest (NULL - file was hashed whole)
+// param[in] fingerprint - file's metadata (NULL - unknown)
+static void report_changed_regions(const char *file, const FileManifest *manifest,
+                                   const FileFingerprint *fingerprint) {
+    FileManifest old;
+    if (!manifest || get_file_manifest(file, &old) || old.block_size != manifest->block_size)
+        return;
+    uint32_t count = old.block_count > manifest->block_count ? old.block_count : manifest->block_count;
+    unsigned regions = 0;
+    char detail[80];
+    for (uint32_t block = 0; block < count; ) {
+        if (!block_changed(&old, manifest, block)) {
+            block++;
+            continue;
+        }
+        uint32_t first = block;
+        while (block < count && block_changed(&old, manifest, block))
+            block++;
+        uint64_t begin = first * manifest->block_size;
+        uint64_t end = block * manifest->block_size;
+        // the last block is up to the end of file
+        if (block == manifest->block_count && fingerprint && fingerprint->size > begin)
+            end = fingerprint->size;
+        if (regions++ < MAX_LOGGED_REGIONS) {
+            snprintf(detail, sizeof(detail), "changed region at offset %llu, %llu bytes",
+                     (unsigned long long)begin, (unsigned long long)(end - begin));
+            report_file_event(REPORT_CHANGED_REGION, file, get_log_name(file), detail);
+        }
+    }
+    if (regions > MAX_LOGGED_REGIONS) {
+        snprintf(detail, sizeof(detail), "%u more changed regions", regions - MAX_LOGGED_REGIONS);
+        report_file_event(REPORT_CHANGED_REGION, file, get_log_name(file), detail);
+    }
+}
+
+// keep manifest of unchanged file if the reference one is missing or has other blocks
+static void update_manifest(const char *file, const FileManifest *manifest) {
+    FileManifest old;
+    if (!manifest || (get_file_manifest(file, &old) == 0 && old.block_size == manifest->block_size))
+        return;
+    if (set_file_manifest(file, manifest))
+        syslog(LOG_ERR, "[ERROR] save file info %s\n", get_log_name(file));
+}
+
+// compare file's digest with the reference one
+static void check_file_info(const char *file, const FileAttr *digest,
+                            const FileFingerprint *fingerprint,
+                            const FileManifest *manifest, void *ctx) {
+    DirPass *pass = (DirPass *)ctx;
+    uint64_t version = get_files_version();
+    FileAttr old_digest;
+    char new_text[80], old_text[80], detail[180];
+    // file kept changing while it was read, a new file is reported anyway
+    int unstable = digest->size == 0;
+    if (!unstable)
+        end_file_deferral(file);
+    switch (unstable ? skip_file_check(file) : check_file_attr(file, digest, fingerprint)) {
+    case FILE_NOT_FOUND:
+        pass->fails++;
+        report_file_event(REPORT_NEW_FILE, file, get_log_name(file), NULL);
+        break;
+    case ATTR_CHANGED:
+        pass->fails++;
+        get_file_attr(file, &old_digest);
+        hash_digest_text(digest, new_text, sizeof(new_text));
+        hash_digest_text(&old_digest, old_text, sizeof(old_text));
+        snprintf(detail, sizeof(detail), "new %s, old %s", new_text, old_text);
+        report_file_event(REPORT_CHANGED_FILE, file, get_log_name(file), detail);
+        report_changed_regions(file, manifest, fingerprint);
+        break;
+    case VALID_ATTR:
+        if (unstable && defer_file_check(file)) {
+            pass->deferred++;
+            stats_add(STAT_DEFERRED_UNSTABLE, 1);
+        } else if (unstable) {
+            // deferred too many passes, its content can't be trusted
+            end_file_deferral(file);
+            pass->fails++;
+            report_file_event(REPORT_CHANGED_FILE, file, get_log_name(file),
+                              "torn read, the file kept changing while it was read");
+        } else {
+            update_manifest(file, manifest);
+            count_set_change(pass, file, version);
+            return;
+        }
+        break;
+    case CHECK_ERROR:
+    default:
+        syslog(LOG_ERR, "[ERROR] check directory\n");
+        break;
+    }
+    // the file's directories are walked until it's valid
+    mark_path_changed(file);
+    count_set_change(pass, file, version);
+}
+
+// log large file's hashing time
+static void report_large_file(const char *file, uint64_t size, unsigned chunks, uint64_t ns) {
+    report_log(LOG_INFO, "Large file %s: %llu bytes, %u chunks, %.3f sec, %.0f bytes/sec\n",
+           get_log_name(file),
+           (unsigned long long)size,
+           chunks,
+           ns / 1e9,
+           ns ? size * 1e9 / ns : 0.0);
+}
+
+static int compare_roots(const void *a, const void *b) {
+    return compare_tree_paths(*(char *const *)a, *(char *const *)b);
+}
+
+// free watch sets' state
+static void free_sets() {
+    for (int i = 0; i < sets_count; ++i)
+        free(sets[i].walk_roots);
+    free(sets);
+    sets = NULL;
+    sets_count = 0;
+}
+
+// set watch set's directories in walk order
+// return operation result: 0 - ok, 1 - out of memory
+static int setup_set(SetState *set, const WatchSet *config) {
+    memset(set, 0, sizeof(*set));
+    set->config = *config;
+    set->walk_roots = malloc((config->dirs_count ? config->dirs_count : 1) * sizeof(char *));
+    if (!set->walk_roots)
+        return 1;
+    memcpy(set->walk_roots, config->paths_to_dirs, config->dirs_count * sizeof(char *));
+    qsort(set->walk_roots, config->dirs_count, sizeof(char *), compare_roots);
+    return 0;
+}
+
+void dir_check_setup(const DaemonConfig *config, int uring) {
+    paths_to_dirs = config->paths_to_dirs;
+    dirs_count = config->dirs_count;
+    include_globs = config->include_globs;
+    include_count = config->include_count;
+    exclude_globs = config->exclude_globs;
+    exclude_count = config->exclude_count;
+    fast_check = config->fast_check;
+    paranoid_every = config->paranoid_every;
+    use_uring = uring;
+    large_file_size = config->large_file_size;
+    cycle_window_s = config->cycle_window_s;
+    free_sets();
+    const WatchSet *watch_sets = config->watch_sets;
+    int count = config->watch_sets_count;
+    // the deamon without watch sets has one set of all directories
+    if (!watch_sets || count <= 0) {
+        default_set.name = "default";
+        default_set.paths_to_dirs = config->paths_to_dirs;
+        default_set.dirs_count = config->dirs_count;
+        default_set.interval_s = config->timeout_s;
+        default_set.weight = 1;
+        default_set.baseline_path = config->baseline_path;
+        watch_sets = &default_set;
+        count = 1;
+    }
+    sets = calloc((size_t)count, sizeof(SetState));
+    const char **names = calloc((size_t)count, sizeof(char *));
+    for (int i = 0; sets && names && i < count; ++i, ++sets_count) {
+        names[i] = watch_sets[i].name;
+        if (setup_set(&sets[i], &watch_sets[i]))
+            break;
+    }
+    if (!sets || !names || sets_count < count) {
+        syslog(LOG_ERR, "[ERROR] out of memory, directories aren't walked\n");
+        free_sets();
+        dirs_count = 0;
+    } else if (stats_watch_sets(names, count)) {
+        syslog(LOG_ERR, "[ERROR] out of memory, watch sets' metrics aren't kept\n");
+    }
+    free(names);
+    stats_set(STAT_GAUGE_TIMEOUT, (uint64_t)(config->timeout_s > 0 ? config->timeout_s : 0));
+    hash_pool_set_large_files(config->large_file_size, config->chunk_size, report_large_file);
+}
+
+void set_changes_watched(int watched) {
+    changes_watched = watched;
+    forget_dir_checks();
+}
+
+int get_watch_sets_count() {
+    return sets_count;
+}
+
+const WatchSet *get_watch_set(int set) {
+    return &sets[set].config;
+}
+
+uint64_t get_watch_set_version(int set) {
+    return sets[set].version;
+}
+
+// state of the check of watch set's files
+typedef struct {
+    DirPass     pass;
+    CheckCycle *cycle;
+    uint64_t    bytes;        // size of files queued for hashing by the turn
+    uint64_t    budget_bytes; // turn's budget (0 - no limit)
+    uint64_t    budget_ns;    // turn's budget (0 - no limit)
+    uint64_t    spent_ns;     // turn's time before the call
+    uint64_t    pause_bytes;  // the call pauses at this turn's size (0 - never)
+    uint64_t    pause_ns;     // the call pauses after this time (0 - never)
+    int         paused;       // the walk was stopped by the pause
+} CheckState;
+
+// return 0 - the walk goes on, 1 - turn's budget is spent, 2 - the call pauses
+static int get_turn_stop(const CheckState *state) {
+    if (state->budget_bytes && state->bytes >= state->budget_bytes)
+        return 1;
+    if (!state->budget_ns && !state->pause_bytes && !state->pause_ns)
+        return 0;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t ns = (uint64_t)(now.tv_sec - state->pass.start.tv_sec) * 1000000000 +
+                  now.tv_nsec - state->pass.start.tv_nsec;
+    if (state->budget_ns && state->spent_ns + ns >= state->budget_ns)
+        return 1;
+    if ((state->pause_bytes && state->bytes >= state->pause_bytes) || (state->pause_ns && ns >= state->pause_ns))
+        return 2;
+    return 0;
+}
+
+// queue found file for checking, stop the walk when turn's budget is spent or the call pauses
+static int check_found_file(int dir_fd, const char *path, const char *name, void *ctx) {
+    CheckState *state = (CheckState *)ctx;
+    state->pass.files++;
+    FileFingerprint fingerprint;
+    int no_fingerprint = get_file_fingerprint(dir_fd, name, &fingerprint);
+    if (state->cycle->skip_unchanged && !no_fingerprint &&
+        check_file_fingerprint(path, &fingerprint) == VALID_ATTR) {
+        state->pass.skipped++;
+    } else if (!no_fingerprint && is_deferred_writer(path, &fingerprint)) {
+        state->pass.deferred++;
+    } else {
+        if (submit_file(path, no_fingerprint ? NULL : &fingerprint, check_file_info, &state->pass))
+            syslog(LOG_ERR, "[ERROR] hash request for %s\n", get_log_name(path));
+        if (!no_fingerprint)
+            state->bytes += fingerprint.size;
+    }
+    int stop = get_turn_stop(state);
+    if (!stop)
+        return 0;
+    state->paused = stop == 2;
+    snprintf(state->cycle->cursor, sizeof(state->cycle->cursor), "%s", path);
+    return 1;
+}
+
+// skip directory's tree in fast mode if it's verified and the watcher reports
+// changes of its files, verify walked trees
+static int check_found_dir(int dir_fd, const char *path, int complete, void *ctx) {
+    CheckState *state = (CheckState *)ctx;
+    if (complete) {
+        end_dir_check(path);
+        return 0;
+    }
+    struct stat sb;
+    FileFingerprint fingerprint;
+    if (fstat(dir_fd, &sb) != 0)
+        return 0;
+    set_fingerprint(&sb, &fingerprint);
+    if (begin_dir_check(path, &fingerprint, state->cycle->skip_unchanged && changes_watched) != VALID_ATTR)
+        return 0;
+    state->pass.trees++;
+    return 1;
+}
+
+// start cycle of set's files
+// param[in] skip_unchanged - fast mode of the cycle
+static void start_cycle(CheckCycle *cycle, int skip_unchanged, int64_t start) {
+    memset(&cycle->totals, 0, sizeof(cycle->totals));
+    cycle->active = 1;
+    cycle->skip_unchanged = skip_unchanged;
+    cycle->slices = 0;
+    cycle->start = start;
+    cycle->cursor[0] = '\0';
+    cycle->resumed[0] = '\0';
+    cycle->gen = begin_files_check();
+}
+
+static void begin_cycle(SetState *set) {
+    // paranoid check: rehash files even with unchanged metadata
+    set->check_count++;
+    start_cycle(&set->cycle, fast_check && !(paranoid_every && set->check_count % paranoid_every == 0),
+                (int64_t)time(NULL));
+}
+
+// report set's files which weren't found by the cycle as deleted. Files of the
+// only set are all observed files.
+static void sweep_deleted_files(const SetState *set, CheckState *state) {
+    const CheckCycle *cycle = &set->cycle;
+    if (begin_files_sweep(cycle->gen, sets_count > 1 ? set->config.paths_to_dirs : NULL, set->config.dirs_count))
+        return; // deletion will be found by the next cycle
+    const char *name = NULL;
+    while ((name = get_next_unchecked_file()) != NULL) {
+        // checked by previous deamon's run, deletion will be found by the next cycle
+        if (cycle->resumed[0] && compare_tree_paths(name, cycle->resumed) <= 0)
+            continue;
+        report_file_event(REPORT_DELETED_FILE, name, get_log_name(name), NULL);
+        mark_path_changed(name);
+        state->pass.fails++;
+    }
+}
+
+// update watch set's metrics of the finished cycle
+static void count_set_cycle(int index, const PassTotals *totals) {
+    stats_watch_add(index, STAT_SET_CHECKS, 1);
+    stats_watch_add(index, STAT_SET_FILES, totals->files);
+    stats_watch_add(index, STAT_SET_FILES_FAILED, (uint64_t)totals->fails);
+    stats_watch_set(index, STAT_SET_GAUGE_THROUGHPUT,
+                    totals->ns ? (uint64_t)(totals->bytes * 1e9 / totals->ns) : 0);
+}
+
+int check_set_turn(int index, CheckTurn *turn) {
+    SetState *set = &sets[index];
+    CheckCycle *cycle = &set->cycle;
+    CheckState state;
+    char name[128];
+    memset(&state, 0, sizeof(state));
+    begin_pass(&state.pass, index);
+    state.cycle = cycle;
+    if (!turn->paused) {
+        memset(&cycle->turn_totals, 0, sizeof(cycle->turn_totals));
+        cycle->turn_whole = !cycle->active;
+        cycle->turn_unbounded = 0;
+        turn->bytes = 0;
+        turn->ns = 0;
+        if (!cycle->active)
+            begin_cycle(set);
+        if (turn->sliced && (turn->budget_bytes || turn->budget_ns) && cycle_window_s &&
+            (int64_t)time(NULL) - cycle->start >= cycle_window_s) {
+            report_log(LOG_NOTICE, "%s is longer than %d sec, it's finished without budget\n",
+                       get_pass_name(name, sizeof(name), "Check cycle", index), cycle_window_s);
+            cycle->turn_unbounded = 1;
+        }
+    }
+    turn->paused = 0;
+    state.bytes = turn->bytes;
+    state.spent_ns = turn->ns;
+    if (!cycle->turn_unbounded) {
+        state.budget_bytes = turn->budget_bytes;
+        state.budget_ns = turn->budget_ns;
+    }
+    state.pause_bytes = turn->pause_bytes ? turn->bytes + turn->pause_bytes : 0;
+    state.pause_ns = turn->pause_ns;
+    // files are hashed by the pool or io_uring scanner, results come back in walk order.
+    // Files of missing directories will be printed as deleted
+    int stopped = walk_directories(set, check_found_file, check_found_dir, &state,
+                                   cycle->cursor[0] ? cycle->cursor : NULL);
+    flush_files();
+    if (!stopped)
+        sweep_deleted_files(set, &state);
+    PassTotals totals;
+    measure_pass(&state.pass, &totals);
+    add_totals(&cycle->totals, &totals);
+    add_totals(&cycle->turn_totals, &totals);
+    stats_watch_add(index, STAT_SET_BYTES_HASHED, totals.bytes);
+    stats_watch_add(index, STAT_SET_BUSY_NS, totals.ns);
+    turn->bytes = state.bytes;
+    turn->ns += totals.ns;
+    turn->finished = !stopped;
+    int fails = totals.fails;
+    if (stopped && state.paused) {
+        turn->paused = 1;
+        return fails;
+    }
+    // the turn is logged with the results of all its calls
+    totals = cycle->turn_totals;
+    int whole_cycle = cycle->turn_whole;
+    // turns of the scheduler are logged by their cycle, timer's slices are logged
+    int silent = !turn->sliced && sets_count > 1;
+    if (stopped) {
+        cycle->slices++;
+        if (!silent) {
+            log_pass(get_pass_name(name, sizeof(name), "Check slice", index), STAT_PASSES_SLICE, &totals, 0);
+            report_reader_stats();
+        }
+        return fails;
+    }
+    cycle->active = 0;
+    if (cycle->totals.fails == 0)
+        report_log(LOG_NOTICE, "%s: OK\n", get_pass_name(name, sizeof(name), "Integrity check", index));
+    if (whole_cycle) {
+        log_pass(get_pass_name(name, sizeof(name), "Check", index), STAT_PASSES_FULL, &totals,
+                 set->config.interval_s);
+    } else {
+        if (silent) {
+            log_pass(get_pass_name(name, sizeof(name), "Check", index), STAT_PASSES_FULL, &cycle->totals,
+                     set->config.interval_s);
+        } else {
+            log_pass(get_pass_name(name, sizeof(name), "Check slice", index), STAT_PASSES_SLICE, &totals, 0);
+            stats_add(STAT_PASSES_FULL, 1);
+        }
+        report_log(LOG_INFO, "%s: %lu files, %d failed, %u slices, %lld sec\n",
+                   get_pass_name(name, sizeof(name), "Check cycle", index), cycle->totals.files,
+                   cycle->totals.fails, cycle->slices + 1, (long long)((int64_t)time(NULL) - cycle->start));
+    }
+    count_set_cycle(index, &cycle->totals);
+    report_reader_stats();
+    return fails;
+}
+
+// check present information
+int check_files_in_directory() {
+    int fails = 0;
+    for (int i = 0; i < sets_count; ++i) {
+        CheckTurn turn;
+        memset(&turn, 0, sizeof(turn));
+        fails += check_set_turn(i, &turn);
+    }
+    return fails;
+}
+
+// make file's rename or removal durable (see save_baseline)
+static void sync_parent_dir(const char *path) {
+    char dir_path[PATH_MAX];
+    snprintf(dir_path, sizeof(dir_path), "%s", path);
+    int fd = open(dirname(dir_path), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+int save_check_cursor(int set, const char *path) {
+    const CheckCycle *cycle = &sets[set].cycle;
+    if (!cycle->active || !cycle->cursor[0]) {
+        if (unlink(path) != 0)
+            return errno == ENOENT ? 0 : 1;
+        sync_parent_dir(path);
+        return 0;
+    }
+    char tmp_path[PATH_MAX];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path))
+        return 1;
+    FILE *f = fopen(tmp_path, "w");
+    if (!f)
+        return 1;
+    int ok = fprintf(f, "%s\n%lld %d\n%s\n", CURSOR_MAGIC, (long long)cycle->start,
+                     cycle->skip_unchanged, cycle->cursor) > 0;
+    // the cursor's content reaches the disk before the rename
+    ok &= fflush(f) == 0 && fsync(fileno(f)) == 0;
+    ok &= fclose(f) == 0;
+    if (!ok || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return 1;
+    }
+    sync_parent_dir(path);
+    return 0;
+}
+
+int load_check_cursor(int set, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return 0;
+    char line[PATH_MAX + 2];
+    long long start = 0;
+    int skip_unchanged = 0;
+    int ok = fgets(line, sizeof(line), f) && strcmp(line, CURSOR_MAGIC "\n") == 0 &&
+             fgets(line, sizeof(line), f) && sscanf(line, "%lld %d", &start, &skip_unchanged) == 2;
+    // the rest is cursor's path, it can contain '\n'
+    size_t len = ok ? fread(line, 1, sizeof(line) - 1, f) : 0;
+    fclose(f);
+    if (!ok || len < 2 || len > PATH_MAX || line[len - 1] != '\n' || line[0] != '/') {
+        unlink(path);
+        return 0;
+    }
+    line[len - 1] = '\0';
+    CheckCycle *cycle = &sets[set].cycle;
+    start_cycle(cycle, skip_unchanged != 0, (int64_t)start);
+    memcpy(cycle->cursor, line, len);
+    memcpy(cycle->resumed, line, len);
+    char name[128];
+    report_log(LOG_NOTICE, "%s is resumed after %s\n", get_pass_name(name, sizeof(name), "Check cycle", set),
+               get_log_name(cycle->cursor));
+    return 1;
+}
+
+// check file by its path
+// param[in] file - absolute path to file
+// param[in,out] pass - files and fails of the pass
+// param[in] on_result - file's result handler, its context is pass
+// param[in] on_workers - 1: hash the file by hash workers, the caller isn't blocked by io_uring scanner
+// return 0 - file is ignored, 1 - file was checked without reading, 2 - file was queued for hashing
+static int check_path(const char *file, DirPass *pass, hash_result_fn on_result, int on_workers) {
+    const char *relative = get_relative_path(file);
+    if (!relative || !is_file_selected(relative, 1))
+        return 0;
+    FileFingerprint fingerprint;
+    if (get_file_fingerprint(AT_FDCWD, file, &fingerprint)) {
+        if (!is_file_observed(file))
+            return 0;
+        pass->files++;
+        report_file_event(REPORT_DELETED_FILE, file, get_log_name(file), NULL);
+        pass->fails++;
+        return 1;
+    }
+    pass->files++;
+    if (is_deferred_writer(file, &fingerprint)) {
+        pass->deferred++;
+        return 1;
+    }
+    if (on_workers ? hash_pool_submit(file, &fingerprint, on_result, pass) :
+                     submit_file(file, &fingerprint, on_result, pass)) {
+        syslog(LOG_ERR, "[ERROR] hash request for %s\n", get_log_name(file));
+        return 1;
+    }
+    return 2;
+}
+
+// check files reported by the directory watcher
+int check_dirty_files() {
+    DirPass pass;
+    begin_pass(&pass, -1);
+    char file[PATH_MAX];
+    while (dir_watch_next_dirty(file, sizeof(file)) == 0) {
+        mark_path_changed(file);
+        check_path(file, &pass, check_file_info, 0);
+    }
+    flush_files();
+    end_pass("Dirty check", STAT_PASSES_DIRTY, &pass);
+    return pass.fails;
+}
+
+// single file's check, its pass is the result handler's context
+typedef struct {
+    DirPass       pass;
+    file_check_fn on_done;
+    void         *ctx;
+} FileCheck;
+
+static void finish_file_check(FileCheck *check) {
+    end_pass("File check", STAT_PASSES_FILE, &check->pass);
+    check->on_done(check->pass.fails ? FILE_CHECK_FAIL : FILE_CHECK_OK, check->ctx);
+    free(check);
+}
+
+static void single_file_info(const char *file, const FileAttr *digest,
+                             const FileFingerprint *fingerprint,
+                             const FileManifest *manifest, void *ctx) {
+    FileCheck *check = (FileCheck *)ctx;
+    check_file_info(file, digest, fingerprint, manifest, &check->pass);
+    finish_file_check(check);
+}
+
+int check_single_file(const char *path, file_check_fn on_done, void *ctx) {
+    FileCheck *check = malloc(sizeof(*check));
+    if (!check)
+        return 1;
+    begin_pass(&check->pass, -1);
+    check->on_done = on_done;
+    check->ctx = ctx;
+    switch (check_path(path, &check->pass, single_file_info, 1)) {
+    case 0:
+        free(check);
+        on_done(FILE_CHECK_IGNORED, ctx);
+        break;
+    case 1:
+        finish_file_check(check);
+        break;
+    default:
+        break; // the result comes from hash workers
+    }
+    return 0;
+}
+
+// export or compare of tree manifest
+typedef struct {
+    ManifestWriter  *writer;    // exported manifest (NULL - compare)
+    ManifestReader  *reader;    // compared manifest
+    ManifestEntry    reference; // manifest's next file (status is MANIFEST_OK)
+    ManifestStatus   status;    // writer's or reader's status
+    manifest_diff_fn on_diff;
+    void            *ctx;
+    ManifestTotals  *totals;
+} ManifestPass;
+
+static void read_reference(ManifestPass *pass) {
+    pass->status = manifest_read(pass->reader, &pass->reference);
+}
+
+// report manifest's files before relative path as removed
+// param[in] relative - local file's path (NULL - all the rest files)
+static void report_removed(ManifestPass *pass, const char *relative) {
+    while (pass->status == MANIFEST_OK && (!relative || compare_tree_paths(pass->reference.path, relative) < 0)) {
+        pass->totals->removed++;
+        pass->on_diff(MANIFEST_REMOVED, NULL, &pass->reference, pass->ctx);
+        read_reference(pass);
+    }
+}
+
+// digest of file for the manifest. Zero digest marks a read error (see hash_failed),
+// such file is read again to tell the error from content with zero digest.
+// param[in] digest - hash pool's result
+// param[out] result - file's digest
+// return operation result: 0 - ok, 1 - file couldn't be read
+static int read_manifest_digest(const char *file, const FileAttr *digest, FileAttr *result) {
+    *result = *digest;
+    uint32_t i = 0;
+    while (i < digest->size && digest->bytes[i] == 0)
+        ++i;
+    // file kept changing: its last content is taken
+    if (digest->size != 0 && i < digest->size)
+        return 0;
+    return hash_path(file, result);
+}
+
+// write file into manifest or merge it with manifest's files, results come in walk order
+static void manifest_file_info(const char *file, const FileAttr *digest,
+                               const FileFingerprint *fingerprint,
+                               const FileManifest *manifest, void *ctx) {
+    (void)manifest;
+    ManifestPass *pass = (ManifestPass *)ctx;
+    ManifestEntry entry;
+    entry.path = get_relative_path(file);
+    entry.size = fingerprint ? fingerprint->size : 0;
+    int unreadable = read_manifest_digest(file, digest, &entry.digest);
+    if (!entry.path)
+        return;
+    if (unreadable)
+        pass->totals->errors++;
+    if (pass->writer) {
+        // zero digest of unreadable file isn't written, the export fails
+        if (unreadable) {
+            syslog(LOG_ERR, "[ERROR] read %s for the manifest failed\n", get_log_name(file));
+            pass->status = MANIFEST_ERROR;
+        }
+        if (pass->status == MANIFEST_OK)
+            pass->status = manifest_write(pass->writer, &entry);
+        return;
+    }
+    report_removed(pass, entry.path);
+    int found = pass->status == MANIFEST_OK && compare_tree_paths(pass->reference.path, entry.path) == 0;
+    if (unreadable) {
+        // neither a match nor a change: the file's content is unknown
+        if (pass->status == MANIFEST_OK || pass->status == MANIFEST_END)
+            pass->on_diff(MANIFEST_UNREADABLE, &entry, found ? &pass->reference : NULL, pass->ctx);
+        if (found)
+            read_reference(pass);
+    } else if (found) {
+        if (entry.size != pass->reference.size ||
+            memcmp(entry.digest.bytes, pass->reference.digest.bytes, entry.digest.size) != 0) {
+            pass->totals->changed++;
+            pass->on_diff(MANIFEST_CHANGED, &entry, &pass->reference, pass->ctx);
+        }
+        read_reference(pass);
+    } else if (pass->status == MANIFEST_OK || pass->status == MANIFEST_END) {
+        pass->totals->added++;
+        pass->on_diff(MANIFEST_ADDED, &entry, NULL, pass->ctx);
+    }
+}
+
+// queue found file for the manifest, stop the walk on manifest's error
+static int manifest_found_file(int dir_fd, const char *path, const char *name, void *ctx) {
+    ManifestPass *pass = (ManifestPass *)ctx;
+    pass->totals->files++;
+    FileFingerprint fingerprint;
+    int no_fingerprint = get_file_fingerprint(dir_fd, name, &fingerprint);
+    // a file missing from the walk would be exported or compared as removed
+    if (hash_pool_submit(path, no_fingerprint ? NULL : &fingerprint, manifest_file_info, pass)) {
+        syslog(LOG_ERR, "[ERROR] hash request for %s\n", get_log_name(path));
+        pass->status = MANIFEST_ERROR;
+    }
+    return pass->status != MANIFEST_OK && pass->status != MANIFEST_END;
+}
+
+// walk the only observing directory in manifest's order
+static void walk_manifest(ManifestPass *pass) {
+    ManifestTotals *totals = pass->totals;
+    if (sets_count != 1 || dirs_count != 1) {
+        pass->status = MANIFEST_ERROR;
+        return;
+    }
+    uint64_t bytes = stats_get(STAT_BYTES_HASHED);
+    // io_uring scanner isn't used: large files would be hashed by the pool out of walk order
+    walk_directories(&sets[0], manifest_found_file, NULL, pass, NULL);
+    hash_pool_flush();
+    totals->bytes = stats_get(STAT_BYTES_HASHED) - bytes;
+}
+
+ManifestStatus export_manifest(ManifestWriter *writer, ManifestTotals *totals) {
+    ManifestPass pass;
+    memset(&pass, 0, sizeof(pass));
+    memset(totals, 0, sizeof(*totals));
+    pass.writer = writer;
+    pass.status = MANIFEST_OK;
+    pass.totals = totals;
+    walk_manifest(&pass);
+    return pass.status;
+}
+
+ManifestStatus compare_manifest(ManifestReader *reader, manifest_diff_fn on_diff, void *ctx,
+                                ManifestTotals *totals) {
+    ManifestPass pass;
+    memset(&pass, 0, sizeof(pass));
+    memset(totals, 0, sizeof(*totals));
+    pass.reader = reader;
+    pass.on_diff = on_diff;
+    pass.ctx = ctx;
+    pass.totals = totals;
+    read_reference(&pass);
+    if (pass.status == MANIFEST_OK || pass.status == MANIFEST_END)
+        walk_manifest(&pass);
+    report_removed(&pass, NULL);
+    return pass.status;
+}
@@ -0,0 +1,159 @@
+#ifndef DIR_CHECK_HEADER
+#define DIR_CHECK_HEADER
+
+#include "daemon.h"
+#include "tree_manifest.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// set observing directories, watch sets, file filters and check mode. Hash
+// workers and io_uring scanner are started by the caller.
+// param[in] config - deamon's settings, the arrays must outlive the checks
+// param[in] use_uring - 1 - hash files with the started io_uring scanner
+void dir_check_setup(const DaemonConfig *config, int use_uring);
+
+// set whether the directory watcher reports changed files. Fast checks skip
+// trees of directories which weren't changed since their last complete walk
+// only while changes are watched. Every call forgets verified trees, so call it
+// when watcher's events were lost too.
+// param[in] watched - 1: changes are watched, 0 - they aren't
+void set_changes_watched(int watched);
+
+// return number of watch sets, the deamon without watch sets has one set of
+// all observing directories
+int get_watch_sets_count();
+
+// return watch set's settings
+// param[in] set - set's index
+const WatchSet *get_watch_set(int set);
+
+// return version of watch set's reference info, it's changed when the set's
+// files or their metadata are saved into file repository
+// param[in] set - set's index
+uint64_t get_watch_set_version(int set);
+
+// hash all files of watch set and save them into file repository as reference
+// param[in] set - set's index
+void init_set_info(int set);
+
+// hash all observed files and save them into file repository as reference
+void init_directory_info();
+
+// check all observed files against file repository, results are logged.
+// Check cycles begun by turns are finished.
+// return number of failed files
+int check_files_in_directory();
+
+// watch set's turn of the check scheduler
+typedef struct {
+    uint64_t budget_bytes; // [in] stop after the file which spent this many bytes (0 - no limit)
+    uint64_t budget_ns;    // [in] stop after this time (0 - no limit)
+    int      sliced;       // [in] 1 - turn is timer's slice: it's logged, the cycle's window applies
+    uint64_t pause_bytes;  // [in] pause after the file which spent this many bytes in the call (0 - never)
+    uint64_t pause_ns;     // [in] pause after this time in the call (0 - never)
+    uint64_t bytes;        // [out] size of files queued for hashing
+    uint64_t ns;           // [out] turn's time
+    int      finished;     // [out] 1 - check cycle was finished
+    int      paused;       // [in,out] 1 - turn was paused: the next call goes on with it
+} CheckTurn;
+
+// check the next files of watch set's check cycle within turn's budget, a new
+// cycle is begun if there is no active one. Files are walked in name order, the
+// turn stops after the file which spent the budget; set's files deleted since
+// the cycle's begin are reported by its last turn. With several watch sets
+// only timer's slices and cycles are logged. A call can pause the turn, so the
+// caller's loop serves its events: the turn goes on by the next call with the
+// same turn, its budget and log cover all its calls.
+// param[in] set - set's index
+// param[in,out] turn - turn's budget and results
+// return number of files failed in the call
+int check_set_turn(int set, CheckTurn *turn);
+
+// save position of watch set's active check cycle, also of a paused turn, so the
+// next deamon's run resumes it. The file is replaced atomically, it's removed if
+// there is no active cycle.
+// param[in] set - set's index
+// param[in] path - path to cursor file
+// return operation result: 0 - ok, 1 - error
+int save_check_cursor(int set, const char *path);
+
+// resume watch set's check cycle saved by save_check_cursor. Call after file repository was
+// loaded from set's baseline.
+// param[in] set - set's index
+// param[in] path - path to cursor file
+// return 1 - cycle was resumed, 0 - no cycle
+int load_check_cursor(int set, const char *path);
+
+// check files reported by the directory watcher
+// return number of failed files
+int check_dirty_files();
+
+typedef enum {
+    FILE_CHECK_OK,      // file is valid
+    FILE_CHECK_FAIL,    // file is new, changed or deleted
+    FILE_CHECK_IGNORED  // file is outside of observing directories, filtered or not a regular file
+} FileCheckResult;
+
+// single file check's result handler, called in the thread which started the check
+// param[in] result - check's result (see FileCheckResult)
+// param[in] ctx - user context from check_single_file
+typedef void (*file_check_fn)(FileCheckResult result, void *ctx);
+
+// check one file, failure is logged like in full check. The file is hashed by
+// hash workers, its result comes from hash_pool_poll or hash_pool_flush, so the
+// caller's loop isn't blocked; results without reading come at once.
+// param[in] path - absolute path to file
+// param[in] on_done - result handler
+// param[in] ctx - user context for on_done
+// return operation's result: 0 - on_done is or will be called, 1 - error
+int check_single_file(const char *path, file_check_fn on_done, void *ctx);
+
+// results of manifest's export or compare
+typedef struct {
+    unsigned long files;   // local files
+    unsigned long added;   // local files which aren't in the manifest
+    unsigned long removed; // manifest's files which aren't found
+    unsigned long changed; // files with another size or digest
+    uint64_t      errors;  // local files which couldn't be read
+    uint64_t      bytes;   // bytes read and hashed
+} ManifestTotals;
+
+typedef enum {
+    MANIFEST_ADDED,
+    MANIFEST_REMOVED,
+    MANIFEST_CHANGED,
+    MANIFEST_UNREADABLE // local file couldn't be read, its digest is zero
+} ManifestDiff;
+
+// difference's handler, called in path order
+// param[in] diff - difference's type (see typedef)
+// param[in] local - local file (NULL - removed file)
+// param[in] reference - manifest's file (NULL - added file or unreadable file which isn't in the manifest)
+// param[in] ctx - user context from compare_manifest
+typedef void (*manifest_diff_fn)(ManifestDiff diff, const ManifestEntry *local,
+                                 const ManifestEntry *reference, void *ctx);
+
+// hash files of the only observing directory and write them into manifest
+// param[in] writer - manifest of the selected hash algorithm, the caller commits it
+// param[out] totals - export's results
+// return operation's status (see ManifestStatus), MANIFEST_ERROR - also some file couldn't be read
+ManifestStatus export_manifest(ManifestWriter *writer, ManifestTotals *totals);
+
+// hash files of the only observing directory and merge them with manifest's
+// files as they come, memory doesn't depend on files count
+// param[in] reader - opened manifest of the selected hash algorithm
+// param[in] on_diff - difference's handler
+// param[in] ctx - user context for on_diff
+// param[out] totals - compare's results
+// return operation's status (see ManifestStatus), MANIFEST_END - all files were compared,
+//        unreadable ones are reported and counted in totals' errors
+ManifestStatus compare_manifest(ManifestReader *reader, manifest_diff_fn on_diff, void *ctx,
+                                ManifestTotals *totals);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DIR_CHECK_HEADER
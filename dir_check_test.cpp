@@ -0,0 +1,736 @@
+#include "baseline_db.h"
+#include "check_stats.h"
+#include "consistency.h"
+#include "daemon.h"
+#include "dir_check.h"
+#include "dir_watch.h"
+#include "file_repo.h"
+#include "report.h"
+#include "set_round.h"
+#include "throttle.h"
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <signal.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+static int fails = 0;
+
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        printf("failed: %s\n", what);
+        fails++;
+    }
+}
+
+static bool write_file(const std::string &path, const std::string &content) {
+    FILE *f = fopen(path.c_str(), "wb");
+    if (!f)
+        return false;
+    bool ok = fwrite(content.data(), 1, content.size(), f) == content.size();
+    return fclose(f) == 0 && ok;
+}
+
+static int remove_entry(const char *path, const struct stat *, int, struct FTW *) {
+    return remove(path);
+}
+
+static void remove_tree(const std::string &path) {
+    nftw(path.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+// JSON lines of integrity events
+static std::string events_path;
+static ReportConfig report_config;
+
+// directory watcher's calls
+static std::atomic<int> watch_changes(0);
+
+static void on_watch_change(int) {
+    watch_changes++;
+}
+
+// return true if the watcher reported a change within 2 sec
+static bool wait_watch_change(int before) {
+    for (int i = 0; i < 200 && watch_changes == before; ++i)
+        usleep(10000);
+    return watch_changes != before;
+}
+
+// return events reported since the previous call, the file is emptied
+static std::vector<std::string> take_events() {
+    report_stop();
+    std::vector<std::string> events;
+    FILE *f = fopen(events_path.c_str(), "r");
+    char line[4096];
+    while (f && fgets(line, sizeof(line), f)) {
+        if (!strstr(line, "\"event\":\"log\""))
+            events.push_back(line);
+    }
+    if (f)
+        fclose(f);
+    if (truncate(events_path.c_str(), 0) != 0 || report_start(&report_config) != 0)
+        check(false, "restart report");
+    return events;
+}
+
+// return number of events of the type with the text
+static int count_events(const std::vector<std::string> &events, const char *type, const char *text) {
+    std::string name = std::string("\"event\":\"") + type + "\"";
+    int count = 0;
+    for (const std::string &event: events) {
+        if (event.find(name) != std::string::npos && (!text || event.find(text) != std::string::npos))
+            count++;
+    }
+    return count;
+}
+
+static ConsistencyConfig consistency_config(int retries, int backoff_ms, int defer_writers, int max_deferrals) {
+    ConsistencyConfig consistency;
+    memset(&consistency, 0, sizeof(consistency));
+    consistency.retries = retries;
+    consistency.backoff_ms = backoff_ms;
+    consistency.defer_writers = defer_writers;
+    consistency.max_deferrals = max_deferrals;
+    return consistency;
+}
+
+// set up checks of the directories, reference info is taken from their files
+static void setup_checks(DaemonConfig &config, char **dirs, const ConsistencyConfig &consistency,
+                         int dirs_count = 1, int fast_check = 0) {
+    memset(&config, 0, sizeof(config));
+    config.paths_to_dirs = dirs;
+    config.dirs_count = dirs_count;
+    config.fast_check = fast_check;
+    config.timeout_s = 1;
+    config.consistency = consistency;
+    consistency_setup(&config.consistency);
+    dir_check_setup(&config, 0);
+    clear_files();
+    init_directory_info();
+    take_events();
+}
+
+// write count files of size bytes: f00, f01, ...
+static bool make_files(const std::string &dir, int count, size_t size) {
+    if (mkdir(dir.c_str(), 0755) != 0)
+        return false;
+    for (int i = 0; i < count; ++i) {
+        char name[16];
+        snprintf(name, sizeof(name), "/f%02d", i);
+        if (!write_file(dir + name, std::string(size, static_cast<char>('a' + i % 26))))
+            return false;
+    }
+    return true;
+}
+
+// set up checks of watch sets, reference info is taken from their files
+static void setup_sets(DaemonConfig &config, WatchSet *sets, int count, std::vector<char *> &dirs) {
+    dirs.clear();
+    for (int i = 0; i < count; ++i)
+        dirs.insert(dirs.end(), sets[i].paths_to_dirs, sets[i].paths_to_dirs + sets[i].dirs_count);
+    memset(&config, 0, sizeof(config));
+    config.paths_to_dirs = dirs.data();
+    config.dirs_count = static_cast<int>(dirs.size());
+    config.timeout_s = 1;
+    config.watch_sets = sets;
+    config.watch_sets_count = count;
+    consistency_setup(&config.consistency);
+    dir_check_setup(&config, 0);
+    clear_files();
+    init_directory_info();
+    take_events();
+}
+
+// turns of watch sets' round till all checks are finished
+struct RoundLog {
+    std::vector<int> sets;        // set of every turn
+    std::vector<uint64_t> bytes;  // bytes of every turn
+    std::vector<int> fails;       // failed files of every turn
+    std::vector<int> finished;    // set's check was finished by the turn
+};
+
+// param[in] on_turn - called after every turn with its set
+template <typename TurnFn>
+static RoundLog run_round(WatchSet *sets, int count, uint64_t quantum, TurnFn on_turn) {
+    std::vector<RoundSet> members(static_cast<size_t>(count));
+    SetRound round = {members.data(), count, 0, quantum};
+    for (int i = 0; i < count; ++i) {
+        members[static_cast<size_t>(i)].weight = sets[i].weight;
+        join_round(&round, i);
+    }
+    RoundLog log;
+    int set;
+    while ((set = next_round_turn(&round)) >= 0) {
+        CheckTurn turn;
+        memset(&turn, 0, sizeof(turn));
+        turn.budget_bytes = round_turn_budget(&round, set);
+        log.fails.push_back(check_set_turn(set, &turn));
+        spend_round_turn(&round, set, turn.bytes);
+        if (turn.finished)
+            leave_round(&round, set);
+        log.sets.push_back(set);
+        log.bytes.push_back(turn.bytes);
+        log.finished.push_back(turn.finished);
+        on_turn(set);
+    }
+    return log;
+}
+
+// changes file's metadata without writing it until stopped
+class MetadataWriter {
+public:
+    explicit MetadataWriter(const std::string &path) : path_(path), stop_(false), started_(false) {
+        thread_ = std::thread([this] {
+            struct timespec times[2] = {{1000000, 0}, {1000000, 0}};
+            while (!stop_) {
+                times[0].tv_sec++;
+                times[1].tv_sec++;
+                utimensat(AT_FDCWD, path_.c_str(), times, 0);
+                started_ = true;
+            }
+        });
+        while (!started_) {}
+    }
+
+    ~MetadataWriter() {
+        stop_ = true;
+        thread_.join();
+    }
+
+private:
+    std::string path_;
+    std::atomic<bool> stop_;
+    std::atomic<bool> started_;
+    std::thread thread_;
+};
+
+// keeps file open for write in a child process
+class OpenWriter {
+public:
+    explicit OpenWriter(const std::string &path) : pid_(-1) {
+        int ready[2];
+        if (pipe(ready) != 0)
+            return;
+        pid_ = fork();
+        if (pid_ == 0) {
+            int fd = open(path.c_str(), O_WRONLY | O_APPEND);
+            char c = fd >= 0 ? 1 : 0;
+            if (write(ready[1], &c, 1) != 1) {}
+            pause();
+            _exit(0);
+        }
+        char c = 0;
+        if (pid_ < 0 || read(ready[0], &c, 1) != 1 || !c)
+            check(false, "open file for write");
+        close(ready[0]);
+        close(ready[1]);
+    }
+
+    ~OpenWriter() {
+        if (pid_ > 0) {
+            kill(pid_, SIGKILL);
+            waitpid(pid_, NULL, 0);
+        }
+    }
+
+private:
+    pid_t pid_;
+};
+
+// differences of compare_manifest: "<type> <path>"
+static void collect_diff(ManifestDiff diff, const ManifestEntry *local, const ManifestEntry *reference, void *ctx) {
+    static const char *names[] = {"added", "removed", "changed", "unreadable"};
+    const char *path = local ? local->path : reference->path;
+    static_cast<std::vector<std::string> *>(ctx)->push_back(std::string(names[diff]) + " " + path);
+}
+
+// compare files of the only directory with manifest
+static std::vector<std::string> compare_with(const std::string &path, ManifestStatus &status) {
+    std::vector<std::string> diffs;
+    HashAlgo algo;
+    ManifestReader *reader;
+    status = manifest_open(path.c_str(), &algo, &reader);
+    if (status != MANIFEST_OK)
+        return diffs;
+    ManifestTotals totals;
+    status = compare_manifest(reader, collect_diff, &diffs, &totals);
+    manifest_close_reader(reader);
+    return diffs;
+}
+
+// call function with its printing discarded
+template <typename Fn>
+static int quietly(Fn fn) {
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    int result = fn();
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(null_fd);
+    close(saved);
+    return result;
+}
+
+static int run_manifest_quietly(const DaemonConfig &config, const std::string &path, int write_manifest) {
+    return quietly([&] { return run_manifest_command(&config, path.c_str(), write_manifest); });
+}
+
+// write tree of check cursor's tests: c, d/f00, d/f01, d-e, d.txt, e. Walk order
+// puts "d-e" after "d/f01" though strcmp puts it before.
+static bool make_cursor_tree(const std::string &root) {
+    remove_tree(root);
+    return mkdir(root.c_str(), 0755) == 0 && write_file(root + "/c", std::string(100, 'c')) &&
+           make_files(root + "/d", 2, 100) && write_file(root + "/d-e", std::string(100, '-')) &&
+           write_file(root + "/d.txt", std::string(100, '.')) && write_file(root + "/e", std::string(100, 'e'));
+}
+
+// check the only set's files within budget
+// return number of failed files
+static int check_turn(uint64_t budget_bytes, CheckTurn &turn) {
+    memset(&turn, 0, sizeof(turn));
+    turn.budget_bytes = budget_bytes;
+    return check_set_turn(0, &turn);
+}
+
+// stop the set's check after budget, save its cursor and start a new deamon's run
+// with the cursor, reference info is kept
+// return 1 - cycle was resumed, 0 - no cycle
+static int restart_after(DaemonConfig &config, uint64_t budget_bytes, const std::string &cursor) {
+    CheckTurn turn;
+    if (check_turn(budget_bytes, turn) != 0 || turn.finished || save_check_cursor(0, cursor.c_str()) != 0)
+        return 0;
+    dir_check_setup(&config, 0);
+    return load_check_cursor(0, cursor.c_str());
+}
+
+int main() {
+    char dir[] = "/tmp/dir_check_test_XXXXXX";
+    if (!mkdtemp(dir)) {
+        printf("failed: can't create directory\n");
+        return 1;
+    }
+    std::string root = std::string(dir) + "/tree";
+    mkdir(root.c_str(), 0755);
+    char *dirs[] = {&root[0]};
+    events_path = std::string(dir) + "/events.json";
+    report_config.events_path = events_path.c_str();
+    if (report_start(&report_config) != 0) {
+        printf("failed: can't start report\n");
+        return 1;
+    }
+    DaemonConfig config;
+
+    printf("TEST 1: torn reads are retried... ");
+    std::string large = root + "/large";
+    // reads of the file sleep in the rate limiter, so its changes are seen on one cpu too
+    check(write_file(large, std::string(4 << 20, 'x')), "write large file");
+    ThrottleConfig throttle;
+    memset(&throttle, 0, sizeof(throttle));
+    throttle.bytes_per_sec = 16 << 20;
+    throttle_setup(&throttle);
+    ConsistencyConfig consistency = consistency_config(2, 1, 0, 1);
+    consistency_setup(&consistency);
+    FileAttr digest;
+    FileFingerprint fingerprint, current;
+    uint64_t torn = stats_get(STAT_TORN_READS);
+    {
+        MetadataWriter writer(large);
+        check(hash_path_consistent(large.c_str(), &digest, &fingerprint) == READ_UNSTABLE, "changing file is unstable");
+    }
+    check(stats_get(STAT_TORN_READS) - torn == 3, "every read is torn");
+    torn = stats_get(STAT_TORN_READS);
+    check(hash_path_consistent(large.c_str(), &digest, &fingerprint) == READ_STABLE, "unchanged file is stable");
+    check(stats_get(STAT_TORN_READS) == torn, "no torn reads");
+    check(get_path_fingerprint(large.c_str(), &current) == 0 && same_fingerprint(&fingerprint, &current),
+          "fingerprint of hashed content");
+    // the file stops changing before the retry
+    consistency = consistency_config(2, 500, 0, 1);
+    consistency_setup(&consistency);
+    MetadataWriter *writer = new MetadataWriter(large);
+    std::thread stopper([writer] {
+        usleep(100000);
+        delete writer;
+    });
+    check(hash_path_consistent(large.c_str(), &digest, &fingerprint) == READ_STABLE, "retry is stable");
+    stopper.join();
+    check(stats_get(STAT_TORN_READS) - torn == 1, "retried once");
+    printf("Ok\n");
+
+    printf("TEST 2: changing file is deferred, then reported... ");
+    setup_checks(config, dirs, consistency_config(1, 1, 0, 2));
+    uint64_t deferred = stats_get(STAT_DEFERRED_UNSTABLE);
+    {
+        MetadataWriter writer(large);
+        check(check_files_in_directory() == 0 && check_files_in_directory() == 0, "deferred passes");
+        check(stats_get(STAT_DEFERRED_UNSTABLE) - deferred == 2, "deferrals counted");
+        check(take_events().empty(), "no events while deferred");
+        check(check_files_in_directory() == 1, "reported after max deferrals");
+        check(count_events(take_events(), "changed", "torn read") == 1, "torn read event");
+    }
+    check(check_files_in_directory() == 0, "stable file is valid");
+    check(stats_get(STAT_DEFERRED_UNSTABLE) - deferred == 2, "no more deferrals");
+    printf("Ok\n");
+
+    printf("TEST 3: file open for write is deferred, then hashed... ");
+    std::string written = root + "/written";
+    check(write_file(written, "old content"), "write file");
+    memset(&throttle, 0, sizeof(throttle));
+    throttle_setup(&throttle);
+    setup_checks(config, dirs, consistency_config(0, 0, 1, 2));
+    deferred = stats_get(STAT_DEFERRED_WRITERS);
+    {
+        OpenWriter writer(written);
+        check(write_file(written, "new content"), "change file");
+        // files open for write are rescanned once per second
+        sleep(1);
+        check(check_files_in_directory() == 0 && check_files_in_directory() == 0, "deferred passes");
+        check(stats_get(STAT_DEFERRED_WRITERS) - deferred == 2, "deferrals counted");
+        check(check_files_in_directory() == 1, "hashed after max deferrals");
+        check(count_events(take_events(), "changed", "new ") == 1, "changed event");
+        // deferrals start again after the check
+        check(check_files_in_directory() == 0, "deferred again");
+        check(stats_get(STAT_DEFERRED_WRITERS) - deferred == 3, "deferral after the check");
+    }
+    printf("Ok\n");
+
+    printf("TEST 4: weighted fairness of watch sets... ");
+    std::string light_dir = root + "/light", heavy_dir = root + "/heavy";
+    check(make_files(light_dir, 64, 4096) && make_files(heavy_dir, 64, 4096), "make sets' files");
+    char *light_dirs[] = {&light_dir[0]};
+    char *heavy_dirs[] = {&heavy_dir[0]};
+    WatchSet sets[2];
+    memset(sets, 0, sizeof(sets));
+    sets[0].name = const_cast<char *>("light");
+    sets[0].paths_to_dirs = light_dirs;
+    sets[0].dirs_count = 1;
+    sets[0].interval_s = 1;
+    sets[0].weight = 1;
+    sets[1] = sets[0];
+    sets[1].name = const_cast<char *>("heavy");
+    sets[1].paths_to_dirs = heavy_dirs;
+    sets[1].weight = 3;
+    std::vector<char *> all_dirs;
+    setup_sets(config, sets, 2, all_dirs);
+    const uint64_t quantum = 8192;
+    RoundLog log = run_round(sets, 2, quantum, [](int) {});
+    uint64_t read[2] = {0, 0};
+    int total_fails = 0;
+    bool both_running = true;
+    for (size_t i = 0; i < log.sets.size(); ++i) {
+        int set = log.sets[i];
+        // a turn stops after the file which spent its deficit
+        check(log.bytes[i] <= quantum * sets[set].weight + 4096, "turn's budget");
+        if (both_running)
+            read[set] += log.bytes[i];
+        if (log.finished[i])
+            both_running = false;
+        total_fails += log.fails[i];
+    }
+    check(total_fails == 0 && take_events().empty(), "unchanged sets");
+    check(log.finished.back() && log.sets.back() == 0, "heavy set finishes first");
+    check(read[1] == 64 * 4096 && read[0] * 5 >= read[1] && read[0] * 2 <= read[1], "reading by weights");
+    printf("Ok\n");
+
+    printf("TEST 5: set's check resumes after its quantum... ");
+    bool changed = false;
+    log = run_round(sets, 2, quantum, [&](int set) {
+        if (changed || set != 0)
+            return;
+        // files after the light set's cursor are changed and deleted
+        check(write_file(light_dir + "/f60", std::string(4096, '#')), "change file");
+        check(unlink((light_dir + "/f61").c_str()) == 0, "delete file");
+        changed = true;
+    });
+    std::vector<std::string> events = take_events();
+    total_fails = 0;
+    int light_turns = 0;
+    for (size_t i = 0; i < log.sets.size(); ++i) {
+        total_fails += log.fails[i];
+        light_turns += log.sets[i] == 0;
+    }
+    check(changed && light_turns > 2, "light set's turns");
+    check(total_fails == 2 && events.size() == 2, "failed files");
+    check(count_events(events, "changed", "/light/f60") == 1 && count_events(events, "deleted", "/light/f61") == 1,
+          "events of resumed cycle");
+    printf("Ok\n");
+
+    printf("TEST 6: sets with common path prefix... ");
+    std::string prefix_dir = root + "/heavy_more";
+    check(make_files(prefix_dir, 4, 100), "make prefix set's files");
+    char *prefix_dirs[] = {&prefix_dir[0]};
+    sets[0].paths_to_dirs = prefix_dirs;
+    setup_sets(config, sets, 2, all_dirs);
+    CheckTurn turn;
+    memset(&turn, 0, sizeof(turn));
+    check(check_set_turn(1, &turn) == 0 && turn.finished, "heavy set keeps prefix set's files");
+    check(unlink((prefix_dir + "/f00").c_str()) == 0, "delete file");
+    memset(&turn, 0, sizeof(turn));
+    check(check_set_turn(1, &turn) == 0, "other set's deletion");
+    memset(&turn, 0, sizeof(turn));
+    check(check_set_turn(0, &turn) == 1, "own deletion");
+    events = take_events();
+    check(events.size() == 1 && count_events(events, "deleted", "/heavy_more/f00") == 1, "deleted event");
+    printf("Ok\n");
+
+    printf("TEST 7: set's baseline round trip... ");
+    setup_sets(config, sets, 2, all_dirs);
+    std::string baseline = std::string(dir) + "/heavy.db";
+    FileAttr heavy_attr, prefix_attr, loaded;
+    std::string heavy_file = heavy_dir + "/f01", prefix_file = prefix_dir + "/f01";
+    check(get_file_attr(heavy_file.c_str(), &heavy_attr) == 0 && get_file_attr(prefix_file.c_str(), &prefix_attr) == 0,
+          "observed files");
+    check(save_baseline_in(baseline.c_str(), heavy_dirs, 1) == BASELINE_OK, "save set's baseline");
+    clear_files();
+    check(load_baseline(baseline.c_str()) == BASELINE_OK, "load set's baseline");
+    check(get_file_attr(heavy_file.c_str(), &loaded) == 0 && loaded.size == heavy_attr.size &&
+          memcmp(loaded.bytes, heavy_attr.bytes, loaded.size) == 0, "set's file");
+    check(!is_file_observed(prefix_file.c_str()), "other set's file");
+    memset(&turn, 0, sizeof(turn));
+    check(check_set_turn(1, &turn) == 0 && take_events().empty(), "check of loaded set");
+    printf("Ok\n");
+
+    printf("TEST 8: tree manifest's export and compare... ");
+    std::string tree = std::string(dir) + "/manifest_tree", manifest = std::string(dir) + "/tree.manifest";
+    char *tree_dirs[] = {&tree[0]};
+    // "a/b" goes before "a-b" and "a.b" in tree order
+    check(mkdir(tree.c_str(), 0755) == 0 && mkdir((tree + "/a").c_str(), 0755) == 0 &&
+          write_file(tree + "/a/b", "ab") && write_file(tree + "/a/c", "ac") && write_file(tree + "/a.b", "a.b") &&
+          write_file(tree + "/b", "b"), "write tree");
+    setup_checks(config, tree_dirs, consistency_config(0, 0, 0, 1));
+    check(run_manifest_quietly(config, manifest, 1) == 0, "export exit code");
+    check(run_manifest_quietly(config, manifest, 0) == 0, "same tree's exit code");
+    ManifestStatus status;
+    check(compare_with(manifest, status).empty() && status == MANIFEST_END, "same tree");
+    check(write_file(tree + "/a/c", "AC") && write_file(tree + "/a/a", "aa") && write_file(tree + "/a-b", "a-b") &&
+          remove((tree + "/a.b").c_str()) == 0 && remove((tree + "/b").c_str()) == 0 &&
+          mkdir((tree + "/c").c_str(), 0755) == 0 && write_file(tree + "/c/d", "cd"), "change tree");
+    std::vector<std::string> diffs = compare_with(manifest, status);
+    std::vector<std::string> expected = {"added a/a", "changed a/c", "added a-b", "removed a.b", "removed b",
+                                         "added c/d"};
+    check(diffs == expected && status == MANIFEST_END, "differences in tree order");
+    check(run_manifest_quietly(config, manifest, 0) == 1, "changed tree's exit code");
+    // root reads files regardless of their mode
+    std::string unreadable = tree + "/a/b";
+    chmod(unreadable.c_str(), 0);
+    if (access(unreadable.c_str(), R_OK) != 0) {
+        check(run_manifest_quietly(config, manifest, 0) == 2, "unreadable file's compare exit code");
+        diffs = compare_with(manifest, status);
+        check(diffs.size() == expected.size() + 1 && diffs[1] == "unreadable a/b", "unreadable file's difference");
+        std::string other = std::string(dir) + "/other.manifest";
+        check(run_manifest_quietly(config, other, 1) == 2 && access(other.c_str(), F_OK) != 0,
+              "unreadable file's export");
+    }
+    chmod(unreadable.c_str(), 0644);
+    printf("Ok\n");
+
+    printf("TEST 9: verified trees are skipped while changes are watched... ");
+    std::string skip_root = std::string(dir) + "/skip", skip_x = skip_root + "/x", skip_y = skip_root + "/y";
+    char *skip_dirs[] = {&skip_root[0]};
+    check(mkdir(skip_root.c_str(), 0755) == 0 && make_files(skip_x, 4, 64) && make_files(skip_y, 2, 64),
+          "write tree");
+    setup_checks(config, skip_dirs, consistency_config(0, 0, 0, 1), 1, 1);
+    set_changes_watched(0);
+    uint64_t skipped = stats_get(STAT_TREES_SKIPPED);
+    check(check_files_in_directory() == 0 && check_files_in_directory() == 0 &&
+          stats_get(STAT_TREES_SKIPPED) == skipped, "trees aren't skipped without the watcher");
+    // rewritten in place: directories' metadata is the same
+    check(write_file(skip_y + "/f00", std::string(64, 'z')), "rewrite file");
+    check(check_files_in_directory() == 1, "unwatched change");
+    init_directory_info();
+    take_events();
+    set_changes_watched(1);
+    check(check_files_in_directory() == 0 && stats_get(STAT_TREES_SKIPPED) == skipped, "verifying walk");
+    check(check_files_in_directory() == 0 && stats_get(STAT_TREES_SKIPPED) == skipped + 1, "verified tree");
+    // the change isn't seen till the watcher marks it
+    check(write_file(skip_x + "/f00", std::string(64, 'z')), "rewrite file");
+    check(check_files_in_directory() == 0 && stats_get(STAT_TREES_SKIPPED) == skipped + 2, "unmarked change");
+    mark_path_changed((skip_x + "/f00").c_str());
+    check(check_files_in_directory() == 1 && stats_get(STAT_TREES_SKIPPED) == skipped + 3, "marked tree's walk");
+    events = take_events();
+    check(events.size() == 1 && count_events(events, "changed", "/x/f00") == 1, "marked change");
+    // saved files change their trees, the next walk verifies them
+    init_directory_info();
+    check(check_files_in_directory() == 0 && stats_get(STAT_TREES_SKIPPED) == skipped + 3, "walk of saved tree");
+    check(check_files_in_directory() == 0 && stats_get(STAT_TREES_SKIPPED) == skipped + 4, "tree verified again");
+    // watcher's events were lost
+    check(write_file(skip_y + "/f01", std::string(64, 'z')), "rewrite file");
+    set_changes_watched(1);
+    check(check_files_in_directory() == 1 && stats_get(STAT_TREES_SKIPPED) == skipped + 4, "forgotten trees' walk");
+    events = take_events();
+    check(events.size() == 1 && count_events(events, "changed", "/y/f01") == 1, "change after lost events");
+    // in-place write without close is seen by the watcher
+    init_directory_info();
+    check(dir_watch_start(skip_dirs, 1, on_watch_change) == 0 && dir_watch_complete(), "start watcher");
+    set_changes_watched(1);
+    check(check_files_in_directory() == 0, "verifying walk");
+    skipped = stats_get(STAT_TREES_SKIPPED);
+    check(check_files_in_directory() == 0 && stats_get(STAT_TREES_SKIPPED) == skipped + 1, "verified tree");
+    int changes = watch_changes;
+    int writer_fd = open((skip_x + "/f01").c_str(), O_WRONLY);
+    check(writer_fd >= 0 && pwrite(writer_fd, "zz", 2, 0) == 2, "write in place");
+    check(wait_watch_change(changes), "watcher's change");
+    check(check_dirty_files() == 1, "dirty check");
+    check(check_files_in_directory() == 1 && stats_get(STAT_TREES_SKIPPED) == skipped + 2, "written tree's walk");
+    events = take_events();
+    check(events.size() == 2 && count_events(events, "changed", "/x/f01") == 2, "unclosed write");
+    if (writer_fd >= 0)
+        close(writer_fd);
+    dir_watch_stop();
+    set_changes_watched(0);
+    printf("Ok\n");
+
+    printf("TEST 10: Merkle digests of trees... ");
+    std::string mount_a = std::string(dir) + "/mount_a", mount_b = std::string(dir) + "/mount_b";
+    std::string tree_a = mount_a + "/data", tree_b = mount_b + "/data";
+    char *digest_dirs[] = {&tree_a[0], &tree_b[0]};
+    check(mkdir(mount_a.c_str(), 0755) == 0 && mkdir(mount_b.c_str(), 0755) == 0 && make_files(tree_a, 3, 32) &&
+          make_files(tree_a + "/sub", 2, 16) && make_files(tree_b, 3, 32) && make_files(tree_b + "/sub", 2, 16),
+          "write trees");
+    setup_checks(config, digest_dirs, consistency_config(0, 0, 0, 1), 2);
+    FileAttr digest_a, digest_b, sub_a;
+    check(get_tree_digest(tree_a.c_str(), &digest_a) == 0 && get_tree_digest(tree_b.c_str(), &digest_b) == 0 &&
+          get_tree_digest((tree_a + "/sub").c_str(), &sub_a) == 0, "trees' digests");
+    check(digest_a.size == get_file_attr_size() && digest_a.size == digest_b.size &&
+          memcmp(digest_a.bytes, digest_b.bytes, digest_a.size) == 0, "same trees in other directories");
+    check(memcmp(digest_a.bytes, sub_a.bytes, digest_a.size) != 0, "subdirectory's digest");
+    check(get_tree_digest((std::string(dir) + "/unknown").c_str(), &digest_b) != 0, "unknown directory");
+    // digests are kept over reference info
+    check(write_file(tree_b + "/sub/added", "added"), "add file");
+    init_directory_info();
+    check(get_tree_digest(tree_b.c_str(), &digest_b) == 0 && memcmp(digest_a.bytes, digest_b.bytes, digest_a.size) != 0,
+          "added file's digest");
+    check(write_file(tree_a + "/sub/added", "added"), "add file");
+    init_directory_info();
+    check(get_tree_digest(tree_a.c_str(), &digest_a) == 0 && get_tree_digest(tree_b.c_str(), &digest_b) == 0 &&
+          memcmp(digest_a.bytes, digest_b.bytes, digest_a.size) == 0, "same added file");
+    check(remove((tree_b + "/f02").c_str()) == 0, "remove file");
+    clear_files();
+    init_directory_info();
+    check(get_tree_digest(tree_b.c_str(), &digest_b) == 0 && memcmp(digest_a.bytes, digest_b.bytes, digest_a.size) != 0,
+          "removed file's digest");
+    take_events();
+    printf("Ok\n");
+
+    printf("TEST 11: check cycle resumes by saved cursor... ");
+    std::string cursor_root = std::string(dir) + "/cursor", cursor = std::string(dir) + "/cursor.txt";
+    char *cursor_dirs[] = {&cursor_root[0]};
+    check(make_cursor_tree(cursor_root), "write tree");
+    setup_checks(config, cursor_dirs, consistency_config(0, 0, 0, 1));
+    // after d/f01: the rest of "d" is skipped, "d-e" isn't
+    check(restart_after(config, 300, cursor) == 1, "resume after d/f01");
+    check(write_file(cursor_root + "/c", std::string(100, 'C')) && write_file(cursor_root + "/d/f00", std::string(100, 'D')) &&
+          write_file(cursor_root + "/d-e", std::string(100, 'E')) && write_file(cursor_root + "/d.txt", std::string(100, 'T')),
+          "change files");
+    check(check_turn(0, turn) == 2 && turn.finished, "resumed turn");
+    events = take_events();
+    check(events.size() == 2 && count_events(events, "changed", "/cursor/d-e") == 1 &&
+          count_events(events, "changed", "/cursor/d.txt") == 1, "files after cursor");
+    check(access(cursor.c_str(), F_OK) == 0 && save_check_cursor(0, cursor.c_str()) == 0 &&
+          access(cursor.c_str(), F_OK) != 0, "finished cycle's cursor is removed");
+    // cursor's file was deleted meanwhile
+    check(make_cursor_tree(cursor_root), "write tree");
+    clear_files();
+    init_directory_info();
+    take_events();
+    check(restart_after(config, 200, cursor) == 1, "resume after d/f00");
+    check(unlink((cursor_root + "/d/f00").c_str()) == 0 && write_file(cursor_root + "/d/f01", std::string(100, 'D')),
+          "change files");
+    check(check_turn(0, turn) == 1 && turn.finished, "resumed turn after deleted cursor");
+    events = take_events();
+    check(events.size() == 1 && count_events(events, "changed", "/cursor/d/f01") == 1, "file after deleted cursor");
+    // the deletion is found by the next cycle
+    check(check_turn(0, turn) == 2, "next cycle");
+    events = take_events();
+    check(count_events(events, "deleted", "/cursor/d/f00") == 1, "deleted cursor's file");
+    // cursor's directory was deleted meanwhile
+    check(make_cursor_tree(cursor_root), "write tree");
+    clear_files();
+    init_directory_info();
+    take_events();
+    check(restart_after(config, 200, cursor) == 1, "resume after d/f00");
+    remove_tree(cursor_root + "/d");
+    check(check_turn(0, turn) == 1 && turn.finished, "resumed turn after deleted directory");
+    events = take_events();
+    check(events.size() == 1 && count_events(events, "deleted", "/cursor/d/f01") == 1, "deleted directory's file");
+    printf("Ok\n");
+
+    printf("TEST 12: baseline of another hash algorithm isn't rebuilt... ");
+    std::string algo_baseline = std::string(dir) + "/crc32.db";
+    check(save_baseline(algo_baseline.c_str()) == BASELINE_OK, "save crc32 baseline");
+    config.baseline_path = &algo_baseline[0];
+    config.hash_algo = HASH_BLAKE3;
+    check(quietly([&] { return check_baselines(&config); }) == 1, "blake3 daemon");
+    check(quietly([&] { return start_daemon(&config); }) == EXIT_FAILURE, "blake3 daemon isn't started");
+    config.hash_algo = HASH_CRC32;
+    check(check_baselines(&config) == 0, "crc32 daemon");
+    sets[1].baseline_path = &algo_baseline[0];
+    config.watch_sets = sets;
+    config.watch_sets_count = 2;
+    config.baseline_path = NULL;
+    config.hash_algo = HASH_XXH3_64;
+    check(quietly([&] { return check_baselines(&config); }) == 1, "watch set's baseline");
+    config.hash_algo = HASH_CRC32;
+    check(check_baselines(&config) == 0, "watch sets' baselines");
+    std::string missing = std::string(dir) + "/missing.db";
+    sets[1].baseline_path = &missing[0];
+    config.hash_algo = HASH_BLAKE3;
+    check(check_baselines(&config) == 0, "baseline to build");
+    printf("Ok\n");
+
+    printf("TEST 13: paused turns go on by the next call... ");
+    std::string pause_root = std::string(dir) + "/pause";
+    char *pause_dirs[] = {&pause_root[0]};
+    check(make_files(pause_root, 10, 4096), "write tree");
+    setup_checks(config, pause_dirs, consistency_config(0, 0, 0, 1));
+    check(write_file(pause_root + "/f01", std::string(4096, 'z')) && write_file(pause_root + "/f08", std::string(4096, 'z')),
+          "change files");
+    uint64_t full_passes = stats_get(STAT_PASSES_FULL), slice_passes = stats_get(STAT_PASSES_SLICE);
+    memset(&turn, 0, sizeof(turn));
+    turn.pause_bytes = 3 * 4096;
+    int calls = 0, turn_fails = 0;
+    do {
+        turn_fails += check_set_turn(0, &turn);
+        calls++;
+    } while (turn.paused && calls < 10);
+    check(calls == 4 && turn.finished && turn.bytes == 10 * 4096 && turn_fails == 2, "paused whole check");
+    check(stats_get(STAT_PASSES_FULL) == full_passes + 1 && stats_get(STAT_PASSES_SLICE) == slice_passes,
+          "one check's log");
+    events = take_events();
+    check(events.size() == 2 && count_events(events, "changed", "/pause/f01") == 1 &&
+          count_events(events, "changed", "/pause/f08") == 1, "changes of paused check");
+    // budget counts all calls of the turn
+    init_directory_info();
+    memset(&turn, 0, sizeof(turn));
+    turn.budget_bytes = 5 * 4096;
+    turn.pause_bytes = 2 * 4096;
+    calls = 0;
+    do {
+        check_set_turn(0, &turn);
+        calls++;
+    } while (turn.paused && calls < 10);
+    check(calls == 3 && !turn.finished && turn.bytes == 5 * 4096, "turn's budget over pauses");
+    check(check_turn(0, turn) == 0 && turn.finished, "rest of cycle");
+    // the budget's slice and the cycle's last one
+    check(stats_get(STAT_PASSES_SLICE) == slice_passes + 2 && take_events().empty(), "budget's slice");
+    printf("Ok\n");
+
+    report_stop();
+    clear_files();
+    remove_tree(dir);
+    if (fails) {
+        printf("%d checks failed\n", fails);
+        return 1;
+    }
+    return 0;
+}
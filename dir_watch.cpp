@@ -0,0 +1,242 @@
+#include "dir_watch.h"
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// in-place writes of long-lived writers and mmap stores, truncates and utimes are
+// seen without close too
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | \
+                      IN_CREATE | IN_ONLYDIR)
+
+// a watcher with missing watches retries to add them this often
+#define REWATCH_INTERVAL_MS (60 * 1000)
+
+static int inotify_fd = -1;
+static int stop_pipe[2] = {-1, -1};
+static std::thread watcher;
+static dir_change_fn change_handler;
+static std::mutex dirty_mutex;
+static std::unordered_set<std::string> dirty_files;
+// watched directories by watch descriptor
+static std::unordered_map<int, std::string> watched_dirs;
+static std::vector<std::string> watched_roots;
+// every directory of the trees has its watch
+static std::atomic<bool> watches_complete(false);
+
+// return true if file became dirty in the clean directory
+static bool mark_dirty(const char *file) {
+    std::lock_guard<std::mutex> lock(dirty_mutex);
+    bool was_clean = dirty_files.empty();
+    dirty_files.insert(file);
+    return was_clean;
+}
+
+static std::string join_path(const std::string &dir, const char *name) {
+    if (!dir.empty() && dir.back() == '/')
+        return dir + name;
+    return dir + "/" + name;
+}
+
+// watch directory and its subdirectories
+// param[in] path - path to directory
+// param[in] mark_files - mark found files dirty (directory is new for the daemon)
+// param[out] notify - set if file became dirty in the clean directories
+// return false - some directory can't be watched
+static bool watch_tree(const std::string &path, bool mark_files, bool *notify) {
+    int wd = inotify_add_watch(inotify_fd, path.c_str(), WATCH_EVENTS);
+    if (wd < 0)
+        return errno == ENOENT || errno == ENOTDIR; // removed already
+    watched_dirs[wd] = path;
+    DIR *d = opendir(path.c_str());
+    if (!d)
+        return errno == ENOENT;
+    bool ok = true;
+    struct dirent *dir;
+    while ((dir = readdir(d)) != NULL) {
+        const char *name = dir->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+            continue;
+        unsigned char type = dir->d_type;
+        if (type == DT_UNKNOWN) {
+            struct stat sb;
+            if (fstatat(dirfd(d), name, &sb, AT_SYMLINK_NOFOLLOW) != 0)
+                continue;
+            type = S_ISDIR(sb.st_mode) ? DT_DIR : S_ISREG(sb.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+        if (type == DT_DIR)
+            ok &= watch_tree(join_path(path, name), mark_files, notify);
+        else if (type == DT_REG && mark_files)
+            *notify |= mark_dirty(join_path(path, name).c_str());
+    }
+    closedir(d);
+    return ok;
+}
+
+// re-add watches of the whole trees after lost events, e.g. of new subdirectories
+// return true - every directory is watched
+static bool rewatch_trees() {
+    bool ok = true;
+    try {
+        bool notify = false;
+        for (const std::string &root: watched_roots)
+            ok &= watch_tree(root, false, &notify);
+    }  catch (...) {
+        ok = false;
+    }
+    watches_complete = ok;
+    return ok;
+}
+
+static void watch_loop() {
+    alignas(struct inotify_event) char buffer[16 * 1024];
+    struct pollfd fds[2] = {{inotify_fd, POLLIN, 0}, {stop_pipe[0], POLLIN, 0}};
+    while (1) {
+        int ready = poll(fds, 2, watches_complete ? -1 : REWATCH_INTERVAL_MS);
+        if (ready < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        if (ready == 0) {
+            // checks know the trees are watched again
+            if (rewatch_trees())
+                change_handler(1);
+            continue;
+        }
+        if (fds[1].revents)
+            return; // stop request
+        ssize_t len = read(inotify_fd, buffer, sizeof(buffer));
+        if (len <= 0) {
+            if (len < 0 && (errno == EINTR || errno == EAGAIN))
+                continue;
+            return;
+        }
+        bool notify = false;
+        bool overflow = false;
+        for (char *p = buffer; p < buffer + len; ) {
+            struct inotify_event *event = reinterpret_cast<struct inotify_event *>(p);
+            p += sizeof(struct inotify_event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW) {
+                overflow = true;
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                watched_dirs.erase(event->wd);
+                continue;
+            }
+            auto dir = watched_dirs.find(event->wd);
+            if (event->len == 0 || dir == watched_dirs.end())
+                continue;
+            try {
+                std::string path = join_path(dir->second, event->name);
+                if (!(event->mask & IN_ISDIR)) {
+                    if (!(event->mask & IN_CREATE)) // the file is checked when it's written
+                        notify |= mark_dirty(path.c_str());
+                } else if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    if (!watch_tree(path, true, &notify))
+                        overflow = true;
+                } else if (event->mask & IN_MOVED_FROM) {
+                    overflow = true; // files of moved directory are unknown here
+                }
+            }  catch (...) {
+                overflow = true; // lost event, check everything
+            }
+        }
+        if (overflow) {
+            watches_complete = false;
+            rewatch_trees();
+            change_handler(1);
+        }
+        else if (notify)
+            change_handler(0);
+    }
+}
+
+int dir_watch_start(char *const *paths_to_dirs, int count, dir_change_fn on_change) {
+    if (inotify_fd >= 0)
+        return 1;
+    inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (inotify_fd < 0)
+        return 1;
+    bool watched = pipe2(stop_pipe, O_CLOEXEC) == 0;
+    try {
+        bool notify = false;
+        for (int i = 0; i < count && watched; ++i) {
+            watched_roots.push_back(paths_to_dirs[i]);
+            watched = watch_tree(paths_to_dirs[i], false, &notify);
+        }
+    }  catch (...) {
+        watched = false;
+    }
+    watches_complete = watched;
+    if (!watched) {
+        dir_watch_stop();
+        return 1;
+    }
+    change_handler = on_change;
+    // signals are handled by the daemon's thread only
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    bool failed = false;
+    try {
+        watcher = std::thread(watch_loop);
+    }  catch (...) {
+        failed = true;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (failed) {
+        dir_watch_stop();
+        return 1;
+    }
+    return 0;
+}
+
+void dir_watch_stop() {
+    if (watcher.joinable()) {
+        char stop = 0;
+        while (write(stop_pipe[1], &stop, 1) < 0 && errno == EINTR) {}
+        watcher.join();
+    }
+    for (int &fd: stop_pipe) {
+        if (fd >= 0)
+            close(fd);
+        fd = -1;
+    }
+    if (inotify_fd >= 0)
+        close(inotify_fd);
+    inotify_fd = -1;
+    watched_dirs.clear();
+    watched_roots.clear();
+    watches_complete = false;
+    std::lock_guard<std::mutex> lock(dirty_mutex);
+    dirty_files.clear();
+}
+
+int dir_watch_next_dirty(char *file, size_t size) {
+    std::lock_guard<std::mutex> lock(dirty_mutex);
+    if (dirty_files.empty())
+        return 1;
+    auto it = dirty_files.begin();
+    snprintf(file, size, "%s", it->c_str());
+    dirty_files.erase(it);
+    return 0;
+}
+
+int dir_watch_complete() {
+    return watches_complete ? 1 : 0;
+}
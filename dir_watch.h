@@ -0,0 +1,42 @@
+#ifndef DIR_WATCH_HEADER
+#define DIR_WATCH_HEADER
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// change handler, called from the watcher thread
+// param[in] full_check - 1: events were lost, check all files (watches are re-added
+//                        before the call, see dir_watch_complete); 0 - check dirty files
+typedef void (*dir_change_fn)(int full_check);
+
+// start watching directories and their subdirectories with inotify
+// param[in] paths_to_dirs - paths to directories
+// param[in] count - number of directories
+// param[in] on_change - called when the first dirty file appears (after all
+//                       dirty files were taken) or events were lost
+// return operation result: 0 - watching started, 1 - error
+int dir_watch_start(char *const *paths_to_dirs, int count, dir_change_fn on_change);
+
+// stop watching directories
+void dir_watch_stop();
+
+// take next written, changed, moved or deleted file. Files of a new subdirectory are
+// dirty too, a subdirectory moved away requires full check.
+// param[out] file - buffer for path to file
+// param[in] size - buffer size
+// return 0 - file name was taken, 1 - no dirty files
+int dir_watch_next_dirty(char *file, size_t size);
+
+// return 1 if every directory of the trees is watched, 0 - some watch couldn't be
+// added after lost events. The watcher retries to add it and reports lost events
+// when the trees are watched again.
+int dir_watch_complete();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DIR_WATCH_HEADER
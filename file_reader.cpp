@@ -0,0 +1,260 @@
+#include "file_reader.h"
+#include "io_buffer.h"
+#include "throttle.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <mutex>
+
+// pread backend's part, O_DIRECT reads whole I/O buffers (see io_buffer.h)
+#define PREAD_BUFFER_SIZE    (1024 * 1024)
+#define DIRECT_ALIGNMENT     IO_BUFFER_ALIGNMENT
+// mapped file is passed to handler by parts
+#define MMAP_CHUNK_SIZE      (4 * 1024 * 1024)
+// auto backend: pread for small files, mmap for medium files, O_DIRECT for big files
+#define AUTO_MMAP_MIN_SIZE   (256 * 1024)
+#define AUTO_DIRECT_MIN_SIZE (64 * 1024 * 1024)
+
+struct reader_counters {
+    std::atomic<uint64_t> files;
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> ns;
+};
+
+static reader_counters counters[FILE_READER_COUNT];
+static std::atomic<int> active_reader(FILE_READER_AUTO);
+
+// jump target for SIGBUS while the thread reads mapped file. The handler reads it,
+// initial-exec model keeps the access a plain offset from the thread pointer in
+// the shared library too (__tls_get_addr isn't async-signal-safe)
+static thread_local sigjmp_buf *volatile mmap_guard __attribute__((tls_model("initial-exec")));
+static std::once_flag sigbus_once;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+static int open_file(const char *path, int flags) {
+    int fd;
+    do {
+        fd = open(path, O_RDONLY | O_CLOEXEC | flags);
+    } while (fd < 0 && errno == EINTR);
+    return fd;
+}
+
+// read fd from offset up to end or EOF by buffer size parts
+// return operation result: 0 - ok, 1 - error
+static int read_fd(int fd, char *buf, size_t size, bool drop_cache, uint64_t begin, uint64_t end,
+                   file_data_fn on_data, void *ctx, uint64_t *bytes) {
+    off_t offset = static_cast<off_t>(begin);
+    while (static_cast<uint64_t>(offset) < end) {
+        size_t part = end - static_cast<uint64_t>(offset) < size ? static_cast<size_t>(end - static_cast<uint64_t>(offset)) : size;
+        ssize_t n = pread(fd, buf, part, offset);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return 1;
+        }
+        if (n == 0)
+            break;
+        // tokens are taken for read bytes, the next read waits for them
+        throttle_bytes(static_cast<uint64_t>(n));
+        on_data(buf, static_cast<size_t>(n), ctx);
+        // don't keep pages of the checked files in page cache
+        if (drop_cache)
+            posix_fadvise(fd, offset, n, POSIX_FADV_DONTNEED);
+        offset += n;
+    }
+    *bytes = static_cast<uint64_t>(offset) - begin;
+    return 0;
+}
+
+static int read_pread(int fd, uint64_t begin, uint64_t end, file_data_fn on_data, void *ctx, uint64_t *bytes) {
+    char *buf = io_buffer_acquire();
+    if (!buf)
+        return 1;
+    posix_fadvise(fd, static_cast<off_t>(begin), 0, POSIX_FADV_SEQUENTIAL);
+    int result = read_fd(fd, buf, PREAD_BUFFER_SIZE, true, begin, end, on_data, ctx, bytes);
+    io_buffer_release(buf);
+    return result;
+}
+
+static int read_direct(int fd, uint64_t begin, uint64_t end, file_data_fn on_data, void *ctx, uint64_t *bytes) {
+    char *buf = io_buffer_acquire();
+    if (!buf)
+        return 1;
+    int result = read_fd(fd, buf, IO_BUFFER_SIZE, false, begin, end, on_data, ctx, bytes);
+    io_buffer_release(buf);
+    return result;
+}
+
+static void sigbus_handler(int signo) {
+    if (mmap_guard)
+        siglongjmp(*mmap_guard, 1);
+    // not a mapped file's fault
+    signal(signo, SIG_DFL);
+    raise(signo);
+}
+
+static void init_sigbus_handler() {
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    sigemptyset(&act.sa_mask);
+    act.sa_handler = sigbus_handler;
+    act.sa_flags = SA_NODEFER;
+    sigaction(SIGBUS, &act, NULL);
+}
+
+static int read_mmap(int fd, uint64_t begin, uint64_t end, file_data_fn on_data, void *ctx, uint64_t *bytes) {
+    *bytes = 0;
+    if (begin >= end)
+        return 0;
+    // mapping starts at page boundary
+    uint64_t map_offset = begin - begin % static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    uint64_t map_size = end - map_offset;
+    void *map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, static_cast<off_t>(map_offset));
+    if (map == MAP_FAILED)
+        return 1;
+    madvise(map, map_size, MADV_SEQUENTIAL);
+    uint64_t size = end - begin;
+    // the file can be truncated while it's mapped, reading behind its end raises SIGBUS
+    std::call_once(sigbus_once, init_sigbus_handler);
+    sigset_t sigbus;
+    sigemptyset(&sigbus);
+    sigaddset(&sigbus, SIGBUS);
+    pthread_sigmask(SIG_UNBLOCK, &sigbus, NULL);
+    sigjmp_buf guard;
+    int result = 0;
+    if (sigsetjmp(guard, 1) == 0) {
+        mmap_guard = &guard;
+        const char *data = static_cast<const char *>(map) + (begin - map_offset);
+        for (uint64_t offset = 0; offset < size; offset += MMAP_CHUNK_SIZE) {
+            size_t len = static_cast<size_t>(size - offset < MMAP_CHUNK_SIZE ? size - offset : MMAP_CHUNK_SIZE);
+            throttle_bytes(len);
+            on_data(data + offset, len, ctx);
+        }
+        *bytes = size;
+    } else {
+        result = 1; // file was truncated
+    }
+    mmap_guard = NULL;
+    munmap(map, map_size);
+    return result;
+}
+
+int read_file(const char *path, FileReaderKind kind, file_data_fn on_data, void *ctx) {
+    return read_file_range(path, kind, 0, UINT64_MAX, on_data, ctx);
+}
+
+int read_file_range(const char *path, FileReaderKind kind, uint64_t offset, uint64_t length,
+                    file_data_fn on_data, void *ctx) {
+    // chunks of a large file are counted as one file
+    if (offset == 0)
+        throttle_file();
+    uint64_t start = now_ns();
+    int fd = open_file(path, 0);
+    if (fd < 0)
+        return 1;
+    struct stat sb;
+    if (fstat(fd, &sb) != 0) {
+        close(fd);
+        return 1;
+    }
+    uint64_t size = static_cast<uint64_t>(sb.st_size);
+    if (offset > size)
+        offset = size;
+    uint64_t end = length < size - offset ? offset + length : size;
+    if (kind == FILE_READER_AUTO) {
+        if (size >= AUTO_DIRECT_MIN_SIZE)
+            kind = FILE_READER_DIRECT;
+        else if (size >= AUTO_MMAP_MIN_SIZE)
+            kind = FILE_READER_MMAP;
+        else
+            kind = FILE_READER_PREAD;
+    }
+    if (kind == FILE_READER_DIRECT && (offset % DIRECT_ALIGNMENT != 0 ||
+                                       (end != size && end % DIRECT_ALIGNMENT != 0)))
+        kind = FILE_READER_PREAD; // unaligned part
+    if (kind == FILE_READER_DIRECT) {
+        int direct_fd = open_file(path, O_DIRECT);
+        if (direct_fd >= 0) {
+            close(fd);
+            fd = direct_fd;
+        } else {
+            kind = FILE_READER_PREAD; // file system without O_DIRECT
+        }
+    }
+    uint64_t bytes = 0;
+    int result;
+    switch (kind) {
+    case FILE_READER_MMAP:
+        result = read_mmap(fd, offset, end, on_data, ctx, &bytes);
+        break;
+    case FILE_READER_DIRECT:
+        result = read_direct(fd, offset, end == size ? UINT64_MAX : end, on_data, ctx, &bytes);
+        break;
+    case FILE_READER_PREAD:
+    default:
+        kind = FILE_READER_PREAD;
+        result = read_pread(fd, offset, end == size ? UINT64_MAX : end, on_data, ctx, &bytes);
+        break;
+    }
+    close(fd);
+    if (result == 0) {
+        // parts are counted as bytes of one file
+        if (offset == 0)
+            counters[kind].files.fetch_add(1, std::memory_order_relaxed);
+        counters[kind].bytes.fetch_add(bytes, std::memory_order_relaxed);
+        counters[kind].ns.fetch_add(now_ns() - start, std::memory_order_relaxed);
+    }
+    return result;
+}
+
+void set_file_reader(FileReaderKind kind) {
+    active_reader = kind;
+}
+
+FileReaderKind get_file_reader() {
+    return static_cast<FileReaderKind>(active_reader.load());
+}
+
+const char *file_reader_name(FileReaderKind kind) {
+    switch (kind) {
+    case FILE_READER_AUTO:
+        return "auto";
+    case FILE_READER_PREAD:
+        return "pread";
+    case FILE_READER_MMAP:
+        return "mmap";
+    case FILE_READER_DIRECT:
+        return "direct";
+    default:
+        return "unknown";
+    }
+}
+
+FileReaderKind file_reader_by_name(const char *name) {
+    for (int k = 0; k < FILE_READER_COUNT; ++k) {
+        FileReaderKind kind = static_cast<FileReaderKind>(k);
+        if (strcmp(name, file_reader_name(kind)) == 0)
+            return kind;
+    }
+    return FILE_READER_COUNT;
+}
+
+void get_file_reader_stats(FileReaderKind kind, FileReaderStats *stats) {
+    stats->files = counters[kind].files.load(std::memory_order_relaxed);
+    stats->bytes = counters[kind].bytes.load(std::memory_order_relaxed);
+    stats->ns = counters[kind].ns.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,66 @@
+#ifndef FILE_READER_HEADER
+#define FILE_READER_HEADER
+
+#include <stddef.h>
+#include <stdint.h>
+#include "crc32check_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// backend's statistic
+typedef struct {
+    uint64_t files; // files read
+    uint64_t bytes; // bytes read
+    uint64_t ns;    // time spent on reading and data handling
+} FileReaderStats;
+
+// data handler
+// param[in] buf - next part of file
+// param[in] len - size of buf
+// param[in] ctx - user context from read_file
+typedef void (*file_data_fn)(const void *buf, size_t len, void *ctx);
+
+// read whole file
+// param[in] path - path to file
+// param[in] kind - reading backend
+// param[in] on_data - data handler, called for file's parts in order
+// param[in] ctx - user context for on_data
+// return operation result: 0 - file was read, 1 - error
+int read_file(const char *path, FileReaderKind kind, file_data_fn on_data, void *ctx);
+
+// read part of file (up to its end). O_DIRECT reads only aligned parts (offset
+// and length are multiples of 4096), others are read by pread.
+// param[in] path - path to file
+// param[in] kind - reading backend (FILE_READER_AUTO - chosen by the whole file size)
+// param[in] offset - part's offset
+// param[in] length - part's size in bytes
+// param[in] on_data - data handler, called for part's pieces in order
+// param[in] ctx - user context for on_data
+// return operation result: 0 - part was read, 1 - error
+int read_file_range(const char *path, FileReaderKind kind, uint64_t offset, uint64_t length,
+                    file_data_fn on_data, void *ctx);
+
+// set backend for calc_file_crc32 (FILE_READER_AUTO by default)
+void set_file_reader(FileReaderKind kind);
+
+// return backend for calc_file_crc32
+FileReaderKind get_file_reader();
+
+// return backend's name (auto, pread, mmap, direct)
+const char *file_reader_name(FileReaderKind kind);
+
+// return backend by name (FILE_READER_COUNT - unknown name)
+FileReaderKind file_reader_by_name(const char *name);
+
+// get backend's statistic since start
+// param[in] kind - reading backend (not FILE_READER_AUTO)
+// param[out] stats - statistic
+void get_file_reader_stats(FileReaderKind kind, FileReaderStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FILE_READER_HEADER
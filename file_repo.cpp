@@ -1,58 +1,838 @@
 #include "file_repo.h"
-#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "hash_engine.h"
+
+// A file's path is split into its directory and name: directories are interned
+// as (parent id, name) nodes, names of files and directories are stored once in
+// the names arena. File's fields are columns indexed by file id (structure of
+// arrays), the id is found by a flat open addressing index (linear probing)
+// that compares hash tags before names. Columns and names are allocated by
+// blocks, so a file costs 26 bytes of columns, its attribute (4-32 bytes), its
+// name and 5-11 bytes of index.
+//
+// A file is checked by a check when its check generation isn't older than the
+// check's one, so starting a new check is O(1) and checks of different directory
+// trees can overlap. Only large files have manifests, they are kept by file id
+// aside from the columns.
+//
+// Directories form a Merkle tree over files' attributes: a directory's digest
+// hashes its children's names and digests in name order. Changed files mark their
+// directories up to the top, only marked directories are hashed again. Walked
+// directories keep their metadata and the sequence numbers of their last walk
+// and of the last change under them, so a check can skip a tree which wasn't
+// changed since its last complete walk.
+
+// directory of paths without '/'
+#define TOP_DIR       0
+#define NO_DIR        UINT32_MAX
+#define NO_FILE       UINT32_MAX
+// tables are resized when they are 3/4 full
+#define MAX_LOAD_NUM  3
+#define MAX_LOAD_DEN  4
+#define MIN_CAPACITY  1024
+#define COLUMN_BLOCK  65536
+#define NAMES_BLOCK   (1024 * 1024)
+
+// array allocated by blocks: no reallocation and no unused capacity
+template <typename T>
+class block_column {
+public:
+    T &operator[](uint32_t id) {
+        return blocks[id / COLUMN_BLOCK][id % COLUMN_BLOCK];
+    }
+    // make element id available
+    void reserve(uint32_t id) {
+        while (id / COLUMN_BLOCK >= blocks.size())
+            blocks.emplace_back(new T[COLUMN_BLOCK]);
+    }
+    void clear() {
+        blocks.clear();
+    }
+private:
+    std::vector<std::unique_ptr<T[]>> blocks;
+};
+
+// byte strings of the same size allocated by blocks
+class bytes_column {
+public:
+    uint8_t *operator[](uint32_t id) {
+        return blocks[id / COLUMN_BLOCK].get() + static_cast<size_t>(id % COLUMN_BLOCK) * width;
+    }
+    void reserve(uint32_t id) {
+        while (id / COLUMN_BLOCK >= blocks.size())
+            blocks.emplace_back(new uint8_t[static_cast<size_t>(COLUMN_BLOCK) * width]);
+    }
+    void clear() {
+        blocks.clear();
+    }
+    // change strings' size, the column must be empty
+    void set_width(uint32_t size) {
+        width = size;
+    }
+    uint32_t get_width() const {
+        return width;
+    }
+private:
+    std::vector<std::unique_ptr<uint8_t[]>> blocks;
+    uint32_t width = 4;
+};
+
+struct file_manifest {
+    uint64_t             block_size;
+    uint32_t             block_count;
+    std::vector<uint8_t> digests;
+};
+
+struct dir_node {
+    uint32_t parent;
+    uint32_t name_offset;
+    uint32_t name_len;
+};
+
+// directory's check state and Merkle digest's state, by directory id
+struct dir_state {
+    uint64_t fingerprint;  // directory's metadata digest at its last walk (0 - unknown)
+    uint64_t walk_seq;     // begin of its last walk (0 - never walked)
+    uint64_t verified_seq; // begin of its last complete walk (0 - tree isn't verified)
+    uint64_t changed_seq;  // the last change in its tree
+    uint32_t check_gen;    // the tree's files are checked by this check (it was skipped)
+    bool     digest_valid; // digest is up to date
+    bool     empty;        // no observed files in its tree, it's left out of parent's digest
+};
+
+// directory's child for its digest
+struct tree_entry {
+    std::string_view name;
+    uint32_t         id;
+    bool             is_dir;
+};
 
-struct file_info {
-    uint32_t file_attr;
-    bool     checked;
+struct file_key {
+    uint32_t         dir;
+    std::string_view name;
+    uint64_t         hash;
 };
-static std::unordered_map<std::string, file_info> check_files;
 
-int push_file(const char *file_name, uint32_t file_attr) {
+// names of files and directories, a name doesn't cross block's boundary
+static std::vector<std::unique_ptr<char[]>> name_blocks;
+static uint64_t names_size;
+// directories by id, dirs[TOP_DIR] is a stub
+static std::vector<dir_node> dirs(1, dir_node());
+static std::vector<dir_state> dir_states(1, dir_state{0, 0, 0, 0, 0, true, true});
+// trees' digests by directory id (see get_tree_digest)
+static std::vector<uint8_t> dir_digests;
+// a directory's digest isn't up to date
+static bool digests_changed;
+// order of walks and changes, trees verified before change_forget_seq aren't trusted
+static uint64_t change_seq;
+static uint64_t change_forget_seq;
+// directory ids (0 - empty entry, TOP_DIR isn't there)
+static std::vector<uint32_t> dir_table;
+// files' columns
+static block_column<uint32_t> file_hashes;       // low half of hash, compared before names
+static block_column<uint32_t> file_dirs;
+static block_column<uint32_t> file_name_offsets;
+static block_column<uint16_t> file_name_lens;
+static bytes_column file_attrs;
+static block_column<uint64_t> file_fingerprints; // fingerprint's digest, 0 - unknown
+static block_column<uint32_t> file_check_gens;
+static std::unordered_map<uint32_t, file_manifest> file_manifests;
+static uint32_t files_count;
+// file ids + 1 (0 - empty entry)
+static std::vector<uint32_t> file_table;
+static uint64_t files_version;
+// generation of the latest check, checked files get it
+static uint32_t check_gen = 1;
+// the last used directory, files usually come directory by directory
+static std::string last_dir_path;
+static uint32_t last_dir = NO_DIR;
+// get_next_unchecked_file's position, filter and result
+static uint32_t sweep_pos;
+static uint32_t sweep_gen = 1;          // files of older generations are unchecked
+static bool sweep_filtered;             // only files under the sweep's directories are swept
+static std::vector<bool> sweep_dirs;    // by directory id: it's under one of the sweep's directories
+static std::vector<uint32_t> sweep_tree_gens; // by directory id: the latest check which skipped its tree
+static bool sweep_ready;                // sweep_tree_gens are computed
+static std::string sweep_name;
+
+static uint64_t mix64(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// hash of name in directory, 8 bytes per step
+static uint64_t hash_name(uint32_t dir, std::string_view name) {
+    uint64_t h = 0x9E3779B97F4A7C15ULL * (name.size() + 1) ^ dir;
+    const char *p = name.data();
+    size_t len = name.size();
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        h = (h ^ mix64(word)) * 0x100000001B3ULL;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, p, len);
+    return mix64(h ^ tail);
+}
+
+static const char *get_name(uint32_t offset) {
+    return name_blocks[offset / NAMES_BLOCK].get() + offset % NAMES_BLOCK;
+}
+
+static uint32_t store_name(std::string_view name) {
+    if (name.size() > NAMES_BLOCK)
+        throw std::length_error("name is too long");
+    uint64_t offset = names_size;
+    if (offset % NAMES_BLOCK + name.size() > NAMES_BLOCK)
+        offset += NAMES_BLOCK - offset % NAMES_BLOCK;
+    if (offset + name.size() > UINT32_MAX)
+        throw std::length_error("names arena is full");
+    if (offset / NAMES_BLOCK == name_blocks.size())
+        name_blocks.emplace_back(new char[NAMES_BLOCK]);
+    memcpy(name_blocks[offset / NAMES_BLOCK].get() + offset % NAMES_BLOCK, name.data(), name.size());
+    names_size = offset + name.size();
+    return static_cast<uint32_t>(offset);
+}
+
+static bool same_name(uint32_t offset, size_t len, std::string_view name) {
+    return len == name.size() && memcmp(get_name(offset), name.data(), len) == 0;
+}
+
+// return index of directory's entry or of the empty entry for it
+static size_t find_dir_entry(uint32_t parent, std::string_view name) {
+    size_t mask = dir_table.size() - 1;
+    for (size_t i = hash_name(parent, name) & mask; ; i = (i + 1) & mask) {
+        uint32_t id = dir_table[i];
+        if (id == 0)
+            return i;
+        if (dirs[id].parent == parent && same_name(dirs[id].name_offset, dirs[id].name_len, name))
+            return i;
+    }
+}
+
+static void grow_dir_table() {
+    std::vector<uint32_t> table(dir_table.empty() ? MIN_CAPACITY : dir_table.size() * 2, 0);
+    table.swap(dir_table);
+    for (uint32_t id = TOP_DIR + 1; id < dirs.size(); ++id) {
+        const dir_node &node = dirs[id];
+        dir_table[find_dir_entry(node.parent, std::string_view(get_name(node.name_offset), node.name_len))] = id;
+    }
+}
+
+// return directory's id (NO_DIR - directory isn't known and create is false)
+static uint32_t find_dir_component(uint32_t parent, std::string_view name, bool create) {
+    if (!dir_table.empty()) {
+        uint32_t id = dir_table[find_dir_entry(parent, name)];
+        if (id != 0)
+            return id;
+    }
+    if (!create)
+        return NO_DIR;
+    if (dirs.size() >= UINT32_MAX - 1)
+        throw std::length_error("too many directories");
+    if (dirs.size() * MAX_LOAD_DEN >= dir_table.size() * MAX_LOAD_NUM)
+        grow_dir_table();
+    uint32_t id = static_cast<uint32_t>(dirs.size());
+    dirs.push_back({parent, store_name(name), static_cast<uint32_t>(name.size())});
+    // no files yet: its digest is valid and it's left out of parent's one
+    dir_states.push_back({0, 0, 0, 0, 0, true, true});
+    dir_table[find_dir_entry(parent, name)] = id;
+    return id;
+}
+
+// return id of directory path (without the last '/'), "" is the root directory
+static uint32_t find_dir(std::string_view path, bool create) {
+    if (last_dir != NO_DIR && path == last_dir_path)
+        return last_dir;
+    uint32_t dir = TOP_DIR;
+    size_t begin = 0;
+    while (1) {
+        size_t end = path.find('/', begin);
+        dir = find_dir_component(dir, path.substr(begin, end - begin), create);
+        if (dir == NO_DIR)
+            return NO_DIR;
+        if (end == std::string_view::npos)
+            break;
+        begin = end + 1;
+    }
+    last_dir_path.assign(path);
+    last_dir = dir;
+    return dir;
+}
+
+// return id of directory path, "/" is the root directory "" (NO_DIR - unknown directory)
+static uint32_t find_dir_path(std::string_view path, bool create) {
+    if (!path.empty() && path.back() == '/')
+        path.remove_suffix(1);
+    return find_dir(path, create);
+}
+
+// return id of the deepest known directory of path (TOP_DIR - none)
+static uint32_t find_known_dir(std::string_view path) {
+    for (size_t slash = path.rfind('/'); slash != std::string_view::npos; slash = path.rfind('/', slash - 1)) {
+        uint32_t dir = find_dir(path.substr(0, slash), false);
+        if (dir != NO_DIR)
+            return dir;
+        if (slash == 0)
+            break;
+    }
+    return TOP_DIR;
+}
+
+// mark directory and its parents: their digests are out of date, their trees were changed
+static void mark_dir_changed(uint32_t dir, bool digest_changed) {
+    uint64_t seq = ++change_seq;
+    for (uint32_t id = dir; ; id = dirs[id].parent) {
+        dir_state &state = dir_states[id];
+        state.changed_seq = seq;
+        if (digest_changed) {
+            state.digest_valid = false;
+            state.empty = false;
+        }
+        if (id == TOP_DIR)
+            break;
+    }
+    digests_changed |= digest_changed;
+}
+
+// split file's path into directory and name
+// return false - directory isn't known and create is false
+static bool split_path(std::string_view path, bool create, file_key *key) {
+    size_t slash = path.rfind('/');
+    if (slash != std::string_view::npos) {
+        key->dir = find_dir(path.substr(0, slash), create);
+        if (key->dir == NO_DIR)
+            return false;
+        key->name = path.substr(slash + 1);
+    } else {
+        key->dir = TOP_DIR;
+        key->name = path;
+    }
+    key->hash = hash_name(key->dir, key->name);
+    return true;
+}
+
+// return index of file's entry in the index or of the empty entry for it
+static size_t find_file_index(const file_key &key) {
+    size_t mask = file_table.size() - 1;
+    uint32_t tag = static_cast<uint32_t>(key.hash);
+    for (size_t i = (key.hash >> 32) & mask; ; i = (i + 1) & mask) {
+        uint32_t id = file_table[i];
+        if (id == 0)
+            return i;
+        --id;
+        if (file_hashes[id] == tag && file_dirs[id] == key.dir &&
+            same_name(file_name_offsets[id], file_name_lens[id], key.name))
+            return i;
+    }
+}
+
+// return observed file's id (NO_FILE - unknown file)
+static uint32_t find_file(std::string_view path) {
+    file_key key;
+    if (file_table.empty() || !split_path(path, false, &key))
+        return NO_FILE;
+    uint32_t id = file_table[find_file_index(key)];
+    return id ? id - 1 : NO_FILE;
+}
+
+static void grow_file_table() {
+    std::vector<uint32_t> table(file_table.empty() ? MIN_CAPACITY : file_table.size() * 2, 0);
+    table.swap(file_table);
+    size_t mask = file_table.size() - 1;
+    for (uint32_t id = 0; id < files_count; ++id) {
+        // names are unique, just find an empty entry
+        uint64_t hash = hash_name(file_dirs[id], std::string_view(get_name(file_name_offsets[id]),
+                                                                  file_name_lens[id]));
+        size_t i = (hash >> 32) & mask;
+        while (file_table[i] != 0)
+            i = (i + 1) & mask;
+        file_table[i] = id + 1;
+    }
+}
+
+static void append_dir_path(uint32_t dir, std::string &path) {
+    if (dir == TOP_DIR)
+        return;
+    append_dir_path(dirs[dir].parent, path);
+    path.append(get_name(dirs[dir].name_offset), dirs[dir].name_len);
+    path.push_back('/');
+}
+
+static void get_file_path(uint32_t id, std::string &path) {
+    path.clear();
+    append_dir_path(file_dirs[id], path);
+    path.append(get_name(file_name_offsets[id]), file_name_lens[id]);
+}
+
+// return flags by directory id: the directory is one of paths or under them
+static std::vector<bool> find_subdirs(char *const *paths, int count) {
+    std::vector<bool> inside(dirs.size(), false);
+    for (int i = 0; i < count; ++i) {
+        uint32_t dir = find_dir_path(paths[i], false);
+        if (dir != NO_DIR)
+            inside[dir] = true;
+    }
+    // parents are interned before their subdirectories
+    for (uint32_t id = TOP_DIR + 1; id < dirs.size(); ++id) {
+        if (inside[dirs[id].parent])
+            inside[id] = true;
+    }
+    return inside;
+}
+
+// return true if file is under the directories of find_subdirs
+static bool is_file_inside(const std::vector<bool> &inside, uint32_t id) {
+    uint32_t dir = file_dirs[id];
+    return dir < inside.size() && inside[dir];
+}
+
+// compute the latest check which skipped each directory's tree, parents are
+// interned before their subdirectories
+static void find_tree_gens() {
+    sweep_tree_gens.resize(dirs.size());
+    sweep_tree_gens[TOP_DIR] = dir_states[TOP_DIR].check_gen;
+    for (uint32_t id = TOP_DIR + 1; id < dirs.size(); ++id)
+        sweep_tree_gens[id] = std::max(dir_states[id].check_gen, sweep_tree_gens[dirs[id].parent]);
+    sweep_ready = true;
+}
+
+// return true if file's tree was skipped by the sweep's check
+static bool is_tree_checked(uint32_t id) {
+    uint32_t dir = file_dirs[id];
+    return dir < sweep_tree_gens.size() && sweep_tree_gens[dir] >= sweep_gen;
+}
+
+static bool compare_tree_entries(const tree_entry &a, const tree_entry &b) {
+    return a.name != b.name ? a.name < b.name : a.is_dir < b.is_dir;
+}
+
+// hash directory's children: type, name and digest of each one in name order
+static void hash_tree_entries(std::vector<tree_entry> &entries, uint8_t *digest) {
+    uint32_t width = file_attrs.get_width();
+    std::sort(entries.begin(), entries.end(), compare_tree_entries);
+    HashState state;
+    hash_begin(&state);
+    for (const tree_entry &entry: entries) {
+        const char type = entry.is_dir ? 'd' : 'f';
+        hash_update(&state, &type, 1);
+        hash_update(&state, entry.name.data(), entry.name.size());
+        hash_update(&state, "", 1);
+        hash_update(&state, entry.is_dir ? &dir_digests[static_cast<size_t>(entry.id) * width] :
+                                           file_attrs[entry.id], width);
+    }
+    FileAttr result;
+    hash_end(&state, &result);
+    memset(digest, 0, width);
+    memcpy(digest, result.bytes, std::min(result.size, width));
+}
+
+// hash changed directories again: their files are gathered by one pass over the
+// files' directories, subdirectories are hashed before their parents
+static void update_tree_digests() {
+    if (!digests_changed)
+        return;
+    uint32_t width = file_attrs.get_width();
+    dir_digests.resize(dirs.size() * width);
+    // children of changed directories by their index in changed
+    std::vector<uint32_t> changed;
+    std::vector<uint32_t> slots(dirs.size(), NO_DIR);
+    for (uint32_t id = 0; id < dirs.size(); ++id) {
+        if (!dir_states[id].digest_valid) {
+            slots[id] = static_cast<uint32_t>(changed.size());
+            changed.push_back(id);
+        }
+    }
+    std::vector<std::vector<tree_entry>> children(changed.size());
+    for (uint32_t id = 0; id < files_count; ++id) {
+        uint32_t slot = slots[file_dirs[id]];
+        if (slot != NO_DIR)
+            children[slot].push_back({std::string_view(get_name(file_name_offsets[id]), file_name_lens[id]),
+                                      id, false});
+    }
+    for (uint32_t id = TOP_DIR + 1; id < dirs.size(); ++id) {
+        const dir_state &state = dir_states[id];
+        if (state.digest_valid && !state.empty && slots[dirs[id].parent] != NO_DIR)
+            children[slots[dirs[id].parent]].push_back({std::string_view(get_name(dirs[id].name_offset),
+                                                                         dirs[id].name_len), id, true});
+    }
+    for (size_t i = changed.size(); i-- > 0; ) {
+        uint32_t id = changed[i];
+        dir_state &state = dir_states[id];
+        state.empty = children[i].empty();
+        if (!state.empty)
+            hash_tree_entries(children[i], &dir_digests[static_cast<size_t>(id) * width]);
+        state.digest_valid = true;
+        children[i].clear();
+        children[i].shrink_to_fit();
+        uint32_t parent = dirs[id].parent;
+        if (id != TOP_DIR && !state.empty && slots[parent] != NO_DIR)
+            children[slots[parent]].push_back({std::string_view(get_name(dirs[id].name_offset), dirs[id].name_len),
+                                               id, true});
+    }
+    digests_changed = false;
+}
+
+uint64_t get_fingerprint_digest(const FileFingerprint *fingerprint) {
+    const uint64_t fields[] = {fingerprint->size,
+                               static_cast<uint64_t>(fingerprint->mtime_ns),
+                               static_cast<uint64_t>(fingerprint->ctime_ns),
+                               fingerprint->inode,
+                               fingerprint->device};
+    uint64_t digest = 0;
+    for (uint64_t field: fields)
+        digest = mix64(digest ^ field) + 0x9E3779B97F4A7C15ULL;
+    return digest ? digest : 1;
+}
+
+int set_file_attr_size(uint32_t size) {
+    if (size == 0 || size > FILE_ATTR_MAX_SIZE)
+        return 1;
+    if (size != file_attrs.get_width()) {
+        clear_files();
+        file_attrs.set_width(size);
+    }
+    return 0;
+}
+
+uint32_t get_file_attr_size() {
+    return file_attrs.get_width();
+}
+
+int push_file_digest(const char *file_name, const FileAttr *file_attr, uint64_t fingerprint_digest) {
     try {
-        check_files[std::string(file_name)] = {file_attr, false};
+        if (files_count == NO_FILE - 1 || file_attr->size != file_attrs.get_width())
+            return 1;
+        if ((static_cast<size_t>(files_count) + 1) * MAX_LOAD_DEN > file_table.size() * MAX_LOAD_NUM)
+            grow_file_table();
+        file_key key;
+        split_path(file_name, true, &key);
+        if (key.name.empty() || key.name.size() > UINT16_MAX)
+            return 1;
+        size_t index = find_file_index(key);
+        uint32_t id = file_table[index];
+        if (id == 0) {
+            id = files_count;
+            file_hashes.reserve(id);
+            file_dirs.reserve(id);
+            file_name_offsets.reserve(id);
+            file_name_lens.reserve(id);
+            file_attrs.reserve(id);
+            file_fingerprints.reserve(id);
+            file_check_gens.reserve(id);
+            file_name_offsets[id] = store_name(key.name);
+            file_name_lens[id] = static_cast<uint16_t>(key.name.size());
+            file_hashes[id] = static_cast<uint32_t>(key.hash);
+            file_dirs[id] = key.dir;
+            file_table[index] = ++files_count;
+        } else {
+            --id;
+        }
+        memcpy(file_attrs[id], file_attr->bytes, file_attr->size);
+        if (!file_manifests.empty())
+            file_manifests.erase(id);
+        file_fingerprints[id] = fingerprint_digest;
+        file_check_gens[id] = 0;
+        mark_dir_changed(key.dir, true);
+        files_version++;
     }  catch (...) {
         return 1;
     }
     return 0;
 }
 
-FileAttrStatus check_file_attr(const char *file_name, uint32_t file_attr) {
+int push_file(const char *file_name, const FileAttr *file_attr, const FileFingerprint *fingerprint) {
+    return push_file_digest(file_name, file_attr, fingerprint ? get_fingerprint_digest(fingerprint) : 0);
+}
+
+FileAttrStatus check_file_attr(const char *file_name, const FileAttr *file_attr, const FileFingerprint *fingerprint) {
+    try {
+        if (file_attr->size != file_attrs.get_width())
+            return CHECK_ERROR;
+        uint32_t id = find_file(file_name);
+        if (id == NO_FILE)
+            return FILE_NOT_FOUND;
+        file_check_gens[id] = check_gen;
+        if (memcmp(file_attrs[id], file_attr->bytes, file_attr->size) != 0)
+            return ATTR_CHANGED;
+        if (fingerprint) {
+            uint64_t digest = get_fingerprint_digest(fingerprint);
+            if (file_fingerprints[id] != digest) {
+                file_fingerprints[id] = digest;
+                files_version++;
+            }
+        }
+        return VALID_ATTR;
+    }  catch (...) {}
+    return CHECK_ERROR;
+}
+
+FileAttrStatus check_file_fingerprint(const char *file_name, const FileFingerprint *fingerprint) {
     try {
-        std::string fname = std::string(file_name);
-        if (check_files.find(fname) == check_files.end())
+        uint32_t id = find_file(file_name);
+        if (id == NO_FILE)
             return FILE_NOT_FOUND;
-        check_files[fname].checked = true;
-        if (check_files[fname].file_attr != file_attr)
+        if (file_fingerprints[id] == 0 || file_fingerprints[id] != get_fingerprint_digest(fingerprint))
             return ATTR_CHANGED;
+        file_check_gens[id] = check_gen;
+        return VALID_ATTR;
+    }  catch (...) {}
+    return CHECK_ERROR;
+}
+
+FileAttrStatus skip_file_check(const char *file_name) {
+    try {
+        uint32_t id = find_file(file_name);
+        if (id == NO_FILE)
+            return FILE_NOT_FOUND;
+        file_check_gens[id] = check_gen;
         return VALID_ATTR;
     }  catch (...) {}
     return CHECK_ERROR;
 }
 
-uint32_t get_file_attr(const char *file_name) {
+int get_file_attr(const char *file_name, FileAttr *file_attr) {
+    file_attr->size = 0;
+    try {
+        uint32_t id = find_file(file_name);
+        if (id == NO_FILE)
+            return 1;
+        file_attr->size = file_attrs.get_width();
+        memcpy(file_attr->bytes, file_attrs[id], file_attr->size);
+        return 0;
+    }  catch (...) {}
+    return 1;
+}
+
+int set_file_manifest(const char *file_name, const FileManifest *manifest) {
     try {
-        std::string fname = std::string(file_name);
-        if (check_files.find(fname) == check_files.end())
+        uint32_t id = find_file(file_name);
+        if (id == NO_FILE)
+            return 1;
+        if (!manifest) {
+            if (file_manifests.erase(id))
+                files_version++;
             return 0;
-        return check_files[fname].file_attr;
+        }
+        if (manifest->block_size == 0 || manifest->block_count == 0)
+            return 1;
+        const uint8_t *digests = manifest->digests;
+        file_manifest &stored = file_manifests[id];
+        stored.block_size = manifest->block_size;
+        stored.block_count = manifest->block_count;
+        stored.digests.assign(digests, digests + static_cast<size_t>(manifest->block_count) * file_attrs.get_width());
+        files_version++;
+        return 0;
+    }  catch (...) {}
+    return 1;
+}
+
+int get_file_manifest(const char *file_name, FileManifest *manifest) {
+    try {
+        if (file_manifests.empty())
+            return 1;
+        uint32_t id = find_file(file_name);
+        auto it = file_manifests.find(id);
+        if (it == file_manifests.end())
+            return 1;
+        manifest->block_size = it->second.block_size;
+        manifest->block_count = it->second.block_count;
+        manifest->digests = it->second.digests.data();
+        return 0;
     }  catch (...) {}
+    return 1;
+}
+
+int is_file_observed(const char *file_name) {
+    try {
+        return find_file(file_name) != NO_FILE ? 1 : 0;
+    }  catch (...) {}
+    return 0;
+}
+
+uint32_t begin_files_check() {
+    if (++check_gen == 0) {
+        // generation wrapped, forget old ones
+        for (uint32_t id = 0; id < files_count; ++id)
+            file_check_gens[id] = 0;
+        for (dir_state &state: dir_states)
+            state.check_gen = 0;
+        check_gen = 1;
+    }
+    sweep_pos = 0;
+    sweep_gen = check_gen;
+    sweep_filtered = false;
+    sweep_ready = false;
+    return check_gen;
+}
+
+int begin_files_sweep(uint32_t gen, char *const *paths, int count) {
+    sweep_pos = files_count;
+    // generation wrapped since the check's begin
+    if (gen == 0 || gen > check_gen)
+        return 1;
+    try {
+        sweep_dirs = paths ? find_subdirs(paths, count) : std::vector<bool>();
+    }  catch (...) {
+        return 1;
+    }
+    sweep_pos = 0;
+    sweep_gen = gen;
+    sweep_filtered = paths != NULL;
+    sweep_ready = false;
     return 0;
 }
 
 const char *get_next_unchecked_file() {
     try {
-        for (auto &it: check_files) {
-            if (!it.second.checked) {
-                it.second.checked = true;
-                return it.first.c_str();
+        if (!sweep_ready)
+            find_tree_gens();
+        while (sweep_pos < files_count) {
+            uint32_t id = sweep_pos++;
+            if (file_check_gens[id] < sweep_gen && !is_tree_checked(id) &&
+                (!sweep_filtered || is_file_inside(sweep_dirs, id))) {
+                file_check_gens[id] = check_gen;
+                get_file_path(id, sweep_name);
+                return sweep_name.c_str();
             }
         }
-    }  catch (...) {
-        return NULL;
+    }  catch (...) {}
+    return NULL;
+}
+
+void for_each_file(file_visit_fn visit, void *ctx) {
+    for_each_file_in(NULL, 0, visit, ctx);
+}
+
+void for_each_file_in(char *const *paths, int count, file_visit_fn visit, void *ctx) {
+    std::vector<bool> inside = paths ? find_subdirs(paths, count) : std::vector<bool>();
+    std::string path;
+    FileAttr file_attr;
+    file_attr.size = file_attrs.get_width();
+    for (uint32_t id = 0; id < files_count; ++id) {
+        if (paths && !is_file_inside(inside, id))
+            continue;
+        get_file_path(id, path);
+        memcpy(file_attr.bytes, file_attrs[id], file_attr.size);
+        visit(path.c_str(), &file_attr, file_fingerprints[id], ctx);
     }
-    for (auto &it: check_files) {
-        it.second.checked = false;
+}
+
+void for_each_manifest(manifest_visit_fn visit, void *ctx) {
+    for_each_manifest_in(NULL, 0, visit, ctx);
+}
+
+void for_each_manifest_in(char *const *paths, int count, manifest_visit_fn visit, void *ctx) {
+    std::vector<bool> inside = paths ? find_subdirs(paths, count) : std::vector<bool>();
+    std::string path;
+    for (auto &it: file_manifests) {
+        if (paths && !is_file_inside(inside, it.first))
+            continue;
+        FileManifest manifest = {it.second.block_size, it.second.block_count, it.second.digests.data()};
+        get_file_path(it.first, path);
+        visit(path.c_str(), &manifest, ctx);
     }
-    return NULL;
+}
+
+int get_tree_digest(const char *dir_path, FileAttr *digest) {
+    digest->size = 0;
+    try {
+        uint32_t dir = dir_path ? find_dir_path(dir_path, false) : TOP_DIR;
+        if (dir == NO_DIR)
+            return 1;
+        update_tree_digests();
+        uint32_t width = file_attrs.get_width();
+        digest->size = width;
+        if (dir_states[dir].empty) {
+            std::vector<tree_entry> none;
+            hash_tree_entries(none, digest->bytes);
+        } else {
+            memcpy(digest->bytes, &dir_digests[static_cast<size_t>(dir) * width], width);
+        }
+        return 0;
+    }  catch (...) {}
+    digest->size = 0;
+    return 1;
+}
+
+FileAttrStatus begin_dir_check(const char *dir_path, const FileFingerprint *fingerprint, int can_skip) {
+    try {
+        uint32_t dir = find_dir_path(dir_path, true);
+        dir_state &state = dir_states[dir];
+        uint64_t digest = get_fingerprint_digest(fingerprint);
+        bool verified = state.fingerprint == digest && state.verified_seq > state.changed_seq &&
+                        state.verified_seq > change_forget_seq;
+        if (verified && can_skip) {
+            state.check_gen = check_gen;
+            sweep_ready = false;
+            return VALID_ATTR;
+        }
+        // entries were changed since the last complete walk
+        if (!verified)
+            state.verified_seq = 0;
+        state.fingerprint = digest;
+        state.walk_seq = ++change_seq;
+        return ATTR_CHANGED;
+    }  catch (...) {}
+    return CHECK_ERROR;
+}
+
+void end_dir_check(const char *dir_path) {
+    try {
+        uint32_t dir = find_dir_path(dir_path, false);
+        if (dir != NO_DIR && dir_states[dir].walk_seq)
+            dir_states[dir].verified_seq = dir_states[dir].walk_seq;
+    }  catch (...) {}
+}
+
+void mark_path_changed(const char *path) {
+    try {
+        mark_dir_changed(find_known_dir(path), false);
+    }  catch (...) {}
+}
+
+void forget_dir_checks() {
+    change_forget_seq = ++change_seq;
+}
+
+uint64_t get_files_version() {
+    return files_version;
+}
+
+void clear_files() {
+    file_table.clear();
+    file_hashes.clear();
+    file_dirs.clear();
+    file_name_offsets.clear();
+    file_name_lens.clear();
+    file_attrs.clear();
+    file_fingerprints.clear();
+    file_check_gens.clear();
+    file_manifests.clear();
+    files_count = 0;
+    dir_table.clear();
+    dirs.resize(1);
+    dir_states.assign(1, dir_state{0, 0, 0, 0, 0, true, true});
+    dir_digests.clear();
+    digests_changed = false;
+    forget_dir_checks();
+    name_blocks.clear();
+    names_size = 0;
+    last_dir = NO_DIR;
+    sweep_pos = 0;
+    sweep_dirs.clear();
+    sweep_tree_gens.clear();
+    sweep_ready = false;
+    files_version++;
 }
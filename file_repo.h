@@ -2,6 +2,7 @@
 #define FILE_REPO_HEADER
 
 #include <stdint.h>
+#include "crc32check_types.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -14,26 +15,184 @@ typedef enum {
     CHECK_ERROR
 } FileAttrStatus;
 
+// file's metadata (the file isn't read while its fingerprint is the same)
+typedef struct {
+    uint64_t size;
+    int64_t  mtime_ns;
+    int64_t  ctime_ns;
+    uint64_t inode;
+    uint64_t device;
+} FileFingerprint;
+
+// large file's manifest: digests of its blocks in file's order, a changed
+// block is found by comparing manifests
+typedef struct {
+    uint64_t       block_size;  // block's size in bytes, the last block can be shorter
+    uint32_t       block_count;
+    const uint8_t *digests;     // block_count digests of get_file_attr_size bytes
+} FileManifest;
+
+// files are identified by their paths ('/' separated). Directories are kept once
+// for all their files, a file costs a table slot and its name.
+
+// return fingerprint's digest, the repository keeps it instead of the metadata (never 0)
+uint64_t get_fingerprint_digest(const FileFingerprint *fingerprint);
+
+// set size of files' attributes (4 bytes by default), observed files are
+// forgotten if the size is changed
+// param[in] size - attribute's size in bytes (1..FILE_ATTR_MAX_SIZE)
+// return operation result: 0 - ok, 1 - wrong size
+int set_file_attr_size(uint32_t size);
+
+// return size of files' attributes in bytes
+uint32_t get_file_attr_size();
+
 // start observing file
 // param[in] file_name - uniq file name
-// param[in] file_attr - file's attribute for observation
+// param[in] file_attr - file's attribute for observation (its size is get_file_attr_size)
+// param[in] fingerprint - file's metadata (NULL - unknown)
 // return operation result: 0 - file was added, 1 - error
-int push_file(const char *file_name, uint32_t file_attr);
+// (file's manifest is removed, see set_file_manifest)
+int push_file(const char *file_name, const FileAttr *file_attr, const FileFingerprint *fingerprint);
+
+// the same as push_file but with fingerprint's digest
+// param[in] fingerprint_digest - see get_fingerprint_digest (0 - unknown)
+int push_file_digest(const char *file_name, const FileAttr *file_attr, uint64_t fingerprint_digest);
 
 // check file's attribute
 // param[in] file_name - uniq file name
 // param[in] file_attr - current file's attribute
+// param[in] fingerprint - file's metadata before attribute calculation (NULL - unknown),
+//                         saved if attribute is valid
 // return attribute's status (see typedef)
-FileAttrStatus check_file_attr(const char *file_name, uint32_t file_attr);
+FileAttrStatus check_file_attr(const char *file_name, const FileAttr *file_attr, const FileFingerprint *fingerprint);
+
+// check file's metadata without attribute calculation
+// param[in] file_name - uniq file name
+// param[in] fingerprint - current file's metadata
+// return VALID_ATTR - the same metadata, file is checked; ATTR_CHANGED - metadata
+//        changed or unknown, check attribute; FILE_NOT_FOUND; CHECK_ERROR
+FileAttrStatus check_file_fingerprint(const char *file_name, const FileFingerprint *fingerprint);
+
+// mark observed file as checked without its attribute (the check is deferred)
+// param[in] file_name - uniq file name
+// return VALID_ATTR - file is checked; FILE_NOT_FOUND; CHECK_ERROR
+FileAttrStatus skip_file_check(const char *file_name);
 
 // get file's attribute
 // param[in] file_name - uniq file name
-// return file's attribute (0 if file not found)
-uint32_t get_file_attr(const char *file_name);
+// param[out] file_attr - file's attribute (zero size if file not found)
+// return operation result: 0 - ok, 1 - file not found or error
+int get_file_attr(const char *file_name, FileAttr *file_attr);
+
+// keep large file's manifest next to its attribute
+// param[in] file_name - observed file's name
+// param[in] manifest - blocks' digests (copied), NULL - remove manifest
+// return operation result: 0 - ok, 1 - file not found or error
+int set_file_manifest(const char *file_name, const FileManifest *manifest);
+
+// get file's manifest
+// param[in] file_name - uniq file name
+// param[out] manifest - file's manifest, digests are valid until the file is changed
+// return operation result: 0 - ok, 1 - file has no manifest or isn't found
+int get_file_manifest(const char *file_name, FileManifest *manifest);
+
+// check if file is observed
+// param[in] file_name - uniq file name
+// return 1 - file is observed, 0 - unknown file
+int is_file_observed(const char *file_name);
+
+// start checking all files: every file becomes unchecked for this check, files
+// checked since its start are checked. get_next_unchecked_file sweeps all files.
+// return check's generation for begin_files_sweep
+uint32_t begin_files_check();
 
-// return unchecked file name until there is no unchecked file (return NULL)
+// sweep unchecked files of the check under directories, checks of other
+// directories can be begun after it
+// param[in] gen - check's generation from begin_files_check
+// param[in] paths - directories' paths (NULL - all files)
+// param[in] count - number of directories
+// return operation result: 0 - ok, 1 - generations wrapped since the check's start (nothing to sweep) or error
+int begin_files_sweep(uint32_t gen, char *const *paths, int count);
+
+// return unchecked file name until there is no unchecked file (return NULL),
+// the name is valid until the next call. Returned files become checked.
 const char *get_next_unchecked_file();
 
+// observed file's handler
+// param[in] file_name - uniq file name
+// param[in] file_attr - file's attribute
+// param[in] fingerprint_digest - file's metadata digest (0 - unknown)
+// param[in] ctx - user context from for_each_file
+typedef void (*file_visit_fn)(const char *file_name, const FileAttr *file_attr,
+                              uint64_t fingerprint_digest, void *ctx);
+
+// visit all observed files (in no particular order)
+// param[in] visit - file's handler
+// param[in] ctx - user context for visit
+void for_each_file(file_visit_fn visit, void *ctx);
+
+// visit observed files under directories (in no particular order)
+// param[in] paths - directories' paths (NULL - all files)
+// param[in] count - number of directories
+// param[in] visit - file's handler
+// param[in] ctx - user context for visit
+void for_each_file_in(char *const *paths, int count, file_visit_fn visit, void *ctx);
+
+// file's manifest handler
+// param[in] file_name - uniq file name
+// param[in] manifest - file's manifest
+// param[in] ctx - user context from for_each_manifest
+typedef void (*manifest_visit_fn)(const char *file_name, const FileManifest *manifest, void *ctx);
+
+// visit all manifests (in no particular order)
+// param[in] visit - manifest's handler
+// param[in] ctx - user context for visit
+void for_each_manifest(manifest_visit_fn visit, void *ctx);
+
+// visit manifests of files under directories (in no particular order)
+// param[in] paths - directories' paths (NULL - all manifests)
+// param[in] count - number of directories
+// param[in] visit - manifest's handler
+// param[in] ctx - user context for visit
+void for_each_manifest_in(char *const *paths, int count, manifest_visit_fn visit, void *ctx);
+
+// get Merkle digest of directory's tree: digest of its files' and subdirectories'
+// names and digests in name order, directories without observed files are left
+// out. The same trees have the same digest wherever they are. Digests of changed
+// directories are updated on request, the algorithm is hash_get_algo's one, so
+// the digest is truncated to 32 bits with crc32 and crc32c.
+// param[in] dir_path - directory's path (NULL - all observed files)
+// param[out] digest - tree's digest (its size is get_file_attr_size)
+// return operation result: 0 - ok, 1 - unknown directory or error
+int get_tree_digest(const char *dir_path, FileAttr *digest);
+
+// begin directory's walk of the check. A directory's tree is verified by its
+// complete walk (see end_dir_check) until its metadata or its files are changed.
+// param[in] dir_path - directory's path
+// param[in] fingerprint - directory's metadata before its entries are read
+// param[in] can_skip - 1: verified tree may be skipped, its files become checked
+// return VALID_ATTR - tree was skipped; ATTR_CHANGED - walk the directory; CHECK_ERROR
+FileAttrStatus begin_dir_check(const char *dir_path, const FileFingerprint *fingerprint, int can_skip);
+
+// end directory's walk begun by begin_dir_check: all its entries were walked
+// param[in] dir_path - directory's path
+void end_dir_check(const char *dir_path);
+
+// mark file or directory as changed: trees of its directories aren't verified
+// by walks begun before this call
+// param[in] path - path to file or directory
+void mark_path_changed(const char *path);
+
+// forget verified trees, e.g. when their changes could be missed
+void forget_dir_checks();
+
+// return repository's version, it's changed when files or their metadata are saved
+uint64_t get_files_version();
+
+// stop observing all files
+void clear_files();
+
 #ifdef __cplusplus
 }
 #endif
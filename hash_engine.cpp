@@ -0,0 +1,252 @@
+#include "hash_engine.h"
+#include "check_stats.h"
+#include "crc32.h"
+#include "file_reader.h"
+#include <time.h>
+#include <cstdio>
+#include <cstring>
+
+static HashAlgo active_algo = HASH_CRC32;
+
+static const char *const algo_names[HASH_ALGO_COUNT] = {
+    "crc32", "crc32c", "xxh3-64", "xxh3-128", "blake3"
+};
+
+static const uint32_t digest_sizes[HASH_ALGO_COUNT] = {
+    4, 4, 8, 16, BLAKE3_OUT_LEN
+};
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+// store number as big-endian bytes
+static void put_be(uint8_t *p, uint64_t value, int size) {
+    for (int i = size - 1; i >= 0; --i, value >>= 8)
+        p[i] = static_cast<uint8_t>(value);
+}
+
+static void put_crc(FileAttr *digest, uint32_t crc) {
+    digest->size = 4;
+    put_be(digest->bytes, crc, 4);
+}
+
+void hash_set_algo(HashAlgo algo) {
+    if (algo >= 0 && algo < HASH_ALGO_COUNT)
+        active_algo = algo;
+}
+
+HashAlgo hash_get_algo() {
+    return active_algo;
+}
+
+const char *hash_algo_name(HashAlgo algo) {
+    return algo >= 0 && algo < HASH_ALGO_COUNT ? algo_names[algo] : "unknown";
+}
+
+HashAlgo hash_algo_by_name(const char *name) {
+    for (int i = 0; i < HASH_ALGO_COUNT; ++i) {
+        if (strcmp(name, algo_names[i]) == 0)
+            return static_cast<HashAlgo>(i);
+    }
+    return HASH_ALGO_COUNT;
+}
+
+uint32_t hash_digest_size(HashAlgo algo) {
+    return algo >= 0 && algo < HASH_ALGO_COUNT ? digest_sizes[algo] : 0;
+}
+
+const char *hash_algo_kernel(HashAlgo algo) {
+    switch (algo) {
+    case HASH_CRC32:
+        return crc32_kernel_name(crc32_get_kernel());
+    case HASH_CRC32C:
+        return crc32c_kernel_name();
+    case HASH_XXH3_64:
+    case HASH_XXH3_128:
+        return xxh3_kernel_name();
+    case HASH_BLAKE3:
+        return blake3_kernel_name();
+    default:
+        return "unknown";
+    }
+}
+
+// start hashing of part at offset
+static void begin_part(HashState *state, HashAlgo algo, uint64_t offset) {
+    state->algo = algo;
+    state->len = 0;
+    switch (state->algo) {
+    case HASH_XXH3_64:
+    case HASH_XXH3_128:
+        xxh3_reset(&state->u.xxh3);
+        break;
+    case HASH_BLAKE3:
+        blake3_reset(&state->u.blake3, offset / BLAKE3_CHUNK_LEN);
+        break;
+    default:
+        state->u.crc = 0;
+        break;
+    }
+}
+
+void hash_begin(HashState *state) {
+    begin_part(state, active_algo, 0);
+}
+
+void hash_begin_algo(HashState *state, HashAlgo algo) {
+    begin_part(state, algo >= 0 && algo < HASH_ALGO_COUNT ? algo : HASH_CRC32, 0);
+}
+
+void hash_update(HashState *state, const void *buf, size_t len) {
+    state->len += len;
+    switch (state->algo) {
+    case HASH_CRC32:
+        state->u.crc = crc32_update(state->u.crc, buf, len);
+        break;
+    case HASH_CRC32C:
+        state->u.crc = crc32c_update(state->u.crc, buf, len);
+        break;
+    case HASH_XXH3_64:
+    case HASH_XXH3_128:
+        xxh3_update(&state->u.xxh3, buf, len);
+        break;
+    case HASH_BLAKE3:
+        blake3_update(&state->u.blake3, buf, len);
+        break;
+    default:
+        break;
+    }
+}
+
+void hash_end(const HashState *state, FileAttr *digest) {
+    digest->size = digest_sizes[state->algo];
+    switch (state->algo) {
+    case HASH_CRC32:
+    case HASH_CRC32C:
+        put_crc(digest, state->u.crc);
+        break;
+    case HASH_XXH3_64:
+        put_be(digest->bytes, xxh3_digest64(&state->u.xxh3), 8);
+        break;
+    case HASH_XXH3_128: {
+        Xxh3Hash128 hash = xxh3_digest128(&state->u.xxh3);
+        put_be(digest->bytes, hash.high, 8);
+        put_be(digest->bytes + 8, hash.low, 8);
+        break;
+    }
+    case HASH_BLAKE3:
+        blake3_final(&state->u.blake3, digest->bytes);
+        break;
+    default:
+        break;
+    }
+}
+
+int hash_can_split(uint64_t part_size) {
+    switch (active_algo) {
+    case HASH_CRC32:
+    case HASH_CRC32C:
+        return part_size > 0;
+    case HASH_BLAKE3:
+        // parts must be whole subtrees: 2^n chunks
+        return part_size >= BLAKE3_CHUNK_LEN && (part_size & (part_size - 1)) == 0;
+    default:
+        return 0;
+    }
+}
+
+void hash_begin_part(HashState *state, uint64_t offset) {
+    begin_part(state, active_algo, offset);
+}
+
+void hash_end_part(const HashState *state, HashPart *part) {
+    part->len = state->len;
+    if (state->algo == HASH_BLAKE3)
+        blake3_subtree(&state->u.blake3, &part->u.blake3);
+    else
+        part->u.crc = state->u.crc;
+}
+
+void hash_part_digest(const HashPart *part, FileAttr *digest) {
+    if (active_algo == HASH_BLAKE3) {
+        digest->size = BLAKE3_OUT_LEN;
+        blake3_subtree_cv(&part->u.blake3, digest->bytes);
+    } else {
+        put_crc(digest, part->u.crc);
+    }
+}
+
+void hash_combine_parts(const HashPart *parts, size_t count, FileAttr *digest) {
+    // a file could be truncated while it was read: its empty parts are dropped
+    while (count > 1 && parts[count - 1].len == 0)
+        count--;
+    switch (active_algo) {
+    case HASH_CRC32:
+    case HASH_CRC32C: {
+        uint32_t crc = parts[0].u.crc;
+        for (size_t i = 1; i < count; ++i)
+            crc = active_algo == HASH_CRC32 ? crc32_combine(crc, parts[i].u.crc, parts[i].len) :
+                                              crc32c_combine(crc, parts[i].u.crc, parts[i].len);
+        put_crc(digest, crc);
+        break;
+    }
+    case HASH_BLAKE3: {
+        Blake3Output outputs[64];
+        if (count <= sizeof(outputs) / sizeof(outputs[0])) {
+            for (size_t i = 0; i < count; ++i)
+                outputs[i] = parts[i].u.blake3;
+            blake3_combine(outputs, count, digest->bytes);
+        } else {
+            Blake3Output *many = new Blake3Output[count];
+            for (size_t i = 0; i < count; ++i)
+                many[i] = parts[i].u.blake3;
+            blake3_combine(many, count, digest->bytes);
+            delete[] many;
+        }
+        digest->size = BLAKE3_OUT_LEN;
+        break;
+    }
+    default:
+        hash_failed(digest);
+        break;
+    }
+}
+
+static void hash_file_data(const void *buf, size_t len, void *ctx) {
+    hash_update(static_cast<HashState *>(ctx), buf, len);
+}
+
+int hash_path(const char *path, FileAttr *digest) {
+    HashState state;
+    hash_begin(&state);
+    uint64_t start_ns = now_ns();
+    int failed = read_file(path, get_file_reader(), hash_file_data, &state);
+    stats_file_hashed(state.len, now_ns() - start_ns, failed);
+    // zero digest for bad file
+    if (failed)
+        hash_failed(digest);
+    else
+        hash_end(&state, digest);
+    return failed;
+}
+
+void hash_failed(FileAttr *digest) {
+    digest->size = digest_sizes[active_algo];
+    memset(digest->bytes, 0, digest->size);
+}
+
+void hash_digest_text(const FileAttr *digest, char *text, size_t size) {
+    if (active_algo == HASH_CRC32 || active_algo == HASH_CRC32C) {
+        uint32_t crc = 0;
+        for (uint32_t i = 0; i < digest->size && i < 4; ++i)
+            crc = crc << 8 | digest->bytes[i];
+        snprintf(text, size, "%s 0x%X", active_algo == HASH_CRC32 ? "crc" : "crc32c", crc);
+        return;
+    }
+    int len = snprintf(text, size, "%s ", algo_names[active_algo]);
+    for (uint32_t i = 0; i < digest->size && len > 0 && static_cast<size_t>(len) < size; ++i)
+        len += snprintf(text + len, size - len, "%02x", digest->bytes[i]);
+}
@@ -0,0 +1,103 @@
+#ifndef HASH_ENGINE_HEADER
+#define HASH_ENGINE_HEADER
+
+#include <stddef.h>
+#include <stdint.h>
+#include "blake3.h"
+#include "file_repo.h"
+#include "xxh3.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// hash engine: files' attributes are digests of the selected algorithm. Digests
+// are stored as big-endian numbers (crc32, crc32c, xxh3) or as bytes (blake3).
+
+// hashed part of file (see hash_begin_part)
+typedef struct {
+    uint64_t len; // part's size in bytes
+    union {
+        uint32_t     crc;
+        Blake3Output blake3;
+    } u;
+} HashPart;
+
+// select algorithm for files' attributes (HASH_CRC32 by default)
+void hash_set_algo(HashAlgo algo);
+
+// return algorithm for files' attributes
+HashAlgo hash_get_algo();
+
+// return algorithm's name (crc32, crc32c, xxh3-64, xxh3-128, blake3)
+const char *hash_algo_name(HashAlgo algo);
+
+// return algorithm by name (HASH_ALGO_COUNT - unknown name)
+HashAlgo hash_algo_by_name(const char *name);
+
+// return algorithm's digest size in bytes
+uint32_t hash_digest_size(HashAlgo algo);
+
+// return algorithm's implementation for logs (crc32 kernel, SIMD or portable)
+const char *hash_algo_kernel(HashAlgo algo);
+
+// start hashing with the selected algorithm
+void hash_begin(HashState *state);
+
+// start hashing with the given algorithm, the selected one isn't changed
+// param[in] algo - hash algorithm
+void hash_begin_algo(HashState *state, HashAlgo algo);
+
+// continue hashing
+// param[in] buf - data
+// param[in] len - data size in bytes
+void hash_update(HashState *state, const void *buf, size_t len);
+
+// get digest of hashed data
+// param[out] digest - digest
+void hash_end(const HashState *state, FileAttr *digest);
+
+// return 1 if file's parts of part_size bytes can be hashed separately and
+// combined into file's digest (see hash_combine_parts), 0 - otherwise
+int hash_can_split(uint64_t part_size);
+
+// start hashing file's part with the selected algorithm
+// param[in] offset - part's offset in file (multiple of part_size, see hash_can_split)
+void hash_begin_part(HashState *state, uint64_t offset);
+
+// get hashed part
+// param[out] part - part for hash_combine_parts
+void hash_end_part(const HashState *state, HashPart *part);
+
+// get part's own digest (crc of the part, BLAKE3 subtree's chaining value),
+// it has the selected algorithm's digest size
+// param[in] part - hashed part (see hash_end_part)
+// param[out] digest - part's digest
+void hash_part_digest(const HashPart *part, FileAttr *digest);
+
+// combine file's parts into its digest
+// param[in] parts - parts in file's order, all but the last one have the same size
+// param[in] count - number of parts (> 0)
+// param[out] digest - file's digest
+void hash_combine_parts(const HashPart *parts, size_t count, FileAttr *digest);
+
+// hash file with the selected algorithm (see get_file_reader)
+// param[in] path - path to file
+// param[out] digest - file's digest (all zero bytes - file not found or system error)
+// return operation result: 0 - ok, 1 - error
+int hash_path(const char *path, FileAttr *digest);
+
+// set digest of failed file: all zero bytes of the selected algorithm's size
+void hash_failed(FileAttr *digest);
+
+// format digest for logs: "crc 0x1A2B3C4D" for crc32, "<algorithm> <hex>" for others
+// param[in] digest - digest of the selected algorithm
+// param[out] text - formatted digest
+// param[in] size - text's size (the longest digest needs 80 bytes)
+void hash_digest_text(const FileAttr *digest, char *text, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HASH_ENGINE_HEADER
@@ -0,0 +1,399 @@
+#include "hash_pool.h"
+#include "check_stats.h"
+#include "consistency.h"
+#include "file_reader.h"
+#include "hash_engine.h"
+#include "throttle.h"
+#include <linux/limits.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// max jobs in flight per worker
+#define JOBS_PER_WORKER 16
+
+// chunk size alignment (O_DIRECT reads aligned parts only)
+#define CHUNK_ALIGNMENT 4096
+
+// job's slot of the window, slots are reused: the path is copied into the slot
+// and large files' lists keep their capacity, so queueing a file doesn't allocate
+struct hash_job {
+    char                  path[PATH_MAX];
+    bool                  has_fingerprint;
+    FileFingerprint       fingerprint;
+    hash_result_fn        on_result;
+    void                 *ctx;
+    FileAttr              digest;
+    bool                  done;
+    // large file: wall time is reported, chunks are hashed by several workers
+    bool                  large = false;
+    uint64_t              start_ns = 0;
+    uint64_t              ns = 0;
+    unsigned              chunks = 0; // 0 - file is hashed whole
+    unsigned              next_chunk = 0;
+    unsigned              chunks_done = 0;
+    bool                  failed = false;
+    std::vector<HashPart> chunk_parts;
+    std::vector<uint8_t>  manifest; // chunks' digests of split file
+    // split file's metadata at start and its copy (see open_file_snapshot)
+    FileFingerprint       start_fingerprint;
+    bool                  has_start_fingerprint = false;
+    FileSnapshot          snapshot = {-1, ""};
+};
+
+static std::vector<std::thread> workers;
+static std::mutex pool_mutex;
+static std::condition_variable job_queued; // wakes workers
+static std::condition_variable job_done;   // wakes submitter
+// ring of window's slots: jobs in submission order, freed after result delivery
+static std::vector<hash_job> window;
+static size_t window_size;
+static size_t window_capacity;
+// sequence number of the window's first job and of the first job not taken by workers
+static uint64_t head_seq;
+static uint64_t next_seq;
+static bool stopping;
+// eventfd of the submitter's loop, written once after hash_pool_poll left jobs
+static int wakeup_fd = -1;
+static bool wakeup_armed;
+// large files' settings
+static uint64_t large_file_size;
+static uint64_t chunk_size;
+static large_file_fn large_file_handler;
+// split jobs with chunks not taken by workers (ring of window_capacity)
+static std::vector<hash_job *> split_jobs;
+static size_t split_head;
+static size_t split_count;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+// return job of sequence number
+static hash_job &job_at(uint64_t seq) {
+    return window[seq % window_capacity];
+}
+
+// resize large file's list, growing its capacity is counted
+template <typename T>
+static void resize_list(std::vector<T> &list, size_t size) {
+    if (size > list.capacity())
+        stats_add(STAT_HASH_ALLOCATIONS, 1);
+    list.resize(size);
+}
+
+// set up job's slot for file
+// return operation result: 0 - ok, 1 - path is too long
+static int init_job(hash_job &job, const char *path, const FileFingerprint *fingerprint,
+                    hash_result_fn on_result, void *ctx) {
+    size_t len = strlen(path);
+    if (len >= PATH_MAX)
+        return 1;
+    memcpy(job.path, path, len + 1);
+    job.has_fingerprint = fingerprint != NULL;
+    job.fingerprint = fingerprint ? *fingerprint : FileFingerprint();
+    job.on_result = on_result;
+    job.ctx = ctx;
+    job.digest = FileAttr();
+    job.done = false;
+    job.large = false;
+    job.start_ns = 0;
+    job.ns = 0;
+    job.chunks = 0;
+    job.next_chunk = 0;
+    job.chunks_done = 0;
+    job.failed = false;
+    job.chunk_parts.clear();
+    job.manifest.clear();
+    job.has_start_fingerprint = false;
+    job.snapshot.fd = -1;
+    job.snapshot.path[0] = '\0';
+    return 0;
+}
+
+// mark large file and split it if there are workers for its chunks (called under pool_mutex)
+// return true - split file's metadata and copy are to be taken by snapshot_job
+static bool start_job(hash_job &job) {
+    job.large = large_file_size && job.has_fingerprint && job.fingerprint.size >= large_file_size;
+    if (!job.large)
+        return false;
+    job.start_ns = now_ns();
+    if (chunk_size && workers.size() > 1 && job.fingerprint.size > chunk_size && hash_can_split(chunk_size)) {
+        job.chunks = static_cast<unsigned>((job.fingerprint.size + chunk_size - 1) / chunk_size);
+        resize_list(job.chunk_parts, job.chunks);
+        return consistency_enabled() != 0;
+    }
+    return false;
+}
+
+// take split file's metadata and copy, chunks are read from the copy or the
+// file is checked for changes at the end. The copy can take long: it's taken
+// without pool_mutex, before the chunks are given to other workers.
+static void snapshot_job(hash_job &job) {
+    if (get_path_fingerprint(job.path, &job.start_fingerprint) == 0) {
+        job.has_start_fingerprint = true;
+        open_file_snapshot(job.path, &job.start_fingerprint, &job.snapshot);
+    }
+}
+
+static void finish_job(hash_job &job) {
+    if (job.large)
+        job.ns = now_ns() - job.start_ns;
+    // whole files are counted by hash_path
+    if (job.chunks) {
+        uint64_t bytes = 0;
+        for (auto &part: job.chunk_parts)
+            bytes += part.len;
+        stats_file_hashed(bytes, job.ns, job.failed);
+    }
+    job.done = true;
+}
+
+static void chunk_data(const void *buf, size_t len, void *ctx) {
+    hash_update(static_cast<HashState *>(ctx), buf, len);
+}
+
+// the last chunk is read up to the end of file
+// return operation result: 0 - ok, 1 - error
+static int hash_chunk(const hash_job &job, unsigned index, HashPart *part) {
+    HashState state;
+    uint64_t offset = index * chunk_size;
+    hash_begin_part(&state, offset);
+    uint64_t length = index + 1 < job.chunks ? chunk_size : UINT64_MAX;
+    const char *path = job.snapshot.fd >= 0 ? job.snapshot.path : job.path;
+    int failed = read_file_range(path, get_file_reader(), offset, length, chunk_data, &state);
+    hash_end_part(&state, part);
+    return failed;
+}
+
+// digest of the whole file from its chunks (zero if some chunk failed, like hash_path)
+// and its manifest
+static void combine_chunks(hash_job &job) {
+    bool copied = job.snapshot.fd >= 0;
+    close_file_snapshot(&job.snapshot);
+    if (job.failed) {
+        hash_failed(&job.digest);
+        return;
+    }
+    // torn read isn't retried, the file is checked by the next pass
+    if (job.has_start_fingerprint && !copied) {
+        FileFingerprint end;
+        if (get_path_fingerprint(job.path, &end) != 0 || !same_fingerprint(&job.start_fingerprint, &end)) {
+            stats_add(STAT_TORN_READS, 1);
+            job.digest.size = 0;
+            return;
+        }
+    }
+    if (job.has_start_fingerprint)
+        job.fingerprint = job.start_fingerprint;
+    hash_combine_parts(job.chunk_parts.data(), job.chunks, &job.digest);
+    resize_list(job.manifest, static_cast<size_t>(job.chunks) * job.digest.size);
+    for (unsigned i = 0; i < job.chunks; ++i) {
+        FileAttr digest;
+        hash_part_digest(&job.chunk_parts[i], &digest);
+        memcpy(&job.manifest[static_cast<size_t>(i) * digest.size], digest.bytes, digest.size);
+    }
+}
+
+static void worker_loop() {
+    // hashing yields CPU and disk to other processes
+    throttle_idle_thread();
+    std::unique_lock<std::mutex> lock(pool_mutex);
+    while (1) {
+        job_queued.wait(lock, [] {
+            return stopping || split_count || next_seq - head_seq < window_size;
+        });
+        // slots stay in place until their results are delivered
+        hash_job *job;
+        unsigned chunk = 0;
+        if (split_count) { // help with started file first
+            job = split_jobs[split_head];
+            chunk = job->next_chunk++;
+            if (job->next_chunk == job->chunks) {
+                split_head = (split_head + 1) % window_capacity;
+                split_count--;
+            }
+        } else if (next_seq - head_seq < window_size) {
+            job = &job_at(next_seq++);
+            // the slot is taken, other workers don't touch it till its chunks are given
+            if (start_job(*job)) {
+                lock.unlock();
+                snapshot_job(*job);
+                lock.lock();
+            }
+            if (job->chunks) {
+                job->next_chunk = 1;
+                split_jobs[(split_head + split_count++) % window_capacity] = job;
+                job_queued.notify_all();
+            }
+        } else {
+            return; // stopping and no more jobs
+        }
+        lock.unlock();
+        if (job->chunks == 0) {
+            FileAttr digest;
+            FileFingerprint fingerprint = job->fingerprint;
+            ReadConsistency read = hash_path_consistent(job->path, &digest,
+                                                        job->has_fingerprint ? &fingerprint : NULL);
+            if (read == READ_UNSTABLE)
+                digest.size = 0;
+            lock.lock();
+            job->digest = digest;
+            job->fingerprint = fingerprint;
+            finish_job(*job);
+        } else {
+            HashPart part;
+            int failed = hash_chunk(*job, chunk, &part);
+            lock.lock();
+            job->chunk_parts[chunk] = part;
+            job->failed |= failed != 0;
+            if (++job->chunks_done < job->chunks)
+                continue;
+            combine_chunks(*job);
+            finish_job(*job);
+        }
+        job_done.notify_one();
+        if (wakeup_armed && job == &job_at(head_seq)) {
+            wakeup_armed = false;
+            uint64_t one = 1;
+            while (write(wakeup_fd, &one, sizeof(one)) < 0 && errno == EINTR) {}
+        }
+    }
+}
+
+// pass finished jobs from the window's head to their handlers, a slot is
+// freed after its handler returns
+static void deliver_ready(std::unique_lock<std::mutex> &lock) {
+    while (window_size && job_at(head_seq).done) {
+        hash_job &job = job_at(head_seq);
+        lock.unlock();
+        if (job.large && large_file_handler)
+            large_file_handler(job.path, job.fingerprint.size, job.chunks ? job.chunks : 1, job.ns);
+        FileManifest manifest = {chunk_size, job.chunks, job.manifest.data()};
+        job.on_result(job.path, &job.digest,
+                      job.has_fingerprint ? &job.fingerprint : NULL,
+                      job.manifest.empty() ? NULL : &manifest, job.ctx);
+        lock.lock();
+        head_seq++;
+        window_size--;
+        stats_set(STAT_GAUGE_POOL_QUEUE, window_size);
+    }
+}
+
+int hash_pool_start(int count) {
+    if (count < 0 || !workers.empty())
+        return 1;
+    stopping = false;
+    head_seq = next_seq = 0;
+    window_size = split_head = split_count = 0;
+    window_capacity = static_cast<size_t>(count) * JOBS_PER_WORKER;
+    // slots are allocated once for the pool's life
+    try {
+        window = std::vector<hash_job>(window_capacity);
+        split_jobs.assign(window_capacity, NULL);
+    }  catch (...) {
+        return 1;
+    }
+    stats_add(STAT_HASH_ALLOCATIONS, 2);
+    // signals are handled by the daemon's thread only
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    bool failed = false;
+    try {
+        for (int i = 0; i < count; ++i)
+            workers.emplace_back(worker_loop);
+    }  catch (...) {
+        failed = true;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (failed) {
+        hash_pool_stop();
+        return 1;
+    }
+    return 0;
+}
+
+void hash_pool_stop() {
+    hash_pool_flush();
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        stopping = true;
+    }
+    job_queued.notify_all();
+    for (auto &it: workers)
+        it.join();
+    workers.clear();
+    std::vector<hash_job>().swap(window);
+    std::vector<hash_job *>().swap(split_jobs);
+}
+
+int hash_pool_submit(const char *path, const FileFingerprint *fingerprint,
+                     hash_result_fn on_result, void *ctx) {
+    try {
+        if (workers.empty()) {
+            hash_job job;
+            if (init_job(job, path, fingerprint, on_result, ctx))
+                return 1;
+            if (start_job(job))
+                snapshot_job(job);
+            if (hash_path_consistent(path, &job.digest, fingerprint ? &job.fingerprint : NULL) == READ_UNSTABLE)
+                job.digest.size = 0;
+            finish_job(job);
+            if (job.large && large_file_handler)
+                large_file_handler(path, job.fingerprint.size, 1, job.ns);
+            on_result(path, &job.digest, fingerprint ? &job.fingerprint : NULL, NULL, ctx);
+            return 0;
+        }
+        std::unique_lock<std::mutex> lock(pool_mutex);
+        deliver_ready(lock);
+        while (window_size >= window_capacity) {
+            job_done.wait(lock, [] { return job_at(head_seq).done; });
+            deliver_ready(lock);
+        }
+        if (init_job(job_at(head_seq + window_size), path, fingerprint, on_result, ctx))
+            return 1;
+        window_size++;
+        stats_set(STAT_GAUGE_POOL_QUEUE, window_size);
+        job_queued.notify_one();
+    }  catch (...) {
+        return 1;
+    }
+    return 0;
+}
+
+void hash_pool_set_large_files(uint64_t threshold, uint64_t chunk, large_file_fn on_large_file) {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    large_file_size = threshold;
+    chunk_size = (chunk + CHUNK_ALIGNMENT - 1) / CHUNK_ALIGNMENT * CHUNK_ALIGNMENT;
+    large_file_handler = on_large_file;
+}
+
+void hash_pool_flush() {
+    std::unique_lock<std::mutex> lock(pool_mutex);
+    while (window_size) {
+        job_done.wait(lock, [] { return job_at(head_seq).done; });
+        deliver_ready(lock);
+    }
+}
+
+void hash_pool_poll() {
+    std::unique_lock<std::mutex> lock(pool_mutex);
+    deliver_ready(lock);
+    wakeup_armed = wakeup_fd >= 0 && window_size;
+}
+
+void hash_pool_set_wakeup(int fd) {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    wakeup_fd = fd;
+    wakeup_armed = false;
+}
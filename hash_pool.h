@@ -0,0 +1,72 @@
+#ifndef HASH_POOL_HEADER
+#define HASH_POOL_HEADER
+
+#include <stdint.h>
+#include "file_repo.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// result handler, called in the submitting thread in submission order, it must not queue files
+// param[in] file - path to file from hash_pool_submit
+// param[in] digest - file's digest (see hash_path), its size is 0 if the file kept
+//                    changing while it was read (see hash_path_consistent)
+// param[in] fingerprint - metadata of the hashed content, hash_pool_submit's one if consistency
+//                         checks are off (NULL - unknown)
+// param[in] manifest - large file's chunks' digests (NULL - file was hashed whole)
+// param[in] ctx - user context from hash_pool_submit
+typedef void (*hash_result_fn)(const char *file, const FileAttr *digest,
+                               const FileFingerprint *fingerprint,
+                               const FileManifest *manifest, void *ctx);
+
+// large file's handler, called in the submitting thread before its result handler
+// param[in] file - path to file
+// param[in] size - file's size
+// param[in] chunks - number of chunks hashed in parallel (1 - file was hashed whole)
+// param[in] ns - hashing wall time
+typedef void (*large_file_fn)(const char *file, uint64_t size, unsigned chunks, uint64_t ns);
+
+// start hash workers
+// param[in] workers - number of worker threads (0 - hash in the caller thread)
+// return operation result: 0 - workers started, 1 - error
+int hash_pool_start(int workers);
+
+// wait for queued jobs and stop workers
+void hash_pool_stop();
+
+// queue file for hashing. Blocks while the pool is full; ready results are
+// delivered to their handlers meanwhile.
+// param[in] path - path to file
+// param[in] fingerprint - file's metadata passed to on_result (NULL - unknown)
+// param[in] on_result - result handler
+// param[in] ctx - user context for on_result
+// return operation result: 0 - file was queued, 1 - error
+int hash_pool_submit(const char *path, const FileFingerprint *fingerprint,
+                     hash_result_fn on_result, void *ctx);
+
+// wait for all queued files and deliver their results
+void hash_pool_flush();
+
+// deliver results of finished files without waiting for the others
+void hash_pool_poll();
+
+// set event loop's wakeup: after hash_pool_poll left queued files, the first
+// finished one writes 1 into eventfd, so the loop calls hash_pool_poll again
+// param[in] fd - eventfd (-1 - no wakeup)
+void hash_pool_set_wakeup(int fd);
+
+// set large files' handling: their chunks are hashed by several workers and
+// combined into the same digest (see hash_can_split), chunks' digests are the
+// file's manifest
+// param[in] threshold - large file's min size in bytes (0 - no large files)
+// param[in] chunk - chunk's size in bytes, rounded up to 4096 (0 - large files aren't split).
+//                   Algorithms that can't be split by chunk's size hash large files whole.
+// param[in] on_large_file - large file's handler (NULL - no handler)
+void hash_pool_set_large_files(uint64_t threshold, uint64_t chunk, large_file_fn on_large_file);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HASH_POOL_HEADER
@@ -0,0 +1,91 @@
+#include "io_buffer.h"
+#include "check_stats.h"
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mutex>
+
+// free lists by NUMA node (nodes above are folded)
+#define IO_BUFFER_NODES 64
+
+// released buffer keeps the next free one in its first bytes
+struct free_buffer {
+    free_buffer *next;
+};
+
+static std::mutex pool_mutex;
+static free_buffer *free_lists[IO_BUFFER_NODES];
+
+// return NUMA node of the CPU the thread runs on (0 - unknown)
+static unsigned current_node() {
+    unsigned cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0)
+        return 0;
+    return node % IO_BUFFER_NODES;
+}
+
+static void put_free(char *buffer) {
+    unsigned node = current_node();
+    free_buffer *item = reinterpret_cast<free_buffer *>(buffer);
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    item->next = free_lists[node];
+    free_lists[node] = item;
+}
+
+// buffer of the thread between its reads, it goes back to the pool when the thread exits
+struct thread_buffer {
+    char *buffer = NULL;
+    ~thread_buffer() {
+        if (buffer)
+            put_free(buffer);
+    }
+};
+
+static thread_local thread_buffer cached;
+
+static char *take_free(unsigned node) {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    free_buffer *head = free_lists[node];
+    if (head)
+        free_lists[node] = head->next;
+    return reinterpret_cast<char *>(head);
+}
+
+char *io_buffer_acquire() {
+    if (cached.buffer) {
+        char *buffer = cached.buffer;
+        cached.buffer = NULL;
+        return buffer;
+    }
+    char *buffer = take_free(current_node());
+    if (buffer)
+        return buffer;
+    void *p = NULL;
+    if (posix_memalign(&p, IO_BUFFER_ALIGNMENT, IO_BUFFER_SIZE) != 0)
+        return NULL;
+    stats_add(STAT_HASH_ALLOCATIONS, 1);
+    // first touch places the pages on this thread's node
+    memset(p, 0, IO_BUFFER_SIZE);
+    return static_cast<char *>(p);
+}
+
+void io_buffer_release(char *buffer) {
+    if (!buffer)
+        return;
+    if (!cached.buffer)
+        cached.buffer = buffer;
+    else
+        put_free(buffer);
+}
+
+void io_buffer_trim() {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    for (int i = 0; i < IO_BUFFER_NODES; ++i) {
+        while (free_lists[i]) {
+            free_buffer *item = free_lists[i];
+            free_lists[i] = item->next;
+            free(item);
+        }
+    }
+}
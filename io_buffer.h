@@ -0,0 +1,36 @@
+#ifndef IO_BUFFER_HEADER
+#define IO_BUFFER_HEADER
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// reading buffers of the hashing path: page-aligned, allocated once and reused.
+// A new buffer is first touched by the thread which checks it out, so its pages
+// are on that thread's NUMA node. Released buffers are kept by the releasing
+// thread's node and checked out on that node again; a thread keeps its last
+// buffer until it exits. Allocations are counted by STAT_HASH_ALLOCATIONS.
+
+// size of I/O buffer in bytes
+#define IO_BUFFER_SIZE      (4 * 1024 * 1024)
+// alignment of I/O buffer (O_DIRECT)
+#define IO_BUFFER_ALIGNMENT 4096
+
+// check out I/O buffer of IO_BUFFER_SIZE bytes
+// return buffer (NULL - no memory)
+char *io_buffer_acquire();
+
+// return I/O buffer to the pool
+// param[in] buffer - buffer from io_buffer_acquire (NULL - nothing)
+void io_buffer_release(char *buffer);
+
+// free buffers kept by the pool, buffers kept by threads stay
+void io_buffer_trim();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IO_BUFFER_HEADER
@@ -1,42 +1,496 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <string.h>
+#include <ctype.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <linux/limits.h>
 #include "daemon.h"
 
 #define DAEMON_ENV_DIR          "CRC32_CHECK_DAEMOM_DIR"
 #define DAEMON_ENV_TIMEOUT      "CRC32_CHECK_DAEMOM_TIMEOUT"
+#define DAEMON_ENV_RATE         "CRC32_CHECK_DAEMOM_RATE"
+#define DAEMON_ENV_FILES_RATE   "CRC32_CHECK_DAEMOM_FILES_RATE"
+#define DAEMON_ENV_IDLE         "CRC32_CHECK_DAEMOM_IDLE"
+#define DAEMON_ENV_PSI          "CRC32_CHECK_DAEMOM_PSI"
+#define DAEMON_ENV_LOAD         "CRC32_CHECK_DAEMOM_LOAD"
+#define DAEMON_ENV_HASH         "CRC32_CHECK_DAEMOM_HASH"
+
+// default full rehash cadence in fast mode
+#define DEFAULT_PARANOID_EVERY  10
+
+// default large file's size and its chunk size (MiB)
+#define DEFAULT_LARGE_FILE_MB   1024
+#define DEFAULT_CHUNK_MB        64
+
+// default max file events per pass in syslog
+#define DEFAULT_SYSLOG_EVENTS   100
+
+// default torn read's retries and the first retry's delay (ms)
+#define DEFAULT_TORN_RETRIES    3
+#define DEFAULT_TORN_BACKOFF_MS 50
+
+// default max passes in a row a file's check is deferred while it's written
+#define DEFAULT_MAX_DEFERRALS   3
+
+// watch set's max name length and weight
+#define WATCH_SET_NAME_MAX      64
+#define WATCH_SET_WEIGHT_MAX    1000
+
+// get option's value from env variable if it isn't set by arg
+// param[in,out] value - option's value (NULL - not set)
+// param[in] env - env variable's name
+static void get_env_option(char **value, const char *env) {
+    if (!*value)
+        *value = getenv(env);
+}
+
+// make path absolute, deamon works in root directory
+// param[in] path - path to file
+// param[out] abs_path - buffer (PATH_MAX) for absolute path
+// return absolute path (path or abs_path), NULL - path is too long
+static char *get_abs_path(char *path, char *abs_path) {
+    if (path[0] == '/')
+        return path;
+    char cwd[PATH_MAX];
+    int len = getcwd(cwd, sizeof(cwd)) ? snprintf(abs_path, PATH_MAX, "%s/%s", cwd, path) : -1;
+    return len < 0 || len >= PATH_MAX ? NULL : abs_path;
+}
+
+// send command to deamon's control socket and print its reply
+// return operation result: EXIT_SUCCESS - reply was received, EXIT_FAILURE - error
+static int send_command(const char *socket_path, const char *command) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        printf("[ERROR] path to control socket is too long: %s\n", socket_path);
+        return EXIT_FAILURE;
+    }
+    strcpy(addr.sun_path, socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        printf("[ERROR] connect to control socket %s failed\n", socket_path);
+        if (fd >= 0)
+            close(fd);
+        return EXIT_FAILURE;
+    }
+    char line[PATH_MAX + 16];
+    int len = snprintf(line, sizeof(line), "%s\n", command);
+    if (len < 0 || len >= (int)sizeof(line) || write(fd, line, (size_t)len) != len) {
+        printf("[ERROR] send command failed: %s\n", command);
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    char reply[4096];
+    ssize_t n;
+    while ((n = read(fd, reply, sizeof(reply))) > 0)
+        fwrite(reply, 1, (size_t)n, stdout);
+    close(fd);
+    return n == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// return 1 if directory is inside the other one or they are the same
+static int is_nested_dir(const char *dir, const char *other) {
+    size_t len = strlen(other);
+    if (len == 1 && other[0] == '/')
+        return 1;
+    return strncmp(dir, other, len) == 0 && (dir[len] == '/' || dir[len] == '\0');
+}
+
+// make directory's path absolute and check that it isn't nested with the previous ones
+// param[in,out] paths_to_dirs - directories, the path is replaced by its real path
+// param[in] index - directory's index
+static void resolve_dir(char **paths_to_dirs, int index) {
+    struct stat sb;
+    char *path = realpath(paths_to_dirs[index], NULL);
+    if (!path || stat(path, &sb) != 0 || !S_ISDIR(sb.st_mode)) {
+        printf("[ERROR] no such directory: %s\n", paths_to_dirs[index]);
+        exit(EXIT_FAILURE);
+    }
+    paths_to_dirs[index] = path;
+    for (int j = 0; j < index; ++j) {
+        if (is_nested_dir(paths_to_dirs[index], paths_to_dirs[j]) ||
+            is_nested_dir(paths_to_dirs[j], paths_to_dirs[index])) {
+            printf("[ERROR] nested directories: %s, %s\n", paths_to_dirs[j], paths_to_dirs[index]);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+// return 1 if watch set's name can be a metric's label value
+static int is_valid_set_name(const char *name) {
+    size_t len = strlen(name);
+    if (len == 0 || len > WATCH_SET_NAME_MAX || name[0] == '/')
+        return 0;
+    for (size_t i = 0; i < len; ++i) {
+        if (!isalnum((unsigned char)name[i]) && !strchr("_.-", name[i]))
+            return 0;
+    }
+    return 1;
+}
+
+// load watch sets' file, a line is a set: name, interval in sec, weight, baseline
+// file ('-' - no baseline) and set's directories separated by spaces. Empty lines
+// and lines starting with '#' are skipped. Errors are printed and the process exits.
+// param[in] path - path to watch sets' file
+// param[out] sets - watch sets
+// param[out] paths_to_dirs - directories of all sets (absolute)
+// param[out] dirs_count - number of directories
+// return number of watch sets
+static int load_watch_sets(const char *path, WatchSet **sets, char ***paths_to_dirs, int *dirs_count) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        printf("[ERROR] open watch sets' file %s failed\n", path);
+        exit(EXIT_FAILURE);
+    }
+    int count = 0, capacity = 0, dirs_capacity = 0;
+    *sets = NULL;
+    *paths_to_dirs = NULL;
+    *dirs_count = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    int line_number = 0;
+    while (getline(&line, &line_size, f) >= 0) {
+        line_number++;
+        char *save = NULL;
+        char *name = strtok_r(line, " \t\r\n", &save);
+        if (!name || name[0] == '#')
+            continue;
+        char *interval = strtok_r(NULL, " \t\r\n", &save);
+        char *weight = strtok_r(NULL, " \t\r\n", &save);
+        char *baseline = strtok_r(NULL, " \t\r\n", &save);
+        char *dir = strtok_r(NULL, " \t\r\n", &save);
+        if (!dir) {
+            printf("[ERROR] %s:%d: watch set must be: name interval weight baseline dir...\n", path, line_number);
+            exit(EXIT_FAILURE);
+        }
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            *sets = realloc(*sets, (size_t)capacity * sizeof(WatchSet));
+            if (!*sets) {
+                printf("[ERROR] out of memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        WatchSet *set = &(*sets)[count];
+        memset(set, 0, sizeof(*set));
+        set->name = strdup(name);
+        set->interval_s = atoi(interval);
+        long set_weight = atol(weight);
+        if (!set->name || !is_valid_set_name(name)) {
+            printf("[ERROR] %s:%d: watch set's name must be up to %d letters, digits, '_', '.', '-' (%s)\n",
+                   path, line_number, WATCH_SET_NAME_MAX, name);
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < count; ++i) {
+            if (strcmp((*sets)[i].name, name) == 0) {
+                printf("[ERROR] %s:%d: watch set %s is repeated\n", path, line_number, name);
+                exit(EXIT_FAILURE);
+            }
+        }
+        if (set->interval_s <= 0 || set_weight <= 0 || set_weight > WATCH_SET_WEIGHT_MAX) {
+            printf("[ERROR] %s:%d: interval must be > 0, weight must be in [1, %d]\n",
+                   path, line_number, WATCH_SET_WEIGHT_MAX);
+            exit(EXIT_FAILURE);
+        }
+        set->weight = (unsigned)set_weight;
+        if (strcmp(baseline, "-") != 0) {
+            char abs_path[PATH_MAX];
+            char *baseline_path = get_abs_path(baseline, abs_path);
+            set->baseline_path = baseline_path ? strdup(baseline_path) : NULL;
+            if (!set->baseline_path) {
+                printf("[ERROR] %s:%d: wrong path to baseline file\n", path, line_number);
+                exit(EXIT_FAILURE);
+            }
+            for (int i = 0; i < count; ++i) {
+                if ((*sets)[i].baseline_path && strcmp((*sets)[i].baseline_path, set->baseline_path) == 0) {
+                    printf("[ERROR] %s:%d: baseline %s is used by watch set %s\n",
+                           path, line_number, set->baseline_path, (*sets)[i].name);
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+        // set's directories are the next range of all directories, it's pointed at the end
+        for (; dir; dir = strtok_r(NULL, " \t\r\n", &save)) {
+            if (*dirs_count == dirs_capacity) {
+                dirs_capacity = dirs_capacity ? dirs_capacity * 2 : 64;
+                *paths_to_dirs = realloc(*paths_to_dirs, (size_t)dirs_capacity * sizeof(char *));
+                if (!*paths_to_dirs) {
+                    printf("[ERROR] out of memory\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            (*paths_to_dirs)[*dirs_count] = strdup(dir);
+            resolve_dir(*paths_to_dirs, (*dirs_count)++);
+            set->dirs_count++;
+        }
+        count++;
+    }
+    free(line);
+    fclose(f);
+    if (count == 0) {
+        printf("[ERROR] no watch sets in %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0, first = 0; i < count; first += (*sets)[i++].dirs_count)
+        (*sets)[i].paths_to_dirs = *paths_to_dirs + first;
+    return count;
+}
 
 int main(int argc, char *argv[]) {
-    char *path_to_dir = NULL;
+    // options can't be repeated more than argc times
+    char **paths_to_dirs = calloc((size_t)argc + 1, sizeof(char *));
+    int dirs_count = 0;
+    char **include_globs = calloc((size_t)argc, sizeof(char *));
+    int include_count = 0;
+    char **exclude_globs = calloc((size_t)argc, sizeof(char *));
+    int exclude_count = 0;
     char *env_timeout = NULL;
     int timeout_s = 0;
+    int min_interval_s = 0;
+    int workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int fast_check = 0;
+    int paranoid_every = DEFAULT_PARANOID_EVERY;
+    long slice_mb = 0;
+    int slice_ms = 0;
+    int cycle_window_s = 0;
+    int watch_changes = 0;
+    FileReaderKind reader = FILE_READER_AUTO;
+    char *hash_name = NULL;
+    int use_uring = 0;
+    long large_file_mb = DEFAULT_LARGE_FILE_MB;
+    long chunk_mb = DEFAULT_CHUNK_MB;
+    char *baseline_path = NULL;
+    char baseline_abs_path[PATH_MAX];
+    char *watch_sets_path = NULL;
+    WatchSet *watch_sets = NULL;
+    int watch_sets_count = 0;
+    char *stats_socket = NULL;
+    char stats_abs_socket[PATH_MAX];
+    char *control_socket = NULL;
+    char control_abs_socket[PATH_MAX];
+    char *events_path = NULL;
+    char events_abs_path[PATH_MAX];
+    int syslog_events = DEFAULT_SYSLOG_EVENTS;
+    ConsistencyConfig consistency = {DEFAULT_TORN_RETRIES, DEFAULT_TORN_BACKOFF_MS, 0, 0, DEFAULT_MAX_DEFERRALS};
+    char *command = NULL;
+    // one-shot mode: export files into tree manifest or compare them with one
+    char *manifest_path = NULL;
+    int export_manifest = 0;
+    // throttling options are parsed after env variables are applied
+    char *rate_mb = NULL;
+    char *files_rate = NULL;
+    char *idle_priority = NULL;
+    char *psi_limit = NULL;
+    char *load_limit = NULL;
     int opt = 0;
+    if (!paths_to_dirs || !include_globs || !exclude_globs) {
+        printf("[ERROR] out of memory\n");
+        exit(EXIT_FAILURE);
+    }
     // try to get options from args
-    while ((opt = getopt(argc, argv, "d:t:")) != -1) {
+    while ((opt = getopt(argc, argv, "d:g:t:m:j:fp:ir:a:ub:I:E:c:k:s:C:x:X:D:B:M:W:R:F:nP:L:e:l:T:wS")) != -1) {
         switch (opt) {
         case 'd':
-            path_to_dir = optarg;
+            paths_to_dirs[dirs_count++] = optarg;
+            break;
+        case 'g':
+            watch_sets_path = optarg;
+            break;
+        case 'I':
+            include_globs[include_count++] = optarg;
+            break;
+        case 'E':
+            exclude_globs[exclude_count++] = optarg;
             break;
         case 't':
             timeout_s = atoi(optarg);
             break;
+        case 'm':
+            min_interval_s = atoi(optarg);
+            if (min_interval_s < 0) {
+                printf("[ERROR] min interval between checks must be >= 0 (%s)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'j':
+            workers = atoi(optarg);
+            if (workers <= 0) {
+                printf("[ERROR] number of hash workers must be > 0 (%s)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'f':
+            fast_check = 1;
+            break;
+        case 'p':
+            paranoid_every = atoi(optarg);
+            if (paranoid_every < 0) {
+                printf("[ERROR] paranoid check period must be >= 0 (%s)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'B':
+            slice_mb = atol(optarg);
+            if (slice_mb < 0) {
+                printf("[ERROR] check slice's size must be >= 0 MiB (%s)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'M':
+            slice_ms = atoi(optarg);
+            if (slice_ms < 0) {
+                printf("[ERROR] check slice's time must be >= 0 ms (%s)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'W':
+            cycle_window_s = atoi(optarg);
+            if (cycle_window_s < 0) {
+                printf("[ERROR] check cycle's window must be >= 0 sec (%s)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'R':
+            rate_mb = optarg;
+            break;
+        case 'F':
+            files_rate = optarg;
+            break;
+        case 'n':
+            idle_priority = "1";
+            break;
+        case 'P':
+            psi_limit = optarg;
+            break;
+        case 'L':
+            load_limit = optarg;
+            break;
+        case 'i':
+            watch_changes = 1;
+            break;
+        case 'r':
+            reader = file_reader_by_name(optarg);
+            if (reader == FILE_READER_COUNT) {
+                printf("[ERROR] file reader must be auto, pread, mmap or direct (%s)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'a':
+            hash_name = optarg;
+            break;
+        case 'u':
+            use_uring = 1;
+            break;
+        case 'b':
+            baseline_path = optarg;
+            break;
+        case 's':
+            stats_socket = optarg;
+            break;
+        case 'C':
+            control_socket = optarg;
+            break;
+        case 'x':
+            command = optarg;
+            break;
+        case 'X':
+        case 'D':
+            if (manifest_path) {
+                printf("[ERROR] only one of -X and -D args can be used\n");
+                exit(EXIT_FAILURE);
+            }
+            manifest_path = optarg;
+            export_manifest = opt == 'X';
+            break;
+        case 'e':
+            events_path = optarg;
+            break;
+        case 'T':
+            consistency.retries = atoi(optarg);
+            if (consistency.retries < 0) {
+                printf("[ERROR] torn read retries must be >= 0 (%s)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'w':
+            consistency.defer_writers = 1;
+            break;
+        case 'S':
+            consistency.reflink = 1;
+            break;
+        case 'l':
+            syslog_events = atoi(optarg);
+            if (syslog_events < 0) {
+                printf("[ERROR] number of file events in syslog must be >= 0 (%s)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'c':
+            large_file_mb = atol(optarg);
+            if (large_file_mb < 0) {
+                printf("[ERROR] large file size must be >= 0 MiB (%s)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'k':
+            chunk_mb = atol(optarg);
+            if (chunk_mb < 0) {
+                printf("[ERROR] chunk size must be >= 0 MiB (%s)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        }
+    }
+    // client mode: pass command to running deamon
+    if (command) {
+        if (!control_socket) {
+            printf("[ERROR] provide deamon's control socket via -C arg\n");
+            exit(EXIT_FAILURE);
+        }
+        return send_command(control_socket, command);
+    }
+    // watch sets replace directories and baseline
+    if (watch_sets_path && manifest_path) {
+        printf("[ERROR] -g arg can't be used with -X and -D args\n");
+        exit(EXIT_FAILURE);
+    }
+    if (watch_sets_path) {
+        if (dirs_count || baseline_path) {
+            printf("[ERROR] -g arg can't be used with -d and -b args\n");
+            exit(EXIT_FAILURE);
+        }
+        free(paths_to_dirs);
+        watch_sets_count = load_watch_sets(watch_sets_path, &watch_sets, &paths_to_dirs, &dirs_count);
+        // watch sets have their own timers, deamon's timeout is the shortest one
+        if (!timeout_s) {
+            timeout_s = watch_sets[0].interval_s;
+            for (int i = 1; i < watch_sets_count; ++i) {
+                if (watch_sets[i].interval_s < timeout_s)
+                    timeout_s = watch_sets[i].interval_s;
+            }
         }
     }
     // if no arg try to get path from env
-    if (!path_to_dir)
-        path_to_dir = getenv(DAEMON_ENV_DIR);
+    if (!dirs_count && getenv(DAEMON_ENV_DIR))
+        paths_to_dirs[dirs_count++] = getenv(DAEMON_ENV_DIR);
     // no env variable for path
-    if (!path_to_dir) {
+    if (!dirs_count) {
         printf("[ERROR] provide path to directory via -d arg or %s env variable\n", DAEMON_ENV_DIR);
         exit(EXIT_FAILURE);
     }
-    struct stat sb;
-    if (stat(path_to_dir, &sb) != 0 || !S_ISDIR(sb.st_mode)) {
-        printf("[ERROR] no such directory: %s\n", path_to_dir);
+    // deamon works in root directory, paths must be absolute (watch sets' ones already are)
+    for (int i = 0; !watch_sets && i < dirs_count; ++i)
+        resolve_dir(paths_to_dirs, i);
+    // manifest's paths are relative to the only directory
+    if (manifest_path && dirs_count != 1) {
+        printf("[ERROR] -X and -D args need one directory\n");
         exit(EXIT_FAILURE);
     }
-    if (!timeout_s) {
+    if (!timeout_s && !manifest_path) {
         env_timeout = getenv(DAEMON_ENV_TIMEOUT);
         if (env_timeout)
             timeout_s = atoi(env_timeout);
@@ -45,13 +499,80 @@ int main(int argc, char *argv[]) {
             exit(EXIT_FAILURE);
         }
     }
-    if (timeout_s <= 0) {
+    if (timeout_s <= 0 && !manifest_path) {
         printf("[ERROR] timeout must be > 0 (%d)\n", timeout_s);
         exit(EXIT_FAILURE);
     }
+    if (workers <= 0)
+        workers = 1;
+    get_env_option(&rate_mb, DAEMON_ENV_RATE);
+    get_env_option(&files_rate, DAEMON_ENV_FILES_RATE);
+    get_env_option(&idle_priority, DAEMON_ENV_IDLE);
+    get_env_option(&psi_limit, DAEMON_ENV_PSI);
+    get_env_option(&load_limit, DAEMON_ENV_LOAD);
+    get_env_option(&hash_name, DAEMON_ENV_HASH);
+    HashAlgo hash_algo = hash_name ? hash_algo_by_name(hash_name) : HASH_CRC32;
+    if (hash_algo == HASH_ALGO_COUNT) {
+        printf("[ERROR] hash algorithm must be crc32, crc32c, xxh3-64, xxh3-128 or blake3 (%s)\n", hash_name);
+        exit(EXIT_FAILURE);
+    }
+    ThrottleConfig throttle = {0, 0, 0, 0, 0};
+    double rate = rate_mb ? atof(rate_mb) : 0;
+    if (rate < 0) {
+        printf("[ERROR] read rate must be >= 0 MiB/sec (%s)\n", rate_mb);
+        exit(EXIT_FAILURE);
+    }
+    throttle.bytes_per_sec = (uint64_t)(rate * 1024 * 1024);
+    long files = files_rate ? atol(files_rate) : 0;
+    if (files < 0) {
+        printf("[ERROR] file open rate must be >= 0 files/sec (%s)\n", files_rate);
+        exit(EXIT_FAILURE);
+    }
+    throttle.files_per_sec = (uint64_t)files;
+    throttle.idle_priority = idle_priority && atoi(idle_priority) != 0;
+    throttle.psi_limit = psi_limit ? atof(psi_limit) : 0;
+    throttle.load_limit = load_limit ? atof(load_limit) : 0;
+    if (throttle.psi_limit < 0 || throttle.psi_limit >= 100 || throttle.load_limit < 0) {
+        printf("[ERROR] io pressure limit must be in [0, 100) %%, load limit must be >= 0\n");
+        exit(EXIT_FAILURE);
+    }
+    if (baseline_path && !(baseline_path = get_abs_path(baseline_path, baseline_abs_path))) {
+        printf("[ERROR] wrong path to baseline file\n");
+        exit(EXIT_FAILURE);
+    }
+    if (stats_socket && !(stats_socket = get_abs_path(stats_socket, stats_abs_socket))) {
+        printf("[ERROR] wrong path to stats socket\n");
+        exit(EXIT_FAILURE);
+    }
+    if (control_socket && !(control_socket = get_abs_path(control_socket, control_abs_socket))) {
+        printf("[ERROR] wrong path to control socket\n");
+        exit(EXIT_FAILURE);
+    }
+    if (events_path && !(events_path = get_abs_path(events_path, events_abs_path))) {
+        printf("[ERROR] wrong path to events file\n");
+        exit(EXIT_FAILURE);
+    }
+    if (manifest_path) {
+        DaemonConfig config = {paths_to_dirs, dirs_count, 0, 0, workers, 0, 0, 0, 0, 0, 0,
+                               reader, hash_algo, 0, (uint64_t)large_file_mb << 20, (uint64_t)chunk_mb << 20,
+                               NULL, include_globs, include_count, exclude_globs, exclude_count,
+                               NULL, NULL, throttle, NULL, 0, consistency, NULL, 0};
+        return run_manifest_command(&config, manifest_path, export_manifest);
+    }
     // start working
-    printf("[start deamon] dir %s, timeout %d sec ... ", path_to_dir, timeout_s);
-    int start_res = start_daemon(path_to_dir, timeout_s);
+    if (watch_sets)
+        printf("[start deamon] %d watch sets from %s, ", watch_sets_count, watch_sets_path);
+    printf("%sdir %s", watch_sets ? "" : "[start deamon] ", paths_to_dirs[0]);
+    for (int i = 1; i < dirs_count; ++i)
+        printf(", %s", paths_to_dirs[i]);
+    printf(", timeout %d sec, %d workers ... ", timeout_s, workers);
+    DaemonConfig config = {paths_to_dirs, dirs_count, timeout_s, min_interval_s, workers, fast_check, paranoid_every,
+                           (uint64_t)slice_mb << 20, slice_ms, cycle_window_s, watch_changes,
+                           reader, hash_algo, use_uring, (uint64_t)large_file_mb << 20, (uint64_t)chunk_mb << 20,
+                           baseline_path, include_globs, include_count, exclude_globs, exclude_count,
+                           stats_socket, control_socket, throttle, events_path, (unsigned)syslog_events,
+                           consistency, watch_sets, watch_sets_count};
+    int start_res = start_daemon(&config);
     if (start_res == EXIT_SUCCESS) {
         printf("ok\n");
     } else {
@@ -0,0 +1,163 @@
+#include "tree_manifest.h"
+#include "hash_engine.h"
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static int fails = 0;
+
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        printf("failed: %s\n", what);
+        fails++;
+    }
+}
+
+static bool corrupt_byte(const std::string &path, long offset) {
+    FILE *f = fopen(path.c_str(), "r+b");
+    if (!f)
+        return false;
+    fseek(f, offset, SEEK_SET);
+    int c = fgetc(f);
+    fseek(f, offset, SEEK_SET);
+    fputc(c ^ 0x5A, f);
+    fclose(f);
+    return true;
+}
+
+// attribute of size bytes made of number
+static FileAttr make_attr(uint32_t value, uint32_t size) {
+    FileAttr attr;
+    attr.size = size;
+    for (uint32_t i = 0; i < size; ++i)
+        attr.bytes[i] = static_cast<uint8_t>(value >> (i % 4 * 8)) + static_cast<uint8_t>(i / 4);
+    return attr;
+}
+
+// nested paths with shared prefixes
+static std::string file_path(int i) {
+    return "dir" + std::to_string(i % 7) + "/sub" + std::to_string(i % 3) + "/file" + std::to_string(i);
+}
+
+static bool tree_order(const std::string &a, const std::string &b) {
+    return compare_tree_paths(a.c_str(), b.c_str()) < 0;
+}
+
+// write entries of paths, the entry's number is its index
+static bool write_manifest(const std::string &path, const std::vector<std::string> &paths, HashAlgo algo) {
+    ManifestWriter *writer;
+    if (manifest_create(path.c_str(), algo, &writer) != MANIFEST_OK)
+        return false;
+    bool ok = true;
+    for (size_t i = 0; i < paths.size() && ok; ++i) {
+        ManifestEntry entry = {paths[i].c_str(), i * 1000, make_attr(static_cast<uint32_t>(i), hash_digest_size(algo))};
+        ok = manifest_write(writer, &entry) == MANIFEST_OK;
+    }
+    return manifest_close_writer(writer, ok) == MANIFEST_OK && ok;
+}
+
+// read all entries and compare them with paths
+static ManifestStatus read_manifest(const std::string &path, const std::vector<std::string> &paths) {
+    HashAlgo algo;
+    ManifestReader *reader;
+    ManifestStatus status = manifest_open(path.c_str(), &algo, &reader);
+    if (status != MANIFEST_OK)
+        return status;
+    ManifestEntry entry;
+    size_t i = 0;
+    while ((status = manifest_read(reader, &entry)) == MANIFEST_OK) {
+        FileAttr attr = make_attr(static_cast<uint32_t>(i), hash_digest_size(algo));
+        if (i >= paths.size() || paths[i] != entry.path || entry.size != i * 1000 || entry.digest.size != attr.size ||
+            memcmp(entry.digest.bytes, attr.bytes, attr.size) != 0) {
+            status = MANIFEST_ERROR;
+            break;
+        }
+        i++;
+    }
+    if (status == MANIFEST_END && (i != paths.size() || manifest_entries_read(reader) != i))
+        status = MANIFEST_ERROR;
+    manifest_close_reader(reader);
+    return status;
+}
+
+int main() {
+    char dir[] = "/tmp/manifest_test_XXXXXX";
+    if (!mkdtemp(dir)) {
+        printf("failed: can't create directory\n");
+        return 1;
+    }
+    std::string path = std::string(dir) + "/manifest";
+
+    printf("TEST 1: tree paths' order... ");
+    check(compare_tree_paths("a/b", "a.b") < 0, "directory's files before longer name");
+    check(compare_tree_paths("a", "a/b") < 0, "directory before its files");
+    check(compare_tree_paths("a/b", "a/b") == 0, "the same path");
+    check(compare_tree_paths("b", "a/z") > 0, "name order");
+    check(compare_tree_paths("a\xff", "ab") > 0, "unsigned chars");
+    printf("Ok\n");
+
+    printf("TEST 2: no manifest file... ");
+    HashAlgo algo;
+    ManifestReader *reader;
+    check(manifest_open(path.c_str(), &algo, &reader) == MANIFEST_NOT_FOUND && !reader, "missing file");
+    printf("Ok\n");
+
+    printf("TEST 3: write and read manifest... ");
+    std::vector<std::string> paths;
+    for (int i = 0; i < 20000; ++i)
+        paths.push_back(file_path(i));
+    std::sort(paths.begin(), paths.end(), tree_order);
+    check(write_manifest(path, paths, HASH_CRC32), "write crc32");
+    check(read_manifest(path, paths) == MANIFEST_END, "read crc32");
+    check(write_manifest(path, paths, HASH_BLAKE3), "write blake3");
+    check(manifest_open(path.c_str(), &algo, &reader) == MANIFEST_OK && algo == HASH_BLAKE3, "blake3 algorithm");
+    manifest_close_reader(reader);
+    check(read_manifest(path, paths) == MANIFEST_END, "read blake3");
+    std::vector<std::string> empty;
+    check(write_manifest(path, empty, HASH_CRC32) && read_manifest(path, empty) == MANIFEST_END, "empty manifest");
+    printf("Ok\n");
+
+    printf("TEST 4: wrong entries... ");
+    ManifestWriter *writer;
+    check(manifest_create(path.c_str(), HASH_CRC32, &writer) == MANIFEST_OK, "create");
+    ManifestEntry entry = {"b", 1, make_attr(1, 4)};
+    check(manifest_write(writer, &entry) == MANIFEST_OK, "first entry");
+    entry.path = "a/b";
+    check(manifest_write(writer, &entry) == MANIFEST_CORRUPTED, "wrong order");
+    entry.path = "b";
+    check(manifest_write(writer, &entry) == MANIFEST_CORRUPTED, "repeated path");
+    entry.path = "c";
+    entry.digest = make_attr(1, 8);
+    check(manifest_write(writer, &entry) == MANIFEST_ERROR, "wrong digest size");
+    // dropped manifest keeps the previous one
+    check(manifest_close_writer(writer, 0) == MANIFEST_OK && read_manifest(path, empty) == MANIFEST_END, "drop");
+    printf("Ok\n");
+
+    printf("TEST 5: corrupted manifest... ");
+    check(write_manifest(path, paths, HASH_CRC32), "write");
+    check(corrupt_byte(path, 12), "corrupt header");
+    check(read_manifest(path, paths) == MANIFEST_CORRUPTED, "corrupted header");
+    check(write_manifest(path, paths, HASH_CRC32), "write");
+    struct stat sb;
+    check(stat(path.c_str(), &sb) == 0 && corrupt_byte(path, sb.st_size / 2), "corrupt entry");
+    ManifestStatus status = read_manifest(path, paths);
+    check(status == MANIFEST_CORRUPTED || status == MANIFEST_ERROR, "corrupted entry");
+    check(write_manifest(path, paths, HASH_CRC32), "write");
+    check(corrupt_byte(path, sb.st_size - 3), "corrupt end");
+    check(read_manifest(path, paths) == MANIFEST_CORRUPTED, "corrupted end");
+    check(write_manifest(path, paths, HASH_CRC32) && truncate(path.c_str(), sb.st_size - 20) == 0, "truncate");
+    check(read_manifest(path, paths) == MANIFEST_CORRUPTED, "truncated file");
+    printf("Ok\n");
+
+    unlink(path.c_str());
+    rmdir(dir);
+    if (fails) {
+        printf("%d checks failed\n", fails);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,396 @@
+#include "report.h"
+#include "check_stats.h"
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <time.h>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+
+// ring's size in bytes (power of two)
+#define RING_SIZE        (4 * 1024 * 1024)
+// records are aligned to their header's first field
+#define RECORD_ALIGNMENT 8
+// max message's size
+#define MAX_MESSAGE      1024
+// JSON lines are written by batches of about this size
+#define BATCH_SIZE       (64 * 1024)
+// writer checks the ring at least so often (ms)
+#define WRITER_POLL_MS   1000
+// ring's space kept for pass ends, so their summaries aren't lost while the ring is full
+#define PASS_END_RESERVE 4096
+
+typedef enum {
+    RECORD_WRAP,     // the rest of the ring is skipped
+    RECORD_FILE,     // file's event
+    RECORD_LOG,      // message
+    RECORD_PASS_END  // end of pass
+} RecordType;
+
+// record in the ring, followed by its text: path and detail or message
+struct record_header {
+    uint32_t size;       // record's size with padding
+    uint16_t type;       // RecordType
+    uint16_t event;      // ReportEvent or syslog priority
+    uint32_t text_len;   // path or message
+    uint32_t log_offset; // log name's offset in path
+    uint32_t detail_len;
+    uint32_t reserved;
+    int64_t  time_ns;    // unix time
+};
+
+static const char *const event_names[REPORT_EVENT_COUNT] = {"new", "changed", "deleted", "region"};
+
+static char *ring;
+// positions since start: head is moved by the reporting thread, tail by the writer
+static std::atomic<uint64_t> ring_head;
+static std::atomic<uint64_t> ring_tail;
+// writer waits for wake_fd
+static std::atomic<bool> writer_idle;
+static std::atomic<bool> stopping;
+// events and messages (the last counter) which didn't fit the ring
+static std::atomic<uint64_t> overflows[REPORT_EVENT_COUNT + 1];
+static int wake_fd = -1;
+static int events_fd = -1;
+static std::string events_path;
+static unsigned syslog_limit;
+static std::thread writer;
+static bool started;
+// writer's state
+static std::string batch;
+static uint64_t pass_files;     // file events of the pass (without regions)
+static uint64_t pass_logged;    // file events written to syslog
+static uint64_t pass_suppressed;
+static uint64_t reported_overflows[REPORT_EVENT_COUNT + 1];
+static bool write_failed;
+
+static int64_t unix_time_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// put record into the ring
+// return operation result: 0 - ok, 1 - no space, the caller logs the record itself
+static int push_record(RecordType type, uint16_t event, const char *text, size_t text_len,
+                       size_t log_offset, const char *detail, size_t detail_len) {
+    size_t size = (sizeof(record_header) + text_len + detail_len + RECORD_ALIGNMENT - 1) /
+                  RECORD_ALIGNMENT * RECORD_ALIGNMENT;
+    uint64_t head = ring_head.load(std::memory_order_relaxed);
+    uint64_t tail = ring_tail.load(std::memory_order_acquire);
+    size_t pos = head % RING_SIZE;
+    // record isn't split: the ring's end is skipped
+    size_t pad = RING_SIZE - pos < size ? RING_SIZE - pos : 0;
+    size_t reserve = type == RECORD_PASS_END ? 0 : PASS_END_RESERVE;
+    if (size > RING_SIZE / 2 || head + pad + size + reserve - tail > RING_SIZE)
+        return 1;
+    if (pad) {
+        uint32_t wrap[2] = {static_cast<uint32_t>(pad), RECORD_WRAP};
+        memcpy(ring + pos, wrap, sizeof(wrap));
+        head += pad;
+        pos = 0;
+    }
+    record_header header;
+    memset(&header, 0, sizeof(header));
+    header.size = static_cast<uint32_t>(size);
+    header.type = static_cast<uint16_t>(type);
+    header.event = event;
+    header.text_len = static_cast<uint32_t>(text_len);
+    header.log_offset = static_cast<uint32_t>(log_offset);
+    header.detail_len = static_cast<uint32_t>(detail_len);
+    header.time_ns = unix_time_ns();
+    memcpy(ring + pos, &header, sizeof(header));
+    // log records have no detail, pass ends have no text (NULL)
+    if (text_len)
+        memcpy(ring + pos + sizeof(header), text, text_len);
+    if (detail_len)
+        memcpy(ring + pos + sizeof(header) + text_len, detail, detail_len);
+    ring_head.store(head + size, std::memory_order_seq_cst);
+    stats_add(STAT_REPORT_EVENTS, 1);
+    if (writer_idle.exchange(false)) {
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0) {} // writer polls anyway
+    }
+    return 0;
+}
+
+// count event or message (REPORT_EVENT_COUNT) which was logged past the ring
+static void count_overflow(int index) {
+    overflows[index].fetch_add(1, std::memory_order_relaxed);
+    stats_add(STAT_REPORT_OVERFLOWS, 1);
+}
+
+static void append_json_string(std::string &out, const char *text, size_t len) {
+    out.push_back('"');
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        if (c == '"' || c == '\\') {
+            out.push_back('\\');
+            out.push_back(static_cast<char>(c));
+        } else if (c == '\n') {
+            out.append("\\n");
+        } else if (c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out.append(escaped);
+        } else {
+            out.push_back(static_cast<char>(c));
+        }
+    }
+    out.push_back('"');
+}
+
+static void append_json_time(std::string &out, int64_t time_ns) {
+    time_t sec = static_cast<time_t>(time_ns / 1000000000);
+    struct tm tm;
+    gmtime_r(&sec, &tm);
+    char text[40];
+    size_t len = strftime(text, sizeof(text), "%Y-%m-%dT%H:%M:%S", &tm);
+    snprintf(text + len, sizeof(text) - len, ".%03dZ", static_cast<int>(time_ns / 1000000 % 1000));
+    out.append("{\"time\":\"").append(text).append("\"");
+}
+
+static void write_batch() {
+    if (events_fd < 0 || batch.empty())
+        return;
+    const char *p = batch.data();
+    size_t len = batch.size();
+    while (len > 0) {
+        ssize_t n = write(events_fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (!write_failed)
+                syslog(LOG_ERR, "[ERROR] write events to %s failed %d\n", events_path.c_str(), errno);
+            write_failed = true;
+            break;
+        }
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    batch.clear();
+}
+
+static void write_file_event(const record_header &header, const char *text) {
+    const char *path = text;
+    const char *detail = text + header.text_len;
+    ReportEvent event = static_cast<ReportEvent>(header.event);
+    if (event != REPORT_CHANGED_REGION)
+        pass_files++;
+    if (events_fd >= 0) {
+        append_json_time(batch, header.time_ns);
+        batch.append(",\"event\":\"").append(event_names[event]).append("\",\"path\":");
+        append_json_string(batch, path, header.text_len);
+        if (header.detail_len) {
+            batch.append(",\"detail\":");
+            append_json_string(batch, detail, header.detail_len);
+        }
+        batch.append("}\n");
+    }
+    if (syslog_limit && pass_logged >= syslog_limit) {
+        pass_suppressed++;
+        return;
+    }
+    pass_logged++;
+    const char *default_detail = event == REPORT_NEW_FILE ? "new file" : "file was deleted";
+    syslog(LOG_NOTICE, "Integrity check: FAIL (%.*s - %.*s)\n",
+           static_cast<int>(header.text_len - header.log_offset), path + header.log_offset,
+           header.detail_len ? static_cast<int>(header.detail_len) : static_cast<int>(strlen(default_detail)),
+           header.detail_len ? detail : default_detail);
+}
+
+static void write_log(const record_header &header, const char *text) {
+    syslog(header.event, "%.*s", static_cast<int>(header.text_len), text);
+    if (events_fd >= 0) {
+        size_t len = header.text_len;
+        while (len > 0 && text[len - 1] == '\n')
+            len--;
+        append_json_time(batch, header.time_ns);
+        batch.append(",\"event\":\"log\",\"priority\":").append(std::to_string(header.event)).append(",\"message\":");
+        append_json_string(batch, text, len);
+        batch.append("}\n");
+    }
+}
+
+static void write_pass_end() {
+    if (pass_suppressed) {
+        syslog(LOG_NOTICE, "Integrity check: FAIL (%llu files changed, %llu more events %s%s)\n",
+               static_cast<unsigned long long>(pass_files), static_cast<unsigned long long>(pass_suppressed),
+               events_fd >= 0 ? "are in " : "aren't logged", events_fd >= 0 ? events_path.c_str() : "");
+    }
+    pass_files = 0;
+    pass_logged = 0;
+    pass_suppressed = 0;
+}
+
+// note events which didn't fit the ring: JSON lines file misses them, syslog has them
+static void write_overflows() {
+    uint64_t counts[REPORT_EVENT_COUNT + 1];
+    uint64_t total = 0;
+    for (int i = 0; i <= REPORT_EVENT_COUNT; ++i) {
+        counts[i] = overflows[i].load(std::memory_order_relaxed) - reported_overflows[i];
+        reported_overflows[i] += counts[i];
+        total += counts[i];
+    }
+    if (!total)
+        return;
+    syslog(LOG_ERR, "[ERROR] report queue was full, %llu events and messages were logged past %s\n",
+           static_cast<unsigned long long>(total), events_fd >= 0 ? events_path.c_str() : "the queue");
+    if (events_fd < 0)
+        return;
+    append_json_time(batch, unix_time_ns());
+    batch.append(",\"event\":\"overflow\"");
+    for (int i = 0; i < REPORT_EVENT_COUNT; ++i)
+        batch.append(",\"").append(event_names[i]).append("\":").append(std::to_string(counts[i]));
+    batch.append(",\"log\":").append(std::to_string(counts[REPORT_EVENT_COUNT])).append("}\n");
+}
+
+// write all records in the ring
+static void drain_ring() {
+    uint64_t tail = ring_tail.load(std::memory_order_relaxed);
+    uint64_t head = ring_head.load(std::memory_order_acquire);
+    while (tail != head) {
+        const char *p = ring + tail % RING_SIZE;
+        record_header header;
+        memcpy(&header, p, 2 * sizeof(uint32_t));
+        if (header.type != RECORD_WRAP) {
+            memcpy(&header, p, sizeof(header));
+            const char *text = p + sizeof(header);
+            if (header.type == RECORD_FILE)
+                write_file_event(header, text);
+            else if (header.type == RECORD_LOG)
+                write_log(header, text);
+            else
+                write_pass_end();
+        }
+        tail += header.size;
+        ring_tail.store(tail, std::memory_order_release);
+        if (batch.size() >= BATCH_SIZE)
+            write_batch();
+    }
+    write_overflows();
+    write_batch();
+}
+
+static void writer_loop() {
+    while (1) {
+        drain_ring();
+        if (stopping.load())
+            break;
+        writer_idle.store(true);
+        // an event could come before the flag was set
+        if (ring_tail.load(std::memory_order_relaxed) != ring_head.load(std::memory_order_seq_cst)) {
+            writer_idle.store(false);
+            continue;
+        }
+        struct pollfd pfd = {wake_fd, POLLIN, 0};
+        if (poll(&pfd, 1, WRITER_POLL_MS) > 0) {
+            uint64_t value;
+            if (read(wake_fd, &value, sizeof(value)) < 0) {}
+        }
+        writer_idle.store(false);
+    }
+    drain_ring();
+}
+
+int report_start(const ReportConfig *config) {
+    if (started)
+        return 1;
+    syslog_limit = config->syslog_events;
+    events_path = config->events_path ? config->events_path : "";
+    write_failed = false;
+    if (config->events_path) {
+        events_fd = open(config->events_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (events_fd < 0)
+            return 1;
+    }
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ring = new (std::nothrow) char[RING_SIZE];
+    if (wake_fd < 0 || !ring) {
+        report_stop();
+        return 1;
+    }
+    ring_head = 0;
+    ring_tail = 0;
+    for (int i = 0; i <= REPORT_EVENT_COUNT; ++i) {
+        overflows[i] = 0;
+        reported_overflows[i] = 0;
+    }
+    pass_files = 0;
+    pass_logged = 0;
+    pass_suppressed = 0;
+    stopping = false;
+    writer_idle = false;
+    try {
+        writer = std::thread(writer_loop);
+    }  catch (...) {
+        report_stop();
+        return 1;
+    }
+    started = true;
+    return 0;
+}
+
+void report_stop() {
+    if (writer.joinable()) {
+        stopping = true;
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0) {}
+        writer.join();
+    }
+    started = false;
+    if (events_fd >= 0)
+        close(events_fd);
+    events_fd = -1;
+    if (wake_fd >= 0)
+        close(wake_fd);
+    wake_fd = -1;
+    delete[] ring;
+    ring = NULL;
+}
+
+void report_file_event(ReportEvent event, const char *path, const char *log_name, const char *detail) {
+    if (started) {
+        size_t path_len = strlen(path);
+        size_t log_offset = log_name >= path && log_name <= path + path_len ? static_cast<size_t>(log_name - path) : 0;
+        if (push_record(RECORD_FILE, static_cast<uint16_t>(event), path, path_len, log_offset,
+                        detail ? detail : "", detail ? strlen(detail) : 0) == 0)
+            return;
+        // failures aren't dropped: the checking thread logs them itself
+        count_overflow(event);
+    }
+    syslog(LOG_NOTICE, "Integrity check: FAIL (%s - %s)\n", log_name,
+           detail ? detail : event == REPORT_NEW_FILE ? "new file" : "file was deleted");
+}
+
+void report_log(int priority, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    if (!started) {
+        vsyslog(priority, format, args);
+        va_end(args);
+        return;
+    }
+    char message[MAX_MESSAGE];
+    int len = vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    if (len < 0)
+        return;
+    size_t size = static_cast<size_t>(len) < sizeof(message) ? static_cast<size_t>(len) : sizeof(message) - 1;
+    if (push_record(RECORD_LOG, static_cast<uint16_t>(priority), message, size, 0, NULL, 0)) {
+        count_overflow(REPORT_EVENT_COUNT);
+        syslog(priority, "%s", message);
+    }
+}
+
+void report_pass_end() {
+    if (started)
+        push_record(RECORD_PASS_END, 0, NULL, 0, 0, NULL, 0);
+}
@@ -0,0 +1,59 @@
+#ifndef REPORT_HEADER
+#define REPORT_HEADER
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// integrity events' reporting: the checking thread puts events into a lock-free
+// ring and never waits for the writer (it logs events itself while the ring is
+// full), a background writer batches them into a JSON lines file and syslog. Syslog gets a limited number of file events per
+// pass and a summary of the rest. Events are reported by one thread.
+
+typedef enum {
+    REPORT_NEW_FILE,       // file isn't observed
+    REPORT_CHANGED_FILE,   // file's digest differs from the reference one
+    REPORT_DELETED_FILE,   // observed file wasn't found
+    REPORT_CHANGED_REGION, // changed part of large file (see FileManifest)
+    REPORT_EVENT_COUNT
+} ReportEvent;
+
+// reporting's settings
+typedef struct {
+    const char *events_path;   // JSON lines file, events are appended (NULL - syslog only)
+    unsigned    syslog_events; // max file events per pass in syslog, the rest are summarized (0 - no limit)
+} ReportConfig;
+
+// start background writer, call after the deamon is forked
+// param[in] config - reporting's settings
+// return operation result: 0 - ok, 1 - error
+int report_start(const ReportConfig *config);
+
+// write queued events and stop background writer
+void report_stop();
+
+// report file's event, syslog line is "Integrity check: FAIL (<log name> - <detail>)".
+// While the ring is full events go to syslog at once, JSON lines file gets their
+// counts by type: {"event":"overflow","new":..,"changed":..,"deleted":..,"region":..,"log":..}
+// param[in] event - event's type
+// param[in] path - file's path
+// param[in] log_name - file's name for syslog, path's suffix
+// param[in] detail - event's description (NULL - default for new and deleted files)
+void report_file_event(ReportEvent event, const char *path, const char *log_name, const char *detail);
+
+// report message in order with file events (syslog and JSON lines). Without
+// background writer or while the ring is full the message goes to syslog immediately.
+// param[in] priority - syslog priority
+// param[in] format - printf format
+void report_log(int priority, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+// mark the end of pass: suppressed file events are summarized
+void report_pass_end();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // REPORT_HEADER
@@ -0,0 +1,200 @@
+#include "report.h"
+#include "check_stats.h"
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+static int fails = 0;
+
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        printf("failed: %s\n", what);
+        fails++;
+    }
+}
+
+static std::string read_text(int fd) {
+    std::string text;
+    char buf[65536];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        text.append(buf, static_cast<size_t>(n));
+    return text;
+}
+
+static std::vector<std::string> split_lines(const std::string &text) {
+    std::vector<std::string> lines;
+    size_t begin = 0, end;
+    while ((end = text.find('\n', begin)) != std::string::npos) {
+        lines.push_back(text.substr(begin, end - begin));
+        begin = end + 1;
+    }
+    return lines;
+}
+
+// return the file's lines, the file is emptied
+static std::vector<std::string> take_lines(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    std::string text = fd >= 0 ? read_text(fd) : std::string();
+    if (fd >= 0)
+        close(fd);
+    if (truncate(path.c_str(), 0) != 0)
+        check(false, "truncate file");
+    return split_lines(text);
+}
+
+static int count_lines(const std::vector<std::string> &lines, const char *text) {
+    int count = 0;
+    for (const std::string &line: lines)
+        count += line.find(text) != std::string::npos;
+    return count;
+}
+
+// number after "<name>": in JSON line
+static unsigned long json_number(const std::string &line, const char *name) {
+    std::string key = std::string("\"") + name + "\":";
+    size_t pos = line.find(key);
+    return pos == std::string::npos ? 0 : strtoul(line.c_str() + pos + key.size(), NULL, 10);
+}
+
+// path of i-th event, long enough for records to cross the ring's end
+static std::string event_path(const char *dir, int i) {
+    char path[256];
+    snprintf(path, sizeof(path), "/%s/%06d/%0120d", dir, i, i);
+    return path;
+}
+
+int main() {
+    char dir[] = "/tmp/report_test_XXXXXX";
+    if (!mkdtemp(dir)) {
+        printf("failed: can't create directory\n");
+        return 1;
+    }
+    // syslog lines are copied to stderr, which is the file
+    std::string events_path = std::string(dir) + "/events.json", syslog_path = std::string(dir) + "/syslog.txt";
+    int syslog_fd = open(syslog_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    int saved_stderr = dup(STDERR_FILENO);
+    if (syslog_fd < 0 || dup2(syslog_fd, STDERR_FILENO) < 0) {
+        printf("failed: can't redirect stderr\n");
+        return 1;
+    }
+    openlog("report_test", LOG_PERROR, LOG_USER);
+    ReportConfig config = {events_path.c_str(), 0};
+
+    printf("TEST 1: JSON escaping... ");
+    check(report_start(&config) == 0, "start report");
+    const char *odd_path = "/t/a\"b\\c\nd\te\x01" "f";
+    report_file_event(REPORT_CHANGED_FILE, odd_path, odd_path + 3, "new \"x\"");
+    report_log(LOG_INFO, "quote \" tab\t\n");
+    report_stop();
+    std::vector<std::string> lines = take_lines(events_path);
+    check(lines.size() == 2, "two lines");
+    check(lines.size() == 2 && lines[0].find("\"event\":\"changed\",\"path\":\"/t/a\\\"b\\\\c\\nd\\u0009e\\u0001f\","
+                                              "\"detail\":\"new \\\"x\\\"\"}") != std::string::npos,
+          "file event's escaping");
+    check(lines.size() == 2 && lines[1].find("\"event\":\"log\",\"priority\":6,\"message\":\"quote \\\" tab\\u0009\"}") !=
+                               std::string::npos, "message's escaping");
+    take_lines(syslog_path);
+    printf("Ok\n");
+
+    printf("TEST 2: ring's wrap-around... ");
+    // records of about 200 bytes: several laps of the ring, chunks give the writer time to drain it
+    const int wrap_events = 40000;
+    uint64_t overflows = stats_get(STAT_REPORT_OVERFLOWS);
+    check(report_start(&config) == 0, "start report");
+    for (int i = 0; i < wrap_events; ++i) {
+        std::string path = event_path("wrap", i);
+        report_file_event(REPORT_NEW_FILE, path.c_str(), path.c_str() + 1, NULL);
+        if (i % 2000 == 1999)
+            usleep(20000);
+    }
+    report_stop();
+    lines = take_lines(events_path);
+    bool ordered = lines.size() == wrap_events;
+    for (size_t i = 0; ordered && i < lines.size(); ++i)
+        ordered = lines[i].find("\"event\":\"new\",\"path\":\"" + event_path("wrap", static_cast<int>(i)) + "\"}") !=
+                  std::string::npos;
+    check(ordered, "events in order");
+    check(stats_get(STAT_REPORT_OVERFLOWS) == overflows, "no overflows");
+    take_lines(syslog_path);
+    printf("Ok\n");
+
+    printf("TEST 3: full ring... ");
+    // the writer blocks on the pipe till it's read, the ring fills up
+    std::string fifo_path = std::string(dir) + "/events.fifo";
+    int fifo_fd = mkfifo(fifo_path.c_str(), 0644) == 0 ? open(fifo_path.c_str(), O_RDONLY | O_NONBLOCK) : -1;
+    check(fifo_fd >= 0 && fcntl(fifo_fd, F_SETFL, 0) == 0, "open pipe");
+    ReportConfig fifo_config = {fifo_path.c_str(), 0};
+    check(report_start(&fifo_config) == 0, "start report");
+    const int full_events = 40000;
+    overflows = stats_get(STAT_REPORT_OVERFLOWS);
+    for (int i = 0; i < full_events; ++i) {
+        std::string path = event_path("full", i);
+        report_file_event(i % 2 ? REPORT_CHANGED_FILE : REPORT_DELETED_FILE, path.c_str(), path.c_str() + 1,
+                          i % 2 ? "digest differs" : NULL);
+    }
+    report_log(LOG_INFO, "after the events\n");
+    unsigned long overflowed = static_cast<unsigned long>(stats_get(STAT_REPORT_OVERFLOWS) - overflows);
+    std::string text;
+    std::thread reader([&] { text = read_text(fifo_fd); });
+    report_stop();
+    reader.join();
+    close(fifo_fd);
+    lines = split_lines(text);
+    unsigned long written = static_cast<unsigned long>(count_lines(lines, "\"path\":\"/full/"));
+    unsigned long counted_files = 0, counted_logs = 0;
+    for (const std::string &line: lines) {
+        if (line.find("\"event\":\"overflow\"") != std::string::npos) {
+            counted_files += json_number(line, "changed") + json_number(line, "deleted");
+            counted_logs += json_number(line, "log");
+        }
+    }
+    check(overflowed > 0, "ring was full");
+    check(written + counted_files == full_events, "every event is written or counted");
+    check(counted_files + counted_logs == overflowed, "overflows by type");
+    // events past the ring are in syslog
+    std::vector<std::string> logged = take_lines(syslog_path);
+    check(count_lines(logged, "Integrity check: FAIL (full/") == full_events, "failures in syslog");
+    check(count_lines(logged, "report queue was full") > 0, "overflow's error");
+    printf("Ok\n");
+
+    printf("TEST 4: pass summary... ");
+    ReportConfig limited = {events_path.c_str(), 2};
+    check(report_start(&limited) == 0, "start report");
+    for (int i = 0; i < 5; ++i) {
+        std::string path = event_path("pass", i);
+        report_file_event(REPORT_CHANGED_FILE, path.c_str(), path.c_str() + 1, "digest differs");
+    }
+    report_pass_end();
+    std::string last = event_path("pass", 5);
+    report_file_event(REPORT_NEW_FILE, last.c_str(), last.c_str() + 1, NULL);
+    report_pass_end();
+    report_stop();
+    lines = take_lines(events_path);
+    logged = take_lines(syslog_path);
+    check(count_lines(lines, "\"path\":\"/pass/") == 6, "all events in JSON lines");
+    check(count_lines(logged, "Integrity check: FAIL (pass/") == 3, "limited events in syslog");
+    std::string summary = "Integrity check: FAIL (5 files changed, 3 more events are in " + events_path + ")";
+    check(count_lines(logged, summary.c_str()) == 1 && count_lines(logged, "more events") == 1, "one summary");
+    printf("Ok\n");
+
+    closelog();
+    dup2(saved_stderr, STDERR_FILENO);
+    close(saved_stderr);
+    close(syslog_fd);
+    unlink(events_path.c_str());
+    unlink(syslog_path.c_str());
+    unlink(fifo_path.c_str());
+    rmdir(dir);
+    if (fails) {
+        printf("%d checks failed\n", fails);
+        return 1;
+    }
+    return 0;
+}
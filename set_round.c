@@ -0,0 +1,44 @@
+#include "set_round.h"
+
+void join_round(SetRound *round, int set) {
+    round->sets[set].running = 1;
+    round->sets[set].deficit = 0;
+}
+
+void leave_round(SetRound *round, int set) {
+    round->sets[set].running = 0;
+    round->sets[set].deficit = 0;
+}
+
+int is_round_running(const SetRound *round) {
+    for (int i = 0; i < round->count; ++i) {
+        if (round->sets[i].running)
+            return 1;
+    }
+    return 0;
+}
+
+int next_round_turn(SetRound *round) {
+    if (!is_round_running(round))
+        return -1;
+    while (1) {
+        int set = round->next;
+        round->next = (round->next + 1) % round->count;
+        RoundSet *member = &round->sets[set];
+        if (!member->running)
+            continue;
+        if (round->count == 1)
+            return set;
+        member->deficit += (int64_t)round->quantum * member->weight;
+        if (member->deficit > 0)
+            return set;
+    }
+}
+
+uint64_t round_turn_budget(const SetRound *round, int set) {
+    return round->count > 1 ? (uint64_t)round->sets[set].deficit : 0;
+}
+
+void spend_round_turn(SetRound *round, int set, uint64_t bytes) {
+    round->sets[set].deficit -= (int64_t)bytes;
+}
@@ -0,0 +1,57 @@
+#ifndef SET_ROUND_HEADER
+#define SET_ROUND_HEADER
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// round of watch sets' checks: the round gives turns to its sets in proportion
+// to their weights (deficit round robin by bytes), so a large set can't delay
+// the others' checks by its whole check.
+
+// watch set's place in the round
+typedef struct {
+    int      running; // set's check is in the round
+    unsigned weight;  // set's share of reading (priority)
+    int64_t  deficit; // bytes the set can read in its turns
+} RoundSet;
+
+typedef struct {
+    RoundSet *sets;
+    int       count;   // number of sets
+    int       next;    // the next set visited by the round
+    uint64_t  quantum; // bytes a set of weight 1 reads in its turn
+} SetRound;
+
+// set's check joins the round
+// param[in] set - set's index
+void join_round(SetRound *round, int set);
+
+// set's check leaves the round, it was finished
+// param[in] set - set's index
+void leave_round(SetRound *round, int set);
+
+// return 1 if any set's check is in the round
+int is_round_running(const SetRound *round);
+
+// return set of the next turn (-1 - no running check). Every visit adds set's
+// quantum to its deficit; a set which read more than its deficit (a large
+// file) skips visits until the deficit is positive.
+int next_round_turn(SetRound *round);
+
+// return bytes set's turn can read (0 - no limit: the only set's turn is its whole check)
+// param[in] set - set's index from next_round_turn
+uint64_t round_turn_budget(const SetRound *round, int set);
+
+// take bytes read by set's turn from its deficit
+// param[in] set - set's index from next_round_turn
+// param[in] bytes - bytes read by the turn
+void spend_round_turn(SetRound *round, int set, uint64_t bytes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SET_ROUND_HEADER
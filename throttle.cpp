@@ -0,0 +1,244 @@
+#include "throttle.h"
+#include "check_stats.h"
+#include <linux/ioprio.h>
+#include <sys/syscall.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+
+// a bucket holds tokens for this time, so short pauses aren't lost
+#define THROTTLE_BURST_NS   (100 * 1000000ULL)
+// system pressure is sampled this often while files are read
+#define PRESSURE_SAMPLE_NS  (1000 * 1000000ULL)
+// every sample under pressure halves the limits, down to 1/64 of the base
+#define BACKOFF_MAX_SHIFT   6
+// big reads take tokens by pieces, so a changed limit applies within a read
+#define THROTTLE_PIECE      (64 * 1024)
+// a reader sleeps at most this long at once, then samples pressure and
+// rechecks the limits before it sleeps the rest
+#define THROTTLE_MAX_WAIT_NS (1000 * 1000000ULL)
+// back-off of an unlimited bucket starts at least from these rates, so an idle
+// sample doesn't throttle it to nothing
+#define MIN_BASE_BYTES      (4ULL << 20)
+#define MIN_BASE_FILES      64ULL
+
+// token bucket as virtual time: taken tokens move next_ns forward
+struct token_bucket {
+    uint64_t limit;   // configured tokens per sec (0 - no limit)
+    uint64_t rate;    // current tokens per sec with back-off (0 - no limit)
+    uint64_t base;    // rate which back-off divides
+    uint64_t min_base; // base's floor of unlimited bucket
+    uint64_t next_ns; // time when taken tokens are refilled
+    uint64_t taken;   // tokens taken since the last pressure sample
+};
+
+static std::mutex throttle_mutex;
+static ThrottleConfig settings;
+static token_bucket byte_bucket;
+static token_bucket file_bucket;
+// limits are base >> backoff_shift under pressure
+static unsigned backoff_shift;
+static uint64_t sample_ns;
+// changes when a limit changes, readers stop waiting for tokens taken before
+static uint64_t limits_version;
+static std::atomic<bool> enabled(false);
+static std::atomic<uint64_t> wait_ns(0);
+static std::atomic<uint64_t> backoffs(0);
+static throttle_probe_fn pressure_probe;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+// return io pressure: share of time some tasks waited for io in the last 10 sec (%, 0 - no PSI)
+static double read_io_pressure() {
+    FILE *f = fopen("/proc/pressure/io", "r");
+    if (!f)
+        return 0;
+    double avg10 = 0;
+    if (fscanf(f, "some avg10=%lf", &avg10) != 1)
+        avg10 = 0;
+    fclose(f);
+    return avg10;
+}
+
+static bool is_under_pressure() {
+    if (pressure_probe)
+        return pressure_probe() != 0;
+    double load = 0;
+    if (settings.load_limit > 0 && getloadavg(&load, 1) == 1 && load > settings.load_limit)
+        return true;
+    return settings.psi_limit > 0 && read_io_pressure() > settings.psi_limit;
+}
+
+static void publish_limits() {
+    stats_set(STAT_GAUGE_READ_RATE_LIMIT, byte_bucket.rate);
+    stats_set(STAT_GAUGE_FILE_RATE_LIMIT, file_bucket.rate);
+}
+
+// apply back-off to bucket's rate, tokens taken at the old rate aren't waited for
+// param[in] interval_ns - time since the previous sample
+// param[in] now - sample's time
+static void set_backoff_rate(token_bucket &bucket, uint64_t interval_ns, uint64_t now) {
+    uint64_t rate = bucket.limit;
+    if (backoff_shift) {
+        // back-off begins: unlimited bucket is throttled from the achieved rate
+        if (backoff_shift == 1 && !bucket.limit) {
+            bucket.base = interval_ns ? static_cast<uint64_t>(bucket.taken * 1e9 / interval_ns) : 0;
+            if (bucket.base < bucket.min_base)
+                bucket.base = bucket.min_base;
+        } else if (backoff_shift == 1) {
+            bucket.base = bucket.limit;
+        }
+        rate = bucket.base >> backoff_shift ? bucket.base >> backoff_shift : 1;
+    }
+    if (rate != bucket.rate) {
+        bucket.next_ns = now;
+        limits_version++;
+    }
+    bucket.rate = rate;
+}
+
+// sample system pressure and adjust the limits (called under throttle_mutex)
+static void sample_pressure(uint64_t now) {
+    if (now - sample_ns < PRESSURE_SAMPLE_NS)
+        return;
+    uint64_t interval_ns = now - sample_ns;
+    sample_ns = now;
+    unsigned shift = backoff_shift;
+    if (is_under_pressure()) {
+        if (shift < BACKOFF_MAX_SHIFT)
+            shift++;
+    } else if (shift > 0) {
+        shift--;
+    }
+    if (shift != backoff_shift) {
+        if (shift > backoff_shift) {
+            backoffs.fetch_add(1, std::memory_order_relaxed);
+            stats_add(STAT_THROTTLE_BACKOFFS, 1);
+        }
+        backoff_shift = shift;
+        set_backoff_rate(byte_bucket, interval_ns, now);
+        set_backoff_rate(file_bucket, interval_ns, now);
+        publish_limits();
+    }
+    byte_bucket.taken = 0;
+    file_bucket.taken = 0;
+}
+
+static void sleep_ns(uint64_t wait) {
+    wait_ns.fetch_add(wait, std::memory_order_relaxed);
+    stats_add(STAT_THROTTLE_WAIT_NS, wait);
+    struct timespec ts;
+    ts.tv_sec = static_cast<time_t>(wait / 1000000000);
+    ts.tv_nsec = static_cast<long>(wait % 1000000000);
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {}
+}
+
+// take tokens and sleep till they are refilled. Long waits are slept by slices:
+// a changed limit drops the debt, an unchanged one is waited for completely.
+static void take(token_bucket &bucket, uint64_t tokens) {
+    uint64_t until, version;
+    {
+        std::lock_guard<std::mutex> lock(throttle_mutex);
+        uint64_t now = now_ns();
+        if (settings.psi_limit > 0 || settings.load_limit > 0)
+            sample_pressure(now);
+        bucket.taken += tokens;
+        if (!bucket.rate)
+            return;
+        // unused tokens are kept for the burst time only
+        if (bucket.next_ns + THROTTLE_BURST_NS < now)
+            bucket.next_ns = now - THROTTLE_BURST_NS;
+        bucket.next_ns += static_cast<uint64_t>(tokens * 1e9 / bucket.rate);
+        if (bucket.next_ns <= now)
+            return;
+        until = bucket.next_ns;
+        version = limits_version;
+    }
+    for (;;) {
+        uint64_t wait;
+        {
+            std::lock_guard<std::mutex> lock(throttle_mutex);
+            uint64_t now = now_ns();
+            if (settings.psi_limit > 0 || settings.load_limit > 0)
+                sample_pressure(now);
+            if (version != limits_version || until <= now)
+                return;
+            wait = until - now < THROTTLE_MAX_WAIT_NS ? until - now : THROTTLE_MAX_WAIT_NS;
+        }
+        sleep_ns(wait);
+    }
+}
+
+void throttle_setup(const ThrottleConfig *config) {
+    std::lock_guard<std::mutex> lock(throttle_mutex);
+    settings = *config;
+    byte_bucket = token_bucket();
+    file_bucket = token_bucket();
+    byte_bucket.limit = byte_bucket.rate = config->bytes_per_sec;
+    file_bucket.limit = file_bucket.rate = config->files_per_sec;
+    byte_bucket.min_base = MIN_BASE_BYTES;
+    file_bucket.min_base = MIN_BASE_FILES;
+    backoff_shift = 0;
+    sample_ns = now_ns();
+    limits_version++;
+    enabled = config->bytes_per_sec || config->files_per_sec || config->psi_limit > 0 || config->load_limit > 0;
+    publish_limits();
+}
+
+void throttle_bytes(uint64_t bytes) {
+    if (!enabled.load(std::memory_order_relaxed))
+        return;
+    while (bytes > 0) {
+        uint64_t piece = bytes < THROTTLE_PIECE ? bytes : THROTTLE_PIECE;
+        take(byte_bucket, piece);
+        bytes -= piece;
+    }
+}
+
+void throttle_file() {
+    if (enabled.load(std::memory_order_relaxed))
+        take(file_bucket, 1);
+}
+
+int throttle_idle_thread() {
+    if (!settings.idle_priority)
+        return 0;
+    // who 0 - the calling thread
+    int failed = syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0)) != 0;
+    struct sched_param param = {};
+    failed |= pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) != 0;
+    return failed;
+}
+
+uint16_t throttle_io_priority() {
+    return settings.idle_priority ? static_cast<uint16_t>(IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0)) : 0;
+}
+
+void throttle_set_pressure_probe(throttle_probe_fn probe) {
+    std::lock_guard<std::mutex> lock(throttle_mutex);
+    pressure_probe = probe;
+}
+
+int throttle_enabled() {
+    return enabled.load(std::memory_order_relaxed) ? 1 : 0;
+}
+
+void throttle_get_stats(ThrottleStats *stats) {
+    std::lock_guard<std::mutex> lock(throttle_mutex);
+    stats->bytes_limit = byte_bucket.limit;
+    stats->files_limit = file_bucket.limit;
+    stats->bytes_per_sec = byte_bucket.rate;
+    stats->files_per_sec = file_bucket.rate;
+    stats->wait_ns = wait_ns.load(std::memory_order_relaxed);
+    stats->backoffs = backoffs.load(std::memory_order_relaxed);
+}
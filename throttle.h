@@ -0,0 +1,72 @@
+#ifndef THROTTLE_HEADER
+#define THROTTLE_HEADER
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// throttling of the hashing path: token buckets on bytes read and files opened,
+// shared by hash workers and io_uring scanner. Readers sleep until their
+// tokens are available, so the limits hold for the whole process regardless
+// of the number of workers.
+
+// throttling settings
+typedef struct {
+    uint64_t bytes_per_sec; // read rate limit (0 - no limit)
+    uint64_t files_per_sec; // file open rate limit (0 - no limit)
+    int      idle_priority; // 1 - hash workers get idle io class and SCHED_IDLE
+    double   psi_limit;     // back off while io pressure (some avg10, %) is above it (0 - never)
+    double   load_limit;    // back off while load average (1 min) is above it (0 - never)
+} ThrottleConfig;
+
+// throttling's statistic
+typedef struct {
+    uint64_t bytes_limit;   // configured read rate limit (0 - no limit)
+    uint64_t files_limit;   // configured file open rate limit (0 - no limit)
+    uint64_t bytes_per_sec; // current read rate limit with back-off (0 - no limit)
+    uint64_t files_per_sec; // current file open rate limit with back-off (0 - no limit)
+    uint64_t wait_ns;       // time readers slept since start
+    uint64_t backoffs;      // limit reductions on system pressure since start
+} ThrottleStats;
+
+// set limits, call before hash workers are started
+// param[in] config - throttling settings
+void throttle_setup(const ThrottleConfig *config);
+
+// take tokens for bytes to read, sleeps while the bucket is empty
+// param[in] bytes - bytes to read
+void throttle_bytes(uint64_t bytes);
+
+// take token for file to open, sleeps while the bucket is empty
+void throttle_file();
+
+// give the calling thread idle io class and SCHED_IDLE if it's configured
+// return operation result: 0 - ok or not configured, 1 - error
+int throttle_idle_thread();
+
+// return io priority for io_uring requests (0 - default priority)
+uint16_t throttle_io_priority();
+
+// system pressure's probe
+// return 1 - the system is under pressure, 0 - it isn't
+typedef int (*throttle_probe_fn)();
+
+// replace reading of load average and PSI with probe, e.g. in tests. Pressure is
+// still sampled only if psi_limit or load_limit is set.
+// param[in] probe - pressure's probe (NULL - load average and PSI)
+void throttle_set_pressure_probe(throttle_probe_fn probe);
+
+// return 1 if any rate limit or back-off is configured
+int throttle_enabled();
+
+// get throttling's statistic
+// param[out] stats - statistic
+void throttle_get_stats(ThrottleStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // THROTTLE_HEADER
@@ -0,0 +1,384 @@
+#include "tree_manifest.h"
+#include "crc32.h"
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <libgen.h>
+#include <limits.h>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#define MANIFEST_MAGIC   "CRC32MF"
+#define MANIFEST_VERSION 1
+// size of read and write buffers
+#define MANIFEST_BUFFER_SIZE (1 << 20)
+// the longest varint of uint64_t
+#define VARINT_MAX_SIZE 10
+
+struct manifest_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t hash_algo;
+    uint32_t attr_size;
+    uint32_t reserved[2];
+    uint32_t header_crc32; // crc32 of the previous fields
+};
+
+struct manifest_end {
+    uint64_t entry_count;
+    uint32_t body_crc32;
+} __attribute__((packed));
+
+static_assert(sizeof(manifest_header) == 32, "manifest header must be 32 bytes");
+static_assert(sizeof(manifest_end) == 12, "manifest end must be 12 bytes");
+
+static uint32_t header_crc32(const manifest_header &header) {
+    return crc32_update(0, &header, offsetof(manifest_header, header_crc32));
+}
+
+int compare_tree_paths(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    // end of path < end of name < any name's char
+    int ca = *a == '\0' ? 0 : *a == '/' ? 1 : static_cast<unsigned char>(*a) + 1;
+    int cb = *b == '\0' ? 0 : *b == '/' ? 1 : static_cast<unsigned char>(*b) + 1;
+    return ca - cb;
+}
+
+struct ManifestWriter {
+    int                  fd;
+    std::string          path;
+    std::string          tmp_path;
+    uint32_t             attr_size;
+    std::string          last_path;
+    uint64_t             count;
+    std::vector<uint8_t> buffer;
+    size_t               used;
+    size_t               crc_from; // buffer's bytes before it are in body_crc32
+    uint32_t             body_crc32;
+    bool                 failed;
+};
+
+static bool write_all(int fd, const void *buf, size_t len) {
+    const char *p = static_cast<const char *>(buf);
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// sync directory to keep rename after crash
+static void sync_parent_dir(const char *path) {
+    std::string dir_path(path);
+    int fd = open(dirname(&dir_path[0]), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+// add buffered body bytes to checksum
+static void update_body_crc32(ManifestWriter *writer) {
+    writer->body_crc32 = crc32_update(writer->body_crc32, writer->buffer.data() + writer->crc_from,
+                                      writer->used - writer->crc_from);
+    writer->crc_from = writer->used;
+}
+
+static bool flush_buffer(ManifestWriter *writer) {
+    update_body_crc32(writer);
+    if (!writer->failed && !write_all(writer->fd, writer->buffer.data(), writer->used))
+        writer->failed = true;
+    writer->used = 0;
+    writer->crc_from = 0;
+    return !writer->failed;
+}
+
+// reserve buffer's space for size bytes (size <= MANIFEST_BUFFER_SIZE)
+static bool reserve_buffer(ManifestWriter *writer, size_t size) {
+    return writer->used + size <= writer->buffer.size() || flush_buffer(writer);
+}
+
+static void put_varint(ManifestWriter *writer, uint64_t value) {
+    uint8_t *p = writer->buffer.data() + writer->used;
+    while (value >= 0x80) {
+        *p++ = static_cast<uint8_t>(value | 0x80);
+        value >>= 7;
+    }
+    *p++ = static_cast<uint8_t>(value);
+    writer->used = static_cast<size_t>(p - writer->buffer.data());
+}
+
+static void put_bytes(ManifestWriter *writer, const void *data, size_t size) {
+    memcpy(writer->buffer.data() + writer->used, data, size);
+    writer->used += size;
+}
+
+ManifestStatus manifest_create(const char *path, HashAlgo algo, ManifestWriter **writer) {
+    *writer = NULL;
+    if (algo >= HASH_ALGO_COUNT)
+        return MANIFEST_ERROR;
+    ManifestWriter *w;
+    try {
+        w = new ManifestWriter();
+        w->path = path;
+        w->tmp_path = w->path + ".tmp";
+        w->buffer.resize(MANIFEST_BUFFER_SIZE);
+    }  catch (...) {
+        return MANIFEST_ERROR;
+    }
+    w->attr_size = hash_digest_size(algo);
+    w->fd = open(w->tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (w->fd < 0) {
+        delete w;
+        return MANIFEST_ERROR;
+    }
+    manifest_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC));
+    header.version = MANIFEST_VERSION;
+    header.hash_algo = static_cast<uint32_t>(algo);
+    header.attr_size = w->attr_size;
+    header.header_crc32 = header_crc32(header);
+    put_bytes(w, &header, sizeof(header));
+    // the header has its own checksum
+    w->crc_from = w->used;
+    *writer = w;
+    return MANIFEST_OK;
+}
+
+ManifestStatus manifest_write(ManifestWriter *writer, const ManifestEntry *entry) {
+    size_t len = strlen(entry->path);
+    if (len == 0 || len >= PATH_MAX || entry->digest.size != writer->attr_size)
+        return MANIFEST_ERROR;
+    if (writer->count && compare_tree_paths(writer->last_path.c_str(), entry->path) >= 0)
+        return MANIFEST_CORRUPTED;
+    size_t shared = 0;
+    while (shared < writer->last_path.size() && writer->last_path[shared] == entry->path[shared])
+        shared++;
+    if (!reserve_buffer(writer, 3 * VARINT_MAX_SIZE + len - shared + writer->attr_size))
+        return MANIFEST_ERROR;
+    put_varint(writer, shared);
+    put_varint(writer, len - shared);
+    put_bytes(writer, entry->path + shared, len - shared);
+    put_varint(writer, entry->size);
+    put_bytes(writer, entry->digest.bytes, writer->attr_size);
+    try {
+        writer->last_path.assign(entry->path, len);
+    }  catch (...) {
+        writer->failed = true;
+        return MANIFEST_ERROR;
+    }
+    writer->count++;
+    return MANIFEST_OK;
+}
+
+ManifestStatus manifest_close_writer(ManifestWriter *writer, int commit) {
+    bool ok = false;
+    if (commit && reserve_buffer(writer, 2 + sizeof(manifest_end))) {
+        // the end's varints are a path of no length after an empty prefix
+        put_varint(writer, 0);
+        put_varint(writer, 0);
+        update_body_crc32(writer);
+        manifest_end end = {writer->count, writer->body_crc32};
+        put_bytes(writer, &end, sizeof(end));
+        ok = flush_buffer(writer) && fsync(writer->fd) == 0;
+    }
+    if (close(writer->fd) != 0)
+        ok = false;
+    if (!ok || rename(writer->tmp_path.c_str(), writer->path.c_str()) != 0) {
+        unlink(writer->tmp_path.c_str());
+        ok = false;
+    } else {
+        sync_parent_dir(writer->path.c_str());
+    }
+    delete writer;
+    return ok || !commit ? MANIFEST_OK : MANIFEST_ERROR;
+}
+
+struct ManifestReader {
+    int                  fd;
+    uint32_t             attr_size;
+    std::string          path;      // the last entry's path
+    std::string          next_path;
+    uint64_t             count;
+    std::vector<uint8_t> buffer;
+    size_t               pos;
+    size_t               size;
+    size_t               crc_from; // buffer's bytes before it are in body_crc32
+    uint32_t             body_crc32;
+    ManifestStatus       status;   // MANIFEST_OK - entries are read, other - status of every next read
+};
+
+// read more bytes into buffer, unread bytes are kept
+// return operation's status (see typedef), MANIFEST_END - end of file
+static ManifestStatus fill_buffer(ManifestReader *reader) {
+    reader->body_crc32 = crc32_update(reader->body_crc32, reader->buffer.data() + reader->crc_from,
+                                      reader->pos - reader->crc_from);
+    memmove(reader->buffer.data(), reader->buffer.data() + reader->pos, reader->size - reader->pos);
+    reader->size -= reader->pos;
+    reader->pos = 0;
+    reader->crc_from = 0;
+    for (;;) {
+        ssize_t n = read(reader->fd, reader->buffer.data() + reader->size, reader->buffer.size() - reader->size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return MANIFEST_ERROR;
+        reader->size += static_cast<size_t>(n);
+        return n == 0 ? MANIFEST_END : MANIFEST_OK;
+    }
+}
+
+// make size bytes available (size <= MANIFEST_BUFFER_SIZE), fewer at the end of file
+static ManifestStatus want_bytes(ManifestReader *reader, size_t size) {
+    while (reader->size - reader->pos < size) {
+        ManifestStatus status = fill_buffer(reader);
+        if (status != MANIFEST_OK)
+            return status == MANIFEST_END ? MANIFEST_OK : status;
+    }
+    return MANIFEST_OK;
+}
+
+// make size bytes available (size <= MANIFEST_BUFFER_SIZE)
+// return operation's status (see typedef), MANIFEST_CORRUPTED - file is too short
+static ManifestStatus need_bytes(ManifestReader *reader, size_t size) {
+    ManifestStatus status = want_bytes(reader, size);
+    if (status == MANIFEST_OK && reader->size - reader->pos < size)
+        return MANIFEST_CORRUPTED;
+    return status;
+}
+
+// return 0 - ok, 1 - varint is too long or is past buffer's data
+static int get_varint(ManifestReader *reader, uint64_t *value) {
+    *value = 0;
+    for (int shift = 0; shift < 64 && reader->pos < reader->size; shift += 7) {
+        uint8_t byte = reader->buffer[reader->pos++];
+        *value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return 0;
+    }
+    return 1;
+}
+
+ManifestStatus manifest_open(const char *path, HashAlgo *algo, ManifestReader **reader) {
+    *reader = NULL;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return errno == ENOENT ? MANIFEST_NOT_FOUND : MANIFEST_ERROR;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    ManifestReader *r;
+    try {
+        r = new ManifestReader();
+        r->buffer.resize(MANIFEST_BUFFER_SIZE);
+    }  catch (...) {
+        close(fd);
+        return MANIFEST_ERROR;
+    }
+    r->fd = fd;
+    manifest_header header;
+    ManifestStatus status = need_bytes(r, sizeof(header));
+    if (status == MANIFEST_OK) {
+        memcpy(&header, r->buffer.data(), sizeof(header));
+        r->pos = r->crc_from = sizeof(header);
+        if (memcmp(header.magic, MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC)) != 0 ||
+            header.version != MANIFEST_VERSION || header.header_crc32 != header_crc32(header) ||
+            header.hash_algo >= HASH_ALGO_COUNT ||
+            header.attr_size != hash_digest_size(static_cast<HashAlgo>(header.hash_algo)))
+            status = MANIFEST_CORRUPTED;
+    }
+    if (status != MANIFEST_OK) {
+        manifest_close_reader(r);
+        return status;
+    }
+    r->attr_size = header.attr_size;
+    *algo = static_cast<HashAlgo>(header.hash_algo);
+    *reader = r;
+    return MANIFEST_OK;
+}
+
+// check manifest's end after its end varints
+static ManifestStatus read_end(ManifestReader *reader) {
+    ManifestStatus status = need_bytes(reader, sizeof(manifest_end));
+    if (status != MANIFEST_OK)
+        return status;
+    // the end itself isn't in the checksum
+    reader->body_crc32 = crc32_update(reader->body_crc32, reader->buffer.data() + reader->crc_from,
+                                      reader->pos - reader->crc_from);
+    manifest_end end;
+    memcpy(&end, reader->buffer.data() + reader->pos, sizeof(end));
+    reader->pos += sizeof(end);
+    reader->crc_from = reader->pos;
+    if (end.entry_count != reader->count || end.body_crc32 != reader->body_crc32)
+        return MANIFEST_CORRUPTED;
+    // nothing after the end
+    if (reader->pos != reader->size || (status = fill_buffer(reader)) != MANIFEST_END)
+        return status == MANIFEST_ERROR ? MANIFEST_ERROR : MANIFEST_CORRUPTED;
+    return MANIFEST_END;
+}
+
+static ManifestStatus read_entry(ManifestReader *reader, ManifestEntry *entry) {
+    // shared prefix's and suffix's lengths
+    ManifestStatus status = want_bytes(reader, 2 * VARINT_MAX_SIZE);
+    if (status != MANIFEST_OK)
+        return status;
+    uint64_t shared, len;
+    if (get_varint(reader, &shared) || get_varint(reader, &len))
+        return MANIFEST_CORRUPTED;
+    if (shared == 0 && len == 0)
+        return read_end(reader);
+    if (shared > reader->path.size() || len >= PATH_MAX || shared + len >= PATH_MAX)
+        return MANIFEST_CORRUPTED;
+    if ((status = want_bytes(reader, len + VARINT_MAX_SIZE + reader->attr_size)) != MANIFEST_OK)
+        return status;
+    if (reader->size - reader->pos < len)
+        return MANIFEST_CORRUPTED;
+    reader->next_path.assign(reader->path, 0, shared);
+    reader->next_path.append(reinterpret_cast<const char *>(reader->buffer.data() + reader->pos), len);
+    reader->pos += len;
+    if (reader->next_path.find('\0') != std::string::npos ||
+        (reader->count && compare_tree_paths(reader->path.c_str(), reader->next_path.c_str()) >= 0))
+        return MANIFEST_CORRUPTED;
+    if (get_varint(reader, &entry->size) || reader->size - reader->pos < reader->attr_size)
+        return MANIFEST_CORRUPTED;
+    reader->path.swap(reader->next_path);
+    entry->digest.size = reader->attr_size;
+    memcpy(entry->digest.bytes, reader->buffer.data() + reader->pos, reader->attr_size);
+    reader->pos += reader->attr_size;
+    entry->path = reader->path.c_str();
+    reader->count++;
+    return MANIFEST_OK;
+}
+
+ManifestStatus manifest_read(ManifestReader *reader, ManifestEntry *entry) {
+    if (reader->status != MANIFEST_OK)
+        return reader->status;
+    try {
+        reader->status = read_entry(reader, entry);
+    }  catch (...) {
+        reader->status = MANIFEST_ERROR;
+    }
+    return reader->status;
+}
+
+uint64_t manifest_entries_read(const ManifestReader *reader) {
+    return reader->count;
+}
+
+void manifest_close_reader(ManifestReader *reader) {
+    if (!reader)
+        return;
+    close(reader->fd);
+    delete reader;
+}
@@ -0,0 +1,94 @@
+#ifndef TREE_MANIFEST_HEADER
+#define TREE_MANIFEST_HEADER
+
+#include <stdint.h>
+#include "file_repo.h"
+#include "hash_engine.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// tree manifest: files of a directory tree in path order (see compare_tree_paths),
+// it's written and read as a stream, so trees of any size are compared in bounded memory
+//
+// header (32 bytes):
+//   magic "CRC32MF", version, hash algorithm (see HashAlgo), digest size,
+//   reserved, crc32 of the header's previous fields
+// entry:
+//   varint length of path's prefix shared with the previous path, varint length
+//   of the rest, the rest of path, varint file's size, digest of digest size bytes
+// end:
+//   two zero varints, entries count (8 bytes), crc32 of entries and end's varints (4 bytes)
+//
+// varints are little-endian base 128, paths are relative to the tree's directory.
+// Numbers are in host byte order (a foreign file fails the version check).
+
+typedef enum {
+    MANIFEST_OK,
+    MANIFEST_END,        // no more entries, the whole file was checked
+    MANIFEST_NOT_FOUND,  // no manifest file
+    MANIFEST_CORRUPTED,  // wrong format, version, order or checksum
+    MANIFEST_ERROR       // system error or wrong argument
+} ManifestStatus;
+
+// manifest's entry
+typedef struct {
+    const char *path;   // path relative to tree's directory, valid until the next read
+    uint64_t    size;   // file's size
+    FileAttr    digest; // file's digest
+} ManifestEntry;
+
+typedef struct ManifestWriter ManifestWriter;
+typedef struct ManifestReader ManifestReader;
+
+// compare relative paths in tree walk's order: component by component, names in strcmp order
+// return < 0 - a is before b, 0 - the same path, > 0 - a is after b
+int compare_tree_paths(const char *a, const char *b);
+
+// create manifest file, entries are written into temporary file which replaces
+// the manifest atomically on commit
+// param[in] path - path to manifest file
+// param[in] algo - hash algorithm of digests
+// param[out] writer - manifest's writer
+// return operation's status (see typedef)
+ManifestStatus manifest_create(const char *path, HashAlgo algo, ManifestWriter **writer);
+
+// add entry to manifest, entries must come in path order
+// param[in] writer - manifest's writer
+// param[in] entry - file's entry (digest of algorithm's size)
+// return operation's status (see typedef), MANIFEST_CORRUPTED - wrong order
+ManifestStatus manifest_write(ManifestWriter *writer, const ManifestEntry *entry);
+
+// finish manifest: write its end, sync and rename temporary file (commit) or remove it
+// param[in] writer - manifest's writer, it's freed
+// param[in] commit - 1: replace manifest file, 0 - drop written entries
+// return operation's status (see typedef)
+ManifestStatus manifest_close_writer(ManifestWriter *writer, int commit);
+
+// open manifest file for reading, its header is checked
+// param[in] path - path to manifest file
+// param[out] algo - hash algorithm of manifest's digests
+// param[out] reader - manifest's reader
+// return operation's status (see typedef)
+ManifestStatus manifest_open(const char *path, HashAlgo *algo, ManifestReader **reader);
+
+// read the next entry. The end's count and checksum are checked when entries
+// end, so an entry may be passed before the file turns out to be corrupted.
+// param[in] reader - manifest's reader
+// param[out] entry - read entry
+// return MANIFEST_OK - entry was read, MANIFEST_END - no more entries, other - error
+ManifestStatus manifest_read(ManifestReader *reader, ManifestEntry *entry);
+
+// return number of entries read by reader
+uint64_t manifest_entries_read(const ManifestReader *reader);
+
+// close manifest file
+// param[in] reader - manifest's reader, it's freed (NULL - nothing)
+void manifest_close_reader(ManifestReader *reader);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TREE_MANIFEST_HEADER
@@ -0,0 +1,502 @@
+#include "uring_scan.h"
+#include "check_stats.h"
+#include "consistency.h"
+#include "hash_engine.h"
+#include "throttle.h"
+#include <linux/io_uring.h>
+#include <linux/limits.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+
+// files in flight, each one owns a buffer
+#define URING_SLOTS         32
+#define URING_BUFFER_SIZE   (128 * 1024)
+// every slot has at most one request in the ring
+#define URING_ENTRIES       64
+// max finished files waiting for delivery behind a slow one
+#define URING_WINDOW        (URING_SLOTS * 8)
+// user_data of cancel requests (others carry slot's index)
+#define URING_CANCEL_DATA   UINT64_MAX
+
+typedef enum {
+    SLOT_FREE,
+    SLOT_OPENING,
+    SLOT_READING,
+    SLOT_CLOSING
+} SlotState;
+
+struct uring_slot {
+    SlotState state;
+    int       fd;
+    uint64_t  offset;
+    HashState hash;
+    bool      failed;
+    uint64_t  seq; // job's sequence number
+    uint64_t  start_ns;
+    char     *buffer;
+};
+
+// job's slot of the window, the path is copied into the slot, so queueing a
+// file doesn't allocate. Kernel opens the file by the slot's path.
+struct uring_job {
+    char            path[PATH_MAX];
+    bool            has_fingerprint;
+    FileFingerprint fingerprint;
+    hash_result_fn  on_result;
+    void           *ctx;
+    FileAttr        digest;
+    bool            done;
+};
+
+static int ring_fd = -1;
+static void *sq_ring = MAP_FAILED;
+static void *cq_ring = MAP_FAILED;
+static size_t sq_ring_size;
+static size_t cq_ring_size;
+static struct io_uring_sqe *sqes = static_cast<struct io_uring_sqe *>(MAP_FAILED);
+static size_t sqes_size;
+static unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+static unsigned *cq_head, *cq_tail, *cq_mask;
+static struct io_uring_cqe *cqes;
+// requests added to submission queue but not passed to kernel yet
+static unsigned to_submit;
+// buffers are registered, use IORING_OP_READ_FIXED
+static bool fixed_buffers;
+// io_uring_enter failed, remaining files fail without reading
+static bool ring_broken;
+
+static uring_slot slots[URING_SLOTS];
+static char *buffers;
+// ring of window's slots: jobs in submission order, freed after result delivery
+static uring_job window[URING_WINDOW];
+static size_t window_size;
+// sequence number of the window's first job and of the first job without slot
+static uint64_t head_seq;
+static uint64_t next_seq;
+
+// return job of sequence number
+static uring_job &job_at(uint64_t seq) {
+    return window[seq % URING_WINDOW];
+}
+
+static int ring_setup(unsigned entries, struct io_uring_params *params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int ring_enter(unsigned submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, submit, min_complete, flags, NULL, 0));
+}
+
+static int ring_register(unsigned opcode, const void *arg, unsigned nr_args) {
+    return static_cast<int>(syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args));
+}
+
+// return true if kernel supports all used operations
+static bool ops_supported() {
+    size_t size = sizeof(struct io_uring_probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = static_cast<struct io_uring_probe *>(calloc(1, size));
+    if (!probe)
+        return false;
+    bool supported = false;
+    if (ring_register(IORING_REGISTER_PROBE, probe, IORING_OP_LAST) == 0) {
+        supported = true;
+        for (int op: {IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_READ_FIXED, IORING_OP_CLOSE}) {
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+                supported = false;
+        }
+    }
+    free(probe);
+    return supported;
+}
+
+// the queue is never full: every slot has at most one request in the ring
+static struct io_uring_sqe *get_sqe() {
+    unsigned tail = *sq_tail;
+    if (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) > *sq_mask)
+        return NULL;
+    unsigned index = tail & *sq_mask;
+    struct io_uring_sqe *sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array[index] = index;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    to_submit++;
+    return sqe;
+}
+
+// pass queued requests to kernel and wait for min_complete completions
+// return operation result: 0 - ok, 1 - error
+static int submit_and_wait(unsigned min_complete) {
+    while (1) {
+        int res = ring_enter(to_submit, min_complete, min_complete ? IORING_ENTER_GETEVENTS : 0);
+        if (res < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+                continue;
+            return 1;
+        }
+        to_submit -= static_cast<unsigned>(res) < to_submit ? static_cast<unsigned>(res) : to_submit;
+        return 0;
+    }
+}
+
+static void queue_read(int index) {
+    uring_slot &slot = slots[index];
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = fixed_buffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->fd = slot.fd;
+    sqe->addr = reinterpret_cast<uint64_t>(slot.buffer);
+    sqe->len = URING_BUFFER_SIZE;
+    sqe->off = slot.offset;
+    sqe->buf_index = static_cast<uint16_t>(index);
+    sqe->ioprio = throttle_io_priority();
+    sqe->user_data = static_cast<uint64_t>(index);
+    slot.state = SLOT_READING;
+}
+
+static void queue_close(int index) {
+    uring_slot &slot = slots[index];
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = slot.fd;
+    sqe->user_data = static_cast<uint64_t>(index);
+    slot.state = SLOT_CLOSING;
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+static void finish_slot(int index) {
+    uring_slot &slot = slots[index];
+    stats_file_hashed(slot.offset, now_ns() - slot.start_ns, slot.failed);
+    uring_job &job = job_at(slot.seq);
+    // the same result as hash_path for bad files
+    if (slot.failed)
+        hash_failed(&job.digest);
+    else
+        hash_end(&slot.hash, &job.digest);
+    // torn read isn't retried, the file is checked by the next pass
+    FileFingerprint end;
+    if (!slot.failed && job.has_fingerprint && consistency_enabled() &&
+        (get_path_fingerprint(job.path, &end) != 0 || !same_fingerprint(&job.fingerprint, &end))) {
+        stats_add(STAT_TORN_READS, 1);
+        job.digest.size = 0;
+    }
+    job.done = true;
+    slot.state = SLOT_FREE;
+}
+
+// give free slots to waiting jobs
+static void start_jobs() {
+    for (int i = 0; i < URING_SLOTS && next_seq - head_seq < window_size; ++i) {
+        uring_slot &slot = slots[i];
+        if (slot.state != SLOT_FREE)
+            continue;
+        uring_job &job = job_at(next_seq);
+        slot.seq = next_seq++;
+        slot.fd = -1;
+        slot.offset = 0;
+        hash_begin(&slot.hash);
+        slot.failed = false;
+        slot.start_ns = now_ns();
+        if (ring_broken) {
+            slot.failed = true;
+            finish_slot(i);
+            continue;
+        }
+        throttle_file();
+        struct io_uring_sqe *sqe = get_sqe();
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = reinterpret_cast<uint64_t>(job.path);
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+        sqe->user_data = static_cast<uint64_t>(i);
+        slot.state = SLOT_OPENING;
+    }
+}
+
+static void handle_completion(int index, int res) {
+    uring_slot &slot = slots[index];
+    switch (slot.state) {
+    case SLOT_OPENING:
+        if (res < 0) {
+            slot.failed = true;
+            finish_slot(index);
+        } else {
+            slot.fd = res;
+            queue_read(index);
+        }
+        break;
+    case SLOT_READING:
+        if (res == -EINTR || res == -EAGAIN) {
+            queue_read(index);
+        } else if (res < 0) {
+            slot.failed = true;
+            queue_close(index);
+        } else if (res == 0) {
+            queue_close(index); // end of file
+        } else {
+            hash_update(&slot.hash, slot.buffer, static_cast<size_t>(res));
+            slot.offset += static_cast<uint64_t>(res);
+            // the scanner's thread waits, so all slots are throttled
+            throttle_bytes(static_cast<uint64_t>(res));
+            queue_read(index);
+        }
+        break;
+    case SLOT_CLOSING:
+        finish_slot(index);
+        break;
+    case SLOT_FREE:
+    default:
+        break;
+    }
+}
+
+static void reap_completions() {
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &cqes[head & *cq_mask];
+        uint64_t data = cqe->user_data;
+        int res = cqe->res;
+        head++;
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        if (data != URING_CANCEL_DATA)
+            handle_completion(static_cast<int>(data), res);
+        tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    }
+}
+
+// pass finished jobs from the window's head to their handlers, a slot is
+// freed after its handler returns
+static void deliver_ready() {
+    while (window_size && job_at(head_seq).done) {
+        uring_job &job = job_at(head_seq);
+        job.on_result(job.path, &job.digest,
+                      job.has_fingerprint ? &job.fingerprint : NULL, NULL, job.ctx);
+        head_seq++;
+        window_size--;
+        stats_set(STAT_GAUGE_URING_QUEUE, window_size);
+    }
+}
+
+static void unmap_ring() {
+    if (sqes != MAP_FAILED)
+        munmap(sqes, sqes_size);
+    if (cq_ring != MAP_FAILED && cq_ring != sq_ring)
+        munmap(cq_ring, cq_ring_size);
+    if (sq_ring != MAP_FAILED)
+        munmap(sq_ring, sq_ring_size);
+    sqes = static_cast<struct io_uring_sqe *>(MAP_FAILED);
+    sq_ring = cq_ring = MAP_FAILED;
+    if (ring_fd >= 0)
+        close(ring_fd);
+    ring_fd = -1;
+}
+
+// take back requests which weren't passed to kernel, cancel the passed ones and
+// wait for their completions
+// param[in,out] in_kernel - slots with a request in the ring, cleared as they complete
+// return operation result: 0 - no slot has a request in kernel, 1 - ring can't be drained
+static int drain_ring(bool in_kernel[URING_SLOTS]) {
+    // without SQPOLL kernel takes requests only in io_uring_enter
+    unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    for (unsigned tail = *sq_tail; head != tail; ++head)
+        in_kernel[sqes[sq_array[head & *sq_mask]].user_data] = false;
+    __atomic_store_n(sq_tail, *sq_head, __ATOMIC_RELEASE);
+    to_submit = 0;
+    int pending = 0;
+    for (int i = 0; i < URING_SLOTS; ++i) {
+        if (!in_kernel[i])
+            continue;
+        pending++;
+        struct io_uring_sqe *sqe = get_sqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = static_cast<uint64_t>(i);
+        sqe->user_data = URING_CANCEL_DATA;
+    }
+    while (pending) {
+        if (submit_and_wait(1))
+            return 1;
+        unsigned cq = *cq_head;
+        unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        for (; cq != tail; ++cq) {
+            struct io_uring_cqe *cqe = &cqes[cq & *cq_mask];
+            if (cqe->user_data == URING_CANCEL_DATA || !in_kernel[cqe->user_data])
+                continue;
+            uring_slot &slot = slots[cqe->user_data];
+            // opened file is closed by the caller, closed one isn't closed again
+            if (slot.state == SLOT_OPENING && cqe->res >= 0)
+                slot.fd = cqe->res;
+            else if (slot.state == SLOT_CLOSING)
+                slot.fd = -1;
+            in_kernel[cqe->user_data] = false;
+            pending--;
+        }
+        __atomic_store_n(cq_head, cq, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+// fail files in flight when the ring doesn't work. Slots are finished after
+// kernel is done with them, so it doesn't write into buffers of reused slots and
+// no completion of a finished slot stays in the ring.
+static void fail_slots() {
+    ring_broken = true;
+    bool in_kernel[URING_SLOTS];
+    for (int i = 0; i < URING_SLOTS; ++i)
+        in_kernel[i] = slots[i].state != SLOT_FREE;
+    if (drain_ring(in_kernel)) {
+        // closed ring cancels the rest, but requests can still complete meanwhile:
+        // buffers are left allocated and fds of closing files aren't touched
+        unmap_ring();
+        buffers = NULL;
+        for (int i = 0; i < URING_SLOTS; ++i) {
+            if (in_kernel[i] && slots[i].state == SLOT_CLOSING)
+                slots[i].fd = -1;
+        }
+    }
+    for (int i = 0; i < URING_SLOTS; ++i) {
+        if (slots[i].state == SLOT_FREE)
+            continue;
+        if (slots[i].fd >= 0)
+            close(slots[i].fd);
+        slots[i].failed = true;
+        finish_slot(i);
+    }
+}
+
+// make progress: start jobs, submit requests and handle completions
+// param[in] wait - wait for at least one completion
+static void run_ring(bool wait) {
+    start_jobs();
+    bool in_flight = false;
+    for (int i = 0; i < URING_SLOTS; ++i)
+        in_flight |= slots[i].state != SLOT_FREE;
+    if (in_flight && submit_and_wait(wait ? 1 : 0))
+        fail_slots();
+    if (!ring_broken)
+        reap_completions();
+    deliver_ready();
+}
+
+int uring_scan_start() {
+    if (ring_fd >= 0)
+        return 1;
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring_fd = ring_setup(URING_ENTRIES, &params);
+    if (ring_fd < 0)
+        return 1;
+    if (!ops_supported()) {
+        uring_scan_stop();
+        return 1;
+    }
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (cq_ring_size > sq_ring_size)
+            sq_ring_size = cq_ring_size;
+        cq_ring_size = sq_ring_size;
+    }
+    sq_ring = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED) {
+        uring_scan_stop();
+        return 1;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        cq_ring = sq_ring;
+    } else {
+        cq_ring = mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ring_fd, IORING_OFF_CQ_RING);
+        if (cq_ring == MAP_FAILED) {
+            uring_scan_stop();
+            return 1;
+        }
+    }
+    sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = static_cast<struct io_uring_sqe *>(mmap(NULL, sqes_size, PROT_READ | PROT_WRITE,
+                                                   MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES));
+    if (sqes == MAP_FAILED) {
+        uring_scan_stop();
+        return 1;
+    }
+    char *sq = static_cast<char *>(sq_ring);
+    char *cq = static_cast<char *>(cq_ring);
+    sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sq_mask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cq_mask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+    to_submit = 0;
+    // buffers for all slots
+    void *p = NULL;
+    if (posix_memalign(&p, 4096, static_cast<size_t>(URING_SLOTS) * URING_BUFFER_SIZE) != 0) {
+        uring_scan_stop();
+        return 1;
+    }
+    buffers = static_cast<char *>(p);
+    stats_add(STAT_HASH_ALLOCATIONS, 1);
+    struct iovec iov[URING_SLOTS];
+    for (int i = 0; i < URING_SLOTS; ++i) {
+        slots[i].state = SLOT_FREE;
+        slots[i].buffer = buffers + static_cast<size_t>(i) * URING_BUFFER_SIZE;
+        iov[i].iov_base = slots[i].buffer;
+        iov[i].iov_len = URING_BUFFER_SIZE;
+    }
+    // registration can fail on low RLIMIT_MEMLOCK, plain reads work anyway
+    fixed_buffers = ring_register(IORING_REGISTER_BUFFERS, iov, URING_SLOTS) == 0;
+    ring_broken = false;
+    head_seq = next_seq = 0;
+    window_size = 0;
+    return 0;
+}
+
+void uring_scan_stop() {
+    // broken ring fails the rest without I/O
+    uring_scan_flush();
+    unmap_ring();
+    free(buffers);
+    buffers = NULL;
+}
+
+int uring_scan_submit(const char *path, const FileFingerprint *fingerprint,
+                      hash_result_fn on_result, void *ctx) {
+    size_t len = strlen(path);
+    if (len >= PATH_MAX)
+        return 1;
+    // the window is never full here: it's drained below
+    uring_job &job = job_at(head_seq + window_size);
+    memcpy(job.path, path, len + 1);
+    job.has_fingerprint = fingerprint != NULL;
+    job.fingerprint = fingerprint ? *fingerprint : FileFingerprint();
+    job.on_result = on_result;
+    job.ctx = ctx;
+    job.digest = FileAttr();
+    job.done = false;
+    window_size++;
+    stats_set(STAT_GAUGE_URING_QUEUE, window_size);
+    run_ring(false);
+    while (window_size >= URING_WINDOW)
+        run_ring(true);
+    return 0;
+}
+
+void uring_scan_flush() {
+    while (window_size)
+        run_ring(true);
+}
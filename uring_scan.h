@@ -0,0 +1,36 @@
+#ifndef URING_SCAN_HEADER
+#define URING_SCAN_HEADER
+
+#include "hash_pool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// io_uring scanner: opens, reads and closes many files at once in the caller
+// thread, files are hashed as their data arrives
+
+// start scanner
+// return operation result: 0 - scanner started, 1 - io_uring isn't supported or error
+int uring_scan_start();
+
+// wait for queued files and stop scanner
+void uring_scan_stop();
+
+// queue file for hashing, the same as hash_pool_submit
+// param[in] path - path to file
+// param[in] fingerprint - file's metadata passed to on_result (NULL - unknown)
+// param[in] on_result - result handler, called in submission order
+// param[in] ctx - user context for on_result
+// return operation result: 0 - file was queued, 1 - error
+int uring_scan_submit(const char *path, const FileFingerprint *fingerprint,
+                      hash_result_fn on_result, void *ctx);
+
+// wait for all queued files and deliver their results
+void uring_scan_flush();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // URING_SCAN_HEADER
@@ -0,0 +1,456 @@
+#include "xxh3.h"
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define XXH3_HAVE_AVX2
+#include <immintrin.h>
+#endif
+
+#define PRIME32_1 0x9E3779B1u
+#define PRIME32_2 0x85EBCA77u
+#define PRIME32_3 0xC2B2AE3Du
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+#define STRIPE_LEN             64
+#define SECRET_CONSUME_RATE    8
+#define SECRET_SIZE            192
+#define SECRET_SIZE_MIN        136
+#define SECRET_MERGEACCS_START 11
+#define SECRET_LASTACC_START   7
+#define MID_SIZE_MAX           240
+#define BUFFER_SIZE            256
+#define BUFFER_STRIPES         (BUFFER_SIZE / STRIPE_LEN)
+// stripes between scrambles
+#define BLOCK_STRIPES          ((SECRET_SIZE - STRIPE_LEN) / SECRET_CONSUME_RATE)
+
+static_assert(sizeof(((Xxh3State *)0)->buffer) == BUFFER_SIZE, "XXH3 buffer size");
+
+// accumulator's 8 lanes and the secret's part for a stripe
+typedef void (*accumulate_fn)(uint64_t *acc, const uint8_t *input, const uint8_t *secret);
+typedef void (*scramble_fn)(uint64_t *acc, const uint8_t *secret);
+
+namespace {
+
+alignas(64) const uint8_t default_secret[SECRET_SIZE] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+const uint64_t initial_acc[8] = {
+    PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3, PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1
+};
+
+inline uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+inline uint64_t read64(const uint8_t *p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+inline uint64_t mul128_fold64(uint64_t a, uint64_t b) {
+    unsigned __int128 product = static_cast<unsigned __int128>(a) * b;
+    return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+}
+
+// a * b as 128-bit result
+inline uint64_t mul64_to128(uint64_t a, uint64_t b, uint64_t *high) {
+    unsigned __int128 product = static_cast<unsigned __int128>(a) * b;
+    *high = static_cast<uint64_t>(product >> 64);
+    return static_cast<uint64_t>(product);
+}
+
+inline uint64_t xorshift64(uint64_t v, int shift) {
+    return v ^ (v >> shift);
+}
+
+inline uint64_t rotl64(uint64_t v, int r) {
+    return (v << r) | (v >> (64 - r));
+}
+
+inline uint32_t rotl32(uint32_t v, int r) {
+    return (v << r) | (v >> (32 - r));
+}
+
+inline uint64_t avalanche(uint64_t h) {
+    h = xorshift64(h, 37);
+    h *= 0x165667919E3779F9ULL;
+    return xorshift64(h, 32);
+}
+
+inline uint64_t xxh64_avalanche(uint64_t h) {
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    return h ^ (h >> 32);
+}
+
+inline uint64_t rrmxmx(uint64_t h, uint64_t len) {
+    h ^= rotl64(h, 49) ^ rotl64(h, 24);
+    h *= 0x9FB21C651E98DF25ULL;
+    h ^= (h >> 35) + len;
+    h *= 0x9FB21C651E98DF25ULL;
+    return xorshift64(h, 28);
+}
+
+inline uint64_t mix16(const uint8_t *input, const uint8_t *secret) {
+    return mul128_fold64(read64(input) ^ read64(secret), read64(input + 8) ^ read64(secret + 8));
+}
+
+inline void mix32(uint64_t &low, uint64_t &high, const uint8_t *input1, const uint8_t *input2,
+                  const uint8_t *secret) {
+    low += mix16(input1, secret);
+    low ^= read64(input2) + read64(input2 + 8);
+    high += mix16(input2, secret + 16);
+    high ^= read64(input1) + read64(input1 + 8);
+}
+
+void accumulate_scalar(uint64_t *acc, const uint8_t *input, const uint8_t *secret) {
+    for (int i = 0; i < 8; ++i) {
+        uint64_t data = read64(input + 8 * i);
+        uint64_t key = data ^ read64(secret + 8 * i);
+        acc[i ^ 1] += data;
+        acc[i] += static_cast<uint64_t>(static_cast<uint32_t>(key)) * (key >> 32);
+    }
+}
+
+void scramble_scalar(uint64_t *acc, const uint8_t *secret) {
+    for (int i = 0; i < 8; ++i)
+        acc[i] = (xorshift64(acc[i], 47) ^ read64(secret + 8 * i)) * PRIME32_1;
+}
+
+#ifdef XXH3_HAVE_AVX2
+__attribute__((target("avx2")))
+void accumulate_avx2(uint64_t *acc, const uint8_t *input, const uint8_t *secret) {
+    __m256i *xacc = reinterpret_cast<__m256i *>(acc);
+    for (int i = 0; i < 2; ++i) {
+        __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(input) + i);
+        __m256i key = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(secret) + i);
+        __m256i data_key = _mm256_xor_si256(data, key);
+        __m256i data_key_high = _mm256_shuffle_epi32(data_key, _MM_SHUFFLE(0, 3, 0, 1));
+        __m256i product = _mm256_mul_epu32(data_key, data_key_high);
+        __m256i data_swap = _mm256_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+        __m256i sum = _mm256_add_epi64(_mm256_loadu_si256(xacc + i), data_swap);
+        _mm256_storeu_si256(xacc + i, _mm256_add_epi64(product, sum));
+    }
+}
+
+__attribute__((target("avx2")))
+void scramble_avx2(uint64_t *acc, const uint8_t *secret) {
+    __m256i *xacc = reinterpret_cast<__m256i *>(acc);
+    const __m256i prime = _mm256_set1_epi32(static_cast<int>(PRIME32_1));
+    for (int i = 0; i < 2; ++i) {
+        __m256i value = _mm256_loadu_si256(xacc + i);
+        value = _mm256_xor_si256(value, _mm256_srli_epi64(value, 47));
+        value = _mm256_xor_si256(value, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(secret) + i));
+        __m256i value_high = _mm256_shuffle_epi32(value, _MM_SHUFFLE(0, 3, 0, 1));
+        __m256i product_low = _mm256_mul_epu32(value, prime);
+        __m256i product_high = _mm256_mul_epu32(value_high, prime);
+        _mm256_storeu_si256(xacc + i, _mm256_add_epi64(product_low, _mm256_slli_epi64(product_high, 32)));
+    }
+}
+#endif
+
+struct xxh3_kernel {
+    accumulate_fn accumulate;
+    scramble_fn   scramble;
+};
+
+xxh3_kernel select_kernel() {
+#ifdef XXH3_HAVE_AVX2
+    if (__builtin_cpu_supports("avx2"))
+        return {accumulate_avx2, scramble_avx2};
+#endif
+    return {accumulate_scalar, scramble_scalar};
+}
+
+const xxh3_kernel kernel = select_kernel();
+
+inline void accumulate(uint64_t *acc, const uint8_t *input, const uint8_t *secret, size_t stripes) {
+    for (size_t n = 0; n < stripes; ++n)
+        kernel.accumulate(acc, input + n * STRIPE_LEN, secret + n * SECRET_CONSUME_RATE);
+}
+
+uint64_t merge_accs(const uint64_t *acc, const uint8_t *secret, uint64_t start) {
+    uint64_t result = start;
+    for (int i = 0; i < 4; ++i)
+        result += mul128_fold64(acc[2 * i] ^ read64(secret + 16 * i), acc[2 * i + 1] ^ read64(secret + 16 * i + 8));
+    return avalanche(result);
+}
+
+// accumulate input of len > MID_SIZE_MAX
+void hash_long(uint64_t *acc, const uint8_t *input, size_t len) {
+    const size_t block_len = STRIPE_LEN * BLOCK_STRIPES;
+    size_t blocks = (len - 1) / block_len;
+    for (size_t n = 0; n < blocks; ++n) {
+        accumulate(acc, input + n * block_len, default_secret, BLOCK_STRIPES);
+        kernel.scramble(acc, default_secret + SECRET_SIZE - STRIPE_LEN);
+    }
+    size_t stripes = ((len - 1) - block_len * blocks) / STRIPE_LEN;
+    accumulate(acc, input + blocks * block_len, default_secret, stripes);
+    kernel.accumulate(acc, input + len - STRIPE_LEN, default_secret + SECRET_SIZE - STRIPE_LEN - SECRET_LASTACC_START);
+}
+
+uint64_t hash64_short(const uint8_t *input, size_t len) {
+    const uint8_t *secret = default_secret;
+    if (len == 0)
+        return xxh64_avalanche(read64(secret + 56) ^ read64(secret + 64));
+    if (len <= 3) {
+        uint32_t combined = (static_cast<uint32_t>(input[0]) << 16) | (static_cast<uint32_t>(input[len >> 1]) << 24) |
+                            input[len - 1] | (static_cast<uint32_t>(len) << 8);
+        return xxh64_avalanche(combined ^ static_cast<uint64_t>(read32(secret) ^ read32(secret + 4)));
+    }
+    if (len <= 8) {
+        uint64_t flip = read64(secret + 8) ^ read64(secret + 16);
+        uint64_t value = read32(input + len - 4) + (static_cast<uint64_t>(read32(input)) << 32);
+        return rrmxmx(value ^ flip, len);
+    }
+    if (len <= 16) {
+        uint64_t low = read64(input) ^ (read64(secret + 24) ^ read64(secret + 32));
+        uint64_t high = read64(input + len - 8) ^ (read64(secret + 40) ^ read64(secret + 48));
+        return avalanche(len + __builtin_bswap64(low) + high + mul128_fold64(low, high));
+    }
+    uint64_t acc = len * PRIME64_1;
+    if (len <= 128) {
+        if (len > 32) {
+            if (len > 64) {
+                if (len > 96) {
+                    acc += mix16(input + 48, secret + 96);
+                    acc += mix16(input + len - 64, secret + 112);
+                }
+                acc += mix16(input + 32, secret + 64);
+                acc += mix16(input + len - 48, secret + 80);
+            }
+            acc += mix16(input + 16, secret + 32);
+            acc += mix16(input + len - 32, secret + 48);
+        }
+        acc += mix16(input, secret);
+        acc += mix16(input + len - 16, secret + 16);
+        return avalanche(acc);
+    }
+    size_t rounds = len / 16;
+    for (size_t i = 0; i < 8; ++i)
+        acc += mix16(input + 16 * i, secret + 16 * i);
+    acc = avalanche(acc);
+    for (size_t i = 8; i < rounds; ++i)
+        acc += mix16(input + 16 * i, secret + 16 * (i - 8) + 3);
+    acc += mix16(input + len - 16, secret + SECRET_SIZE_MIN - 17);
+    return avalanche(acc);
+}
+
+Xxh3Hash128 hash128_short(const uint8_t *input, size_t len) {
+    const uint8_t *secret = default_secret;
+    Xxh3Hash128 result;
+    if (len == 0) {
+        result.low = xxh64_avalanche(read64(secret + 64) ^ read64(secret + 72));
+        result.high = xxh64_avalanche(read64(secret + 80) ^ read64(secret + 88));
+        return result;
+    }
+    if (len <= 3) {
+        uint32_t combined = (static_cast<uint32_t>(input[0]) << 16) | (static_cast<uint32_t>(input[len >> 1]) << 24) |
+                            input[len - 1] | (static_cast<uint32_t>(len) << 8);
+        uint32_t swapped = rotl32(__builtin_bswap32(combined), 13);
+        result.low = xxh64_avalanche(combined ^ static_cast<uint64_t>(read32(secret) ^ read32(secret + 4)));
+        result.high = xxh64_avalanche(swapped ^ static_cast<uint64_t>(read32(secret + 8) ^ read32(secret + 12)));
+        return result;
+    }
+    if (len <= 8) {
+        uint64_t value = read32(input) + (static_cast<uint64_t>(read32(input + len - 4)) << 32);
+        uint64_t keyed = value ^ (read64(secret + 16) ^ read64(secret + 24));
+        uint64_t high;
+        uint64_t low = mul64_to128(keyed, PRIME64_1 + (static_cast<uint64_t>(len) << 2), &high);
+        high += low << 1;
+        low ^= high >> 3;
+        low = xorshift64(low, 35) * 0x9FB21C651E98DF25ULL;
+        result.low = xorshift64(low, 28);
+        result.high = avalanche(high);
+        return result;
+    }
+    if (len <= 16) {
+        uint64_t flip_low = read64(secret + 32) ^ read64(secret + 40);
+        uint64_t flip_high = read64(secret + 48) ^ read64(secret + 56);
+        uint64_t input_low = read64(input);
+        uint64_t input_high = read64(input + len - 8);
+        uint64_t mul_high;
+        uint64_t mul_low = mul64_to128(input_low ^ input_high ^ flip_low, PRIME64_1, &mul_high);
+        mul_low += static_cast<uint64_t>(len - 1) << 54;
+        input_high ^= flip_high;
+        mul_high += input_high + static_cast<uint64_t>(static_cast<uint32_t>(input_high)) * (PRIME32_2 - 1);
+        mul_low ^= __builtin_bswap64(mul_high);
+        uint64_t high;
+        uint64_t low = mul64_to128(mul_low, PRIME64_2, &high);
+        high += mul_high * PRIME64_2;
+        result.low = avalanche(low);
+        result.high = avalanche(high);
+        return result;
+    }
+    uint64_t low = len * PRIME64_1;
+    uint64_t high = 0;
+    if (len <= 128) {
+        if (len > 32) {
+            if (len > 64) {
+                if (len > 96)
+                    mix32(low, high, input + 48, input + len - 64, secret + 96);
+                mix32(low, high, input + 32, input + len - 48, secret + 64);
+            }
+            mix32(low, high, input + 16, input + len - 32, secret + 32);
+        }
+        mix32(low, high, input, input + len - 16, secret);
+    } else {
+        size_t rounds = len / 32;
+        for (size_t i = 0; i < 4; ++i)
+            mix32(low, high, input + 32 * i, input + 32 * i + 16, secret + 32 * i);
+        low = avalanche(low);
+        high = avalanche(high);
+        for (size_t i = 4; i < rounds; ++i)
+            mix32(low, high, input + 32 * i, input + 32 * i + 16, secret + 3 + 32 * (i - 4));
+        mix32(low, high, input + len - 16, input + len - 32, secret + SECRET_SIZE_MIN - 17 - 16);
+    }
+    result.low = avalanche(low + high);
+    result.high = 0 - avalanche(low * PRIME64_1 + high * PRIME64_4 + len * PRIME64_2);
+    return result;
+}
+
+Xxh3Hash128 merge_accs128(const uint64_t *acc, uint64_t len) {
+    Xxh3Hash128 result;
+    result.low = merge_accs(acc, default_secret + SECRET_MERGEACCS_START, len * PRIME64_1);
+    result.high = merge_accs(acc, default_secret + SECRET_SIZE - STRIPE_LEN - SECRET_MERGEACCS_START,
+                             ~(len * PRIME64_2));
+    return result;
+}
+
+// accumulate stripes, the block is scrambled when it's full
+// return stripes in the current block
+uint32_t consume_stripes(uint64_t *acc, uint32_t block_stripes, const uint8_t *input, uint32_t stripes) {
+    if (BLOCK_STRIPES - block_stripes <= stripes) {
+        uint32_t to_end = BLOCK_STRIPES - block_stripes;
+        accumulate(acc, input, default_secret + block_stripes * SECRET_CONSUME_RATE, to_end);
+        kernel.scramble(acc, default_secret + SECRET_SIZE - STRIPE_LEN);
+        accumulate(acc, input + to_end * STRIPE_LEN, default_secret, stripes - to_end);
+        return stripes - to_end;
+    }
+    accumulate(acc, input, default_secret + block_stripes * SECRET_CONSUME_RATE, stripes);
+    return block_stripes + stripes;
+}
+
+// accumulator of streamed input of total_len > MID_SIZE_MAX with its last stripe
+void digest_long(const Xxh3State *state, uint64_t *acc) {
+    std::memcpy(acc, state->acc, sizeof(state->acc));
+    const uint8_t *last_secret = default_secret + SECRET_SIZE - STRIPE_LEN - SECRET_LASTACC_START;
+    if (state->buffered >= STRIPE_LEN) {
+        uint32_t stripes = (state->buffered - 1) / STRIPE_LEN;
+        consume_stripes(acc, state->stripes, state->buffer, stripes);
+        kernel.accumulate(acc, state->buffer + state->buffered - STRIPE_LEN, last_secret);
+    } else {
+        // the last stripe begins in consumed data, its tail is kept in the buffer
+        uint8_t last_stripe[STRIPE_LEN];
+        size_t catchup = STRIPE_LEN - state->buffered;
+        std::memcpy(last_stripe, state->buffer + BUFFER_SIZE - catchup, catchup);
+        std::memcpy(last_stripe + catchup, state->buffer, state->buffered);
+        kernel.accumulate(acc, last_stripe, last_secret);
+    }
+}
+
+} // namespace
+
+void xxh3_reset(Xxh3State *state) {
+    std::memcpy(state->acc, initial_acc, sizeof(initial_acc));
+    state->total_len = 0;
+    state->buffered = 0;
+    state->stripes = 0;
+}
+
+void xxh3_update(Xxh3State *state, const void *buf, size_t len) {
+    const uint8_t *input = static_cast<const uint8_t *>(buf);
+    state->total_len += len;
+    if (state->buffered + len <= BUFFER_SIZE) {
+        std::memcpy(state->buffer + state->buffered, input, len);
+        state->buffered += static_cast<uint32_t>(len);
+        return;
+    }
+    // the last input is kept in the buffer for digest
+    if (state->buffered > 0) {
+        size_t fill = BUFFER_SIZE - state->buffered;
+        std::memcpy(state->buffer + state->buffered, input, fill);
+        input += fill;
+        len -= fill;
+        state->stripes = consume_stripes(state->acc, state->stripes, state->buffer, BUFFER_STRIPES);
+        state->buffered = 0;
+    }
+    if (len > BUFFER_SIZE) {
+        do {
+            state->stripes = consume_stripes(state->acc, state->stripes, input, BUFFER_STRIPES);
+            input += BUFFER_SIZE;
+            len -= BUFFER_SIZE;
+        } while (len > BUFFER_SIZE);
+        // the last stripe may begin in consumed input
+        std::memcpy(state->buffer + BUFFER_SIZE - STRIPE_LEN, input - STRIPE_LEN, STRIPE_LEN);
+    }
+    std::memcpy(state->buffer, input, len);
+    state->buffered = static_cast<uint32_t>(len);
+}
+
+uint64_t xxh3_digest64(const Xxh3State *state) {
+    if (state->total_len <= MID_SIZE_MAX)
+        return hash64_short(state->buffer, state->buffered);
+    alignas(32) uint64_t acc[8];
+    digest_long(state, acc);
+    return merge_accs(acc, default_secret + SECRET_MERGEACCS_START, state->total_len * PRIME64_1);
+}
+
+Xxh3Hash128 xxh3_digest128(const Xxh3State *state) {
+    if (state->total_len <= MID_SIZE_MAX)
+        return hash128_short(state->buffer, state->buffered);
+    alignas(32) uint64_t acc[8];
+    digest_long(state, acc);
+    return merge_accs128(acc, state->total_len);
+}
+
+const char *xxh3_kernel_name() {
+    return kernel.accumulate == accumulate_scalar ? "scalar" : "avx2";
+}
+
+uint64_t xxh3_64(const void *buf, size_t len) {
+    const uint8_t *input = static_cast<const uint8_t *>(buf);
+    if (len <= MID_SIZE_MAX)
+        return hash64_short(input, len);
+    alignas(32) uint64_t acc[8];
+    std::memcpy(acc, initial_acc, sizeof(acc));
+    hash_long(acc, input, len);
+    return merge_accs(acc, default_secret + SECRET_MERGEACCS_START, len * PRIME64_1);
+}
+
+Xxh3Hash128 xxh3_128(const void *buf, size_t len) {
+    const uint8_t *input = static_cast<const uint8_t *>(buf);
+    if (len <= MID_SIZE_MAX)
+        return hash128_short(input, len);
+    alignas(32) uint64_t acc[8];
+    std::memcpy(acc, initial_acc, sizeof(acc));
+    hash_long(acc, input, len);
+    return merge_accs128(acc, len);
+}
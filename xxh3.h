@@ -0,0 +1,49 @@
+#ifndef XXH3_HEADER
+#define XXH3_HEADER
+
+#include <stddef.h>
+#include <stdint.h>
+#include "crc32check_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// XXH3 (xxHash 0.8) with the default secret and seed 0, 64 and 128-bit
+// results are the same as XXH3_64bits and XXH3_128bits
+
+// streaming state: Xxh3State (see crc32check_types.h)
+
+typedef struct {
+    uint64_t low;
+    uint64_t high;
+} Xxh3Hash128;
+
+// start new hash
+void xxh3_reset(Xxh3State *state);
+
+// continue hash with data
+// param[in] buf - data
+// param[in] len - data size in bytes
+void xxh3_update(Xxh3State *state, const void *buf, size_t len);
+
+// return 64-bit hash of data passed to xxh3_update (state isn't changed)
+uint64_t xxh3_digest64(const Xxh3State *state);
+
+// return 128-bit hash of data passed to xxh3_update (state isn't changed)
+Xxh3Hash128 xxh3_digest128(const Xxh3State *state);
+
+// return implementation's name for logs (avx2, scalar)
+const char *xxh3_kernel_name();
+
+// return 64-bit hash of buffer
+uint64_t xxh3_64(const void *buf, size_t len);
+
+// return 128-bit hash of buffer
+Xxh3Hash128 xxh3_128(const void *buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // XXH3_HEADER